@@ -67,6 +67,10 @@
 # define FALLOC_FL_KEEP_SIZE 1
 #endif
 
+#ifndef FALLOC_FL_PUNCH_HOLE
+# define FALLOC_FL_PUNCH_HOLE 2
+#endif
+
 #ifndef RENAME_NOREPLACE
 # define RENAME_NOREPLACE	(1 << 0)
 #endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2026 Linux Test Project
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program;  if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LAPI_IO_URING_H__
+#define __LAPI_IO_URING_H__
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "config.h"
+#include "linux_syscall_numbers.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+#else
+
+/* The subset of the 5.1 ABI that is needed for READV/WRITEV */
+
+struct io_uring_sqe {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t ioprio;
+	int32_t fd;
+	uint64_t off;
+	uint64_t addr;
+	uint32_t len;
+	uint32_t rw_flags;
+	uint64_t user_data;
+	uint64_t __pad2[3];
+};
+
+struct io_uring_cqe {
+	uint64_t user_data;
+	int32_t res;
+	uint32_t flags;
+};
+
+struct io_sqring_offsets {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t flags;
+	uint32_t dropped;
+	uint32_t array;
+	uint32_t resv1;
+	uint64_t resv2;
+};
+
+struct io_cqring_offsets {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t overflow;
+	uint32_t cqes;
+	uint64_t resv[2];
+};
+
+struct io_uring_params {
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t flags;
+	uint32_t sq_thread_cpu;
+	uint32_t sq_thread_idle;
+	uint32_t resv[5];
+	struct io_sqring_offsets sq_off;
+	struct io_cqring_offsets cq_off;
+};
+
+# define IORING_OFF_SQ_RING	0ULL
+# define IORING_OFF_CQ_RING	0x8000000ULL
+# define IORING_OFF_SQES	0x10000000ULL
+
+# define IORING_ENTER_GETEVENTS	(1U << 0)
+
+# define IORING_OP_NOP		0
+# define IORING_OP_READV	1
+# define IORING_OP_WRITEV	2
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+static inline int io_uring_setup(unsigned int entries,
+				 struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd, unsigned int to_submit,
+				 unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+#endif /* __LAPI_IO_URING_H__ */
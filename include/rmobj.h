@@ -9,4 +9,15 @@
  */
 int rmobj( char *object , char **errmesg );
 
+/* Remove only the contents of the directory, keep the directory itself */
+#define RMOBJ_KEEP_TOP	1
+
+/*
+ * rmobj_parallel() - Same as rmobj(), but directory trees are removed by
+ *           up to nthreads threads (nthreads <= 0 picks one per CPU, at
+ *           most 16).  Programs not linked with libpthread fall back to a
+ *           single thread.  flags may be RMOBJ_KEEP_TOP.
+ */
+int rmobj_parallel(char *object, int nthreads, int flags, char **errmesg);
+
 #endif
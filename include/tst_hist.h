@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Further, this software is distributed without any warranty that it is
+ * free of the rightful claim of any third person regarding infringement
+ * or the like.  Any license provided herein, whether implied or
+ * otherwise, applies only to this software file.  Patent licenses, if
+ * any, provided herein do not apply to combinations of this program with
+ * other software, or any other product whatsoever.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+ /*
+
+   Histogram - fixed size log-linear histogram of latency samples.
+
+   Each power of two is split into 2^TST_HIST_SUB_BITS linear buckets so the
+   percentiles are accurate to 12.5%. The structure contains no pointers and
+   can be placed into shared memory and merged between processes.
+
+   The samples are unitless, by convention nanoseconds, tst_hist_report()
+   prints them as microseconds.
+
+  */
+
+#ifndef TST_HIST_H__
+#define TST_HIST_H__
+
+#define TST_HIST_SUB_BITS 3
+#define TST_HIST_BUCKETS (64 << TST_HIST_SUB_BITS)
+
+struct tst_hist {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long buckets[TST_HIST_BUCKETS];
+};
+
+/*
+ * Zeroes the histogram.
+ */
+void tst_hist_init(struct tst_hist *h);
+
+/*
+ * Records one sample.
+ */
+void tst_hist_add(struct tst_hist *h, unsigned long long val);
+
+/*
+ * Adds all samples from src to dst.
+ */
+void tst_hist_merge(struct tst_hist *dst, const struct tst_hist *src);
+
+/*
+ * Returns value below which pct percent (0 - 100) of samples fall.
+ */
+unsigned long long tst_hist_percentile(const struct tst_hist *h, double pct);
+
+/*
+ * Prints count, average, p50, p90, p99, p99.9 and max as a TINFO message
+ * prefixed with name.
+ */
+void tst_hist_report(const char *name, const struct tst_hist *h);
+
+#endif /* TST_HIST_H__ */
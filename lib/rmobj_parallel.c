@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Further, this software is distributed without any warranty that it is
+ * free of the rightful claim of any third person regarding infringement
+ * or the like.  Any license provided herein, whether implied or
+ * otherwise, applies only to this software file.  Patent licenses, if
+ * any, provided herein do not apply to combinations of this program with
+ * other software, or any other product whatsoever.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Parallel version of rmobj().
+ *
+ * Every directory is a node that holds one reference for its own scan and
+ * one for each subdirectory handed to the work queue.  Workers open a
+ * queued directory relative to its parent's descriptor, read it with
+ * getdents64() in large batches, unlink the files and queue the
+ * subdirectories.  When the last reference of a node is dropped, the
+ * directory is empty, so it is removed and the reference it held on its
+ * parent is released, which may in turn complete the parent.
+ *
+ * The queue is bounded; once it is full, subdirectories are removed
+ * depth-first by the thread that found them, which also bounds the
+ * number of open directory descriptors.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "rmobj.h"
+
+/*
+ * Do not force every program that calls tst_rmdir() to link with
+ * -lpthread; without it the tree is removed by the calling thread only.
+ */
+#pragma weak pthread_create
+#pragma weak pthread_join
+
+#define RMTREE_BUFSIZE		(32 * 1024)
+#define RMTREE_MAX_THREADS	16
+#define RMTREE_QUEUE_PER_THREAD	64
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct rmtree_node {
+	struct rmtree_node *parent;
+	struct rmtree_node *next;
+	int fd;
+	int refs;
+	int failed;
+	char name[];
+};
+
+struct rmtree {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct rmtree_node *queue;
+	int queued;
+	int max_queued;
+	pthread_t *threads;
+	int nthreads;
+	int max_threads;
+	int done;
+	int flags;
+	int ret;
+};
+
+static char err_msg[1024];
+
+static void rmtree_error(struct rmtree *t, const char *call, const char *name)
+{
+	int err = errno;
+
+	pthread_mutex_lock(&t->lock);
+	if (!t->ret) {
+		snprintf(err_msg, sizeof(err_msg),
+			 "%s(%s) failed; errno=%d: %s",
+			 call, name, err, strerror(err));
+	}
+	t->ret = -1;
+	pthread_mutex_unlock(&t->lock);
+}
+
+static int rmtree_isdir(int fd, struct linux_dirent64 *d)
+{
+	struct stat st;
+
+	if (d->d_type != DT_UNKNOWN)
+		return d->d_type == DT_DIR;
+
+	if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW))
+		return 0;
+
+	return S_ISDIR(st.st_mode);
+}
+
+static int rmtree_inline(struct rmtree *t, int pfd, const char *name,
+			 int retry);
+static void *rmtree_worker(void *arg);
+
+static int rmtree_push(struct rmtree *t, struct rmtree_node *node,
+		       const char *name)
+{
+	struct rmtree_node *child;
+
+	pthread_mutex_lock(&t->lock);
+
+	if (t->queued >= t->max_queued)
+		goto full;
+
+	child = malloc(sizeof(*child) + strlen(name) + 1);
+	if (!child)
+		goto full;
+
+	child->parent = node;
+	child->fd = -1;
+	child->refs = 1;
+	child->failed = 0;
+	strcpy(child->name, name);
+
+	node->refs++;
+	child->next = t->queue;
+	t->queue = child;
+	t->queued++;
+
+	/* Workers are started on demand, small trees never start any */
+	if (t->nthreads < t->max_threads &&
+	    !pthread_create(&t->threads[t->nthreads], NULL,
+			    rmtree_worker, t))
+		t->nthreads++;
+
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	return 1;
+full:
+	pthread_mutex_unlock(&t->lock);
+	return 0;
+}
+
+/*
+ * Removes everything in the directory open at fd.  Subdirectories are
+ * queued when node is not NULL and there is room, otherwise removed
+ * before returning.
+ */
+static int rmtree_scan(struct rmtree *t, struct rmtree_node *node, int fd,
+		       char *buf)
+{
+	struct linux_dirent64 *d;
+	int ret = 0;
+	long n, off;
+
+	for (;;) {
+		n = syscall(SYS_getdents64, fd, buf, RMTREE_BUFSIZE);
+		if (n < 0) {
+			rmtree_error(t, "getdents64", node ? node->name : ".");
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		for (off = 0; off < n; off += d->d_reclen) {
+			d = (struct linux_dirent64 *)(buf + off);
+
+			if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+				continue;
+
+			if (rmtree_isdir(fd, d)) {
+				if (node && rmtree_push(t, node, d->d_name))
+					continue;
+				if (rmtree_inline(t, fd, d->d_name, 1))
+					ret = -1;
+				continue;
+			}
+
+			if (unlinkat(fd, d->d_name, 0) && errno != ENOENT) {
+				rmtree_error(t, "unlinkat", d->d_name);
+				ret = -1;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Removes an emptied directory.  Some filesystems may skip entries when
+ * a directory is modified while it is being read, so on ENOTEMPTY the
+ * directory is swept once more.
+ */
+static int rmtree_rmdir(struct rmtree *t, int pfd, const char *name,
+			int retry)
+{
+	if (!unlinkat(pfd, name, AT_REMOVEDIR) || errno == ENOENT)
+		return 0;
+
+	if (errno == ENOTEMPTY && retry)
+		return rmtree_inline(t, pfd, name, 0);
+
+	rmtree_error(t, "rmdir", name);
+	return -1;
+}
+
+static int rmtree_inline(struct rmtree *t, int pfd, const char *name,
+			 int retry)
+{
+	char *buf;
+	int fd, ret;
+
+	fd = openat(pfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		/* as rmobj(), an unreadable directory may still be removable */
+		return rmtree_rmdir(t, pfd, name, 0);
+	}
+
+	buf = malloc(RMTREE_BUFSIZE);
+	if (!buf) {
+		close(fd);
+		rmtree_error(t, "malloc", name);
+		return -1;
+	}
+
+	ret = rmtree_scan(t, NULL, fd, buf);
+	free(buf);
+	close(fd);
+
+	if (ret)
+		return -1;
+
+	return rmtree_rmdir(t, pfd, name, retry);
+}
+
+/*
+ * Drops a reference to node and completes it and its ancestors as long
+ * as their last reference goes away.
+ */
+static void rmtree_put(struct rmtree *t, struct rmtree_node *node)
+{
+	struct rmtree_node *parent;
+	char *buf;
+	int refs, failed;
+
+	for (;;) {
+		pthread_mutex_lock(&t->lock);
+		refs = --node->refs;
+		failed = node->failed;
+		pthread_mutex_unlock(&t->lock);
+
+		if (refs)
+			return;
+
+		parent = node->parent;
+
+		if (!parent) {
+			if (node->fd >= 0 && !failed &&
+			    (t->flags & RMOBJ_KEEP_TOP)) {
+				buf = malloc(RMTREE_BUFSIZE);
+				if (buf && !lseek(node->fd, 0, SEEK_SET))
+					rmtree_scan(t, NULL, node->fd, buf);
+				free(buf);
+			}
+			if (node->fd >= 0)
+				close(node->fd);
+			if (!failed && !(t->flags & RMOBJ_KEEP_TOP))
+				rmtree_rmdir(t, AT_FDCWD, node->name, 1);
+
+			pthread_mutex_lock(&t->lock);
+			t->done = 1;
+			pthread_cond_broadcast(&t->cond);
+			pthread_mutex_unlock(&t->lock);
+			return;
+		}
+
+		if (node->fd >= 0)
+			close(node->fd);
+
+		if (failed || rmtree_rmdir(t, parent->fd, node->name, 1)) {
+			pthread_mutex_lock(&t->lock);
+			parent->failed = 1;
+			pthread_mutex_unlock(&t->lock);
+		}
+
+		free(node);
+		node = parent;
+	}
+}
+
+static void rmtree_process(struct rmtree *t, struct rmtree_node *node,
+			   char *buf)
+{
+	int pfd = node->parent ? node->parent->fd : AT_FDCWD;
+	int fd, failed = 0;
+
+	fd = openat(pfd, node->name,
+		    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		/*
+		 * An unreadable directory is left to the rmdir() in
+		 * rmtree_put(), it succeeds if the directory is empty.
+		 */
+		if (errno != ENOENT && !node->parent &&
+		    (t->flags & RMOBJ_KEEP_TOP)) {
+			rmtree_error(t, "openat", node->name);
+			failed = 1;
+		}
+	} else {
+		node->fd = fd;
+		failed = rmtree_scan(t, node, fd, buf) != 0;
+	}
+
+	if (failed) {
+		pthread_mutex_lock(&t->lock);
+		node->failed = 1;
+		pthread_mutex_unlock(&t->lock);
+	}
+
+	rmtree_put(t, node);
+}
+
+static void *rmtree_worker(void *arg)
+{
+	struct rmtree *t = arg;
+	struct rmtree_node *node;
+	char *buf;
+
+	buf = malloc(RMTREE_BUFSIZE);
+	if (!buf)
+		return NULL;
+
+	pthread_mutex_lock(&t->lock);
+	for (;;) {
+		while (!t->queue && !t->done)
+			pthread_cond_wait(&t->cond, &t->lock);
+
+		if (!t->queue)
+			break;
+
+		node = t->queue;
+		t->queue = node->next;
+		t->queued--;
+		pthread_mutex_unlock(&t->lock);
+
+		rmtree_process(t, node, buf);
+
+		pthread_mutex_lock(&t->lock);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	free(buf);
+	return NULL;
+}
+
+int rmobj_parallel(char *obj, int nthreads, int flags, char **errmsg)
+{
+	struct rmtree t;
+	struct rmtree_node *root;
+	char *buf;
+	int fd, i;
+
+	if (!strcmp(obj, "/")) {
+		if (errmsg != NULL) {
+			sprintf(err_msg, "Cannot remove /");
+			*errmsg = err_msg;
+		}
+		return -1;
+	}
+
+	fd = open(obj, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if (flags & RMOBJ_KEEP_TOP) {
+			if (errmsg != NULL) {
+				sprintf(err_msg, "open(%s) failed; errno=%d: %s",
+					obj, errno, strerror(errno));
+				*errmsg = err_msg;
+			}
+			return -1;
+		}
+		/* not a directory, let rmobj() unlink it */
+		return rmobj(obj, errmsg);
+	}
+	close(fd);
+
+	if (nthreads <= 0) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads > RMTREE_MAX_THREADS)
+			nthreads = RMTREE_MAX_THREADS;
+	}
+	if (!pthread_create || !pthread_join)
+		nthreads = 1;
+
+	memset(&t, 0, sizeof(t));
+	pthread_mutex_init(&t.lock, NULL);
+	pthread_cond_init(&t.cond, NULL);
+	t.flags = flags;
+
+	if (nthreads > 1) {
+		t.max_threads = nthreads - 1;
+		t.max_queued = nthreads * RMTREE_QUEUE_PER_THREAD;
+		t.threads = calloc(t.max_threads, sizeof(pthread_t));
+		if (!t.threads)
+			t.max_threads = t.max_queued = 0;
+	}
+
+	root = malloc(sizeof(*root) + strlen(obj) + 1);
+	buf = malloc(RMTREE_BUFSIZE);
+	if (!root || !buf) {
+		free(root);
+		free(buf);
+		free(t.threads);
+		if (errmsg != NULL) {
+			sprintf(err_msg, "malloc failed");
+			*errmsg = err_msg;
+		}
+		return -1;
+	}
+	root->parent = NULL;
+	root->fd = -1;
+	root->refs = 1;
+	root->failed = 0;
+	strcpy(root->name, obj);
+
+	rmtree_process(&t, root, buf);
+	free(buf);
+
+	/* help draining the queue until the root directory completes */
+	rmtree_worker(&t);
+
+	for (i = 0; i < t.nthreads; i++)
+		pthread_join(t.threads[i], NULL);
+
+	free(t.threads);
+	free(root);
+	pthread_cond_destroy(&t.cond);
+	pthread_mutex_destroy(&t.lock);
+
+	if (t.ret && errmsg != NULL)
+		*errmsg = err_msg;
+
+	return t.ret;
+}
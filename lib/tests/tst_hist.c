@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Further, this software is distributed without any warranty that it is
+ * free of the rightful claim of any third person regarding infringement
+ * or the like.  Any license provided herein, whether implied or
+ * otherwise, applies only to this software file.  Patent licenses, if
+ * any, provided herein do not apply to combinations of this program with
+ * other software, or any other product whatsoever.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "test.h"
+#include "tst_hist.h"
+
+char *TCID = "tst_hist";
+int TST_TOTAL = 1;
+
+static struct tst_hist h1, h2;
+
+static int near(unsigned long long val, unsigned long long exp)
+{
+	return val >= exp - exp / 8 && val <= exp + exp / 8;
+}
+
+int main(void)
+{
+	unsigned long long i, p50, p99;
+
+	tst_hist_init(&h1);
+	tst_hist_init(&h2);
+
+	for (i = 1; i <= 50000; i++)
+		tst_hist_add(&h1, i * 1000);
+
+	for (i = 50001; i <= 100000; i++)
+		tst_hist_add(&h2, i * 1000);
+
+	tst_hist_merge(&h1, &h2);
+
+	p50 = tst_hist_percentile(&h1, 50);
+	p99 = tst_hist_percentile(&h1, 99);
+
+	if (h1.count != 100000 || h1.min != 1000 || h1.max != 100000000)
+		tst_brkm(TFAIL, NULL, "wrong count/min/max %llu/%llu/%llu",
+			 h1.count, h1.min, h1.max);
+
+	if (!near(p50, 50000000) || !near(p99, 99000000))
+		tst_brkm(TFAIL, NULL, "wrong p50=%llu p99=%llu", p50, p99);
+
+	if (tst_hist_percentile(&h1, 100) != h1.max)
+		tst_brkm(TFAIL, NULL, "p100 != max");
+
+	tst_hist_report("tst_hist", &h1);
+
+	tst_resm(TPASS, "Histogram percentiles are within 12.5%%");
+	tst_exit();
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Further, this software is distributed without any warranty that it is
+ * free of the rightful claim of any third person regarding infringement
+ * or the like.  Any license provided herein, whether implied or
+ * otherwise, applies only to this software file.  Patent licenses, if
+ * any, provided herein do not apply to combinations of this program with
+ * other software, or any other product whatsoever.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "test.h"
+#include "safe_macros.h"
+#include "rmobj.h"
+
+char *TCID = "tst_rmobj_parallel";
+int TST_TOTAL = 1;
+
+static int nfiles;
+static char keep[PATH_MAX];
+
+static void cleanup(void)
+{
+	tst_rmdir();
+}
+
+static void mktree(const char *path, int depth)
+{
+	char buf[PATH_MAX];
+	int i;
+
+	SAFE_MKDIR(cleanup, path, 0777);
+
+	for (i = 0; i < 5; i++) {
+		snprintf(buf, sizeof(buf), "%s/f%i", path, i);
+		SAFE_FILE_PRINTF(cleanup, buf, "%i", i);
+		nfiles++;
+	}
+
+	snprintf(buf, sizeof(buf), "%s/link", path);
+	SAFE_SYMLINK(cleanup, keep, buf);
+
+	/* removable, but cannot be read without CAP_DAC_OVERRIDE */
+	snprintf(buf, sizeof(buf), "%s/noread", path);
+	SAFE_MKDIR(cleanup, buf, 0300);
+
+	if (!depth)
+		return;
+
+	for (i = 0; i < 6; i++) {
+		snprintf(buf, sizeof(buf), "%s/d%i", path, i);
+		mktree(buf, depth - 1);
+	}
+}
+
+static void check(const char *path, int nthreads, int flags)
+{
+	struct stat st;
+	char *errmsg;
+
+	nfiles = 0;
+	mktree(path, 4);
+
+	if (rmobj_parallel((char *)path, nthreads, flags, &errmsg))
+		tst_brkm(TFAIL, cleanup, "rmobj_parallel(%s) failed: %s",
+			 path, errmsg);
+
+	if (flags & RMOBJ_KEEP_TOP) {
+		if (rmdir(path))
+			tst_brkm(TFAIL | TERRNO, cleanup,
+				 "%s not kept empty", path);
+	} else if (!lstat(path, &st)) {
+		tst_brkm(TFAIL, cleanup, "%s still exists", path);
+	}
+
+	if (access("keep/file", F_OK))
+		tst_brkm(TFAIL, cleanup, "symlink target was removed");
+
+	tst_resm(TINFO, "removed %i files with %i thread(s), flags %i",
+		 nfiles, nthreads, flags);
+}
+
+int main(void)
+{
+	tst_tmpdir();
+
+	SAFE_GETCWD(cleanup, keep, sizeof(keep) - 5);
+	strcat(keep, "/keep");
+	SAFE_MKDIR(cleanup, keep, 0777);
+	SAFE_FILE_PRINTF(cleanup, "keep/file", "keep");
+
+	check("tree", 1, 0);
+	check("tree", 4, 0);
+	check("tree", 0, 0);
+	check("tree", 4, RMOBJ_KEEP_TOP);
+
+	tst_resm(TPASS, "Trees removed, symlink targets kept");
+
+	cleanup();
+	tst_exit();
+}
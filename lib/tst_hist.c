@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * Further, this software is distributed without any warranty that it is
+ * free of the rightful claim of any third person regarding infringement
+ * or the like.  Any license provided herein, whether implied or
+ * otherwise, applies only to this software file.  Patent licenses, if
+ * any, provided herein do not apply to combinations of this program with
+ * other software, or any other product whatsoever.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "tst_hist.h"
+
+#define SUB_COUNT (1 << TST_HIST_SUB_BITS)
+
+static unsigned int bucket_idx(unsigned long long val)
+{
+	unsigned int msb;
+
+	if (val < SUB_COUNT)
+		return val;
+
+	msb = 63 - __builtin_clzll(val);
+
+	return ((msb - TST_HIST_SUB_BITS + 1) << TST_HIST_SUB_BITS) +
+	       ((val >> (msb - TST_HIST_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/* Returns the middle of the range of values mapped to bucket idx. */
+static unsigned long long bucket_val(unsigned int idx)
+{
+	unsigned int msb, shift;
+	unsigned long long low;
+
+	if (idx < SUB_COUNT)
+		return idx;
+
+	msb = (idx >> TST_HIST_SUB_BITS) + TST_HIST_SUB_BITS - 1;
+	shift = msb - TST_HIST_SUB_BITS;
+	low = (1ULL << msb) | ((unsigned long long)(idx & (SUB_COUNT - 1)) << shift);
+
+	return low + ((1ULL << shift) >> 1);
+}
+
+void tst_hist_init(struct tst_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void tst_hist_add(struct tst_hist *h, unsigned long long val)
+{
+	if (!h->count || val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+
+	h->count++;
+	h->sum += val;
+	h->buckets[bucket_idx(val)]++;
+}
+
+void tst_hist_merge(struct tst_hist *dst, const struct tst_hist *src)
+{
+	unsigned int i;
+
+	if (!src->count)
+		return;
+
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+
+	for (i = 0; i < TST_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+unsigned long long tst_hist_percentile(const struct tst_hist *h, double pct)
+{
+	unsigned long long rank, seen = 0, val;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	rank = (unsigned long long)(h->count * pct / 100);
+	if (rank >= h->count)
+		return h->max;
+
+	for (i = 0; i < TST_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank)
+			break;
+	}
+
+	val = bucket_val(i);
+
+	if (val < h->min)
+		return h->min;
+	if (val > h->max)
+		return h->max;
+
+	return val;
+}
+
+void tst_hist_report(const char *name, const struct tst_hist *h)
+{
+	if (!h->count) {
+		tst_resm(TINFO, "%s: no samples", name);
+		return;
+	}
+
+	tst_resm(TINFO, "%s: n=%llu avg=%.1fus p50=%.1fus p90=%.1fus "
+		 "p99=%.1fus p99.9=%.1fus max=%.1fus", name, h->count,
+		 (double)h->sum / h->count / 1000,
+		 tst_hist_percentile(h, 50) / 1000.0,
+		 tst_hist_percentile(h, 90) / 1000.0,
+		 tst_hist_percentile(h, 99) / 1000.0,
+		 tst_hist_percentile(h, 99.9) / 1000.0,
+		 h->max / 1000.0);
+}
@@ -212,10 +212,10 @@ void tst_rmdir(void)
 	}
 
 	/*
-	 * Attempt to remove the "TESTDIR" directory, using rmobj().
+	 * Attempt to remove the "TESTDIR" directory, using rmobj_parallel().
 	 */
-	if (rmobj(TESTDIR, &errmsg) == -1) {
-		tst_resm(TWARN, "%s: rmobj(%s) failed: %s",
+	if (rmobj_parallel(TESTDIR, 0, 0, &errmsg) == -1) {
+		tst_resm(TWARN, "%s: rmobj_parallel(%s) failed: %s",
 			 __func__, TESTDIR, errmsg);
 	}
 }
@@ -0,0 +1 @@
+20150903])
@@ -83,10 +83,12 @@
 #include <sys/time.h>		/* for delays */
 
 #include "doio.h"
+#include "doio_ring.h"
 #include "write_log.h"
 #include "random_range.h"
 #include "string_to_tokens.h"
 #include "pattern.h"
+#include "tst_hist.h"
 
 #define	NMEMALLOC	32
 #define	MEM_DATA	1	/* data space                           */
@@ -134,6 +136,25 @@ struct fd_cache {
 	void *c_memaddr;	/* mmapped address */
 	int c_memlen;		/* length of above region */
 #endif
+	int c_hnext;		/* next slot in the same hash chain */
+	int c_prev;		/* LRU list, most recently used first */
+	int c_next;		/* also links the free slots */
+};
+
+/*
+ * Per process statistics, printed at exit if -s was given.  Latencies are
+ * in nanoseconds, syscall latencies are kept per request type.
+ */
+
+#define NSTAT_TYPES	128
+
+struct doio_stats {
+	long fd_hits;
+	long fd_misses;
+	long fd_evictions;
+	struct tst_hist lock_wait;
+	struct tst_hist *sys_lat[NSTAT_TYPES];
+	char *sys_name[NSTAT_TYPES];
 };
 
 /*
@@ -225,9 +246,10 @@ struct syscall_info {
  * getopt() string of supported cmdline arguments.
  */
 
-#define OPTS	"aC:d:ehm:n:kr:w:vU:V:M:N:"
+#define OPTS	"aC:d:eF:hm:n:kr:R:sw:vU:V:M:N:"
 
 #define DEF_RELEASE_INTERVAL	0
+#define DEF_FD_CACHE_SIZE	256
 
 /*
  * Flags set in parse_cmdline() to indicate which options were selected
@@ -236,12 +258,15 @@ struct syscall_info {
 
 int a_opt = 0;			/* abort on data compare errors     */
 int e_opt = 0;			/* exec() after fork()'ing          */
+int F_opt = 0;			/* fd cache size                    */
 int C_opt = 0;			/* Data Check Type                  */
 int d_opt = 0;			/* delay between operations         */
 int k_opt = 0;			/* lock file regions during writes  */
 int m_opt = 0;			/* generate periodic messages       */
 int n_opt = 0;			/* nprocs                           */
 int r_opt = 0;			/* resource release interval        */
+int R_opt = 0;			/* read requests from a shm ring    */
+int s_opt = 0;			/* print statistics at exit         */
 int w_opt = 0;			/* file write log file              */
 int v_opt = 0;			/* verify writes if set             */
 int U_opt = 0;			/* upanic() on varios conditions    */
@@ -256,9 +281,13 @@ char TagName[40];		/* name of this doio (see Monster)  */
 char *Prog = NULL;		/* set up in parse_cmdline()                */
 int Upanic_Conditions;		/* set by args to -U                        */
 int Release_Interval;		/* arg to -r                                */
+int Fd_Cache_Size;		/* arg to -F                                */
 int Nprocs;			/* arg to -n                                */
 char *Write_Log;		/* arg to -w                                */
 char *Infile;			/* input file (defaults to stdin)           */
+char *Ring_Name;		/* arg to -R                                */
+struct doio_ring_hdr *Ring;	/* request ring shared with iogen           */
+int Ring_Worker;		/* ring this process reads from             */
 int *Children;			/* pids of child procs                      */
 int Nchildren = 0;
 int Nsiblings = 0;		/* tfork'ed siblings                        */
@@ -281,6 +310,11 @@ int active_mmap_rw = 0;		/* Indicates that mmapped I/O is occurring. */
 			    /* Used by sigbus_action() in the child doio. */
 int havesigint = 0;
 
+struct doio_stats Stats;
+
+char *TCID = "doio";
+int TST_TOTAL = 1;
+
 #define SKIP_REQ	-2	/* skip I/O request */
 
 /*
@@ -290,8 +324,18 @@ int havesigint = 0;
 int Wfd_Append;			/* for appending to the write-log       */
 int Wfd_Random;			/* for overlaying write-log entries     */
 
-#define FD_ALLOC_INCR	32	/* allocate this many fd_map structs    */
-				/* at a time */
+/*
+ * The fd cache - a fixed array of Fd_Cache_Size slots, so that pointers
+ * returned by alloc_fdcache() stay valid, looked up through a hash on
+ * file name and open flags.
+ */
+
+struct fd_cache *Fd_Cache = NULL;
+int *Fd_Hash;			/* hash bucket -> first slot in chain  */
+int Fd_Hash_Mask;
+int Fd_Lru_Head = -1;		/* most recently used slot             */
+int Fd_Lru_Tail = -1;		/* least recently used slot            */
+int Fd_Free = -1;		/* first unoccupied slot               */
 
 /*
  * Globals for tracking Sds and Core usage
@@ -314,6 +358,8 @@ int Pattern_Length;
 
 char *syserrno(int err);
 void doio(void);
+int get_request(int infd, struct io_req *req);
+void ring_cleanup(void);
 void doio_delay(void);
 char *format_oflags(int oflags);
 char *format_strat(int strategy);
@@ -415,6 +461,11 @@ int alloc_sds(int nbytes);
 
 int alloc_fd(char *file, int oflags);
 struct fd_cache *alloc_fdcache(char *file, int oflags);
+void fdc_release(int slot);
+
+unsigned long long stat_time(void);
+void stat_syscall(int type, char *name, unsigned long long start);
+void dump_stats(void);
 
 #ifdef sgi
 void signal_info(int sig, siginfo_t * info, void *v);
@@ -604,6 +655,17 @@ int main(int argc, char **argv)
 		wlog_close(&Wlog);
 	}
 
+	if (R_opt) {
+		Ring = doio_ring_create(Ring_Name, Nprocs);
+		if (Ring == NULL) {
+			doio_fprintf(stderr,
+				     "Could not create request ring %s:  %s (%d)\n",
+				     Ring_Name, SYSERR, errno);
+			exit(E_SETUP);
+		}
+		atexit(ring_cleanup);
+	}
+
 	/*
 	 * Malloc space for the children pid array.  Initialize all entries
 	 * to -1.
@@ -646,6 +708,7 @@ int main(int argc, char **argv)
 			Nchildren++;
 
 			if (pid == 0) {
+				Ring_Worker = i;
 				if (e_opt) {
 					char *exec_path;
 
@@ -710,6 +773,13 @@ int main(int argc, char **argv)
 
 					ex_stat |= E_COMPARE;
 
+					for (i = 0; R_opt && i < Nchildren; i++)
+						if (Children[i] == -1 &&
+						    Ring->rings[i].consumer == pid)
+							doio_fprintf(stderr,
+								     "(parent) pid %d was ring worker %d, replay with iogen -S %d\n",
+								     pid, i, Ring->seed);
+
 					if (a_opt)
 						kill(0, SIGINT);
 
@@ -747,6 +817,48 @@ int main(int argc, char **argv)
 
 }				/* main */
 
+/*
+ * Only the process that created the ring removes it, children inherit
+ * the atexit handler.
+ */
+void ring_cleanup(void)
+{
+	if (Ring->owner == getpid())
+		shm_unlink(Ring_Name);
+}
+
+/*
+ * Fetches the next request from the input stream or the request ring.
+ * Returns the number of bytes read like read(2) does.
+ */
+int get_request(int infd, struct io_req *req)
+{
+	struct doio_breq breq;
+	int rval;
+
+	if (!R_opt)
+		return read(infd, (char *)req, sizeof(*req));
+
+	rval = doio_ring_get(Ring, Ring_Worker, &breq);
+	if (rval == -1) {
+		doio_fprintf(stderr, "iogen went away without finishing\n");
+		alloc_mem(-1);
+		exit(E_SETUP);
+	}
+	if (rval == 0)
+		return 0;
+
+	if (breq.r_file >= Ring->nfiles) {
+		doio_fprintf(stderr, "bad file index %d in ring request\n",
+			     breq.r_file);
+		alloc_mem(-1);
+		exit(E_SETUP);
+	}
+
+	doio_breq_unpack(req, &breq, Ring->files[breq.r_file]);
+	return sizeof(*req);
+}
+
 /*
  * main doio function.  Each doio child starts here, and never returns.
  */
@@ -781,6 +893,11 @@ void doio(void)
 					 getpid(), Host, Prog);
 	}
 
+	if (s_opt) {
+		tst_hist_init(&Stats.lock_wait);
+		atexit(dump_stats);
+	}
+
 	/*
 	 * Open a couple of descriptors for the write-log file.  One descriptor
 	 * is for appending, one for random access.  Write logging is done for
@@ -801,10 +918,20 @@ void doio(void)
 	}
 
 	/*
-	 * Open the input stream - either a file or stdin
+	 * Open the input stream - either the request ring, a file or stdin.
+	 * Ring workers get their own seed so that a run can be replayed.
 	 */
 
-	if (Infile == NULL) {
+	if (R_opt) {
+		infd = -1;
+		if (doio_ring_join(Ring, Ring_Worker, 60)) {
+			doio_fprintf(stderr,
+				     "No iogen attached to ring %s:  %s (%d)\n",
+				     Ring_Name, SYSERR, errno);
+			exit(E_SETUP);
+		}
+		random_range_seed(Ring->seed + Ring_Worker);
+	} else if (Infile == NULL) {
 		infd = 0;
 	} else {
 		if ((infd = open(Infile, O_RDWR)) == -1) {
@@ -915,7 +1042,7 @@ void doio(void)
 	 * Call the appropriate io function based on the request type.
 	 */
 
-	while ((nbytes = read(infd, (char *)&ioreq, sizeof(ioreq)))) {
+	while ((nbytes = get_request(infd, &ioreq))) {
 
 		/*
 		 * Periodically check our ppid.  If it is 1, the child exits to
@@ -1405,6 +1532,7 @@ int do_read(struct io_req *req)
 {
 	int fd, offset, nbytes, oflags, rval;
 	char *addr, *file;
+	unsigned long long t0;
 #ifdef CRAY
 	struct aio_info *aiop;
 	int aio_id, aio_strat, signo;
@@ -1508,7 +1636,11 @@ int do_read(struct io_req *req)
 			return -1;
 		}
 
-		if ((rval = read(fd, addr, nbytes)) == -1) {
+		t0 = stat_time();
+		rval = read(fd, addr, nbytes);
+		stat_syscall(req->r_type, "read", t0);
+
+		if (rval == -1) {
 			doio_fprintf(stderr,
 				     "read() request failed:  %s (%d)\n%s\n",
 				     SYSERR, errno,
@@ -1603,6 +1735,7 @@ int do_write(struct io_req *req)
 	off_t offset, woffset;
 	char *addr, pattern, *file, *msg;
 	struct wlog_rec wrec;
+	unsigned long long t0;
 #ifdef CRAY
 	int aio_strat, aio_id;
 	struct aio_info *aiop;
@@ -1798,7 +1931,9 @@ int do_write(struct io_req *req)
 			return -1;
 		}
 
+		t0 = stat_time();
 		rval = write(fd, addr, nbytes);
+		stat_syscall(req->r_type, "write", t0);
 
 		if (rval == -1) {
 			doio_fprintf(stderr,
@@ -1959,12 +2094,14 @@ int do_write(struct io_req *req)
 int lock_file_region(char *fname, int fd, int type, int start, int nbytes)
 {
 	struct flock flk;
+	unsigned long long t0;
 
 	flk.l_type = type;
 	flk.l_whence = 0;
 	flk.l_start = start;
 	flk.l_len = nbytes;
 
+	t0 = stat_time();
 	if (fcntl(fd, F_SETLKW, &flk) < 0) {
 		doio_fprintf(stderr,
 			     "fcntl(%d, %d, %#o) failed for file %s, lock type %d, offset %d, length %d:  %s (%d), open flags: %#o\n",
@@ -1974,6 +2111,9 @@ int lock_file_region(char *fname, int fd, int type, int start, int nbytes)
 		return -1;
 	}
 
+	if (s_opt && type != F_UNLCK)
+		tst_hist_add(&Stats.lock_wait, stat_time() - t0);
+
 	return 0;
 }
 
@@ -2092,6 +2232,7 @@ int do_listio(struct io_req *req)
 	struct wlog_rec wrec;
 	struct aio_info *aiop;
 	struct listreq lio_req;
+	unsigned long long t0;
 
 	lio = &req->r_data.listio;
 
@@ -2222,7 +2363,11 @@ int do_listio(struct io_req *req)
 		sigprocmask(SIG_BLOCK, &block_mask, &omask);
 	}
 
-	if (listio(lio->r_cmd, &lio_req, 1) < 0) {
+	t0 = stat_time();
+	rval = listio(lio->r_cmd, &lio_req, 1);
+	stat_syscall(req->r_type, "listio", t0);
+
+	if (rval < 0) {
 		doio_fprintf(stderr,
 			     "listio() failed: %s (%d)\n%s\n",
 			     SYSERR, errno,
@@ -3064,6 +3209,7 @@ int do_rw(struct io_req *req)
 	struct status *s;
 	struct wlog_rec wrec;
 	struct syscall_info *sy;
+	unsigned long long t0;
 #if defined(CRAY) || defined(sgi)
 	struct aio_info *aiop;
 	struct iosw *iosw;
@@ -3303,7 +3449,9 @@ int do_rw(struct io_req *req)
 		}
 	}
 
+	t0 = stat_time();
 	s = (*sy->sy_syscall) (req, sy, fd, addr);
+	stat_syscall(req->r_type, sy->sy_name, t0);
 
 	if (s->rval == -1) {
 		doio_fprintf(stderr,
@@ -3602,6 +3750,7 @@ int do_sync(struct io_req *req)
 	int fd, oflags;
 	int rval;
 	char *file;
+	unsigned long long t0;
 
 	/*
 	 * Initialize common fields - assumes r_oflags, r_file, r_offset, and
@@ -3619,12 +3768,15 @@ int do_sync(struct io_req *req)
 		return -1;
 
 	rval = 0;
+	t0 = stat_time();
 	switch (req->r_type) {
 	case FSYNC2:
 		rval = fsync(fd);
+		stat_syscall(req->r_type, "fsync", t0);
 		break;
 	case FDATASYNC:
 		rval = fdatasync(fd);
+		stat_syscall(req->r_type, "fdatasync", t0);
 		break;
 	default:
 		rval = -1;
@@ -4246,13 +4398,12 @@ int alloc_sds(int nbytes)
 /*
  * Function to maintain a file descriptor cache, so that doio does not have
  * to do so many open() and close() calls.  Descriptors are stored in the
- * cache by file name, and open flags.  Each entry also has a _rtc value
- * associated with it which is used in aging.  If doio cannot open a file
- * because it already has too many open (ie. system limit hit) it will close
- * the one in the cache that has the oldest _rtc value.
+ * cache by file name, and open flags, and kept on a LRU list.  If the cache
+ * is full, or doio cannot open a file because it already has too many open
+ * (ie. system limit hit), it will close the least recently used one.
  *
  * If alloc_fd() is called with a file of NULL, it will close all descriptors
- * in the cache, and free the memory in the cache.
+ * in the cache.
  */
 
 int alloc_fd(char *file, int oflags)
@@ -4267,78 +4418,153 @@ int alloc_fd(char *file, int oflags)
 		return (-1);
 }
 
+static int fdc_hash(char *file, int oflags)
+{
+	unsigned int h = 2166136261u;
+
+	while (*file)
+		h = (h ^ (unsigned char)*file++) * 16777619u;
+
+	return (h ^ oflags) & Fd_Hash_Mask;
+}
+
+static void fdc_init(void)
+{
+	int i, nbuckets;
+
+	for (nbuckets = 1; nbuckets < 2 * Fd_Cache_Size; nbuckets <<= 1) ;
+
+	Fd_Cache = malloc(sizeof(struct fd_cache) * Fd_Cache_Size);
+	Fd_Hash = malloc(sizeof(int) * nbuckets);
+	if (Fd_Cache == NULL || Fd_Hash == NULL) {
+		doio_fprintf(stderr, "Could not malloc() space for fd cache\n");
+		alloc_mem(-1);
+		exit(E_SETUP);
+	}
+
+	Fd_Hash_Mask = nbuckets - 1;
+	for (i = 0; i < nbuckets; i++)
+		Fd_Hash[i] = -1;
+
+	for (i = 0; i < Fd_Cache_Size; i++) {
+		Fd_Cache[i].c_fd = -1;
+		Fd_Cache[i].c_next = i + 1 < Fd_Cache_Size ? i + 1 : -1;
+	}
+	Fd_Free = 0;
+}
+
+static void fdc_lru_unlink(int slot)
+{
+	struct fd_cache *cp = &Fd_Cache[slot];
+
+	if (cp->c_prev != -1)
+		Fd_Cache[cp->c_prev].c_next = cp->c_next;
+	else
+		Fd_Lru_Head = cp->c_next;
+
+	if (cp->c_next != -1)
+		Fd_Cache[cp->c_next].c_prev = cp->c_prev;
+	else
+		Fd_Lru_Tail = cp->c_prev;
+}
+
+static void fdc_lru_push(int slot)
+{
+	struct fd_cache *cp = &Fd_Cache[slot];
+
+	cp->c_prev = -1;
+	cp->c_next = Fd_Lru_Head;
+	if (Fd_Lru_Head != -1)
+		Fd_Cache[Fd_Lru_Head].c_prev = slot;
+	else
+		Fd_Lru_Tail = slot;
+	Fd_Lru_Head = slot;
+#ifdef CRAY
+	cp->c_rtc = _rtc();
+#else
+	cp->c_rtc = Reqno;
+#endif
+}
+
+/*
+ * Close the descriptor in a cache slot and put the slot on the free list.
+ */
+void fdc_release(int slot)
+{
+	struct fd_cache *cp = &Fd_Cache[slot];
+	int *ip;
+
+	close(cp->c_fd);
+	cp->c_fd = -1;
+#ifndef CRAY
+	if (cp->c_memaddr != NULL) {
+		munmap(cp->c_memaddr, cp->c_memlen);
+		cp->c_memaddr = NULL;
+	}
+#endif
+
+	for (ip = &Fd_Hash[fdc_hash(cp->c_file, cp->c_oflags)]; *ip != slot;
+	     ip = &Fd_Cache[*ip].c_hnext) ;
+	*ip = cp->c_hnext;
+
+	fdc_lru_unlink(slot);
+	cp->c_next = Fd_Free;
+	Fd_Free = slot;
+}
+
 struct fd_cache *alloc_fdcache(char *file, int oflags)
 {
-	int fd;
-	struct fd_cache *free_slot, *oldest_slot, *cp;
-	static int cache_size = 0;
-	static struct fd_cache *cache = NULL;
+	int fd, h, slot;
+	struct fd_cache *cp;
 #ifdef sgi
 	struct dioattr finfo;
 #endif
 
 	/*
-	 * If file is NULL, it means to free up the fd cache.
+	 * If file is NULL, it means to close all descriptors in the cache.
+	 * The slots themselves are kept.
 	 */
 
-	if (file == NULL && cache != NULL) {
-		for (cp = cache; cp < &cache[cache_size]; cp++) {
-			if (cp->c_fd != -1) {
-				close(cp->c_fd);
-			}
-#ifndef CRAY
-			if (cp->c_memaddr != NULL) {
-				munmap(cp->c_memaddr, cp->c_memlen);
-			}
-#endif
-		}
-
-		free(cache);
-		cache = NULL;
-		cache_size = 0;
+	if (file == NULL) {
+		while (Fd_Lru_Head != -1)
+			fdc_release(Fd_Lru_Head);
 		return 0;
 	}
 
-	free_slot = NULL;
-	oldest_slot = NULL;
+	if (Fd_Cache == NULL)
+		fdc_init();
 
 	/*
-	 * Look for a fd in the cache.  If one is found, return it directly.
-	 * Otherwise, when this loop exits, oldest_slot will point to the
-	 * oldest fd slot in the cache, and free_slot will point to an
-	 * unoccupied slot if there are any.
+	 * Look for a fd in the cache.  If one is found, move it to the head
+	 * of the LRU list and return it directly.
 	 */
 
-	for (cp = cache; cp != NULL && cp < &cache[cache_size]; cp++) {
-		if (cp->c_fd != -1 &&
-		    cp->c_oflags == oflags && strcmp(cp->c_file, file) == 0) {
-#ifdef CRAY
-			cp->c_rtc = _rtc();
-#else
-			cp->c_rtc = Reqno;
-#endif
+	h = fdc_hash(file, oflags);
+	for (slot = Fd_Hash[h]; slot != -1; slot = cp->c_hnext) {
+		cp = &Fd_Cache[slot];
+		if (cp->c_oflags == oflags && strcmp(cp->c_file, file) == 0) {
+			Stats.fd_hits++;
+			fdc_lru_unlink(slot);
+			fdc_lru_push(slot);
 			return cp;
 		}
-
-		if (cp->c_fd == -1) {
-			if (free_slot == NULL) {
-				free_slot = cp;
-			}
-		} else {
-			if (oldest_slot == NULL ||
-			    cp->c_rtc < oldest_slot->c_rtc) {
-				oldest_slot = cp;
-			}
-		}
 	}
 
 	/*
-	 * No matching file/oflags pair was found in the cache.  Attempt to
-	 * open a new fd.
+	 * No matching file/oflags pair was found in the cache.  Make room if
+	 * the cache is full and attempt to open a new fd.  If we have as many
+	 * open fd's as we can have, keep closing the least recently used one
+	 * and retry.
 	 */
 
-	if ((fd = open(file, oflags, 0666)) < 0) {
-		if (errno != EMFILE) {
+	Stats.fd_misses++;
+	if (Fd_Free == -1) {
+		fdc_release(Fd_Lru_Tail);
+		Stats.fd_evictions++;
+	}
+
+	while ((fd = open(file, oflags, 0666)) < 0) {
+		if (errno != EMFILE || Fd_Lru_Tail == -1) {
 			doio_fprintf(stderr,
 				     "Could not open file %s with flags %#o (%s): %s (%d)\n",
 				     file, oflags, format_oflags(oflags),
@@ -4347,68 +4573,26 @@ struct fd_cache *alloc_fdcache(char *file, int oflags)
 			exit(E_SETUP);
 		}
 
-		/*
-		 * If we get here, we have as many open fd's as we can have.
-		 * Close the oldest one in the cache (pointed to by
-		 * oldest_slot), and attempt to re-open.
-		 */
-
-		close(oldest_slot->c_fd);
-		oldest_slot->c_fd = -1;
-		free_slot = oldest_slot;
-
-		if ((fd = open(file, oflags, 0666)) < 0) {
-			doio_fprintf(stderr,
-				     "Could not open file %s with flags %#o (%s):  %s (%d)\n",
-				     file, oflags, format_oflags(oflags),
-				     SYSERR, errno);
-			alloc_mem(-1);
-			exit(E_SETUP);
-		}
+		fdc_release(Fd_Lru_Tail);
+		Stats.fd_evictions++;
 	}
 
 /*printf("alloc_fd: new file %s flags %#o fd %d\n", file, oflags, fd);*/
 
-	/*
-	 * If we get here, fd is our open descriptor.  If free_slot is NULL,
-	 * we need to grow the cache, otherwise free_slot is the slot that
-	 * should hold the fd info.
-	 */
-
-	if (free_slot == NULL) {
-		cache =
-		    (struct fd_cache *)realloc(cache,
-					       sizeof(struct fd_cache) *
-					       (FD_ALLOC_INCR + cache_size));
-		if (cache == NULL) {
-			doio_fprintf(stderr,
-				     "Could not malloc() space for fd chace");
-			alloc_mem(-1);
-			exit(E_SETUP);
-		}
-
-		cache_size += FD_ALLOC_INCR;
-
-		for (cp = &cache[cache_size - FD_ALLOC_INCR];
-		     cp < &cache[cache_size]; cp++) {
-			cp->c_fd = -1;
-		}
-
-		free_slot = &cache[cache_size - FD_ALLOC_INCR];
-	}
-
 	/*
 	 * finally, fill in the cache slot info
 	 */
 
-	free_slot->c_fd = fd;
-	free_slot->c_oflags = oflags;
-	strcpy(free_slot->c_file, file);
-#ifdef CRAY
-	free_slot->c_rtc = _rtc();
-#else
-	free_slot->c_rtc = Reqno;
-#endif
+	slot = Fd_Free;
+	cp = &Fd_Cache[slot];
+	Fd_Free = cp->c_next;
+
+	cp->c_fd = fd;
+	cp->c_oflags = oflags;
+	strcpy(cp->c_file, file);
+	cp->c_hnext = Fd_Hash[h];
+	Fd_Hash[h] = slot;
+	fdc_lru_push(slot);
 
 #ifdef sgi
 	if (oflags & O_DIRECT) {
@@ -4423,16 +4607,98 @@ struct fd_cache *alloc_fdcache(char *file, int oflags)
 		finfo.d_maxiosz = 1;
 	}
 
-	free_slot->c_memalign = finfo.d_mem;
-	free_slot->c_miniosz = finfo.d_miniosz;
-	free_slot->c_maxiosz = finfo.d_maxiosz;
+	cp->c_memalign = finfo.d_mem;
+	cp->c_miniosz = finfo.d_miniosz;
+	cp->c_maxiosz = finfo.d_maxiosz;
 #endif /* sgi */
 #ifndef CRAY
-	free_slot->c_memaddr = NULL;
-	free_slot->c_memlen = 0;
+	cp->c_memaddr = NULL;
+	cp->c_memlen = 0;
 #endif
 
-	return free_slot;
+	return cp;
+}
+
+/*
+ * Statistics helpers.  Nothing is measured unless -s was given.
+ */
+
+unsigned long long stat_time(void)
+{
+	struct timespec ts;
+
+	if (!s_opt)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stat_syscall(int type, char *name, unsigned long long start)
+{
+	struct tst_hist *h;
+
+	if (!s_opt || type < 0 || type >= NSTAT_TYPES)
+		return;
+
+	if ((h = Stats.sys_lat[type]) == NULL) {
+		if ((h = malloc(sizeof(struct tst_hist))) == NULL)
+			return;
+		tst_hist_init(h);
+		Stats.sys_lat[type] = h;
+		Stats.sys_name[type] = name;
+	}
+
+	tst_hist_add(h, stat_time() - start);
+}
+
+/*
+ * Advance cp past what snprintf() wrote, never beyond the last byte of
+ * the buffer so that cp always points at the terminating NUL.
+ */
+static char *stat_advance(char *cp, char *end, int n)
+{
+	if (n < 0)
+		return cp;
+	if (n >= end - cp)
+		return end - 1;
+	return cp + n;
+}
+
+static char *fmt_hist(char *cp, char *end, char *name, struct tst_hist *h)
+{
+	return stat_advance(cp, end, snprintf(cp, end - cp,
+			    "%-10s n=%llu avg=%.1fus p50=%.1fus p99=%.1fus max=%.1fus\n",
+			    name, h->count, h->sum / 1000.0 / h->count,
+			    tst_hist_percentile(h, 50) / 1000.0,
+			    tst_hist_percentile(h, 99) / 1000.0,
+			    h->max / 1000.0));
+}
+
+void dump_stats(void)
+{
+	char buf[(NSTAT_TYPES + 4) * 96];
+	char *cp = buf, *end = buf + sizeof(buf);
+	long lookups = Stats.fd_hits + Stats.fd_misses;
+	int i;
+
+	cp = stat_advance(cp, end, snprintf(cp, end - cp,
+		      "Stats:  %d requests, fd cache %ld hits %ld misses %ld evictions (%.1f%% hit rate, %d slots)\n",
+		      Reqno - 1, Stats.fd_hits, Stats.fd_misses,
+		      Stats.fd_evictions,
+		      lookups ? 100.0 * Stats.fd_hits / lookups : 0.0,
+		      Fd_Cache_Size));
+
+	if (Stats.lock_wait.count)
+		cp = fmt_hist(cp, end, "lock-wait", &Stats.lock_wait);
+
+	for (i = 0; i < NSTAT_TYPES; i++) {
+		if (Stats.sys_lat[i] != NULL)
+			cp = fmt_hist(cp, end, Stats.sys_name[i],
+				      Stats.sys_lat[i]);
+	}
+
+	doio_fprintf(stderr, "%s", buf);
 }
 
 /*
@@ -5021,6 +5287,17 @@ int parse_cmdline(int argc, char **argv, char *opts)
 			k_opt++;
 			break;
 
+		case 'F':
+			Fd_Cache_Size = strtol(optarg, &cp, 10);
+			if (*cp != '\0' || Fd_Cache_Size < 2) {
+				fprintf(stderr,
+					"%s%s:  Illegal -F arg (%s):  Must be integer >= 2\n",
+					Prog, TagName, optarg);
+				exit(E_USAGE);
+			}
+			F_opt++;
+			break;
+
 		case 'm':
 			Message_Interval = strtol(optarg, &cp, 10);
 			if (*cp != '\0' || Message_Interval < 0) {
@@ -5082,6 +5359,15 @@ int parse_cmdline(int argc, char **argv, char *opts)
 			r_opt++;
 			break;
 
+		case 'R':
+			Ring_Name = optarg;
+			R_opt++;
+			break;
+
+		case 's':
+			s_opt++;
+			break;
+
 		case 'w':
 			Write_Log = optarg;
 			w_opt++;
@@ -5178,6 +5464,9 @@ int parse_cmdline(int argc, char **argv, char *opts)
 	if (!r_opt)
 		Release_Interval = DEF_RELEASE_INTERVAL;
 
+	if (!F_opt)
+		Fd_Cache_Size = DEF_FD_CACHE_SIZE;
+
 	if (!M_opt) {
 		Memalloc[Nmemalloc].memtype = MEM_DATA;
 		Memalloc[Nmemalloc].flags = 0;
@@ -5201,6 +5490,13 @@ int parse_cmdline(int argc, char **argv, char *opts)
 		exit(E_USAGE);
 	}
 
+	if (R_opt && (Infile != NULL || e_opt || Npes > 1)) {
+		fprintf(stderr,
+			"%s%s:  -R can't be used with an infile, -e or multi-pe\n",
+			Prog, TagName);
+		exit(E_USAGE);
+	}
+
 	return 0;
 }
 
@@ -5425,7 +5721,7 @@ int usage(FILE * stream)
 	}
 
 	fprintf(stream,
-		"usage%s:  %s [-aekv] [-m message_interval] [-n nprocs] [-r release_interval] [-w write_log] [-V validation_ftype] [-U upanic_cond] [infile]\n",
+		"usage%s:  %s [-aeksv] [-F nfds] [-m message_interval] [-n nprocs] [-r release_interval] [-R ring] [-w write_log] [-V validation_ftype] [-U upanic_cond] [infile]\n",
 		TagName, Prog);
 	return 0;
 }
@@ -5467,6 +5763,14 @@ void help(FILE * stream)
 		"\t                     loop.  This is useful for spreading\n");
 	fprintf(stream,
 		"\t                     procs around on multi-pe systems.\n");
+	fprintf(stream,
+		"\t-F nfds              Size of the open file descriptor cache.\n");
+	fprintf(stream,
+		"\t                     The least recently used descriptor is\n");
+	fprintf(stream,
+		"\t                     closed when it is full.  The default\n");
+	fprintf(stream,
+		"\t                     is %d.\n", DEF_FD_CACHE_SIZE);
 	fprintf(stream,
 		"\t-k                   Lock file regions during writes using fcntl()\n");
 	fprintf(stream,
@@ -5519,6 +5823,14 @@ void help(FILE * stream)
 		"\t                     messages.  The default is 0.\n");
 	fprintf(stream, "\t-N tagname           Tag name, for Monster.\n");
 	fprintf(stream, "\t-n nprocs            # of processes to start up\n");
+	fprintf(stream,
+		"\t-R ring              Read requests from the shared memory ring\n");
+	fprintf(stream,
+		"\t                     that 'iogen -R ring' writes to, one ring\n");
+	fprintf(stream,
+		"\t                     per process.  Process n is seeded with\n");
+	fprintf(stream,
+		"\t                     the iogen seed + n.\n");
 	fprintf(stream,
 		"\t-r release_interval  Release all memory and close\n");
 	fprintf(stream,
@@ -5527,6 +5839,12 @@ void help(FILE * stream)
 		"\t                     By default procs never release memory\n");
 	fprintf(stream,
 		"\t                     or close fds unless they have to.\n");
+	fprintf(stream,
+		"\t-s                   Print fd cache hit rate, lock wait and\n");
+	fprintf(stream,
+		"\t                     per request type syscall latencies\n");
+	fprintf(stream,
+		"\t                     when each process exits.\n");
 	fprintf(stream,
 		"\t-V validation_ftype  The type of file descriptor to use for doing data\n");
 	fprintf(stream,
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * Shared memory request ring between iogen and doio (-R name).
+ *
+ * doio creates the POSIX shm segment with one single producer, single
+ * consumer ring per doio process.  iogen attaches to it, fills in the
+ * file table and the seed, and deals requests to the rings round robin,
+ * so with the same seed and number of processes every doio process gets
+ * exactly the same request stream again.
+ *
+ * Requests travel as struct doio_breq, which names the file by its index
+ * in the file table instead of carrying the path, and are published in
+ * batches of DOIO_RING_BATCH.  The semaphores only count wakeups, the
+ * ring indexes are the real state.
+ */
+
+#ifndef DOIO_RING_H
+#define DOIO_RING_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DOIO_RING_MAGIC		0x52494e47	/* "RING" */
+#define DOIO_RING_SLOTS		1024		/* per process, power of 2 */
+#define DOIO_RING_BATCH		32
+#define DOIO_RING_MAXFILES	256
+
+struct doio_breq {
+	uint16_t r_type;
+	uint16_t r_file;	/* index into the file table */
+	int32_t r_oflags;
+	int32_t r_offset;
+	int32_t r_nbytes;
+	int32_t r_nstrides;
+	int32_t r_nent;
+	char r_pattern;
+	uint8_t r_uflags;
+	uint8_t r_aio_strat;
+	uint8_t r_cmd;		/* listio only */
+	int32_t r_opcode;	/* listio only */
+};
+
+struct doio_ring {
+	unsigned head;		/* next slot doio takes */
+	char pad0[60];
+	unsigned tail;		/* published by iogen */
+	unsigned next;		/* iogen private, not yet published */
+	pid_t consumer;		/* doio process reading this ring */
+	char pad1[52];
+	sem_t items;
+	sem_t space;
+	struct doio_breq slots[DOIO_RING_SLOTS];
+} __attribute__((aligned(64)));
+
+struct doio_ring_hdr {
+	int magic;
+	int nrings;
+	pid_t owner;		/* doio parent */
+	pid_t producer;		/* iogen, 0 until attached */
+	int ready;		/* file table and seed are valid */
+	int done;		/* no more requests */
+	int seed;
+	int nfiles;
+	char files[DOIO_RING_MAXFILES][MAX_FNAME_LENGTH];
+	struct doio_ring rings[];
+};
+
+static inline size_t doio_ring_size(int nrings)
+{
+	return sizeof(struct doio_ring_hdr) + nrings * sizeof(struct doio_ring);
+}
+
+/*
+ * Called by the doio parent before it forks.  A stale segment of the same
+ * name is replaced.
+ */
+static inline struct doio_ring_hdr *doio_ring_create(const char *name,
+						      int nrings)
+{
+	struct doio_ring_hdr *hdr;
+	size_t size = doio_ring_size(nrings);
+	int fd, i;
+
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd == -1)
+		return NULL;
+
+	if (ftruncate(fd, size) == -1) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		shm_unlink(name);
+		return NULL;
+	}
+
+	for (i = 0; i < nrings; i++) {
+		if (sem_init(&hdr->rings[i].items, 1, 0) ||
+		    sem_init(&hdr->rings[i].space, 1, 0)) {
+			munmap(hdr, size);
+			shm_unlink(name);
+			return NULL;
+		}
+	}
+
+	hdr->nrings = nrings;
+	hdr->owner = getpid();
+	__atomic_store_n(&hdr->magic, DOIO_RING_MAGIC, __ATOMIC_RELEASE);
+
+	return hdr;
+}
+
+/*
+ * Called by iogen, waits up to timeout seconds for doio to create the
+ * segment.
+ */
+static inline struct doio_ring_hdr *doio_ring_attach(const char *name,
+						      int timeout)
+{
+	struct doio_ring_hdr *hdr;
+	struct stat st;
+	int fd, waited = 0;
+
+	for (;;) {
+		fd = shm_open(name, O_RDWR, 0);
+		if (fd != -1) {
+			if (fstat(fd, &st) == 0 &&
+			    st.st_size >= (off_t)sizeof(*hdr))
+				break;
+			close(fd);
+		} else if (errno != ENOENT) {
+			return NULL;
+		}
+
+		if (waited++ >= timeout * 10) {
+			errno = ETIMEDOUT;
+			return NULL;
+		}
+		usleep(100000);
+	}
+
+	hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	while (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) !=
+	       DOIO_RING_MAGIC) {
+		if (waited++ >= timeout * 10) {
+			munmap(hdr, st.st_size);
+			errno = ETIMEDOUT;
+			return NULL;
+		}
+		usleep(100000);
+	}
+
+	if (hdr->producer ||
+	    (off_t)doio_ring_size(hdr->nrings) > st.st_size) {
+		munmap(hdr, st.st_size);
+		errno = EBUSY;
+		return NULL;
+	}
+	hdr->producer = getpid();
+
+	return hdr;
+}
+
+/* Returns -1 with errno EPIPE once pid has gone away */
+static inline int doio_ring_wait(sem_t *sem, pid_t pid)
+{
+	struct timespec ts;
+
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+
+		if (!sem_timedwait(sem, &ts))
+			return 0;
+
+		if (errno == ETIMEDOUT && pid && kill(pid, 0) &&
+		    errno == ESRCH) {
+			errno = EPIPE;
+			return -1;
+		}
+	}
+}
+
+static inline void doio_ring_flush(struct doio_ring *r)
+{
+	if (r->next == r->tail)
+		return;
+
+	__atomic_store_n(&r->tail, r->next, __ATOMIC_RELEASE);
+	sem_post(&r->items);
+}
+
+/* iogen side, returns -1 if doio has gone away */
+static inline int doio_ring_put(struct doio_ring_hdr *hdr, int ring,
+				const struct doio_breq *req)
+{
+	struct doio_ring *r = &hdr->rings[ring];
+
+	while (r->next - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >=
+	       DOIO_RING_SLOTS) {
+		doio_ring_flush(r);
+		if (doio_ring_wait(&r->space,
+				   r->consumer ? r->consumer : hdr->owner))
+			return -1;
+	}
+
+	r->slots[r->next % DOIO_RING_SLOTS] = *req;
+	r->next++;
+
+	if (r->next - r->tail >= DOIO_RING_BATCH)
+		doio_ring_flush(r);
+
+	return 0;
+}
+
+static inline void doio_ring_finish(struct doio_ring_hdr *hdr)
+{
+	int i;
+
+	for (i = 0; i < hdr->nrings; i++)
+		doio_ring_flush(&hdr->rings[i]);
+
+	__atomic_store_n(&hdr->done, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < hdr->nrings; i++)
+		sem_post(&hdr->rings[i].items);
+}
+
+/*
+ * doio side, returns 1 with a request, 0 when iogen is done and -1 if it
+ * went away without finishing.
+ */
+static inline int doio_ring_get(struct doio_ring_hdr *hdr, int ring,
+				struct doio_breq *req)
+{
+	struct doio_ring *r = &hdr->rings[ring];
+	unsigned head = r->head;
+
+	while (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+		if (__atomic_load_n(&hdr->done, __ATOMIC_ACQUIRE) &&
+		    head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+			return 0;
+		if (doio_ring_wait(&r->items, hdr->producer))
+			return -1;
+	}
+
+	*req = r->slots[head % DOIO_RING_SLOTS];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+	if (!((head + 1) % DOIO_RING_BATCH))
+		sem_post(&r->space);
+
+	return 1;
+}
+
+/*
+ * doio side, waits up to timeout seconds for iogen to attach and fill in
+ * the file table.
+ */
+static inline int doio_ring_join(struct doio_ring_hdr *hdr, int ring,
+				 int timeout)
+{
+	int waited = 0;
+
+	hdr->rings[ring].consumer = getpid();
+
+	while (!__atomic_load_n(&hdr->ready, __ATOMIC_ACQUIRE)) {
+		if (getppid() == 1 && hdr->owner != getpid()) {
+			errno = EPIPE;
+			return -1;
+		}
+		if (waited++ >= timeout * 100) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		usleep(10000);
+	}
+
+	return 0;
+}
+
+/*
+ * struct io_req keeps the common fields at different places for plain
+ * read/write and for the rest, see doio.h.
+ */
+static inline void doio_breq_pack(struct doio_breq *b,
+				  const struct io_req *req, int file)
+{
+	const struct read_req *rd = &req->r_data.read;
+	const struct write_req *wr = &req->r_data.write;
+	const struct listio_req *io = &req->r_data.listio;
+
+	memset(b, 0, sizeof(*b));
+	b->r_type = req->r_type;
+	b->r_file = file;
+
+	switch (req->r_type) {
+	case READ:
+	case READA:
+		b->r_oflags = rd->r_oflags;
+		b->r_offset = rd->r_offset;
+		b->r_nbytes = rd->r_nbytes;
+		b->r_uflags = rd->r_uflags;
+		b->r_aio_strat = rd->r_aio_strat;
+		b->r_nstrides = rd->r_nstrides;
+		b->r_nent = rd->r_nent;
+		break;
+	case WRITE:
+	case WRITEA:
+		b->r_oflags = wr->r_oflags;
+		b->r_offset = wr->r_offset;
+		b->r_nbytes = wr->r_nbytes;
+		b->r_pattern = wr->r_pattern;
+		b->r_uflags = wr->r_uflags;
+		b->r_aio_strat = wr->r_aio_strat;
+		b->r_nstrides = wr->r_nstrides;
+		b->r_nent = wr->r_nent;
+		break;
+	default:
+		b->r_oflags = io->r_oflags;
+		b->r_offset = io->r_offset;
+		b->r_nbytes = io->r_nbytes;
+		b->r_pattern = io->r_pattern;
+		b->r_uflags = io->r_uflags;
+		b->r_aio_strat = io->r_aio_strat;
+		b->r_nstrides = io->r_nstrides;
+		b->r_nent = io->r_nent;
+		b->r_cmd = io->r_cmd;
+		b->r_opcode = io->r_opcode;
+		break;
+	}
+}
+
+static inline void doio_breq_unpack(struct io_req *req,
+				    const struct doio_breq *b,
+				    const char *path)
+{
+	struct read_req *rd = &req->r_data.read;
+	struct write_req *wr = &req->r_data.write;
+	struct listio_req *io = &req->r_data.listio;
+
+	memset(req, 0, sizeof(*req));
+	req->r_type = b->r_type;
+	req->r_magic = DOIO_MAGIC;
+
+	switch (b->r_type) {
+	case READ:
+	case READA:
+		strcpy(rd->r_file, path);
+		rd->r_oflags = b->r_oflags;
+		rd->r_offset = b->r_offset;
+		rd->r_nbytes = b->r_nbytes;
+		rd->r_uflags = b->r_uflags;
+		rd->r_aio_strat = b->r_aio_strat;
+		rd->r_nstrides = b->r_nstrides;
+		rd->r_nent = b->r_nent;
+		break;
+	case WRITE:
+	case WRITEA:
+		strcpy(wr->r_file, path);
+		wr->r_oflags = b->r_oflags;
+		wr->r_offset = b->r_offset;
+		wr->r_nbytes = b->r_nbytes;
+		wr->r_pattern = b->r_pattern;
+		wr->r_uflags = b->r_uflags;
+		wr->r_aio_strat = b->r_aio_strat;
+		wr->r_nstrides = b->r_nstrides;
+		wr->r_nent = b->r_nent;
+		break;
+	default:
+		strcpy(io->r_file, path);
+		io->r_oflags = b->r_oflags;
+		io->r_offset = b->r_offset;
+		io->r_nbytes = b->r_nbytes;
+		io->r_pattern = b->r_pattern;
+		io->r_uflags = b->r_uflags;
+		io->r_aio_strat = b->r_aio_strat;
+		io->r_nstrides = b->r_nstrides;
+		io->r_nent = b->r_nent;
+		io->r_cmd = b->r_cmd;
+		io->r_opcode = b->r_opcode;
+		break;
+	}
+}
+
+#endif /* DOIO_RING_H */
@@ -61,11 +61,16 @@
  *	delay (if wanted)
  *    End loop
  *  End loop
+ *  print extent map and read throughput summary (if wanted)
  *  remove all files (if wanted)
  *
+ * With -j the iteration loop is run by worker threads instead, each one
+ * owning the files whose index modulo the number of threads is its id.
+ *
  * Author: Richard Logan
  *
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -82,6 +87,14 @@
 #include <errno.h>
 #include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "config.h"
+#ifdef HAVE_LINUX_FIEMAP_H
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+#include "lapi/fcntl.h"
 #include "dataascii.h"
 #include "random_range.h"
 #include "databin.h"
@@ -112,6 +125,12 @@ int check_write(int fd, int cf_inter, char *filename, int mode);
 int check_file(int fd, int cf_inter, char *filename, int no_file_check);
 int file_size(int fd);
 int lkfile(int fd, int operation, int lklevel);
+void fill_pattern(char *buf, int size, off_t offset);
+int grow_falloc(int fd, off_t offset, int size);
+int grow_punch(int fd, off_t offset, int size, long rnd);
+struct grow_args;
+void grow_threads(struct grow_args *args);
+void extent_report(void);
 
 #ifndef linux
 int pre_alloc(int fd, long size);
@@ -250,6 +269,51 @@ struct fileinfo_t {
 	int mode;
 } Fileinfo;
 
+#define MAX_DIRS	64	/* max directories given to -d */
+
+#define GROW_WRITE	0	/* grow by writing */
+#define GROW_FALLOC	1	/* fallocate the increment, then write it */
+#define GROW_PUNCH	2	/* write, then punch a hole below the write */
+
+#define GROW_BLKSIZE	4096	/* punched holes are aligned to this */
+#define RDBUF_SIZE	(1024 * 1024)	/* read size for the throughput pass */
+
+int Grow_mode = GROW_WRITE;	/* -G */
+int Nthreads = 0;		/* -j, 0 means the classic single loop */
+int Extent_report = 0;		/* -F, print extent map summary at exit */
+int No_falloc = 0;		/* set if fallocate is not supported */
+
+/*
+ * Loop parameters given to the worker threads, the rest of the options
+ * are read from the globals above.
+ */
+struct grow_args {
+	int iterations;
+	int time_iterval;
+	time_t start_time;
+	int grow_incr;
+	int trunc_incr;
+	int trunc_inter;
+	int unlink_inter;
+	int write_check_inter;
+};
+
+struct grow_worker {
+	pthread_t thread;
+	int id;
+	unsigned int seed;
+	struct grow_args *args;
+	char *buf;		/* write buffer */
+	char *cbuf;		/* write check buffer */
+	long grows;
+	long punches;
+	long truncs;
+	long long bytes;	/* bytes written */
+	int errors;
+};
+
+volatile int Threads_stop = 0;	/* set by a worker on max errors */
+
 /*
  * Define open flags that will be used when '-o random' option is used.
  * Note: If there is more than one growfiles doing its thing to the same
@@ -351,6 +415,8 @@ int main(int argc, char **argv)
 	int num_auto_files = 0;	/* files created by tool */
 	int seq_auto_files = 0;	/* auto files created by tool created by tool */
 	char *auto_dir = DEF_DIR;
+	char *auto_dirs[MAX_DIRS];	/* -d dir[,dir...] */
+	int num_dirs = 0;
 	char *auto_file = DEF_FILE;
 	int grow_incr = 4096;
 	int trunc_incr = 4096;
@@ -392,6 +458,7 @@ int main(int argc, char **argv)
 	char *cptr;		/* temp char pointer */
 	extern int Forker_npids;	/* num of forked pid, defined in forker.c */
 	struct timeval tv1;
+	struct grow_args args;
 
 	if (argv[0][0] == '-')
 		reexec = REXEC_DONE;
@@ -409,7 +476,7 @@ int main(int argc, char **argv)
 	 * Process options
 	 */
 	while ((ind = getopt(argc, argv,
-			     "hB:C:c:bd:D:e:Ef:g:H:I:i:lL:n:N:O:o:pP:q:wt:r:R:s:S:T:uU:W:xy"))
+			     "hB:C:c:bd:D:e:EFf:g:G:H:I:i:j:lL:n:N:O:o:pP:q:wt:r:R:s:S:T:uU:W:xy"))
 	       != EOF) {
 		switch (ind) {
 
@@ -473,28 +540,40 @@ int main(int argc, char **argv)
 			}
 			break;
 
-		case 'd':
-			auto_dir = optarg;
+		case 'd':	/* format: dir[,dir...] */
 #ifdef CRAY
 			unsetenv("TMPDIR");	/* force the use of auto_dir */
 #endif
-			if (stat(auto_dir, &statbuf) == -1) {
-				if (mkdir(auto_dir, 0777) == -1) {
-					if (errno != EEXIST) {
+			for (auto_dir = strtok(optarg, ","); auto_dir != NULL;
+			     auto_dir = strtok(NULL, ",")) {
+				if (num_dirs == MAX_DIRS) {
+					fprintf(stderr,
+						"%s%s: --d option, more than %d directories\n",
+						Progname, TagName, MAX_DIRS);
+					exit(1);
+				}
+				auto_dirs[num_dirs++] = auto_dir;
+
+				if (stat(auto_dir, &statbuf) == -1) {
+					if (mkdir(auto_dir, 0777) == -1) {
+						if (errno != EEXIST) {
+							fprintf(stderr,
+								"%s%s: Unable to make dir %s\n",
+								Progname,
+								TagName,
+								auto_dir);
+							exit(1);
+						}
+					}
+				} else {
+					if (!(statbuf.st_mode & S_IFDIR)) {
 						fprintf(stderr,
-							"%s%s: Unable to make dir %s\n",
+							"%s%s: %s already exists and is not a directory\n",
 							Progname, TagName,
 							auto_dir);
 						exit(1);
 					}
 				}
-			} else {
-				if (!(statbuf.st_mode & S_IFDIR)) {
-					fprintf(stderr,
-						"%s%s: %s already exists and is not a directory\n",
-						Progname, TagName, auto_dir);
-					exit(1);
-				}
 			}
 			break;
 
@@ -518,6 +597,10 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'F':
+			Extent_report++;
+			break;
+
 		case 'f':
 			auto_file = optarg;
 			break;
@@ -545,6 +628,23 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'G':
+			if (strcmp(optarg, "write") == 0) {
+				Grow_mode = GROW_WRITE;
+			} else if (strcmp(optarg, "falloc") == 0) {
+				Grow_mode = GROW_FALLOC;
+			} else if (strcmp(optarg, "punch") == 0) {
+				Grow_mode = GROW_PUNCH;
+				using_random++;
+			} else {
+				fprintf(stderr,
+					"%s%s: --G option arg invalid, write, falloc or punch\n",
+					Progname, TagName);
+				usage();
+				exit(1);
+			}
+			break;
+
 		case 'H':
 			if (sscanf(optarg, "%f", &delaysecs) != 1
 			    || delaysecs < 0) {
@@ -591,6 +691,17 @@ int main(int argc, char **argv)
 #endif
 			break;
 
+		case 'j':
+			if (sscanf(optarg, "%i", &Nthreads) != 1 ||
+			    Nthreads < 0) {
+				fprintf(stderr,
+					"%s%s: --j option arg invalid\n",
+					Progname, TagName);
+				usage();
+				exit(1);
+			}
+			break;
+
 		case 'l':
 			lockfile++;
 			if (lockfile > 2)
@@ -967,6 +1078,19 @@ int main(int argc, char **argv)
 no whole file checking will be performed!\n", Progname, TagName,
 			       getpid());
 
+	} else if (Grow_mode == GROW_PUNCH) {
+		no_file_check = 1;
+
+		if (file_check_inter)
+			printf("%s%s: %d Punching holes while growing,\n\
+no whole file checking will be performed!\n", Progname, TagName,
+			       getpid());
+	}
+
+	if (Nthreads && (Mode & MODE_RAND_LSEEK || lockfile || io_type)) {
+		fprintf(stderr, "%s%s: --j can't be used with -R, -l or -I\n",
+			Progname, TagName);
+		exit(1);
 	}
 
 	if (Mode & MODE_RAND_SIZE)
@@ -1273,19 +1397,23 @@ no whole file checking will be performed!\n", Progname, TagName,
 	 * construct auto filename and insert them into filenames space
 	 */
 
+	if (!num_dirs)
+		auto_dirs[num_dirs++] = DEF_DIR;
+
 	for (ind = 0; ind < num_auto_files; ind++, num++) {
 		gettimeofday(&tv1, NULL);
 		sprintf((char *)filenames + (num * PATH_MAX),
-			"%s/%s%ld%ld%d.%d", auto_dir, auto_file,
-			(long)tv1.tv_sec, (long)tv1.tv_usec, rand(), ind);
+			"%s/%s%ld%ld%d.%d", auto_dirs[ind % num_dirs],
+			auto_file, (long)tv1.tv_sec, (long)tv1.tv_usec, rand(),
+			ind);
 	}
 
 	/*
-	 * construct auto seq filenames
+	 * construct auto seq filenames, spread over the -d directories
 	 */
 	for (ind = 1; ind <= seq_auto_files; ind++, num++) {
 		sprintf((char *)filenames + (num * PATH_MAX), "%s/%s%d",
-			auto_dir, auto_file, ind);
+			auto_dirs[(ind - 1) % num_dirs], auto_file, ind);
 	}
 
 /**** end filename stuff ****/
@@ -1360,6 +1488,25 @@ no whole file checking will be performed!\n", Progname, TagName,
 #endif
 	}
 
+	/*
+	 * With -j the worker threads run the iterations, the loop below
+	 * is skipped.
+	 */
+	if (Nthreads) {
+		args.iterations = iterations;
+		args.time_iterval = time_iterval;
+		args.start_time = start_time;
+		args.grow_incr = grow_incr;
+		args.trunc_incr = trunc_incr;
+		args.trunc_inter = trunc_inter;
+		args.unlink_inter = unlink_inter;
+		args.write_check_inter = write_check_inter;
+
+		grow_threads(&args);
+		strcpy(reason, "Worker threads done");
+		stop = 1;
+	}
+
 	/*
 	 * This is the main iteration loop.
 	 * Each iteration, all files can  be opened, written to,
@@ -1592,6 +1739,9 @@ no whole file checking will be performed!\n", Progname, TagName,
 	fflush(stdout);
 	fflush(stderr);
 
+	if (Extent_report)
+		extent_report();
+
 	cleanup();
 
 	if (Errors) {
@@ -1795,14 +1945,14 @@ int cleanup(void)
 void usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s%s [-bhEluy][[-g grow_incr][-i num][-t trunc_incr][-T trunc_inter]\n",
+		"Usage: %s%s [-bhEFluy][[-g grow_incr][-i num][-t trunc_incr][-T trunc_inter]\n",
 		Progname, TagName);
 	fprintf(stderr,
 		"[-d auto_dir][-e maxerrs][-f auto_file][-N num_files][-w][-c chk_inter][-D debug]\n");
 	fprintf(stderr,
 		"[-s seed][-S seq_auto_files][-p][-P PANIC][-I io_type][-o open_flags][-B maxbytes]\n");
 	fprintf(stderr,
-		"[-r iosizes][-R lseeks][-U unlk_inter][-W tagname] [files]\n");
+		"[-r iosizes][-R lseeks][-U unlk_inter][-W tagname][-j threads][-G grow_mode] [files]\n");
 
 	return;
 
@@ -1824,17 +1974,26 @@ void help(void)
   -C write_chk   Specifies how often to check the last write (default 1)\n\
   -c file_chk    Specifies how often to check whole file (default 0)\n\
   -d auto_dir    Specifies the directory to auto created files. (default .)\n\
+                 A comma separated list spreads the files over the directories\n\
   -D debug_lvl   Specifies the debug level (default 1)\n\
   -E             Print examples and exit\n\
   -e errs        The number errors that will terminate this program (def 100)\n\
+  -F             Print the extent count (FIEMAP) and the sequential read\n\
+                 throughput of each file before exiting\n\
   -f auto_file   Specifies the base filename files created. (default \"gf\")\n\
   -g grow_incr   Specfied to grow by incr for each num. (default 4096)\n\
                  grow_incr may end in b for blocks\n\
 		 If -r option is used, this option is ignored and size is random\n\
+  -G grow_mode   write - grow by write (default)\n\
+                 falloc - fallocate the grow_incr before writing it\n\
+                 punch - after each write punch a hole half the grow_incr in\n\
+                 size below it, disables whole file checks\n\
   -H delay       Amount of time to delay between each file (default 0.0)\n\
   -I io_type Specifies io type: s - sync, p - polled async, a - async (def s)\n\
 		 l - listio sync, L - listio async, r - random\n\
   -i iteration   Specfied to grow each file num times. 0 means forever (default 1)\n\
+  -j threads     Grow the files from threads, each owning every threads'th\n\
+                 file. Can't be used with -I, -l or -R\n\
   -l             Specfied to do file locking around write/read/trunc\n\
 		 If specified twice, file locking after open to just before close\n\
   -L time        Specfied to exit after time secs, must be used with -i.\n\
@@ -2150,26 +2309,7 @@ int /* BUG:14136 */ growfile(int fd, char *file, int grow_incr, char *buf,
 				       (long)Woffset);
 		}
 
-		if (Pattern == PATTERN_OFFSET)
-			datapidgen(STATIC_NUM, buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_PID)
-			datapidgen(Pid, buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_ASCII)
-			dataasciigen(NULL, buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_RANDOM)
-			databingen('r', buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_ALT)
-			databingen('a', buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_CHKER)
-			databingen('c', buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_CNTING)
-			databingen('C', buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_ZEROS)
-			databingen('z', buf, grow_incr, Woffset);
-		else if (Pattern == PATTERN_ONES)
-			databingen('o', buf, grow_incr, Woffset);
-		else
-			dataasciigen(NULL, buf, grow_incr, Woffset);
+		fill_pattern(buf, grow_incr, Woffset);
 
 		if (Debug > 2)
 			printf
@@ -2178,6 +2318,9 @@ int /* BUG:14136 */ growfile(int fd, char *file, int grow_incr, char *buf,
 
 		lkfile(fd, LOCK_EX, LKLVL0);	/* get exclusive lock */
 
+		if (Grow_mode == GROW_FALLOC && !(Mode & MODE_FIFO))
+			grow_falloc(fd, Woffset, grow_incr);
+
 /*****
 		ret=write(fd, buf, grow_incr);
 
@@ -2294,6 +2437,15 @@ int /* BUG:14136 */ growfile(int fd, char *file, int grow_incr, char *buf,
 				Woffset = 0;
 		}
 
+		if (Grow_mode == GROW_PUNCH && !(Mode & MODE_FIFO)) {
+			lkfile(fd, LOCK_EX, LKLVL0);
+			ret = grow_punch(fd, Woffset, grow_incr,
+					 random_range(0, INT32_MAX, 1, NULL));
+			lkfile(fd, LOCK_UN, LKLVL0);
+			if (ret < 0)
+				return -1;
+		}
+
 	}			/* end of grow by write */
 
 	/*
@@ -2328,6 +2480,102 @@ int /* BUG:14136 */ growfile(int fd, char *file, int grow_incr, char *buf,
 
 }				/* end of growfile */
 
+/***********************************************************************
+ * Fill buf with size bytes of the -q pattern as expected at offset.
+ ***********************************************************************/
+void fill_pattern(char *buf, int size, off_t offset)
+{
+	if (Pattern == PATTERN_OFFSET)
+		datapidgen(STATIC_NUM, buf, size, offset);
+	else if (Pattern == PATTERN_PID)
+		datapidgen(Pid, buf, size, offset);
+	else if (Pattern == PATTERN_ASCII)
+		dataasciigen(NULL, buf, size, offset);
+	else if (Pattern == PATTERN_RANDOM)
+		databingen('r', buf, size, offset);
+	else if (Pattern == PATTERN_ALT)
+		databingen('a', buf, size, offset);
+	else if (Pattern == PATTERN_CHKER)
+		databingen('c', buf, size, offset);
+	else if (Pattern == PATTERN_CNTING)
+		databingen('C', buf, size, offset);
+	else if (Pattern == PATTERN_ZEROS)
+		databingen('z', buf, size, offset);
+	else if (Pattern == PATTERN_ONES)
+		databingen('o', buf, size, offset);
+	else
+		dataasciigen(NULL, buf, size, offset);
+}
+
+/***********************************************************************
+ * -G falloc: allocate the space of the next grow before writing it.
+ * If the filesystem can't do it, growfiles goes on growing by write.
+ ***********************************************************************/
+int grow_falloc(int fd, off_t offset, int size)
+{
+	if (No_falloc)
+		return 0;
+
+	if (fallocate(fd, 0, offset, size) == -1) {
+		if (errno == EOPNOTSUPP || errno == ENOSYS) {
+			printf("%s%s: %d fallocate() not supported, growing by write\n",
+			       Progname, TagName, Pid);
+			No_falloc = 1;
+			return 0;
+		}
+		fprintf(stderr,
+			"%s%s: %d %s/%d: fallocate(%d, 0, %ld, %d) failed: %s\n",
+			Progname, TagName, Pid, __FILE__, __LINE__, fd,
+			(long)offset, size, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ * -G punch: punch a hole of half the grow size, in GROW_BLKSIZE units,
+ * at a block aligned place below offset, the start of the last write.
+ * rnd picks the place.  Returns 1 if a hole was punched.
+ ***********************************************************************/
+int grow_punch(int fd, off_t offset, int size, long rnd)
+{
+	off_t len, start;
+
+	if (No_falloc)
+		return 0;
+
+	len = (size / 2) & ~(GROW_BLKSIZE - 1);
+	if (len == 0)
+		len = GROW_BLKSIZE;
+	if (offset < len)
+		return 0;
+
+	start = (rnd % ((offset - len) / GROW_BLKSIZE + 1)) * GROW_BLKSIZE;
+
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      start, len) == -1) {
+		if (errno == EOPNOTSUPP || errno == ENOSYS) {
+			printf("%s%s: %d hole punching not supported, growing by write\n",
+			       Progname, TagName, Pid);
+			No_falloc = 1;
+			return 0;
+		}
+		fprintf(stderr,
+			"%s%s: %d %s/%d: fallocate(%d, PUNCH_HOLE, %ld, %ld) failed: %s\n",
+			Progname, TagName, Pid, __FILE__, __LINE__, fd,
+			(long)start, (long)len, strerror(errno));
+		return -1;
+	}
+
+	if (Debug > 2)
+		printf("%s: %d DEBUG3 %s/%d: punched %ld bytes at %ld\n",
+		       Progname, Pid, __FILE__, __LINE__, (long)len,
+		       (long)start);
+
+	return 1;
+}
+
 /***********************************************************************
  * shrinkfile file by trunc_incr.  file can not be made smaller than
  * size zero.  Therefore, if trunc_incr is larger than file size,
@@ -3048,3 +3296,416 @@ int pre_alloc(int fd, long size)
 	return 0;
 }
 #endif
+
+/***********************************************************************
+ * Worker threads (-j).  Each thread owns the files whose index modulo
+ * Nthreads is its id, so no locking is needed on the files themselves.
+ ***********************************************************************/
+static void worker_error(struct grow_worker *w)
+{
+	w->errors++;
+	if (__sync_add_and_fetch(&Errors, 1) >= Maxerrs && Maxerrs)
+		Threads_stop = 1;
+}
+
+/*
+ * Grow a file once, the threaded counterpart of one pass of the file
+ * loop in main().
+ */
+static void grow_one(struct grow_worker *w, char *filename, int iter)
+{
+	struct grow_args *a = w->args;
+	struct stat stbuf;
+	int fd, flags, incr, ret, i;
+	off_t off, new_size;
+
+	if (open_flags == RANDOM_OPEN)
+		flags = Open_flags[rand_r(&w->seed) %
+				   (sizeof(Open_flags) / sizeof(int))];
+	else
+		flags = open_flags;
+
+	if ((fd = open(filename, flags, 0777)) == -1) {
+		fprintf(stderr,
+			"%s%s: %d %s/%d: %d thread %d: open(%s, %#o, 0777) failed: %s\n",
+			Progname, TagName, Pid, __FILE__, __LINE__, iter,
+			w->id, filename, flags, strerror(errno));
+		worker_error(w);
+		return;
+	}
+
+	if (fstat(fd, &stbuf) == -1 || !S_ISREG(stbuf.st_mode)) {
+		fprintf(stderr,
+			"%s%s: %d %s/%d: %d thread %d: %s is not a regular file\n",
+			Progname, TagName, Pid, __FILE__, __LINE__, iter,
+			w->id, filename);
+		worker_error(w);
+		close(fd);
+		return;
+	}
+
+	incr = a->grow_incr;
+	if (Mode & MODE_RAND_SIZE) {
+		incr = min_size + rand_r(&w->seed) %
+		    ((max_size - min_size) / mult_size + 1) * mult_size;
+	}
+	if (incr <= 0)
+		goto out;
+
+	off = stbuf.st_size;
+
+	if (Mode & MODE_GROW_BY_LSEEK) {
+		ret = pwrite(fd, "w", 1, off + incr - 1);
+		if (ret != 1)
+			goto write_failed;
+		w->bytes++;
+	} else {
+		if (Grow_mode == GROW_FALLOC && grow_falloc(fd, off, incr))
+			worker_error(w);
+
+		fill_pattern(w->buf, incr, off);
+		ret = pwrite(fd, w->buf, incr, off);
+		if (ret != incr)
+			goto write_failed;
+		w->bytes += incr;
+
+		if (a->write_check_inter && iter % a->write_check_inter == 0 &&
+		    Pattern != PATTERN_RANDOM) {
+			if (pread(fd, w->cbuf, incr, off) != incr) {
+				fprintf(stderr,
+					"%s%s: %d %s/%d: %d thread %d: read of %d bytes at %ld from %s failed: %s\n",
+					Progname, TagName, Pid, __FILE__,
+					__LINE__, iter, w->id, incr, (long)off,
+					filename, strerror(errno));
+				worker_error(w);
+			} else if (memcmp(w->buf, w->cbuf, incr)) {
+				for (i = 0; w->buf[i] == w->cbuf[i]; i++) ;
+				fprintf(stderr,
+					"%s%s: %d %s/%d: %d thread %d: corrupted data in %s at offset %ld (write of %d bytes at %ld)\n",
+					Progname, TagName, Pid, __FILE__,
+					__LINE__, iter, w->id, filename,
+					(long)off + i, incr, (long)off);
+				worker_error(w);
+			}
+		}
+
+		if (Grow_mode == GROW_PUNCH) {
+			ret = grow_punch(fd, off, incr, rand_r(&w->seed));
+			if (ret < 0)
+				worker_error(w);
+			else
+				w->punches += ret;
+		}
+	}
+
+	w->grows++;
+	__sync_add_and_fetch(&bytes_consumed, incr);
+
+	if (a->trunc_inter && w->grows % a->trunc_inter == 0) {
+		new_size = off + incr - a->trunc_incr;
+		if (new_size < 0)
+			new_size = 0;
+
+		if (ftruncate(fd, new_size) == -1) {
+			fprintf(stderr,
+				"%s%s: %d %s/%d: %d thread %d: ftruncate(%s, %ld) failed: %s\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				iter, w->id, filename, (long)new_size,
+				strerror(errno));
+			worker_error(w);
+		} else {
+			__sync_sub_and_fetch(&bytes_consumed,
+					     off + incr - new_size);
+			w->truncs++;
+		}
+	}
+
+out:
+	close(fd);
+
+	if (a->unlink_inter && iter % a->unlink_inter == 0)
+		unlink(filename);
+	return;
+
+write_failed:
+	fprintf(stderr,
+		"%s%s: %d %s/%d: %d thread %d: write of %d bytes at %ld to %s failed: %s\n",
+		Progname, TagName, Pid, __FILE__, __LINE__, iter, w->id,
+		(Mode & MODE_GROW_BY_LSEEK) ? 1 : incr, (long)off, filename,
+		ret < 0 ? strerror(errno) : "short write");
+	worker_error(w);
+	if (ret < 0 && errno == ENOSPC)
+		Threads_stop = 1;
+	close(fd);
+}
+
+static void *grow_worker(void *arg)
+{
+	struct grow_worker *w = arg;
+	struct grow_args *a = w->args;
+	struct timeval ts;
+	int iter, ind;
+
+	for (iter = 1; !Threads_stop; iter++) {
+		if (a->iterations && iter > a->iterations)
+			break;
+
+		gettimeofday(&ts, NULL);
+		if (a->time_iterval > 0 &&
+		    a->start_time + a->time_iterval < ts.tv_sec)
+			break;
+
+		if (bytes_to_consume && bytes_consumed >= bytes_to_consume)
+			break;
+
+		for (ind = w->id; ind < num_files && !Threads_stop;
+		     ind += Nthreads) {
+			grow_one(w, filenames + ind * PATH_MAX, iter);
+			if (delaytime)
+				usleep(delaytime);
+		}
+	}
+
+	return NULL;
+}
+
+void grow_threads(struct grow_args *args)
+{
+	struct grow_worker *workers, *w;
+	struct timeval t1, t2;
+	long grows = 0, punches = 0, truncs = 0;
+	long long bytes = 0;
+	double secs;
+	int i, ret;
+
+	if (Nthreads > num_files) {
+		printf("%s%s: %d only %d files, starting %d threads\n",
+		       Progname, TagName, Pid, num_files, num_files);
+		Nthreads = num_files;
+	}
+
+	if ((workers = calloc(Nthreads, sizeof(*workers))) == NULL) {
+		fprintf(stderr, "%s%s: %d %s/%d: calloc failed: %s\n",
+			Progname, TagName, Pid, __FILE__, __LINE__,
+			strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < Nthreads; i++) {
+		w = &workers[i];
+		w->id = i;
+		w->seed = Seed + i;
+		w->args = args;
+		w->buf = malloc(args->grow_incr + Alignment + 1);
+		w->cbuf = malloc(args->grow_incr + 1);
+		if (w->buf == NULL || w->cbuf == NULL) {
+			fprintf(stderr,
+				"%s%s: %d %s/%d: malloc(%d) failed: %s\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				args->grow_incr, strerror(errno));
+			exit(1);
+		}
+		w->buf += Alignment;
+	}
+
+	if (Debug > 1)
+		printf("%s: %d DEBUG2 starting %d worker threads on %d files\n",
+		       Progname, Pid, Nthreads, num_files);
+
+	gettimeofday(&t1, NULL);
+
+	for (i = 0; i < Nthreads; i++) {
+		ret = pthread_create(&workers[i].thread, NULL, grow_worker,
+				     &workers[i]);
+		if (ret) {
+			fprintf(stderr,
+				"%s%s: %d %s/%d: pthread_create failed: %s\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				strerror(ret));
+			Threads_stop = 1;
+			Nthreads = i;
+			Errors++;
+			break;
+		}
+	}
+
+	for (i = 0; i < Nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	gettimeofday(&t2, NULL);
+	secs = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1e6;
+
+	for (i = 0; i < Nthreads; i++) {
+		w = &workers[i];
+		if (Debug > 1)
+			printf("%s: %d DEBUG2 thread %d: %ld grows, %ld punches, %ld truncates, %lld bytes, %d errors\n",
+			       Progname, Pid, i, w->grows, w->punches,
+			       w->truncs, w->bytes, w->errors);
+		grows += w->grows;
+		punches += w->punches;
+		truncs += w->truncs;
+		bytes += w->bytes;
+	}
+
+	printf("%s%s: %d %d threads: %ld grows, %ld punches, %ld truncates, %lld bytes written in %.2f secs (%.1f MB/s)\n",
+	       Progname, TagName, Pid, Nthreads, grows, punches, truncs, bytes,
+	       secs, secs > 0 ? bytes / secs / (1024 * 1024) : 0.0);
+}
+
+/***********************************************************************
+ * Extent map summary (-F).
+ ***********************************************************************/
+#ifdef HAVE_LINUX_FIEMAP_H
+#define FIEMAP_EXTENTS	256
+
+/*
+ * Returns the number of extents of the file, counting physically
+ * contiguous extents as one, or -1 if FIEMAP is not supported.
+ */
+static long count_extents(int fd)
+{
+	struct fiemap *fm;
+	struct fiemap_extent *fe;
+	unsigned long long start = 0, next_phys = 0, next_log = 0;
+	long extents = 0;
+	unsigned int i;
+	int last = 0;
+
+	fm = malloc(sizeof(*fm) + FIEMAP_EXTENTS * sizeof(*fe));
+	if (fm == NULL)
+		return -1;
+
+	while (!last) {
+		memset(fm, 0, sizeof(*fm));
+		fm->fm_start = start;
+		fm->fm_length = FIEMAP_MAX_OFFSET - start;
+		fm->fm_flags = start ? 0 : FIEMAP_FLAG_SYNC;
+		fm->fm_extent_count = FIEMAP_EXTENTS;
+
+		if (ioctl(fd, FS_IOC_FIEMAP, fm) == -1) {
+			extents = -1;
+			break;
+		}
+
+		if (fm->fm_mapped_extents == 0)
+			break;
+
+		for (i = 0; i < fm->fm_mapped_extents; i++) {
+			fe = &fm->fm_extents[i];
+			if (extents == 0 || fe->fe_physical != next_phys ||
+			    fe->fe_logical != next_log)
+				extents++;
+			next_phys = fe->fe_physical + fe->fe_length;
+			next_log = fe->fe_logical + fe->fe_length;
+			if (fe->fe_flags & FIEMAP_EXTENT_LAST)
+				last = 1;
+		}
+		start = next_log;
+	}
+
+	free(fm);
+	return extents;
+}
+#else
+static long count_extents(int fd)
+{
+	return -1;
+}
+#endif /* HAVE_LINUX_FIEMAP_H */
+
+/*
+ * Read the file sequentially with a cold page cache, returns the number of
+ * bytes read and the time it took in *secs.
+ */
+static long long read_file(int fd, char *buf, double *secs)
+{
+	struct timeval t1, t2;
+	long long total = 0;
+	int ret;
+
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	gettimeofday(&t1, NULL);
+	while ((ret = read(fd, buf, RDBUF_SIZE)) > 0)
+		total += ret;
+	gettimeofday(&t2, NULL);
+
+	*secs = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1e6;
+	return total;
+}
+
+void extent_report(void)
+{
+	struct stat stbuf;
+	char *buf, *filename;
+	char ext_str[24], avg_str[24];
+	long extents, tot_extents = 0;
+	long long nread, tot_read = 0, tot_size = 0, tot_alloc = 0;
+	double secs, tot_secs = 0;
+	int ind, fd, nfiles = 0, nmapped = 0;
+
+	if ((buf = malloc(RDBUF_SIZE)) == NULL) {
+		fprintf(stderr, "%s%s: %d %s/%d: malloc(%d) failed: %s\n",
+			Progname, TagName, Pid, __FILE__, __LINE__,
+			RDBUF_SIZE, strerror(errno));
+		return;
+	}
+
+	printf("%s%s: %d extent map and sequential read summary\n",
+	       Progname, TagName, Pid);
+	printf("%-40s %12s %8s %12s %10s\n",
+	       "file", "size", "extents", "avg extent", "read MB/s");
+
+	for (ind = 0; ind < num_files; ind++) {
+		filename = filenames + ind * PATH_MAX;
+
+		if ((fd = open(filename, O_RDONLY)) == -1)
+			continue;	/* unlinked by -U */
+
+		if (fstat(fd, &stbuf) == -1 || !S_ISREG(stbuf.st_mode)) {
+			close(fd);
+			continue;
+		}
+
+		extents = count_extents(fd);
+		nread = read_file(fd, buf, &secs);
+		close(fd);
+
+		strcpy(ext_str, "-");
+		strcpy(avg_str, "-");
+		if (extents >= 0) {
+			sprintf(ext_str, "%ld", extents);
+			if (extents > 0)
+				sprintf(avg_str, "%lld",
+					(long long)stbuf.st_blocks * 512 /
+					extents);
+			tot_extents += extents;
+			tot_alloc += (long long)stbuf.st_blocks * 512;
+			nmapped++;
+		}
+
+		printf("%-40s %12lld %8s %12s %10.1f\n", filename,
+		       (long long)stbuf.st_size, ext_str, avg_str,
+		       secs > 0 ? nread / secs / (1024 * 1024) : 0.0);
+
+		tot_size += stbuf.st_size;
+		tot_read += nread;
+		tot_secs += secs;
+		nfiles++;
+	}
+
+	free(buf);
+
+	if (nmapped) {
+		printf("%s%s: %d %d files, %lld bytes, %ld extents, %.1f extents per file, avg extent %lld bytes, read %.1f MB/s\n",
+		       Progname, TagName, Pid, nfiles, tot_size, tot_extents,
+		       (double)tot_extents / nmapped,
+		       tot_extents ? tot_alloc / tot_extents : 0,
+		       tot_secs > 0 ? tot_read / tot_secs / (1024 * 1024) : 0.0);
+	} else {
+		printf("%s%s: %d %d files, %lld bytes, no FIEMAP support, read %.1f MB/s\n",
+		       Progname, TagName, Pid, nfiles, tot_size,
+		       tot_secs > 0 ? tot_read / tot_secs / (1024 * 1024) : 0.0);
+	}
+}
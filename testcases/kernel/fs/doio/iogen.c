@@ -61,6 +61,7 @@
 #include "libkern.h"
 #endif
 #include "doio.h"
+#include "doio_ring.h"
 #include "bytes_by_prefix.h"
 #include "string_to_tokens.h"
 #include "open_flags.h"
@@ -129,9 +130,10 @@ int usage(FILE * stream);
  * Declare cmdline option flags/variables initialized in parse_cmdline()
  */
 
-#define OPTS	"a:dhf:i:L:m:op:qr:s:t:T:O:N:"
+#define OPTS	"a:B:dhf:i:L:m:op:qr:R:s:S:t:T:O:N:"
 
 int a_opt = 0;			/* async io comp. types supplied            */
+int B_opt = 0;			/* requests per write(2) to the pipe        */
 int o_opt = 0;			/* form overlapping requests                */
 int f_opt = 0;			/* test flags                               */
 int i_opt = 0;			/* iterations - 0 implies infinite          */
@@ -142,6 +144,8 @@ int p_opt = 0;			/* output pipe - default is stdout          */
 int r_opt = 0;			/* specify raw io multiple instead of       */
 				/* getting it from the mounted on device.   */
 				/* Only applies to regular files.           */
+int R_opt = 0;			/* shared memory ring instead of a pipe     */
+int S_opt = 0;			/* random seed                              */
 int s_opt = 0;			/* syscalls                                 */
 int t_opt = 0;			/* min transfer size (bytes)                */
 int T_opt = 0;			/* max transfer size (bytes)                */
@@ -152,6 +156,10 @@ int Iterations;			/* # requests to generate (0 --> infinite)  */
 int Time_Mode = 0;		/* non-zero if Iterations is in seconds     */
 				/* (ie. -i arg was suffixed with 's')       */
 char *Outpipe;			/* Pipe to write output to if p_opt         */
+char *Ring_Name;		/* shm ring to doio if R_opt                */
+int Batch = 1;			/* requests per write(2) to the pipe        */
+int Seed;			/* arg to -S                                */
+int Cur_File;			/* File_List index of the last request      */
 int Mintrans;			/* min io transfer size                     */
 int Maxtrans;			/* max io transfer size                     */
 int Rawmult;			/* raw/ssd io multiple (from -r)            */
@@ -377,11 +385,44 @@ char Byte_Patterns[26] = { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
 	'Y', 'Z'
 };
 
+/*
+ * Hands the file table and the seed to doio and returns the ring segment.
+ */
+struct doio_ring_hdr *init_ring(int seed)
+{
+	struct doio_ring_hdr *hdr;
+	int i;
+
+	if (Nfiles > DOIO_RING_MAXFILES) {
+		fprintf(stderr, "iogen%s:  At most %d files with -R\n",
+			TagName, DOIO_RING_MAXFILES);
+		exit(2);
+	}
+
+	hdr = doio_ring_attach(Ring_Name, 30);
+	if (hdr == NULL) {
+		fprintf(stderr, "iogen%s:  Could not attach to ring %s:  %s\n",
+			TagName, Ring_Name, SYSERR);
+		exit(2);
+	}
+
+	for (i = 0; i < Nfiles; i++)
+		strcpy(hdr->files[i], File_List[i].f_path);
+	hdr->nfiles = Nfiles;
+	hdr->seed = seed;
+	__atomic_store_n(&hdr->ready, 1, __ATOMIC_RELEASE);
+
+	return hdr;
+}
+
 int main(int argc, char **argv)
 {
-	int rseed, outfd, infinite;
+	int rseed, outfd, infinite, nreqs = 0;
 	time_t start_time;
-	struct io_req req;
+	struct io_req req, *batch;
+	struct doio_ring_hdr *ring = NULL;
+	struct doio_breq breq;
+	unsigned long reqno = 0;
 
 	umask(0);
 
@@ -394,17 +435,27 @@ int main(int argc, char **argv)
 	TagName[0] = '\0';
 	parse_cmdline(argc, argv, OPTS);
 
+	rseed = S_opt ? Seed : getpid();
+	random_range_seed(rseed);	/* initialize random number generator */
+
 	/*
 	 * Initialize output descriptor.
 	 */
-	if (!p_opt) {
+	if (R_opt) {
+		outfd = -1;
+		ring = init_ring(rseed);
+	} else if (!p_opt) {
 		outfd = 1;
 	} else {
 		outfd = init_output();
 	}
 
-	rseed = getpid();
-	random_range_seed(rseed);	/* initialize random number generator */
+	batch = malloc(Batch * sizeof(struct io_req));
+	if (batch == NULL) {
+		fprintf(stderr, "iogen%s:  malloc failed:  %s\n", TagName,
+			SYSERR);
+		exit(2);
+	}
 
 	/*
 	 * Print out startup information, unless we're running in quiet mode
@@ -435,11 +486,34 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		/*
+		 * Requests are dealt to the doio processes round robin, so
+		 * the stream each one sees only depends on the seed.
+		 */
+		if (ring) {
+			doio_breq_pack(&breq, &req, Cur_File);
+			if (doio_ring_put(ring, reqno++ % ring->nrings, &breq)) {
+				fprintf(stderr, "iogen%s:  doio went away\n",
+					TagName);
+				exit(2);
+			}
+			continue;
+		}
+
 		req.r_magic = DOIO_MAGIC;
-		if (write(outfd, (char *)&req, sizeof(req)) == -1)
-			perror("Warning: Could not write");
+		batch[nreqs++] = req;
+		if (nreqs == Batch) {
+			if (write(outfd, batch, nreqs * sizeof(req)) == -1)
+				perror("Warning: Could not write");
+			nreqs = 0;
+		}
 	}
 
+	if (ring)
+		doio_ring_finish(ring);
+	else if (nreqs && write(outfd, batch, nreqs * sizeof(req)) == -1)
+		perror("Warning: Could not write");
+
 	exit(0);
 
 }				/* main */
@@ -453,8 +527,11 @@ void startup_info(FILE * stream, int seed)
 	fprintf(stream, "iogen%s starting up with the following:\n", TagName);
 	fprintf(stream, "\n");
 
-	fprintf(stream, "Out-pipe:              %s\n",
-		p_opt ? Outpipe : "stdout");
+	if (R_opt)
+		fprintf(stream, "Out-ring:              %s\n", Ring_Name);
+	else
+		fprintf(stream, "Out-pipe:              %s\n",
+			p_opt ? Outpipe : "stdout");
 
 	if (Iterations) {
 		fprintf(stream, "Iterations:            %d", Iterations);
@@ -629,7 +706,8 @@ int form_iorequest(struct io_req *req)
 	 * open flags, and possibly a pattern (for write/writea).
 	 */
 
-	fptr = &File_List[random_range(0, Nfiles - 1, 1, NULL)];
+	Cur_File = random_range(0, Nfiles - 1, 1, NULL);
+	fptr = &File_List[Cur_File];
 	flags = Flag_List[random_range(0, Nflags - 1, 1, NULL)];
 
 	/*
@@ -1518,6 +1596,18 @@ int parse_cmdline(int argc, char **argv, char *opts)
 			m_opt++;
 			break;
 
+		case 'B':
+			Batch = atoi(optarg);
+			if (Batch < 1 || Batch * sizeof(struct io_req) > PIPE_BUF) {
+				fprintf(stderr,
+					"iogen%s:  Illegal -B arg (%s):  Must be 1 to %d\n",
+					TagName, optarg,
+					(int)(PIPE_BUF / sizeof(struct io_req)));
+				exit(1);
+			}
+			B_opt++;
+			break;
+
 		case 'N':
 			sprintf(TagName, "(%.39s)", optarg);
 			break;
@@ -1599,6 +1689,16 @@ int parse_cmdline(int argc, char **argv, char *opts)
 			p_opt++;
 			break;
 
+		case 'R':
+			Ring_Name = optarg;
+			R_opt++;
+			break;
+
+		case 'S':
+			Seed = atoi(optarg);
+			S_opt++;
+			break;
+
 		case 'r':
 			if ((Rawmult = bytes_by_prefix(optarg)) == -1 ||
 			    Rawmult < 11 || Rawmult % BSIZE) {
@@ -2024,8 +2124,22 @@ int help(FILE * stream)
 #ifdef linux
 	fprintf(stream, "\t                 {O_SYNC,etc}\n");
 #endif
+	fprintf(stream,
+		"\t-B nreqs         Requests per write to the pipe, up to PIPE_BUF\n");
+	fprintf(stream,
+		"\t                 bytes so doio never sees a partial request.\n");
 	fprintf(stream,
 		"\t-p               Output pipe.  Default is stdout.\n");
+	fprintf(stream,
+		"\t-R name          Send requests to 'doio -R name' through a shared\n");
+	fprintf(stream,
+		"\t                 memory ring instead of a pipe.  Each doio process\n");
+	fprintf(stream,
+		"\t                 gets every nprocs'th request.\n");
+	fprintf(stream,
+		"\t-S seed          Random seed.  With -R, the same seed and doio -n\n");
+	fprintf(stream,
+		"\t                 replay the same requests on every doio process.\n");
 	fprintf(stream,
 		"\t-q               Quiet mode.  Normally iogen spits out info\n");
 	fprintf(stream,
@@ -2093,7 +2207,7 @@ int help(FILE * stream)
 int usage(FILE * stream)
 {
 	fprintf(stream,
-		"usage%s:  iogen [-hoq] [-a aio_type,...] [-f flag[,flag...]] [-i iterations] [-p outpipe] [-m offset-mode] [-s syscall[,syscall...]] [-t mintrans] [-T maxtrans] [ -O file-create-flags ] [[len:]file ...]\n",
+		"usage%s:  iogen [-hoq] [-a aio_type,...] [-B nreqs] [-f flag[,flag...]] [-i iterations] [-p outpipe] [-R ring] [-S seed] [-m offset-mode] [-s syscall[,syscall...]] [-t mintrans] [-T maxtrans] [ -O file-create-flags ] [[len:]file ...]\n",
 		TagName);
 	return 0;
 }
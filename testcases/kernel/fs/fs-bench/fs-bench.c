@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program;  if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+/*
+ * fs-bench - metadata benchmark doing the work of create-files,
+ * random-access and random-del-create in one multi-threaded process.
+ *
+ * The files are laid out in a two level directory tree under the test
+ * temporary directory (set TMPDIR to pick the filesystem) and their sizes
+ * follow the box-muler distribution of the original tools.  The sizes are
+ * drawn once into a table shared by all threads, so a given seed produces
+ * the same file set regardless of the number of threads.
+ *
+ * The phases run one after another, each one on all threads:
+ *
+ *  create  - each thread creates and writes its share of the files
+ *  stat    - stat() of random files
+ *  read    - open, read whole and close random files
+ *  churn   - each thread deletes or recreates random files of its share
+ *  delete  - each thread unlinks its share of the files
+ *
+ * For each phase the operations per second and the per operation latency
+ * percentiles are reported.
+ *
+ * Usage: fs-bench [-w stat,read,churn] [-n files] [-T threads]
+ *                 [-o ops] [-m max size] [-S seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "test.h"
+#include "safe_macros.h"
+#include "tst_hist.h"
+
+char *TCID = "fs-bench";
+int TST_TOTAL = 1;
+
+#define FILES_PER_DIR	256
+#define NSIZES		65536
+#define RBUF_SIZE	65536
+
+extern int box_muler(int, int);
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	int first;		/* files [first, last) are owned by this thread */
+	int last;
+	long ops;
+	long errors;
+	long long bytes;
+	int err;		/* errno and path of the first error */
+	char err_path[PATH_MAX];
+	struct tst_hist lat;
+};
+
+struct phase {
+	const char *name;
+	void (*run)(struct worker *w);
+	int always;		/* not selectable with -w */
+};
+
+static char *w_opt, *n_opt, *T_opt, *o_opt, *m_opt, *S_opt;
+static int w_flag, n_flag, T_flag, o_flag, m_flag, S_flag;
+
+static option_t options[] = {
+	{"w:", &w_flag, &w_opt},
+	{"n:", &n_flag, &n_opt},
+	{"T:", &T_flag, &T_opt},
+	{"o:", &o_flag, &o_opt},
+	{"m:", &m_flag, &m_opt},
+	{"S:", &S_flag, &S_opt},
+	{NULL, NULL, NULL}
+};
+
+static int nfiles = 10000;
+static int nthreads;
+static int nops;
+static int max_size = 192 * 1024;
+static unsigned int seed;
+
+static int *sizes;		/* box-muler sizes, shared by all threads */
+static char *exists;		/* per file, written by the owning thread */
+static char *wbuf;
+static struct worker *workers;
+
+static void help(void);
+static void setup(void);
+static void cleanup(void);
+
+static long long mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void file_path(char *path, int i)
+{
+	sprintf(path, "%02x/%02x/%08x", (i >> 16) & 0xff, (i >> 8) & 0xff, i);
+}
+
+static void worker_error(struct worker *w, const char *path)
+{
+	if (!w->errors++) {
+		w->err = errno;
+		strcpy(w->err_path, path);
+	}
+}
+
+static int rand_file(struct worker *w)
+{
+	return rand_r(&w->seed) % nfiles;
+}
+
+static int rand_own_file(struct worker *w)
+{
+	return w->first + rand_r(&w->seed) % (w->last - w->first);
+}
+
+static void create_file(struct worker *w, int i)
+{
+	char path[PATH_MAX];
+	int fd, size = sizes[i % NSIZES];
+	long long start = mono_ns();
+
+	file_path(path, i);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		worker_error(w, path);
+		return;
+	}
+
+	if (write(fd, wbuf, size) != size)
+		worker_error(w, path);
+	else
+		w->bytes += size;
+
+	if (close(fd) == -1)
+		worker_error(w, path);
+
+	tst_hist_add(&w->lat, mono_ns() - start);
+	exists[i] = 1;
+	w->ops++;
+}
+
+static void delete_file(struct worker *w, int i)
+{
+	char path[PATH_MAX];
+	long long start = mono_ns();
+
+	file_path(path, i);
+
+	if (unlink(path) == -1)
+		worker_error(w, path);
+
+	tst_hist_add(&w->lat, mono_ns() - start);
+	exists[i] = 0;
+	w->ops++;
+}
+
+static void phase_create(struct worker *w)
+{
+	int i;
+
+	for (i = w->first; i < w->last; i++)
+		create_file(w, i);
+}
+
+static void phase_stat(struct worker *w)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	long long start;
+	int i, n;
+
+	for (n = 0; n < nops; n++) {
+		i = rand_file(w);
+		file_path(path, i);
+
+		start = mono_ns();
+		if (stat(path, &st) == -1 && (errno != ENOENT || exists[i]))
+			worker_error(w, path);
+		tst_hist_add(&w->lat, mono_ns() - start);
+		w->ops++;
+	}
+}
+
+static void phase_read(struct worker *w)
+{
+	char path[PATH_MAX], buf[RBUF_SIZE];
+	long long start;
+	int i, n, fd, ret;
+
+	for (n = 0; n < nops; n++) {
+		i = rand_file(w);
+		file_path(path, i);
+
+		start = mono_ns();
+		fd = open(path, O_RDONLY);
+		if (fd == -1) {
+			if (errno != ENOENT || exists[i])
+				worker_error(w, path);
+			continue;
+		}
+
+		while ((ret = read(fd, buf, sizeof(buf))) > 0)
+			w->bytes += ret;
+		if (ret == -1)
+			worker_error(w, path);
+
+		close(fd);
+		tst_hist_add(&w->lat, mono_ns() - start);
+		w->ops++;
+	}
+}
+
+static void phase_churn(struct worker *w)
+{
+	int i, n;
+
+	for (n = 0; n < nops; n++) {
+		i = rand_own_file(w);
+		if (exists[i])
+			delete_file(w, i);
+		else
+			create_file(w, i);
+	}
+}
+
+static void phase_delete(struct worker *w)
+{
+	int i;
+
+	for (i = w->first; i < w->last; i++) {
+		if (exists[i])
+			delete_file(w, i);
+	}
+}
+
+static struct phase phases[] = {
+	{"create", phase_create, 1},
+	{"stat", phase_stat, 0},
+	{"read", phase_read, 0},
+	{"churn", phase_churn, 0},
+	{"delete", phase_delete, 1},
+	{NULL, NULL, 0}
+};
+
+static struct phase *cur;
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+
+	cur->run(w);
+
+	return NULL;
+}
+
+static int run(struct phase *p)
+{
+	struct tst_hist *lat;
+	long ops = 0, errors = 0;
+	long long bytes = 0, start;
+	double secs;
+	char name[64];
+	int i, ret;
+
+	cur = p;
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i].ops = 0;
+		workers[i].errors = 0;
+		workers[i].bytes = 0;
+		tst_hist_init(&workers[i].lat);
+	}
+
+	start = mono_ns();
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&workers[i].thread, NULL, worker_fn,
+				     &workers[i]);
+		if (ret) {
+			tst_brkm(TBROK, cleanup, "pthread_create() failed: %s",
+				 tst_strerrno(ret));
+		}
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	secs = (mono_ns() - start) / 1000000000.0;
+	if (secs <= 0)
+		secs = 0.000001;
+
+	lat = SAFE_MALLOC(cleanup, sizeof(*lat));
+	tst_hist_init(lat);
+
+	for (i = 0; i < nthreads; i++) {
+		tst_hist_merge(lat, &workers[i].lat);
+		ops += workers[i].ops;
+		bytes += workers[i].bytes;
+		errors += workers[i].errors;
+
+		if (workers[i].errors) {
+			errno = workers[i].err;
+			tst_resm(TFAIL | TERRNO, "%s: %ld errors in thread %d, "
+				 "first on %s", p->name, workers[i].errors, i,
+				 workers[i].err_path);
+		}
+	}
+
+	tst_resm(TINFO, "%s: %ld ops in %.2fs, %.0f ops/s, %.1f MB/s",
+		 p->name, ops, secs, ops / secs,
+		 bytes / secs / (1024 * 1024));
+
+	sprintf(name, "%s, %d thread(s)", p->name, nthreads);
+	tst_hist_report(name, lat);
+	free(lat);
+
+	return errors != 0;
+}
+
+static int selected(const char *name)
+{
+	const char *s;
+	size_t len = strlen(name);
+
+	if (!w_opt)
+		return 1;
+
+	for (s = w_opt; (s = strstr(s, name)); s += len) {
+		if ((s == w_opt || s[-1] == ',') &&
+		    (s[len] == ',' || s[len] == '\0'))
+			return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct phase *p;
+	int failed = 0;
+
+	tst_parse_opts(argc, argv, options, help);
+
+	setup();
+
+	for (p = phases; p->name; p++) {
+		if (p->always || selected(p->name))
+			failed |= run(p);
+	}
+
+	if (!failed)
+		tst_resm(TPASS, "metadata benchmark completed");
+
+	cleanup();
+	tst_exit();
+}
+
+static void setup(void)
+{
+	char path[PATH_MAX];
+	int i, size;
+
+	tst_sig(NOFORK, DEF_HANDLER, cleanup);
+
+	nthreads = tst_ncpus();
+
+	if (n_flag)
+		nfiles = SAFE_STRTOL(NULL, n_opt, 1, 1 << 24);
+	if (T_flag)
+		nthreads = SAFE_STRTOL(NULL, T_opt, 1, 1024);
+	if (m_flag)
+		max_size = SAFE_STRTOL(NULL, m_opt, 2, 64 * 1024 * 1024);
+	if (S_flag)
+		seed = SAFE_STRTOL(NULL, S_opt, 0, INT_MAX);
+	else
+		seed = time(NULL) ^ getpid();
+
+	nops = o_flag ? SAFE_STRTOL(NULL, o_opt, 1, INT_MAX) : nfiles;
+
+	if (nthreads > nfiles)
+		nthreads = nfiles;
+
+	tst_resm(TINFO, "%d files, %d threads, %d ops per thread, "
+		 "max size %d, seed %u", nfiles, nthreads, nops, max_size,
+		 seed);
+
+	/* the same table as create-files would draw from random() */
+	srandom(seed);
+	sizes = SAFE_MALLOC(NULL, NSIZES * sizeof(*sizes));
+	for (i = 0; i < NSIZES; i++) {
+		size = box_muler(0, max_size);
+		sizes[i] = size < 0 ? max_size : size;
+	}
+
+	exists = SAFE_MALLOC(NULL, nfiles);
+	memset(exists, 0, nfiles);
+	wbuf = SAFE_MALLOC(NULL, max_size);
+	memset(wbuf, 'F', max_size);
+
+	workers = SAFE_MALLOC(NULL, nthreads * sizeof(*workers));
+	memset(workers, 0, nthreads * sizeof(*workers));
+	for (i = 0; i < nthreads; i++) {
+		workers[i].seed = seed + i;
+		workers[i].first = (long long)nfiles * i / nthreads;
+		workers[i].last = (long long)nfiles * (i + 1) / nthreads;
+	}
+
+	tst_tmpdir();
+
+	/* the directory tree is not part of the measurement */
+	for (i = 0; i < nfiles; i += FILES_PER_DIR) {
+		if (!(i & 0xffff)) {
+			sprintf(path, "%02x", (i >> 16) & 0xff);
+			SAFE_MKDIR(cleanup, path, 0755);
+		}
+		sprintf(path, "%02x/%02x", (i >> 16) & 0xff, (i >> 8) & 0xff);
+		SAFE_MKDIR(cleanup, path, 0755);
+	}
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+	tst_rmdir();
+}
+
+static void help(void)
+{
+	printf("  -w list  Comma separated phases run between create and\n"
+	       "           delete: stat, read, churn (default all)\n");
+	printf("  -n x     Number of files (default 10000)\n");
+	printf("  -T x     Number of threads (default ncpus)\n");
+	printf("  -o x     Operations per thread in stat, read and churn\n"
+	       "           (default number of files)\n");
+	printf("  -m x     Maximal file size (default 196608)\n");
+	printf("  -S x     Random seed\n");
+}
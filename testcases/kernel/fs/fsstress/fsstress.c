@@ -33,6 +33,11 @@
 #include "config.h"
 #include "global.h"
 #include <compiler.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <time.h>
+#include "tst_hist.h"
+#include "rmobj.h"
 #ifdef HAVE_SYS_PRCTL_H
 # include <sys/prctl.h>
 #endif
@@ -102,11 +107,29 @@ typedef struct flist {
 	fent_t *fents;
 } flist_t;
 
+/*
+ * Open addressing (linear probing) map from a non-negative id to an int.
+ */
+typedef struct idhash {
+	int *keys;
+	int *vals;
+	unsigned int mask;
+	unsigned int count;
+} idhash_t;
+
 typedef struct pathname {
 	int len;
 	char *path;
 } pathname_t;
 
+/*
+ * Per process, per operation statistics, kept in a shared mapping so that
+ * the parent can aggregate them while the workers are running.
+ */
+typedef struct opstat {
+	struct tst_hist lat;		/* latency in ns */
+} opstat_t;
+
 #define	FT_DIR	0
 #define	FT_DIRm	(1 << FT_DIR)
 #define	FT_REG	1
@@ -123,7 +146,7 @@ typedef struct pathname {
 #define	FT_NOTDIR	(FT_ANYm & ~FT_DIRm)
 
 #define	FLIST_SLOT_INCR	16
-#define	NDCACHE	64
+#define	IDHASH_MIN	64
 
 #define	MAXFSIZE	((1ULL << 63) - 1ULL)
 #define	MAXFSIZE32	((1ULL << 40) - 1ULL)
@@ -204,7 +227,8 @@ flist_t flist[FT_nft] = {
 	{0, 0, 'r', NULL},
 };
 
-int dcache[NDCACHE];
+idhash_t dirslots;		/* directory id -> slot in flist[FT_DIR] */
+idhash_t dirrenames;		/* renamed directory old id -> new id */
 int errrange;
 int errtag;
 opty_t *freq_table;
@@ -233,6 +257,15 @@ int no_xfs = 0;
 int no_xfs = 1;
 #endif
 sig_atomic_t should_stop = 0;
+int opstats;
+int stats_interval;
+volatile sig_atomic_t stats_due = 0;
+opstat_t *stats;
+unsigned long long *stats_prev;
+struct timespec stats_start, stats_last;
+
+char *TCID = "fsstress";
+int TST_TOTAL = 1;
 
 void add_to_flist(int, int, int);
 void append_pathname(pathname_t *, char *);
@@ -243,15 +276,15 @@ int attr_set_path(pathname_t *, const char *, const char *, const int, int);
 #endif
 void check_cwd(void);
 int creat_path(pathname_t *, mode_t);
-void dcache_enter(int, int);
-void dcache_init(void);
-fent_t *dcache_lookup(int);
-void dcache_purge(int);
 void del_from_flist(int, int);
 int dirid_to_name(char *, int);
 void doproc(void);
 void fent_to_name(pathname_t *, flist_t *, fent_t *);
 void fix_parent(int, int);
+void idhash_clear(idhash_t *);
+void idhash_del(idhash_t *, int);
+int idhash_get(idhash_t *, int);
+void idhash_put(idhash_t *, int, int);
 void free_pathname(pathname_t *);
 int generate_fname(fent_t *, int, pathname_t *, int *, int *);
 int get_fname(int, long, pathname_t *, flist_t **, fent_t **, int *);
@@ -284,6 +317,94 @@ void sg_handler(int signum)
 	should_stop = 1;
 }
 
+void stats_handler(int signum LTP_ATTRIBUTE_UNUSED)
+{
+	stats_due = 1;
+}
+
+static unsigned long long ts_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void stats_init(void)
+{
+	size_t size = (size_t)nproc * OP_LAST * sizeof(opstat_t);
+	int i;
+
+	stats = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {
+		perror("mmap opstats");
+		exit(1);
+	}
+	for (i = 0; i < nproc * OP_LAST; i++)
+		tst_hist_init(&stats[i].lat);
+
+	if (!stats_prev)
+		stats_prev = calloc(OP_LAST, sizeof(*stats_prev));
+
+	clock_gettime(CLOCK_MONOTONIC, &stats_start);
+	stats_last = stats_start;
+	memset(stats_prev, 0, OP_LAST * sizeof(*stats_prev));
+}
+
+void stats_fini(void)
+{
+	munmap(stats, (size_t)nproc * OP_LAST * sizeof(opstat_t));
+	stats = NULL;
+}
+
+/*
+ * Merges the per process histograms and prints one line per operation
+ * type.  Interim reports give the rate since the previous report, the
+ * final one the rate over the whole run; percentiles are cumulative.
+ */
+void stats_report(int final)
+{
+	struct tst_hist h;
+	struct timespec now;
+	double secs;
+	opdesc_t *p;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (final)
+		secs = (ts_ns(&now) - ts_ns(&stats_start)) / 1e9;
+	else
+		secs = (ts_ns(&now) - ts_ns(&stats_last)) / 1e9;
+	stats_last = now;
+
+	printf("%s op stats after %.1fs:\n", final ? "final" : "interim",
+	       (ts_ns(&now) - ts_ns(&stats_start)) / 1e9);
+	printf("%-12s %12s %10s %10s %10s %10s\n",
+	       "op", "count", "ops/s", "p50(us)", "p99(us)", "max(us)");
+
+	for (p = ops; p < ops_end; p++) {
+		tst_hist_init(&h);
+		for (i = 0; i < nproc; i++)
+			tst_hist_merge(&h, &stats[i * OP_LAST + p->op].lat);
+		if (!h.count)
+			continue;
+
+		printf("%-12s %12llu %10.0f %10.1f %10.1f %10.1f\n",
+		       p->name, h.count,
+		       secs > 0 ? (h.count - (final ? 0 : stats_prev[p->op]))
+				  / secs : 0,
+		       tst_hist_percentile(&h, 50) / 1000.0,
+		       tst_hist_percentile(&h, 99) / 1000.0,
+		       h.max / 1000.0);
+		stats_prev[p->op] = h.count;
+	}
+}
+
+void stats_report_due(void)
+{
+	stats_due = 0;
+	stats_report(0);
+	alarm(stats_interval);
+}
+
 int main(int argc, char **argv)
 {
 	char buf[10];
@@ -294,7 +415,7 @@ int main(int argc, char **argv)
 	int cleanup = 0;
 	int loops = 1;
 	int loopcntr = 1;
-	char cmd[256];
+	char *errmsg;
 #ifndef NO_XFS
 	int j;
 #endif
@@ -315,7 +436,7 @@ int main(int argc, char **argv)
 	nops = ARRAY_SIZE(ops);
 	ops_end = &ops[nops];
 	myprog = argv[0];
-	while ((c = getopt(argc, argv, "cd:e:f:i:l:n:p:rs:vwzHSX")) != -1) {
+	while ((c = getopt(argc, argv, "cd:e:f:i:l:n:p:rs:tT:vwzHSX")) != -1) {
 		switch (c) {
 		case 'c':
 			/*Don't cleanup */
@@ -360,6 +481,13 @@ int main(int argc, char **argv)
 		case 's':
 			seed = strtoul(optarg, NULL, 0);
 			break;
+		case 't':
+			opstats = 1;
+			break;
+		case 'T':
+			opstats = 1;
+			stats_interval = atoi(optarg);
+			break;
 		case 'v':
 			verbose = 1;
 			break;
@@ -401,6 +529,21 @@ int main(int argc, char **argv)
 
 	make_freq_table();
 
+	if (stats_interval > 0) {
+		/*
+		 * With children, no SA_RESTART: the parent relies on wait()
+		 * being interrupted to print interim reports.  A single
+		 * process reports from its op loop and restarts syscalls.
+		 */
+		action.sa_handler = stats_handler;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = nproc == 1 ? SA_RESTART : 0;
+		if (sigaction(SIGALRM, &action, 0)) {
+			perror("sigaction failed");
+			exit(1);
+		}
+	}
+
 	while (((loopcntr <= loops) || (loops == 0)) && !should_stop) {
 		if (!dirname) {
 			/* no directory specified */
@@ -420,7 +563,6 @@ int main(int argc, char **argv)
 			maxfsize = (off64_t) MAXFSIZE32;
 		else
 			maxfsize = (off64_t) MAXFSIZE;
-		dcache_init();
 		setlinebuf(stdout);
 		if (!seed) {
 			gettimeofday(&t, NULL);
@@ -478,6 +620,10 @@ int main(int argc, char **argv)
 			close(fd);
 		unlink(buf);
 
+		if (opstats) {
+			stats_init();
+			alarm(stats_interval);
+		}
 
 		if (nproc == 1) {
 			procid = 0;
@@ -509,8 +655,14 @@ int main(int argc, char **argv)
 					return 0;
 				}
 			}
-			while (wait(&stat) > 0 && !should_stop) {
-				continue;
+			while (!should_stop) {
+				if (wait(&stat) > 0)
+					continue;
+				if (errno == EINTR && stats_due) {
+					stats_report_due();
+					continue;
+				}
+				break;
 			}
 			if (should_stop) {
 				action.sa_flags = SA_RESTART;
@@ -538,15 +690,25 @@ int main(int argc, char **argv)
 			close(fd);
 		}
 #endif
+		if (opstats) {
+			alarm(0);
+			stats_report(1);
+			stats_fini();
+		}
 		if (cleanup == 0) {
-			sprintf(cmd, "rm -rf %s/*", dirname);
-			system(cmd);
+			if (rmobj_parallel(dirname, 0, RMOBJ_KEEP_TOP,
+					   &errmsg)) {
+				fprintf(stderr, "cleanup of %s failed: %s\n",
+					dirname, errmsg);
+			}
 			for (i = 0; i < FT_nft; i++) {
 				flist[i].nslots = 0;
 				flist[i].nfiles = 0;
 				free(flist[i].fents);
 				flist[i].fents = NULL;
 			}
+			idhash_clear(&dirslots);
+			idhash_clear(&dirrenames);
 		}
 		loopcntr++;
 	}
@@ -560,9 +722,11 @@ void add_to_flist(int ft, int id, int parent)
 
 	ftp = &flist[ft];
 	if (ftp->nfiles == ftp->nslots) {
-		ftp->nslots += FLIST_SLOT_INCR;
+		ftp->nslots = ftp->nslots ? ftp->nslots * 2 : FLIST_SLOT_INCR;
 		ftp->fents = realloc(ftp->fents, ftp->nslots * sizeof(fent_t));
 	}
+	if (ft == FT_DIR)
+		idhash_put(&dirslots, id, ftp->nfiles);
 	fep = &ftp->fents[ftp->nfiles++];
 	fep->id = id;
 	fep->parent = parent;
@@ -680,70 +844,40 @@ int creat_path(pathname_t * name, mode_t mode)
 	return rval;
 }
 
-void dcache_enter(int dirid, int slot)
-{
-	dcache[dirid % NDCACHE] = slot;
-}
-
-void dcache_init(void)
-{
-	int i;
-
-	for (i = 0; i < NDCACHE; i++)
-		dcache[i] = -1;
-}
-
-fent_t *dcache_lookup(int dirid)
-{
-	fent_t *fep;
-	int i;
-
-	i = dcache[dirid % NDCACHE];
-	if (i >= 0 && (fep = &flist[FT_DIR].fents[i])->id == dirid)
-		return fep;
-	return NULL;
-}
-
-void dcache_purge(int dirid)
-{
-	int *dcp;
-
-	dcp = &dcache[dirid % NDCACHE];
-	if (*dcp >= 0 && flist[FT_DIR].fents[*dcp].id == dirid)
-		*dcp = -1;
-}
-
 void del_from_flist(int ft, int slot)
 {
 	flist_t *ftp;
 
 	ftp = &flist[ft];
 	if (ft == FT_DIR)
-		dcache_purge(ftp->fents[slot].id);
+		idhash_del(&dirslots, ftp->fents[slot].id);
 	if (slot != ftp->nfiles - 1) {
 		if (ft == FT_DIR)
-			dcache_purge(ftp->fents[ftp->nfiles - 1].id);
+			idhash_put(&dirslots, ftp->fents[ftp->nfiles - 1].id,
+				   slot);
 		ftp->fents[slot] = ftp->fents[--ftp->nfiles];
 	} else
 		ftp->nfiles--;
 }
 
+/*
+ * Entries keep the id their parent directory had when they were added.
+ * Renaming a directory only records old id -> new id in dirrenames, so
+ * follow that chain (shortening it on the way) when the id is not live.
+ */
 fent_t *dirid_to_fent(int dirid)
 {
-	fent_t *efep;
-	fent_t *fep;
-	flist_t *flp;
+	int id, newid, slot;
 
-	if ((fep = dcache_lookup(dirid)))
-		return fep;
-	flp = &flist[FT_DIR];
-	for (fep = flp->fents, efep = &fep[flp->nfiles]; fep < efep; fep++) {
-		if (fep->id == dirid) {
-			dcache_enter(dirid, fep - flp->fents);
-			return fep;
-		}
+	id = dirid;
+	while ((slot = idhash_get(&dirslots, id)) < 0) {
+		if ((newid = idhash_get(&dirrenames, id)) < 0)
+			return NULL;
+		id = newid;
 	}
-	return NULL;
+	if (id != dirid)
+		idhash_put(&dirrenames, dirid, id);
+	return &flist[FT_DIR].fents[slot];
 }
 
 void doproc(void)
@@ -753,6 +887,8 @@ void doproc(void)
 	int opno;
 	int rval;
 	opdesc_t *p;
+	opstat_t *st = NULL;
+	struct timespec t0, t1;
 
 	sprintf(buf, "p%x", procid);
 	(void)mkdir(buf, 0777);
@@ -766,12 +902,23 @@ void doproc(void)
 	srandom(seed);
 	if (namerand)
 		namerand = random();
+	if (opstats)
+		st = &stats[procid * OP_LAST];
 	for (opno = 0; opno < operations; opno++) {
 		p = &ops[freq_table[random() % freq_table_size]];
 		if ((unsigned long)p->func < 4096)
 			abort();
 
-		p->func(opno, random());
+		if (st) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			p->func(opno, random());
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			tst_hist_add(&st[p->op].lat, ts_ns(&t1) - ts_ns(&t0));
+			if (stats_due && nproc == 1)
+				stats_report_due();
+		} else {
+			p->func(opno, random());
+		}
 		/*
 		 * test for forced shutdown by stat'ing the test
 		 * directory.  If this stat returns EIO, assume
@@ -797,6 +944,8 @@ void fent_to_name(pathname_t * name, flist_t * flp, fent_t * fep)
 		return;
 	if (fep->parent != -1) {
 		pfep = dirid_to_fent(fep->parent);
+		if (pfep)
+			fep->parent = pfep->id;
 		fent_to_name(name, &flist[FT_DIR], pfep);
 		append_pathname(name, "/");
 	}
@@ -807,17 +956,7 @@ void fent_to_name(pathname_t * name, flist_t * flp, fent_t * fep)
 
 void fix_parent(int oldid, int newid)
 {
-	fent_t *fep;
-	flist_t *flp;
-	int i;
-	int j;
-
-	for (i = 0, flp = flist; i < FT_nft; i++, flp++) {
-		for (j = 0, fep = flp->fents; j < flp->nfiles; j++, fep++) {
-			if (fep->parent == oldid)
-				fep->parent = newid;
-		}
-	}
+	idhash_put(&dirrenames, oldid, newid);
 }
 
 void free_pathname(pathname_t * name)
@@ -910,6 +1049,103 @@ get_fname(int which, long r, pathname_t * name, flist_t ** flpp, fent_t ** fepp,
 
 }
 
+static unsigned int idhash_slot(idhash_t * h, int key)
+{
+	unsigned int i;
+
+	i = ((unsigned int)key * 2654435761U) & h->mask;
+	while (h->keys[i] != -1 && h->keys[i] != key)
+		i = (i + 1) & h->mask;
+	return i;
+}
+
+static void idhash_grow(idhash_t * h)
+{
+	idhash_t old = *h;
+	unsigned int i, j, size;
+
+	size = old.keys ? (old.mask + 1) * 2 : IDHASH_MIN;
+	h->keys = malloc(size * sizeof(int));
+	h->vals = malloc(size * sizeof(int));
+	if (!h->keys || !h->vals) {
+		perror("malloc idhash");
+		exit(1);
+	}
+	memset(h->keys, 0xff, size * sizeof(int));
+	h->mask = size - 1;
+
+	if (!old.keys)
+		return;
+	for (i = 0; i <= old.mask; i++) {
+		if (old.keys[i] == -1)
+			continue;
+		j = idhash_slot(h, old.keys[i]);
+		h->keys[j] = old.keys[i];
+		h->vals[j] = old.vals[i];
+	}
+	free(old.keys);
+	free(old.vals);
+}
+
+void idhash_clear(idhash_t * h)
+{
+	free(h->keys);
+	free(h->vals);
+	memset(h, 0, sizeof(*h));
+}
+
+void idhash_del(idhash_t * h, int key)
+{
+	unsigned int i, j, k;
+
+	if (!h->keys)
+		return;
+	i = idhash_slot(h, key);
+	if (h->keys[i] == -1)
+		return;
+	h->count--;
+
+	/* backward shift the rest of the probe sequence into the hole */
+	for (j = i;;) {
+		h->keys[i] = -1;
+		for (;;) {
+			j = (j + 1) & h->mask;
+			if (h->keys[j] == -1)
+				return;
+			k = ((unsigned int)h->keys[j] * 2654435761U) & h->mask;
+			if (((j - k) & h->mask) >= ((j - i) & h->mask))
+				break;
+		}
+		h->keys[i] = h->keys[j];
+		h->vals[i] = h->vals[j];
+		i = j;
+	}
+}
+
+int idhash_get(idhash_t * h, int key)
+{
+	unsigned int i;
+
+	if (!h->keys)
+		return -1;
+	i = idhash_slot(h, key);
+	return h->keys[i] == -1 ? -1 : h->vals[i];
+}
+
+void idhash_put(idhash_t * h, int key, int val)
+{
+	unsigned int i;
+
+	if (!h->keys || (h->count + 1) * 2 > h->mask + 1)
+		idhash_grow(h);
+	i = idhash_slot(h, key);
+	if (h->keys[i] == -1) {
+		h->keys[i] = key;
+		h->count++;
+	}
+	h->vals[i] = val;
+}
+
 void init_pathname(pathname_t * name)
 {
 	name->len = 0;
@@ -1362,7 +1598,7 @@ void usage(void)
 	printf
 	    ("       %s [-c][-d dir][-e errtg][-f op_name=freq][-l loops][-n nops]\n",
 	     myprog);
-	printf("          [-p nproc][-r len][-s seed][-v][-w][-z][-S]\n");
+	printf("          [-p nproc][-r len][-s seed][-t][-T secs][-v][-w][-z][-S]\n");
 	printf("where\n");
 	printf
 	    ("   -c               specifies not to remove files(cleanup) after execution\n");
@@ -1383,6 +1619,10 @@ void usage(void)
 	printf("   -r               specifies random name padding\n");
 	printf
 	    ("   -s seed          specifies the seed for the random generator (default random)\n");
+	printf
+	    ("   -t               report per operation counts, ops/sec and latencies\n");
+	printf
+	    ("   -T secs          as -t, plus an interim report every secs seconds\n");
 	printf("   -v               specifies verbose mode\n");
 	printf
 	    ("   -w               zeros frequencies of non-write operations\n");
@@ -59,6 +59,11 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "lapi/fcntl.h"
+#include "lapi/io_uring.h"
 
 /*
  *	A log entry is an operation and a bunch of arguments.
@@ -67,14 +72,20 @@
 struct log_entry {
 	int operation;
 	struct timeval tv;
-	int args[3];
+	long long args[3];
 };
 
 #define	LOGSIZE	1000
 
-struct log_entry oplog[LOGSIZE];	/* the log */
-int logptr = 0;			/* current position in log */
-int logcount = 0;		/* total ops */
+struct fsx_log {
+	struct log_entry entries[LOGSIZE];	/* the log */
+	int ptr;			/* current position in log */
+	int count;			/* total ops */
+	long long badoff;		/* offset of last bad byte */
+	FILE *logf;			/* .fsxlog file */
+};
+
+struct fsx_log fsxlog = { .badoff = -1 };
 
 /*
  *	Define operations
@@ -87,6 +98,9 @@ int logcount = 0;		/* total ops */
 #define OP_MAPREAD	5
 #define OP_MAPWRITE	6
 #define OP_SKIPPED	7
+#define OP_FALLOCATE	8
+#define OP_PUNCH_HOLE	9
+#define OP_COPY_RANGE	10
 
 int page_size;
 int page_mask;
@@ -126,7 +140,6 @@ int mapped_writes = 1;		/* -W flag disables */
 int mapped_reads = 1;		/* -R flag disables it */
 int fsxgoodfd = 0;
 FILE *fsxlogf = NULL;
-int badoff = -1;
 
 void vwarnc(code, fmt, ap)
 int code;
@@ -150,8 +163,8 @@ void warn(const char *fmt, ...)
 }
 
 void
-    __attribute__ ((format(printf, 1, 2)))
-    prt(char *fmt, ...)
+    __attribute__ ((format(printf, 2, 3)))
+    prtf(FILE *logf, char *fmt, ...)
 {
 	va_list args;
 
@@ -159,116 +172,151 @@ void
 	vfprintf(stdout, fmt, args);
 	va_end(args);
 
-	if (fsxlogf) {
+	if (logf) {
 		va_start(args, fmt);
-		vfprintf(fsxlogf, fmt, args);
+		vfprintf(logf, fmt, args);
 		va_end(args);
 	}
 }
 
+#define prt(...) prtf(fsxlogf, __VA_ARGS__)
+
 void prterr(char *prefix)
 {
 	prt("%s%s%s\n", prefix, prefix ? ": " : "", strerror(errno));
 }
 
-void log4(int operation, int arg0, int arg1, int arg2, struct timeval *tv)
+void logop(struct fsx_log *l, int operation, long long arg0, long long arg1,
+	   long long arg2, struct timeval *tv)
 {
 	struct log_entry *le;
 
-	le = &oplog[logptr];
+	le = &l->entries[l->ptr];
 	le->tv = *tv;
 	le->operation = operation;
 	le->args[0] = arg0;
 	le->args[1] = arg1;
 	le->args[2] = arg2;
-	logptr++;
-	logcount++;
-	if (logptr >= LOGSIZE)
-		logptr = 0;
+	l->ptr++;
+	l->count++;
+	if (l->ptr >= LOGSIZE)
+		l->ptr = 0;
 }
 
-void logdump(void)
+void log4(int operation, int arg0, int arg1, int arg2, struct timeval *tv)
+{
+	logop(&fsxlog, operation, arg0, arg1, arg2, tv);
+}
+
+void dumplog(struct fsx_log *l)
 {
 	int i, count, down;
+	long long badoff = l->badoff;
 	struct log_entry *lp;
 
-	prt("LOG DUMP (%d total operations):\n", logcount);
-	if (logcount < LOGSIZE) {
+	prtf(l->logf, "LOG DUMP (%d total operations):\n", l->count);
+	if (l->count < LOGSIZE) {
 		i = 0;
-		count = logcount;
+		count = l->count;
 	} else {
-		i = logptr;
+		i = l->ptr;
 		count = LOGSIZE;
 	}
 	for (; count > 0; count--) {
 		int opnum;
 
-		opnum = i + 1 + (logcount / LOGSIZE) * LOGSIZE;
-		lp = &oplog[i];
-		prt("%d: %lu.%06lu ", opnum, lp->tv.tv_sec, lp->tv.tv_usec);
+		opnum = i + 1 + (l->count / LOGSIZE) * LOGSIZE;
+		lp = &l->entries[i];
+		prtf(l->logf, "%d: %lu.%06lu ", opnum, lp->tv.tv_sec, lp->tv.tv_usec);
 
 		switch (lp->operation) {
 		case OP_MAPREAD:
-			prt("MAPREAD  0x%x thru 0x%x (0x%x bytes)",
+			prtf(l->logf, "MAPREAD  0x%llx thru 0x%llx (0x%llx bytes)",
 			    lp->args[0], lp->args[0] + lp->args[1] - 1,
 			    lp->args[1]);
 			if (badoff >= lp->args[0] && badoff <
 			    lp->args[0] + lp->args[1])
-				prt("\t***RRRR***");
+				prtf(l->logf, "\t***RRRR***");
 			break;
 		case OP_MAPWRITE:
-			prt("MAPWRITE 0x%x thru 0x%x (0x%x bytes)",
+			prtf(l->logf, "MAPWRITE 0x%llx thru 0x%llx (0x%llx bytes)",
 			    lp->args[0], lp->args[0] + lp->args[1] - 1,
 			    lp->args[1]);
 			if (badoff >= lp->args[0] && badoff <
 			    lp->args[0] + lp->args[1])
-				prt("\t******WWWW");
+				prtf(l->logf, "\t******WWWW");
 			break;
 		case OP_READ:
-			prt("READ     0x%x thru 0x%x (0x%x bytes)",
+			prtf(l->logf, "READ     0x%llx thru 0x%llx (0x%llx bytes)",
 			    lp->args[0], lp->args[0] + lp->args[1] - 1,
 			    lp->args[1]);
 			if (badoff >= lp->args[0] &&
 			    badoff < lp->args[0] + lp->args[1])
-				prt("\t***RRRR***");
+				prtf(l->logf, "\t***RRRR***");
 			break;
 		case OP_WRITE:
-			prt("WRITE    0x%x thru 0x%x (0x%x bytes)",
+			prtf(l->logf, "WRITE    0x%llx thru 0x%llx (0x%llx bytes)",
 			    lp->args[0], lp->args[0] + lp->args[1] - 1,
 			    lp->args[1]);
 			if (lp->args[0] > lp->args[2])
-				prt(" HOLE");
+				prtf(l->logf, " HOLE");
 			else if (lp->args[0] + lp->args[1] > lp->args[2])
-				prt(" EXTEND");
+				prtf(l->logf, " EXTEND");
 			if ((badoff >= lp->args[0] || badoff >= lp->args[2]) &&
 			    badoff < lp->args[0] + lp->args[1])
-				prt("\t***WWWW");
+				prtf(l->logf, "\t***WWWW");
 			break;
 		case OP_TRUNCATE:
 			down = lp->args[0] < lp->args[1];
-			prt("TRUNCATE %s\tfrom 0x%x to 0x%x",
+			prtf(l->logf, "TRUNCATE %s\tfrom 0x%llx to 0x%llx",
 			    down ? "DOWN" : "UP", lp->args[1], lp->args[0]);
 			if (badoff >= lp->args[!down] &&
 			    badoff < lp->args[! !down])
-				prt("\t******WWWW");
+				prtf(l->logf, "\t******WWWW");
 			break;
 		case OP_CLOSEOPEN:
-			prt("CLOSE/OPEN");
+			prtf(l->logf, "CLOSE/OPEN");
 			break;
 		case OP_SKIPPED:
-			prt("SKIPPED (no operation)");
+			prtf(l->logf, "SKIPPED (no operation)");
+			break;
+		case OP_FALLOCATE:
+			prtf(l->logf, "FALLOC  0x%llx thru 0x%llx (0x%llx bytes)%s",
+			    lp->args[0], lp->args[0] + lp->args[1] - 1,
+			    lp->args[1], lp->args[2] ? " KEEP_SIZE" : "");
+			break;
+		case OP_PUNCH_HOLE:
+			prtf(l->logf, "PUNCH    0x%llx thru 0x%llx (0x%llx bytes)",
+			    lp->args[0], lp->args[0] + lp->args[1] - 1,
+			    lp->args[1]);
+			if (badoff >= lp->args[0] && badoff <
+			    lp->args[0] + lp->args[1])
+				prtf(l->logf, "\t******PPPP");
+			break;
+		case OP_COPY_RANGE:
+			prtf(l->logf, "COPY     0x%llx thru 0x%llx (0x%llx bytes) to 0x%llx",
+			    lp->args[0], lp->args[0] + lp->args[1] - 1,
+			    lp->args[1], lp->args[2]);
+			if (badoff >= lp->args[2] && badoff <
+			    lp->args[2] + lp->args[1])
+				prtf(l->logf, "\t******CCCC");
 			break;
 		default:
-			prt("BOGUS LOG ENTRY (operation code = %d)!",
+			prtf(l->logf, "BOGUS LOG ENTRY (operation code = %d)!",
 			    lp->operation);
 		}
-		prt("\n");
+		prtf(l->logf, "\n");
 		i++;
 		if (i == LOGSIZE)
 			i = 0;
 	}
 }
 
+void logdump(void)
+{
+	dumplog(&fsxlog);
+}
+
 void save_buffer(char *buffer, off_t bufferlength, int fd)
 {
 	off_t ret;
@@ -329,47 +377,104 @@ void report_failure(int status)
 #define short_at(cp) ((unsigned short)((*((unsigned char *)(cp)) << 8) | \
 				        *(((unsigned char *)(cp)) + 1)))
 
+/*
+ * The mismatch scans below compare 64 bytes per iteration as eight word
+ * XORs, which the compiler turns into vector compares, and only drop to
+ * bytes inside the block that differs.
+ */
+static size_t first_mismatch(const char *a, const char *b, size_t size)
+{
+	uint64_t wa[8], wb[8], diff;
+	size_t i, j;
+
+	for (i = 0; i + 64 <= size; i += 64) {
+		memcpy(wa, a + i, 64);
+		memcpy(wb, b + i, 64);
+		diff = 0;
+		for (j = 0; j < 8; j++)
+			diff |= wa[j] ^ wb[j];
+		if (diff)
+			break;
+	}
+	while (i < size && a[i] == b[i])
+		i++;
+
+	return i;
+}
+
+static size_t last_mismatch(const char *a, const char *b, size_t size)
+{
+	uint64_t wa[8], wb[8], diff;
+	size_t j;
+
+	for (; size >= 64; size -= 64) {
+		memcpy(wa, a + size - 64, 64);
+		memcpy(wb, b + size - 64, 64);
+		diff = 0;
+		for (j = 0; j < 8; j++)
+			diff |= wa[j] ^ wb[j];
+		if (diff)
+			break;
+	}
+	while (size > 0 && a[size - 1] == b[size - 1])
+		size--;
+
+	return size - 1;
+}
+
+static size_t count_mismatch(const char *a, const char *b, size_t size)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < size; i++)
+		n += a[i] != b[i];
+
+	return n;
+}
+
+/*
+ * Compares size bytes read into temp_buf with the expected data in
+ * good, both starting at file offset.  On mismatch the bad range is
+ * printed, l->badoff is set and nonzero is returned.
+ */
+int compare_buffers(struct fsx_log *l, char *good, char *temp_buf,
+		    off_t offset, unsigned size)
+{
+	size_t first, last, n;
+	unsigned op, bad;
+
+	if (memcmp(good, temp_buf, size) == 0)
+		return 0;
+
+	first = first_mismatch(good, temp_buf, size);
+	last = last_mismatch(good, temp_buf, size);
+	n = count_mismatch(good + first, temp_buf + first, last - first + 1);
+
+	prtf(l->logf, "READ BAD DATA: offset = 0x%llx, size = 0x%x\n",
+	     (long long)offset, size);
+	prtf(l->logf, "OFFSET\tGOOD\tBAD\tRANGE\n");
+
+	bad = short_at(&temp_buf[first]);
+	prtf(l->logf, "%#07llx\t%#06x\t%#06x\t%#7zx\n",
+	     (long long)(offset + first), short_at(&good[first]), bad, n);
+
+	if (bad) {
+		op = temp_buf[(offset + first) & 1 ? first + 1 : first];
+		prtf(l->logf, "operation# (mod 256) for the bad data"
+		    "may be %u\n", op & 0xff);
+	} else {
+		prtf(l->logf, "operation# (mod 256) for the bad data"
+		    "unknown, check HOLE and EXTEND ops\n");
+	}
+
+	l->badoff = offset + last;
+	return 1;
+}
+
 void check_buffers(unsigned offset, unsigned size)
 {
-	unsigned char c, t;
-	unsigned i = 0;
-	unsigned n = 0;
-	unsigned op = 0;
-	unsigned bad = 0;
-
-	if (memcmp(good_buf + offset, temp_buf, size) != 0) {
-		prt("READ BAD DATA: offset = 0x%x, size = 0x%x\n",
-		    offset, size);
-		prt("OFFSET\tGOOD\tBAD\tRANGE\n");
-		while (size > 0) {
-			c = good_buf[offset];
-			t = temp_buf[i];
-			if (c != t) {
-				if (n == 0) {
-					bad = short_at(&temp_buf[i]);
-					prt("%#07x\t%#06x\t%#06x", offset,
-					    short_at(&good_buf[offset]), bad);
-					op = temp_buf[offset & 1 ? i + 1 : i];
-				}
-				n++;
-				badoff = offset;
-			}
-			offset++;
-			i++;
-			size--;
-		}
-		if (n) {
-			prt("\t%#7x\n", n);
-			if (bad)
-				prt("operation# (mod 256) for the bad data"
-				    "may be %u\n", ((unsigned)op & 0xff));
-			else
-				prt("operation# (mod 256) for the bad data"
-				    "unknown, check HOLE and EXTEND ops\n");
-		} else
-			prt("????????????????\n");
+	if (compare_buffers(&fsxlog, good_buf + offset, temp_buf, offset, size))
 		report_failure(110);
-	}
 }
 
 struct test_file {
@@ -1038,6 +1143,790 @@ void test(void)
 		docloseopen();
 }
 
+/*
+ *	Threaded mode (-j): each of the -F files gets its own model, random
+ *	state and replay log and is only ever touched by one worker thread,
+ *	so the models need no locking.  I/O goes through pread/pwrite or
+ *	io_uring (-U), optionally with O_DIRECT (-Z), and fallocate,
+ *	punch hole and copy_file_range are mixed in with the usual ops.
+ */
+
+#define DIO_ALIGN	4096
+
+int nthreads = 0;		/* -j flag */
+int nfiles = 0;			/* -F flag */
+int use_uring = 0;		/* -U flag */
+int use_direct = 0;		/* -Z flag */
+
+/*
+ * The per-file model is sparse so that -l can be far larger than memory.
+ * It is kept in SHADOW_CHUNK sized chunks that are either zero, filled
+ * by a single write (only the op number is kept, the data is generated
+ * again when needed) or materialized in memory after partial updates.
+ * Everything past the model's file size is kept zero.
+ */
+
+#define SHADOW_SHIFT	16
+#define SHADOW_CHUNK	(1UL << SHADOW_SHIFT)
+
+struct shadow_chunk {
+	char *data;		/* materialized contents or NULL */
+	unsigned long gen;	/* op number + 1 if generated, 0 if zero */
+};
+
+struct fsx_shadow {
+	struct shadow_chunk *chunks;
+	size_t nchunks;
+	size_t materialized;	/* chunks with data */
+};
+
+/* Replaces original_buf, which would be as large as the file */
+static unsigned char orig_byte(off_t off)
+{
+	uint64_t x = ((uint64_t)off ^ ((uint64_t)seed << 40)) *
+		     0x9e3779b97f4a7c15ULL;
+
+	return (x ^ (x >> 29)) >> 56;
+}
+
+/* Same pattern as gendata() */
+static void gen_fill(char *buf, off_t off, size_t len, unsigned long calls)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++, off++) {
+		buf[i] = calls % 256;
+		if (off % 2)
+			buf[i] += orig_byte(off);
+	}
+}
+
+static void shadow_init(struct fsx_shadow *s, off_t maxlen)
+{
+	s->nchunks = (maxlen + SHADOW_CHUNK - 1) >> SHADOW_SHIFT;
+	s->materialized = 0;
+	s->chunks = mmap(NULL, s->nchunks * sizeof(*s->chunks),
+			 PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (s->chunks == MAP_FAILED) {
+		prterr("shadow_init: mmap");
+		exit(97);
+	}
+}
+
+static void shadow_fini(struct fsx_shadow *s)
+{
+	size_t i;
+
+	for (i = 0; i < s->nchunks; i++)
+		free(s->chunks[i].data);
+	munmap(s->chunks, s->nchunks * sizeof(*s->chunks));
+}
+
+static void chunk_fill(struct shadow_chunk *c, off_t base, char *buf,
+		       size_t from, size_t len)
+{
+	if (c->data)
+		memcpy(buf, c->data + from, len);
+	else if (c->gen)
+		gen_fill(buf, base + from, len, c->gen - 1);
+	else
+		memset(buf, 0, len);
+}
+
+static void chunk_set(struct fsx_shadow *s, struct shadow_chunk *c,
+		      unsigned long gen)
+{
+	if (c->data) {
+		free(c->data);
+		c->data = NULL;
+		s->materialized--;
+	}
+	/* don't fault in table pages that were never used */
+	if (c->gen != gen)
+		c->gen = gen;
+}
+
+static char *chunk_data(struct fsx_shadow *s, struct shadow_chunk *c,
+			off_t base)
+{
+	char *data;
+
+	if (!c->data) {
+		data = malloc(SHADOW_CHUNK);
+		if (!data) {
+			prterr("chunk_data: malloc");
+			exit(97);
+		}
+		chunk_fill(c, base, data, 0, SHADOW_CHUNK);
+		c->data = data;
+		c->gen = 0;
+		s->materialized++;
+	}
+	return c->data;
+}
+
+/*
+ * Walks [off, off + len) chunk by chunk, calling fn with the chunk, its
+ * file offset, the offset and length within the chunk and the position
+ * within the range.
+ */
+#define shadow_for_each(s, off, len, c, base, from, n, pos)		\
+	for (pos = 0; pos < (len) &&					\
+	     (c = &(s)->chunks[((off) + pos) >> SHADOW_SHIFT],		\
+	      base = ((off) + pos) & ~(off_t)(SHADOW_CHUNK - 1),	\
+	      from = (off) + pos - base,				\
+	      n = MIN((size_t)((len) - pos), SHADOW_CHUNK - from), 1);	\
+	     pos += n)
+
+static void shadow_read(struct fsx_shadow *s, off_t off, size_t len,
+			char *buf)
+{
+	struct shadow_chunk *c;
+	size_t from, n, pos;
+	off_t base;
+
+	shadow_for_each(s, off, len, c, base, from, n, pos)
+		chunk_fill(c, base, buf + pos, from, n);
+}
+
+static void shadow_write(struct fsx_shadow *s, off_t off, size_t len,
+			 const char *buf)
+{
+	struct shadow_chunk *c;
+	size_t from, n, pos;
+	off_t base;
+
+	shadow_for_each(s, off, len, c, base, from, n, pos)
+		memcpy(chunk_data(s, c, base) + from, buf + pos, n);
+}
+
+static void shadow_gen(struct fsx_shadow *s, off_t off, size_t len,
+		       unsigned long calls)
+{
+	struct shadow_chunk *c;
+	size_t from, n, pos;
+	off_t base;
+
+	shadow_for_each(s, off, len, c, base, from, n, pos) {
+		if (n == SHADOW_CHUNK)
+			chunk_set(s, c, calls + 1);
+		else
+			gen_fill(chunk_data(s, c, base) + from, base + from,
+				 n, calls);
+	}
+}
+
+static void shadow_zero(struct fsx_shadow *s, off_t off, size_t len)
+{
+	struct shadow_chunk *c;
+	size_t from, n, pos;
+	off_t base;
+
+	shadow_for_each(s, off, len, c, base, from, n, pos) {
+		if (!c->data && !c->gen)
+			continue;
+		if (n == SHADOW_CHUNK)
+			chunk_set(s, c, 0);
+		else
+			memset(chunk_data(s, c, base) + from, 0, n);
+	}
+}
+
+/* Writes the model to fd, leaving holes where it is zero */
+static int shadow_save(struct fsx_shadow *s, off_t size, int fd, char *buf)
+{
+	struct shadow_chunk *c;
+	size_t from, n, pos;
+	off_t base;
+
+	if (ftruncate(fd, size))
+		return -1;
+
+	shadow_for_each(s, (off_t)0, (size_t)size, c, base, from, n, pos) {
+		if (!c->data && !c->gen)
+			continue;
+		chunk_fill(c, base, buf, 0, n);
+		if (pwrite(fd, buf, n, base) != (ssize_t)n)
+			return -1;
+	}
+	return 0;
+}
+
+struct fsx_ring {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+struct fsx_file {
+	int idx;
+	char path[PATH_MAX];
+	char goodfile[PATH_MAX];
+	int fd;
+	struct fsx_shadow shadow;
+	char *exp_buf;		/* expected data, at least one chunk */
+	char *temp_buf;
+	off_t file_size;
+	unsigned long testcalls;
+	unsigned long numops;
+	struct fsx_log log;
+	struct random_data rdata;
+	char rstate[256];
+	int no_falloc, no_punch, no_copy;
+	struct fsx_ring *ring;
+};
+
+struct fsx_worker {
+	int idx;
+	pthread_t tid;
+	struct fsx_ring ring;
+	struct random_data rdata;
+	char rstate[256];
+};
+
+struct fsx_file *fsx_files;
+
+static long file_random(struct random_data *rd)
+{
+	int32_t r;
+
+	random_r(rd, &r);
+	return r;
+}
+
+/* random() only gives 31 bits, not enough for offsets in huge files */
+static off_t file_random_off(struct random_data *rd)
+{
+	return ((off_t)file_random(rd) << 31) | file_random(rd);
+}
+
+static void *fsx_alloc(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, DIO_ALIGN, size)) {
+		prterr("posix_memalign");
+		exit(97);
+	}
+	memset(p, 0, size);
+	return p;
+}
+
+static int ring_init(struct fsx_ring *r)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = io_uring_setup(4, &p);
+	if (r->fd < 0)
+		return -1;
+
+	sq = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof(unsigned),
+		  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  r->fd, IORING_OFF_SQ_RING);
+	cq = mmap(NULL, p.cq_off.cqes +
+		  p.cq_entries * sizeof(struct io_uring_cqe),
+		  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+		close(r->fd);
+		return -1;
+	}
+
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+/*
+ * Submits one READV/WRITEV and waits for it, returns what pread/pwrite
+ * would.
+ */
+static ssize_t ring_rw(struct fsx_ring *r, int opcode, int fd, void *buf,
+		       size_t len, off_t off)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct iovec iov = { buf, len };
+	unsigned tail, head, idx;
+	int res, ret;
+
+	tail = *r->sq_tail;
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->off = off;
+	sqe->addr = (unsigned long)&iov;
+	sqe->len = 1;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	do {
+		ret = io_uring_enter(r->fd, 1, 1, IORING_ENTER_GETEVENTS);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+
+	head = *r->cq_head;
+	while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		if (io_uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+		    errno != EINTR)
+			return -1;
+	}
+	cqe = &r->cqes[head & *r->cq_mask];
+	res = cqe->res;
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	if (res < 0) {
+		errno = -res;
+		return -1;
+	}
+	return res;
+}
+
+static ssize_t file_pio(struct fsx_file *f, int write, void *buf,
+			size_t len, off_t off)
+{
+	if (f->ring)
+		return ring_rw(f->ring, write ? IORING_OP_WRITEV :
+			       IORING_OP_READV, f->fd, buf, len, off);
+
+	return write ? pwrite(f->fd, buf, len, off) :
+		       pread(f->fd, buf, len, off);
+}
+
+static void file_failure(struct fsx_file *f, int status)
+{
+	int fd;
+
+	prtf(f->log.logf, "file %d (%s) failed\n", f->idx, f->path);
+	dumplog(&f->log);
+
+	fd = open(f->goodfile, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd >= 0) {
+		if (shadow_save(&f->shadow, f->file_size, fd, f->exp_buf))
+			prtf(f->log.logf, "%s: %s\n", f->goodfile,
+			     strerror(errno));
+		else
+			prtf(f->log.logf,
+			     "Correct content saved for comparison\n");
+		prtf(f->log.logf, "(maybe hexdump \"%s\" vs \"%s\")\n",
+		     f->path, f->goodfile);
+		close(fd);
+	}
+	exit(status);
+}
+
+static void file_log(struct fsx_file *f, int op, long long arg0,
+		     long long arg1, long long arg2)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	logop(&f->log, op, arg0, arg1, arg2, &t);
+
+	if (debug && op != OP_SKIPPED)
+		prtf(f->log.logf, "%d:%06lu op %d 0x%llx 0x%llx 0x%llx\n",
+		     f->idx, f->testcalls, op, arg0, arg1, arg2);
+}
+
+static off_t align_down(off_t val, unsigned bdy)
+{
+	if (use_direct && bdy < DIO_ALIGN)
+		bdy = DIO_ALIGN;
+	return val - val % bdy;
+}
+
+static void file_extend(struct fsx_file *f, off_t end)
+{
+	if (end > f->file_size)
+		f->file_size = end;
+}
+
+static void file_read(struct fsx_file *f, off_t offset, unsigned size)
+{
+	ssize_t ret;
+
+	offset = f->file_size ? offset % f->file_size : 0;
+	offset = align_down(offset, readbdy);
+	if (offset + size > f->file_size)
+		size = f->file_size - offset;
+	size = align_down(size, 1);
+	if (!size) {
+		file_log(f, OP_SKIPPED, OP_READ, offset, size);
+		return;
+	}
+
+	file_log(f, OP_READ, offset, size, 0);
+
+	ret = file_pio(f, 0, f->temp_buf, size, offset);
+	if (ret != size) {
+		if (ret == -1)
+			prtf(f->log.logf, "file_read: %s\n", strerror(errno));
+		else
+			prtf(f->log.logf, "short read: 0x%x bytes instead "
+			     "of 0x%x\n", (unsigned)ret, size);
+		file_failure(f, 141);
+	}
+	shadow_read(&f->shadow, offset, size, f->exp_buf);
+	if (compare_buffers(&f->log, f->exp_buf, f->temp_buf, offset, size))
+		file_failure(f, 110);
+}
+
+static void file_write(struct fsx_file *f, off_t offset, unsigned size)
+{
+	ssize_t ret;
+
+	offset = align_down(offset % maxfilelen, writebdy);
+	if (offset + size > (off_t)maxfilelen)
+		size = maxfilelen - offset;
+	size = align_down(size, 1);
+	if (!size) {
+		file_log(f, OP_SKIPPED, OP_WRITE, offset, size);
+		return;
+	}
+
+	file_log(f, OP_WRITE, offset, size, f->file_size);
+
+	gen_fill(f->exp_buf, offset, size, f->testcalls);
+	shadow_gen(&f->shadow, offset, size, f->testcalls);
+	file_extend(f, offset + size);
+
+	ret = file_pio(f, 1, f->exp_buf, size, offset);
+	if (ret != size) {
+		if (ret == -1)
+			prtf(f->log.logf, "file_write: %s\n", strerror(errno));
+		else
+			prtf(f->log.logf, "short write: 0x%x bytes instead "
+			     "of 0x%x\n", (unsigned)ret, size);
+		file_failure(f, 151);
+	}
+}
+
+static void file_truncate(struct fsx_file *f, off_t size)
+{
+	size = align_down(size % maxfilelen, truncbdy);
+
+	file_log(f, OP_TRUNCATE, size, f->file_size, 0);
+
+	if (size < f->file_size)
+		shadow_zero(&f->shadow, size, f->file_size - size);
+	f->file_size = size;
+
+	if (ftruncate(f->fd, size) == -1) {
+		prtf(f->log.logf, "file_truncate: %s\n", strerror(errno));
+		file_failure(f, 160);
+	}
+}
+
+/*
+ * Filesystems without fallocate modes or copy_file_range just lose the
+ * op for the rest of the run.
+ */
+static int file_unsupported(struct fsx_file *f, int *flag, const char *op)
+{
+	if (errno != EOPNOTSUPP && errno != ENOSYS && errno != EXDEV)
+		return 0;
+
+	if (!quiet)
+		prtf(f->log.logf, "file %d: %s not supported, disabled\n",
+		     f->idx, op);
+	*flag = 1;
+	return 1;
+}
+
+static void file_falloc(struct fsx_file *f, off_t offset, unsigned size,
+			int keep)
+{
+	offset = align_down(offset % maxfilelen, writebdy);
+	if (offset + size > (off_t)maxfilelen)
+		size = maxfilelen - offset;
+	size = align_down(size, 1);
+	if (!size || f->no_falloc) {
+		file_log(f, OP_SKIPPED, OP_FALLOCATE, offset, size);
+		return;
+	}
+
+	file_log(f, OP_FALLOCATE, offset, size, keep);
+
+	if (fallocate(f->fd, keep ? FALLOC_FL_KEEP_SIZE : 0, offset, size)) {
+		if (file_unsupported(f, &f->no_falloc, "fallocate"))
+			return;
+		prtf(f->log.logf, "file_falloc: %s\n", strerror(errno));
+		file_failure(f, 210);
+	}
+
+	if (!keep)
+		file_extend(f, offset + size);
+}
+
+static void file_punch(struct fsx_file *f, off_t offset, unsigned size)
+{
+	offset = f->file_size ? offset % f->file_size : 0;
+	offset = align_down(offset, writebdy);
+	if (offset + size > f->file_size)
+		size = f->file_size - offset;
+	size = align_down(size, 1);
+	if (!size || f->no_punch) {
+		file_log(f, OP_SKIPPED, OP_PUNCH_HOLE, offset, size);
+		return;
+	}
+
+	file_log(f, OP_PUNCH_HOLE, offset, size, 0);
+
+	if (fallocate(f->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      offset, size)) {
+		if (file_unsupported(f, &f->no_punch, "punch hole"))
+			return;
+		prtf(f->log.logf, "file_punch: %s\n", strerror(errno));
+		file_failure(f, 220);
+	}
+
+	shadow_zero(&f->shadow, offset, size);
+}
+
+static void file_copy(struct fsx_file *f, off_t src, off_t dst,
+		      unsigned size)
+{
+	loff_t in, out;
+	ssize_t ret;
+
+	src = f->file_size ? src % f->file_size : 0;
+	src = align_down(src, readbdy);
+	if (src + size > f->file_size)
+		size = f->file_size - src;
+	dst = align_down(dst % maxfilelen, writebdy);
+	if (dst + size > (off_t)maxfilelen)
+		size = maxfilelen - dst;
+	size = align_down(size, 1);
+
+	/* ranges within one file must not overlap */
+	if (!size || f->no_copy || (dst < src + size && src < dst + size)) {
+		file_log(f, OP_SKIPPED, OP_COPY_RANGE, src, size);
+		return;
+	}
+
+	file_log(f, OP_COPY_RANGE, src, size, dst);
+
+	in = src;
+	out = dst;
+	while (in < src + size) {
+		ret = syscall(__NR_copy_file_range, f->fd, &in, f->fd, &out,
+			      (size_t)(src + size - in), 0);
+		if (ret > 0)
+			continue;
+		if (ret < 0 && in == src &&
+		    file_unsupported(f, &f->no_copy, "copy_file_range"))
+			return;
+		if (ret == 0)
+			prtf(f->log.logf, "short copy: 0x%x bytes instead "
+			     "of 0x%x\n", (unsigned)(in - src), size);
+		else
+			prtf(f->log.logf, "file_copy: %s\n", strerror(errno));
+		file_failure(f, 230);
+	}
+
+	shadow_read(&f->shadow, src, size, f->exp_buf);
+	shadow_write(&f->shadow, dst, size, f->exp_buf);
+	file_extend(f, dst + size);
+}
+
+static void file_check_size(struct fsx_file *f)
+{
+	struct stat statbuf;
+
+	if (fstat(f->fd, &statbuf)) {
+		prtf(f->log.logf, "file_check_size: %s\n", strerror(errno));
+		statbuf.st_size = -1;
+	}
+	if (f->file_size != statbuf.st_size) {
+		prtf(f->log.logf, "Size error: expected 0x%llx stat 0x%llx\n",
+		     (unsigned long long)f->file_size,
+		     (unsigned long long)statbuf.st_size);
+		file_failure(f, 120);
+	}
+}
+
+static void file_test(struct fsx_file *f)
+{
+	struct random_data *rd = &f->rdata;
+	unsigned long size = maxoplen;
+	unsigned long op = file_random(rd) % 7;
+
+	f->testcalls++;
+
+	if (randomoplen)
+		size = file_random(rd) % (maxoplen + 1);
+
+	switch (op) {
+	case 0:
+	case 1:
+		file_read(f, file_random_off(rd), size);
+		break;
+	case 2:
+	case 3:
+		file_write(f, file_random_off(rd), size);
+		break;
+	case 4:
+		if (style & 1)
+			file_truncate(f, size);
+		else
+			file_truncate(f, file_random_off(rd));
+		break;
+	case 5:
+		if (file_random(rd) & 1)
+			file_punch(f, file_random_off(rd), size);
+		else
+			file_falloc(f, file_random_off(rd), size,
+				    file_random(rd) & 1);
+		break;
+	case 6:
+		file_copy(f, file_random_off(rd), file_random_off(rd), size);
+		break;
+	}
+
+	if (sizechecks)
+		file_check_size(f);
+}
+
+static void *fsx_worker(void *arg)
+{
+	struct fsx_worker *w = arg;
+	struct fsx_file *mine[nfiles];
+	int i, n = 0, left;
+
+	for (i = w->idx; i < nfiles; i += nthreads) {
+		fsx_files[i].ring = use_uring ? &w->ring : NULL;
+		mine[n++] = &fsx_files[i];
+	}
+
+	left = n;
+	while (left) {
+		i = file_random(&w->rdata) % left;
+		file_test(mine[i]);
+		if (numops != -1 && mine[i]->testcalls >= (unsigned long)numops)
+			mine[i] = mine[--left];
+	}
+
+	return NULL;
+}
+
+static void open_fsx_file(struct fsx_file *f, int idx, char *prefix)
+{
+	char logname[PATH_MAX];
+
+	f->idx = idx;
+	snprintf(f->path, sizeof(f->path), "%s.%d", fname, idx);
+	snprintf(f->goodfile, sizeof(f->goodfile), "%s.%d.fsxgood",
+		 prefix, idx);
+	snprintf(logname, sizeof(logname), "%s.%d.fsxlog", prefix, idx);
+
+	f->fd = open(f->path, O_RDWR | O_CREAT | O_TRUNC |
+		     (use_direct ? O_DIRECT : 0), 0666);
+	if (f->fd < 0) {
+		prterr(f->path);
+		exit(91);
+	}
+
+	f->log.badoff = -1;
+	f->log.logf = fopen(logname, "w");
+	if (f->log.logf == NULL) {
+		prterr(logname);
+		exit(93);
+	}
+
+	shadow_init(&f->shadow, maxfilelen);
+	f->exp_buf = fsx_alloc(MAX((size_t)maxoplen, SHADOW_CHUNK));
+	f->temp_buf = fsx_alloc(maxoplen);
+
+	initstate_r(seed + idx, f->rstate, sizeof(f->rstate), &f->rdata);
+}
+
+int run_threads(char *prefix)
+{
+	struct fsx_worker *workers;
+	size_t materialized = 0;
+	int i, rc;
+
+	if (!nfiles)
+		nfiles = nthreads;
+	if (nthreads > nfiles)
+		nthreads = nfiles;
+	if (use_direct)
+		maxfilelen -= maxfilelen % DIO_ALIGN;
+
+	fsx_files = calloc(nfiles, sizeof(*fsx_files));
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!fsx_files || !workers) {
+		prterr("calloc");
+		exit(97);
+	}
+
+	for (i = 0; i < nfiles; i++)
+		open_fsx_file(&fsx_files[i], i, prefix);
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i].idx = i;
+		initstate_r(seed ^ (i << 16), workers[i].rstate,
+			    sizeof(workers[i].rstate), &workers[i].rdata);
+		if (use_uring && ring_init(&workers[i].ring)) {
+			prterr("io_uring_setup, using pread/pwrite");
+			use_uring = 0;
+		}
+	}
+
+	if (!quiet)
+		prt("%d files, %d threads, %s%s\n", nfiles, nthreads,
+		    use_uring ? "io_uring" : "pread/pwrite",
+		    use_direct ? ", O_DIRECT" : "");
+
+	for (i = 0; i < nthreads; i++) {
+		rc = pthread_create(&workers[i].tid, NULL, fsx_worker,
+				    &workers[i]);
+		if (rc) {
+			errno = rc;
+			prterr("pthread_create");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	for (i = 0; i < nfiles; i++) {
+		testcalls += fsx_files[i].testcalls;
+		materialized += fsx_files[i].shadow.materialized;
+		if (close(fsx_files[i].fd)) {
+			prterr("close");
+			file_failure(&fsx_files[i], 99);
+		}
+		fclose(fsx_files[i].log.logf);
+		shadow_fini(&fsx_files[i].shadow);
+	}
+
+	if (!quiet)
+		prt("model: %zu chunks materialized (%zu KiB)\n", materialized,
+		    materialized * (SHADOW_CHUNK / 1024));
+
+	prt("All operations completed A-OK!\n");
+	return 0;
+}
+
 void cleanup(sig)
 int sig;
 {
@@ -1053,7 +1942,8 @@ void usage(void)
 		"fsx [-dnqLOW] [-b opnum] [-c Prob] [-l flen] [-m "
 		"start:end] [-o oplen] [-p progressinterval] [-r readbdy] [-s style] [-t "
 		"truncbdy] [-w writebdy] [-D startingop] [-N numops] [-P dirpath] [-S seed] "
-		"[ -I random|rotate ] fname [additional paths to fname..]\n"
+		"[ -I random|rotate ] [-j threads [-F files] [-U] [-Z]] "
+		"fname [additional paths to fname..]\n"
 		"	-b opnum: beginning operation number (default 1)\n"
 		"	-c P: 1 in P chance of file close+open at each op (default infinity)\n"
 		"	-d: debug output for all operations [-d -d = more debugging]\n"
@@ -1078,16 +1968,23 @@ void usage(void)
 		"	-I: When multiple paths to the file are given each operation uses\n"
 		"	    a different path.  Iterate through them in order with 'rotate'\n"
 		"	    or chose then at 'random'.  (defaults to random)\n"
+		"	-j threads: run a separate model per file on this many threads,\n"
+		"	    files are fname.0 .. fname.N-1 and ops include fallocate,\n"
+		"	    punch hole and copy_file_range (no mmap, -b, -c or -L);\n"
+		"	    the model is sparse so -l may be far larger than memory\n"
+		"	-F files: number of files for -j (default one per thread)\n"
+		"	-U: do -j reads and writes through io_uring\n"
+		"	-Z: open -j files with O_DIRECT (4k aligned I/O)\n"
 		"	fname: this filename is REQUIRED (no default)\n");
 	exit(90);
 }
 
-int getnum(char *s, char **e)
+long long getnum(char *s, char **e)
 {
-	int ret = -1;
+	long long ret = -1;
 
 	*e = NULL;
-	ret = strtol(s, e, 0);
+	ret = strtoll(s, e, 0);
 	if (*e)
 		switch (**e) {
 		case 'b':
@@ -1105,6 +2002,11 @@ int getnum(char *s, char **e)
 			ret *= 1024 * 1024;
 			*e = *e + 1;
 			break;
+		case 'g':
+		case 'G':
+			ret *= 1024 * 1024 * 1024;
+			*e = *e + 1;
+			break;
 		case 'w':
 		case 'W':
 			ret *= 4;
@@ -1129,7 +2031,7 @@ int main(int argc, char **argv)
 	setvbuf(stdout, NULL, _IOLBF, 0);	/* line buffered stdout */
 
 	while ((ch = getopt(argc, argv,
-			    "b:c:dl:m:no:p:qr:s:t:w:D:I:LN:OP:RS:W"))
+			    "b:c:dl:m:no:p:qr:s:t:w:D:F:I:j:LN:OP:RS:UWZ"))
 	       != EOF)
 		switch (ch) {
 		case 'b':
@@ -1211,9 +2113,19 @@ int main(int argc, char **argv)
 			if (debugstart < 1)
 				usage();
 			break;
+		case 'F':
+			nfiles = getnum(optarg, &endp);
+			if (nfiles <= 0)
+				usage();
+			break;
 		case 'I':
 			assign_fd_policy(optarg);
 			break;
+		case 'j':
+			nthreads = getnum(optarg, &endp);
+			if (nthreads <= 0)
+				usage();
+			break;
 		case 'L':
 			lite = 1;
 			break;
@@ -1244,11 +2156,17 @@ int main(int argc, char **argv)
 			if (seed < 0)
 				usage();
 			break;
+		case 'U':
+			use_uring = 1;
+			break;
 		case 'W':
 			mapped_writes = 0;
 			if (!quiet)
 				fprintf(stdout, "mapped writes DISABLED\n");
 			break;
+		case 'Z':
+			use_direct = 1;
+			break;
 
 		default:
 			usage();
@@ -1274,6 +2192,16 @@ int main(int argc, char **argv)
 	initstate(seed, state, 256);
 	setstate(state);
 
+	if ((nfiles || use_uring || use_direct) && !nthreads)
+		usage();
+
+	if (nthreads) {
+		if (lite || simulatedopcount || closeprob)
+			usage();
+		strncat(goodfile, dirpath ? basename(fname) : fname, 256);
+		return run_threads(goodfile);
+	}
+
 	open_test_files(argv, argc);
 
 	strncat(goodfile, dirpath ? basename(fname) : fname, 256);
@@ -1290,6 +2218,7 @@ int main(int argc, char **argv)
 		prterr(logfile);
 		exit(93);
 	}
+	fsxlog.logf = fsxlogf;
 	if (lite) {
 		off_t ret;
 		int fd = get_fd();
@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program;  if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+/*
+ * ipc_bench - compares the cost of the IPC mechanisms exercised by the
+ * ipc_stress tests.
+ *
+ * Pairs of processes ping-pong a message through SysV message queues, POSIX
+ * message queues, SysV semaphores, shared memory futexes and signals. The
+ * number of pairs is doubled from 1 up to -n and for each mechanism and
+ * pair count the total round trips per second and the round trip latency
+ * percentiles are reported.
+ *
+ * Usage: ipc_bench [-t sysv_msg,posix_mq,sysv_sem,futex,signal] [-n pairs]
+ *                  [-c round trips] [-s message size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/sem.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+
+#include "test.h"
+#include "safe_macros.h"
+#include "tst_hist.h"
+#include "tst_timer.h"
+#include "lapi/futex.h"
+#include "lapi/semun.h"
+
+char *TCID = "ipc_bench";
+int TST_TOTAL = 1;
+
+#define MSG_PING	1
+#define MSG_PONG	2
+
+struct pair {
+	/* SysV ids and POSIX queue descriptors, set up by the parent */
+	int msqid;
+	int semid;
+	mqd_t mq_ping;
+	mqd_t mq_pong;
+	/* futex words, pong catches up with ping on each round trip */
+	futex_t ping;
+	futex_t pong;
+	/* signal test */
+	pid_t pid[2];
+	struct tst_hist lat;
+};
+
+struct bench {
+	const char *name;
+	void (*setup)(struct pair *p, int idx);
+	void (*ping)(struct pair *p);
+	void (*pong)(struct pair *p);
+	void (*cleanup)(struct pair *p);
+};
+
+struct bench_msgbuf {
+	long mtype;
+	char mtext[];
+};
+
+static char *t_opt, *n_opt, *c_opt, *s_opt;
+static int t_flag, n_flag, c_flag, s_flag;
+
+static option_t options[] = {
+	{"t:", &t_flag, &t_opt},
+	{"n:", &n_flag, &n_opt},
+	{"c:", &c_flag, &c_opt},
+	{"s:", &s_flag, &s_opt},
+	{NULL, NULL, NULL}
+};
+
+static int max_pairs;
+static int round_trips = 10000;
+static int msg_size = 64;
+
+static struct pair *pairs;
+static int npairs;		/* pairs set up for the current run */
+static struct bench *cur;
+static struct bench_msgbuf *msg;
+static char *mq_buf;
+static sigset_t suspend_mask;
+
+static void help(void);
+static void setup(void);
+static void cleanup(void);
+
+static long long mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* SysV message queue, one queue per pair, ping and pong differ in mtype */
+static void sysv_msg_setup(struct pair *p, int idx LTP_ATTRIBUTE_UNUSED)
+{
+	p->msqid = msgget(IPC_PRIVATE, IPC_CREAT | IPC_EXCL | 0600);
+	if (p->msqid == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "msgget() failed");
+}
+
+static void sysv_msg_xfer(struct pair *p, long snd, long rcv)
+{
+	if (snd) {
+		msg->mtype = snd;
+		if (msgsnd(p->msqid, msg, msg_size, 0) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "msgsnd() failed");
+	}
+
+	if (rcv && msgrcv(p->msqid, msg, msg_size, rcv, 0) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "msgrcv() failed");
+}
+
+static void sysv_msg_ping(struct pair *p)
+{
+	sysv_msg_xfer(p, MSG_PING, MSG_PONG);
+}
+
+static void sysv_msg_pong(struct pair *p)
+{
+	sysv_msg_xfer(p, 0, MSG_PING);
+	sysv_msg_xfer(p, MSG_PONG, 0);
+}
+
+static void sysv_msg_cleanup(struct pair *p)
+{
+	if (msgctl(p->msqid, IPC_RMID, NULL) == -1)
+		tst_resm(TWARN | TERRNO, "msgctl(IPC_RMID) failed");
+}
+
+/* POSIX message queues, one queue per direction */
+static mqd_t posix_mq_open(int idx, char dir)
+{
+	char name[64];
+	struct mq_attr attr = {
+		.mq_maxmsg = 1,
+		.mq_msgsize = msg_size,
+	};
+	mqd_t mqd;
+
+	sprintf(name, "/%s_%d_%d_%c", TCID, getpid(), idx, dir);
+
+	mqd = mq_open(name, O_RDWR | O_CREAT | O_EXCL, 0600, &attr);
+	if (mqd == (mqd_t)-1)
+		tst_brkm(TBROK | TERRNO, cleanup, "mq_open(%s) failed", name);
+
+	/* the descriptors are inherited by the children */
+	if (mq_unlink(name) == -1)
+		tst_resm(TWARN | TERRNO, "mq_unlink(%s) failed", name);
+
+	return mqd;
+}
+
+static void posix_mq_setup(struct pair *p, int idx)
+{
+	p->mq_ping = posix_mq_open(idx, 'a');
+	p->mq_pong = posix_mq_open(idx, 'b');
+}
+
+static void posix_mq_xfer(mqd_t snd, mqd_t rcv)
+{
+	if (mq_send(snd, mq_buf, msg_size, 0) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "mq_send() failed");
+
+	if (mq_receive(rcv, mq_buf, msg_size, NULL) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "mq_receive() failed");
+}
+
+static void posix_mq_ping(struct pair *p)
+{
+	posix_mq_xfer(p->mq_ping, p->mq_pong);
+}
+
+static void posix_mq_pong(struct pair *p)
+{
+	if (mq_receive(p->mq_ping, mq_buf, msg_size, NULL) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "mq_receive() failed");
+
+	if (mq_send(p->mq_pong, mq_buf, msg_size, 0) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "mq_send() failed");
+}
+
+static void posix_mq_cleanup(struct pair *p)
+{
+	mq_close(p->mq_ping);
+	mq_close(p->mq_pong);
+}
+
+/* SysV semaphores, semaphore 0 is the ping and semaphore 1 the pong */
+static void sysv_sem_setup(struct pair *p, int idx LTP_ATTRIBUTE_UNUSED)
+{
+	union semun arg = { .val = 0 };
+
+	p->semid = semget(IPC_PRIVATE, 2, IPC_CREAT | IPC_EXCL | 0600);
+	if (p->semid == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "semget() failed");
+
+	if (semctl(p->semid, 0, SETVAL, arg) == -1 ||
+	    semctl(p->semid, 1, SETVAL, arg) == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "semctl(SETVAL) failed");
+}
+
+static void sysv_sem_xfer(struct pair *p, int up, int down)
+{
+	struct sembuf sops[2] = {
+		{.sem_num = up, .sem_op = 1, .sem_flg = 0},
+		{.sem_num = down, .sem_op = -1, .sem_flg = 0},
+	};
+
+	if (semop(p->semid, &sops[0], 1) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "semop() failed");
+
+	while (semop(p->semid, &sops[1], 1) == -1) {
+		if (errno != EINTR)
+			tst_brkm(TBROK | TERRNO, NULL, "semop() failed");
+	}
+}
+
+static void sysv_sem_ping(struct pair *p)
+{
+	sysv_sem_xfer(p, 0, 1);
+}
+
+static void sysv_sem_pong(struct pair *p)
+{
+	struct sembuf sop = {.sem_num = 0, .sem_op = -1, .sem_flg = 0};
+
+	while (semop(p->semid, &sop, 1) == -1) {
+		if (errno != EINTR)
+			tst_brkm(TBROK | TERRNO, NULL, "semop() failed");
+	}
+
+	sop.sem_num = 1;
+	sop.sem_op = 1;
+	if (semop(p->semid, &sop, 1) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "semop() failed");
+}
+
+static void sysv_sem_cleanup(struct pair *p)
+{
+	if (semctl(p->semid, 0, IPC_RMID) == -1)
+		tst_resm(TWARN | TERRNO, "semctl(IPC_RMID) failed");
+}
+
+/* futexes in shared memory, the fast path never enters the kernel */
+static void futex_setup(struct pair *p, int idx LTP_ATTRIBUTE_UNUSED)
+{
+	p->ping = 0;
+	p->pong = 0;
+}
+
+static void futex_wake(futex_t *f)
+{
+	syscall(SYS_futex, f, FUTEX_WAKE, 1, NULL);
+}
+
+/* sleeps while *f is equal to val */
+static void futex_wait_eq(futex_t *f, uint32_t val)
+{
+	while (*f == val)
+		syscall(SYS_futex, f, FUTEX_WAIT, val, NULL);
+}
+
+static void futex_ping(struct pair *p)
+{
+	uint32_t seq = p->ping + 1;
+
+	p->ping = seq;
+	__sync_synchronize();
+	futex_wake(&p->ping);
+
+	futex_wait_eq(&p->pong, seq - 1);
+}
+
+static void futex_pong(struct pair *p)
+{
+	uint32_t seq = p->pong;
+
+	futex_wait_eq(&p->ping, seq);
+
+	p->pong = seq + 1;
+	__sync_synchronize();
+	futex_wake(&p->pong);
+}
+
+/* signals, SIGUSR1 is blocked except while waiting in sigsuspend() */
+static void signal_handler(int sig LTP_ATTRIBUTE_UNUSED)
+{
+}
+
+static void signal_xfer(pid_t pid)
+{
+	if (pid && kill(pid, SIGUSR1) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "kill() failed");
+
+	sigsuspend(&suspend_mask);
+}
+
+static void signal_ping(struct pair *p)
+{
+	signal_xfer(p->pid[1]);
+}
+
+static void signal_pong(struct pair *p)
+{
+	signal_xfer(0);
+
+	if (kill(p->pid[0], SIGUSR1) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "kill() failed");
+}
+
+static struct bench benches[] = {
+	{"sysv_msg", sysv_msg_setup, sysv_msg_ping, sysv_msg_pong,
+	 sysv_msg_cleanup},
+	{"posix_mq", posix_mq_setup, posix_mq_ping, posix_mq_pong,
+	 posix_mq_cleanup},
+	{"sysv_sem", sysv_sem_setup, sysv_sem_ping, sysv_sem_pong,
+	 sysv_sem_cleanup},
+	{"futex", futex_setup, futex_ping, futex_pong, NULL},
+	{"signal", NULL, signal_ping, signal_pong, NULL},
+	{NULL, NULL, NULL, NULL, NULL}
+};
+
+static void do_child(struct pair *p, int pinger, int go_fd)
+{
+	char c;
+	int i;
+	long long start;
+
+	/* the parent closes the pipe to start all pairs at once */
+	if (read(go_fd, &c, 1) != 0)
+		tst_brkm(TBROK | TERRNO, NULL, "read() from start pipe");
+
+	for (i = 0; i < round_trips; i++) {
+		if (pinger) {
+			start = mono_ns();
+			cur->ping(p);
+			tst_hist_add(&p->lat, mono_ns() - start);
+		} else {
+			cur->pong(p);
+		}
+	}
+
+	exit(0);
+}
+
+static void run(struct bench *b, int n)
+{
+	int i, j, status, go[2];
+	pid_t pid;
+	char name[64];
+	double secs;
+	static struct tst_hist lat;
+
+	cur = b;
+
+	/* cleanup() releases only the pairs that were set up */
+	for (i = 0; i < n; i++) {
+		memset(&pairs[i], 0, sizeof(pairs[i]));
+		tst_hist_init(&pairs[i].lat);
+		if (b->setup)
+			b->setup(&pairs[i], i);
+		npairs++;
+	}
+
+	SAFE_PIPE(cleanup, go);
+
+	/* pong processes first so that their pids are known to the pingers */
+	for (j = 1; j >= 0; j--) {
+		for (i = 0; i < n; i++) {
+			pid = tst_fork();
+			switch (pid) {
+			case -1:
+				tst_brkm(TBROK | TERRNO, cleanup,
+					 "fork() failed");
+			case 0:
+				close(go[1]);
+				do_child(&pairs[i], j == 0, go[0]);
+				break;
+			default:
+				pairs[i].pid[j] = pid;
+			}
+		}
+	}
+
+	SAFE_CLOSE(cleanup, go[0]);
+	tst_timer_start(CLOCK_MONOTONIC);
+	SAFE_CLOSE(cleanup, go[1]);
+
+	for (i = 0; i < 2 * n; i++) {
+		SAFE_WAIT(cleanup, &status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			tst_brkm(TBROK, cleanup, "%s: child failed (%d)",
+				 b->name, status);
+		}
+	}
+
+	tst_timer_stop();
+
+	tst_hist_init(&lat);
+	for (i = 0; i < n; i++) {
+		tst_hist_merge(&lat, &pairs[i].lat);
+		if (b->cleanup)
+			b->cleanup(&pairs[i]);
+	}
+
+	npairs = 0;
+
+	secs = tst_timer_elapsed_us() / 1000000.0;
+	if (secs <= 0)
+		secs = 0.000001;
+
+	tst_resm(TINFO, "%s, %d pair(s): %.0f round trips/s", b->name, n,
+		 (double)n * round_trips / secs);
+
+	sprintf(name, "%s, %d pair(s), round trip", b->name, n);
+	tst_hist_report(name, &lat);
+}
+
+static int selected(const char *name)
+{
+	const char *s;
+	size_t len = strlen(name);
+
+	if (!t_opt)
+		return 1;
+
+	for (s = t_opt; (s = strstr(s, name)); s += len) {
+		if ((s == t_opt || s[-1] == ',') &&
+		    (s[len] == ',' || s[len] == '\0'))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* 1, 2, 4, ... always ending with max_pairs */
+static int next_pairs(int n)
+{
+	if (n < max_pairs && n * 2 > max_pairs)
+		return max_pairs;
+
+	return n * 2;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench *b;
+	int n;
+
+	tst_parse_opts(argc, argv, options, help);
+
+	setup();
+
+	for (b = benches; b->name; b++) {
+		if (!selected(b->name))
+			continue;
+
+		for (n = 1; n <= max_pairs; n = next_pairs(n))
+			run(b, n);
+	}
+
+	tst_resm(TPASS, "IPC benchmark completed");
+
+	cleanup();
+	tst_exit();
+}
+
+static void setup(void)
+{
+	struct sigaction sa;
+	sigset_t mask;
+	struct bench *b;
+	int nb = 0;
+
+	tst_sig(FORK, DEF_HANDLER, cleanup);
+
+	max_pairs = tst_ncpus();
+
+	if (n_flag)
+		max_pairs = SAFE_STRTOL(NULL, n_opt, 1, 4096);
+	if (c_flag)
+		round_trips = SAFE_STRTOL(NULL, c_opt, 1, INT_MAX);
+	if (s_flag)
+		msg_size = SAFE_STRTOL(NULL, s_opt, 1, 8192);
+
+	for (b = benches; b->name; b++)
+		nb += selected(b->name);
+	if (!nb)
+		tst_brkm(TBROK, NULL, "no benchmark selected by -t %s", t_opt);
+
+	pairs = SAFE_MMAP(NULL, NULL, max_pairs * sizeof(*pairs),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			  -1, 0);
+
+	msg = SAFE_MALLOC(NULL, sizeof(*msg) + msg_size);
+	memset(msg->mtext, 'M', msg_size);
+	mq_buf = SAFE_MALLOC(NULL, msg_size);
+	memset(mq_buf, 'Q', msg_size);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signal_handler;
+	if (sigaction(SIGUSR1, &sa, NULL) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "sigaction() failed");
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	if (sigprocmask(SIG_BLOCK, &mask, &suspend_mask) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "sigprocmask() failed");
+	sigdelset(&suspend_mask, SIGUSR1);
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+	int i, j;
+
+	/*
+	 * A run interrupted by an error, e.g. a failed child, leaves the
+	 * partners blocked for good; kill them before releasing resources.
+	 */
+	for (i = 0; i < npairs; i++) {
+		for (j = 0; j < 2; j++) {
+			/* only children that were not reaped yet */
+			if (pairs[i].pid[j] > 0 &&
+			    !waitpid(pairs[i].pid[j], NULL, WNOHANG)) {
+				kill(pairs[i].pid[j], SIGKILL);
+				waitpid(pairs[i].pid[j], NULL, 0);
+			}
+		}
+	}
+
+	for (i = 0; i < npairs; i++) {
+		if (cur->cleanup)
+			cur->cleanup(&pairs[i]);
+	}
+}
+
+static void help(void)
+{
+	printf("  -t list  Comma separated benchmarks: sysv_msg, posix_mq,\n"
+	       "           sysv_sem, futex, signal (default all)\n");
+	printf("  -n x     Maximal number of process pairs (default ncpus)\n");
+	printf("  -c x     Round trips per pair (default 10000)\n");
+	printf("  -s x     Message size for the queues (default 64)\n");
+}
@@ -35,6 +35,7 @@
  *  This tool can be used to beat on system or named pipes.
  *  See the help() function below for user information.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -48,11 +49,15 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/sem.h>
+#include <sys/uio.h>
 
 #include "tlibio.h"
 
 #include "test.h"
 #include "safe_macros.h"
+#include "tst_hist.h"
+#include "tst_timer.h"
+#include "lapi/fcntl.h"
 #include "lapi/semun.h"
 
 char *TCID = "pipeio";
@@ -86,6 +91,8 @@ static void cleanup(void);
 
 static void do_child(void);
 static void do_parent(void);
+static void do_bench_child(void);
+static void do_bench_parent(void);
 
 static void help(void), usage(void), prt_examples(void);
 static void prt_buf(char **addr, char *buf, int length, int format);
@@ -115,6 +122,8 @@ static char *pipe_type;		/* type of pipe under test */
 static int format = HEX;
 static int format_size = -1;
 static int iotype;		/* sync io */
+static char *bench;		/* benchmark mode, writer and reader method */
+static int pipe_size;		/* F_SETPIPE_SZ value, zero means default */
 
 /* variables will be modified in running */
 static int error;
@@ -142,14 +151,20 @@ int main(int ac, char *av[])
 		case -1:
 			tst_brkm(TBROK | TERRNO, cleanup, "fork() failed");
 		case 0:
-			do_child();
+			if (bench)
+				do_bench_child();
+			else
+				do_child();
 			exit(0);
 		default:
 			break;
 		}
 	}
 
-	do_parent();
+	if (bench)
+		do_bench_parent();
+	else
+		do_parent();
 
 	if (empty_read)
 		tst_resm(TWARN, "%d empty reads", empty_read);
@@ -188,7 +203,7 @@ static int parse_options(int argc, char *argv[])
 	int ret = 0;
 	static double d;
 
-	while ((c = getopt(argc, argv, "T:bc:D:he:Ef:i:I:ln:p:qs:uvW:w:"))
+	while ((c = getopt(argc, argv, "T:bB:c:D:he:Ef:i:I:ln:p:P:qs:uvW:w:"))
 	       != -1) {
 		switch (c) {
 		case 'T':
@@ -205,6 +220,19 @@ static int parse_options(int argc, char *argv[])
 			ndelay = 0;
 			blk_type = BLOCKING_IO;
 			break;
+		case 'B':	/* benchmark */
+			bench = optarg;
+			if (strlen(bench) != 2 || !strchr("wv", bench[0]) ||
+			    !strchr("rst", bench[1])) {
+				fprintf(stderr,
+					"%s: --B option invalid arg '%s'.\n",
+					TCID, optarg);
+				fprintf(stderr, "\tIt must be w(write) or "
+					"v(vmsplice) followed by r(read), "
+					"s(splice) or t(tee)\n");
+				ret = 1;
+			}
+			break;
 		case 'c':	/* number childern */
 			if (sscanf(optarg, "%d", &num_writers) != 1) {
 				fprintf(stderr,
@@ -323,6 +351,18 @@ static int parse_options(int argc, char *argv[])
 				ret = 1;
 			}
 			break;
+		case 'P':	/* pipe size */
+			if (sscanf(optarg, "%d", &pipe_size) != 1) {
+				fprintf(stderr,
+					"%s: --P option invalid arg '%s'.\n",
+					TCID, optarg);
+				ret = 1;
+			} else if (pipe_size <= 0) {
+				fprintf(stderr, "%s: --P option must be greater"
+					" than zero.\n", TCID);
+				ret = 1;
+			}
+			break;
 		case 'q':	/* Quiet - NOPASS */
 			quiet = 1;
 			break;
@@ -416,6 +456,17 @@ static void setup(int argc, char *argv[])
 	if (format_size == -1)
 		format_size = size;
 
+	/*
+	 * The benchmark needs a finite amount of data and blocking i/o, the
+	 * data is not verified so writes need not to be atomic either.
+	 */
+	if (bench) {
+		if (loop)
+			tst_brkm(TBROK, cleanup, "-B needs finite -i/-n");
+		ndelay = 0;
+		blk_type = BLOCKING_IO;
+	}
+
 	/*
 	 * If there is more than one writer, all writes and reads
 	 * must be the same size.  Only writes of a size <= PIPE_BUF
@@ -432,7 +483,7 @@ static void setup(int argc, char *argv[])
 	 *      bytes will be written.)  This is the same as:
 	 *      pipeio -s 4096 -n 13 -c 5
 	 */
-	if (size > PIPE_BUF && num_writers > 1) {
+	if (size > PIPE_BUF && num_writers > 1 && !bench) {
 		if (!loop) {
 			/*
 			 * we must set num_writes*num_writers
@@ -455,7 +506,7 @@ static void setup(int argc, char *argv[])
 	memset(writebuf, 'Z', size);
 	writebuf[size - 1] = 'A';
 
-	sem_id = semget(IPC_PRIVATE, 2, IPC_CREAT | S_IRWXU);
+	sem_id = semget(IPC_PRIVATE, 3, IPC_CREAT | S_IRWXU);
 	if (sem_id == -1) {
 		tst_brkm(TBROK | TERRNO, cleanup,
 			 "Couldn't allocate semaphore");
@@ -471,12 +522,21 @@ static void setup(int argc, char *argv[])
 			 "Couldn't initialize semaphore 1 value");
 	}
 
+	if (semctl(sem_id, 2, SETVAL, u) == -1) {
+		tst_brkm(TBROK | TERRNO, cleanup,
+			 "Couldn't initialize semaphore 2 value");
+	}
+
 	if (unpipe) {
 		SAFE_PIPE(cleanup, fds);
 		read_fd = fds[0];
 		write_fd = fds[1];
 		pipe_type = PIPE_UNNAMED;
 		blk_type = UNNAMED_IO;
+		if (pipe_size && fcntl(write_fd, F_SETPIPE_SZ, pipe_size) == -1) {
+			tst_brkm(TBROK | TERRNO, cleanup,
+				 "fcntl(F_SETPIPE_SZ, %d) failed", pipe_size);
+		}
 	} else {
 		if (mkfifo(pname, 0777) == -1) {
 			tst_brkm(TBROK | TERRNO, cleanup,
@@ -499,17 +559,8 @@ static void cleanup(void)
 	tst_rmdir();
 }
 
-static void do_child(void)
+static void open_child_pipe(void)
 {
-	int *count_word;        /* holds address where to write writers count */
-	int *pid_word;          /* holds address where to write writers pid */
-	int nb, j;
-	long clock;
-	char *cp;
-	long int n;
-	struct sembuf sem_op;
-	pid_t self_pid =  getpid();
-
 	if (!unpipe) {
 		write_fd = open(pname, O_WRONLY);
 		if (write_fd == -1) {
@@ -522,9 +573,29 @@ static void do_child(void)
 				"nonblocking mode");
 			exit(1);
 		}
+		if (pipe_size &&
+		    fcntl(write_fd, F_SETPIPE_SZ, pipe_size) == -1) {
+			fprintf(stderr, "fcntl(F_SETPIPE_SZ, %d) failed: %s",
+				pipe_size, strerror(errno));
+			exit(1);
+		}
 	} else {
 		close(read_fd);
 	}
+}
+
+static void do_child(void)
+{
+	int *count_word;        /* holds address where to write writers count */
+	int *pid_word;          /* holds address where to write writers pid */
+	int nb, j;
+	long clock;
+	char *cp;
+	long int n;
+	struct sembuf sem_op;
+	pid_t self_pid =  getpid();
+
+	open_child_pipe();
 
 	sem_op = (struct sembuf) {
 		 .sem_num = 0, .sem_op = 1, .sem_flg = 0};
@@ -717,11 +788,290 @@ static void do_parent(void)
 	SAFE_CLOSE(cleanup, read_fd);
 }
 
+/*
+ * The benchmark stores a CLOCK_MONOTONIC timestamp after the pid and count
+ * words of each buffer so that the reader can compute how long the data
+ * spent between the write and the read.
+ */
+#define BENCH_TS_OFF	(2 * NBPW)
+#define BENCH_HDR_SIZE	(BENCH_TS_OFF + sizeof(long long))
+
+static long long mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *bench_name(void)
+{
+	static char name[32];
+
+	sprintf(name, "%s/%s", bench[0] == 'v' ? "vmsplice" : "write",
+		bench[1] == 'r' ? "read" : bench[1] == 's' ? "splice" : "tee");
+
+	return name;
+}
+
+static void do_bench_child(void)
+{
+	struct sembuf sem_op;
+	struct iovec iov;
+	char **bufs, *buf;
+	int i, j, psize, nbufs = 1, pgsize = getpagesize();
+	long long now;
+	ssize_t nb, off;
+	pid_t self_pid = getpid();
+
+	open_child_pipe();
+
+	/*
+	 * vmsplice() maps the user pages into the pipe, so a buffer may be
+	 * reused only once it has surely been consumed, i.e. after enough
+	 * buffers were queued to fill the whole pipe.
+	 */
+	psize = fcntl(write_fd, F_GETPIPE_SZ);
+	if (bench[0] == 'v' && psize > 0)
+		nbufs = psize / pgsize + 2;
+
+	bufs = malloc(nbufs * sizeof(*bufs));
+	if (!bufs) {
+		fprintf(stderr, "child: %d malloc() failed", self_pid);
+		exit(1);
+	}
+
+	for (i = 0; i < nbufs; i++) {
+		if (posix_memalign((void **)&bufs[i], pgsize, size)) {
+			fprintf(stderr, "child: %d posix_memalign() failed",
+				self_pid);
+			exit(1);
+		}
+		memcpy(bufs[i], writebuf, size);
+	}
+
+	srand48(time(0) + self_pid);
+
+	sem_op = (struct sembuf) {
+		 .sem_num = 0, .sem_op = 1, .sem_flg = 0};
+	if (semop(sem_id, &sem_op, 1) == -1) {
+		fprintf(stderr, "child: %d couldn't raise the semaphore 0",
+			self_pid);
+		exit(1);
+	}
+
+	/* wait for the parent to start the clock */
+	sem_op = (struct sembuf) {
+		 .sem_num = 2, .sem_op = -1, .sem_flg = 0};
+	while (semop(sem_id, &sem_op, 1) == -1) {
+		if (errno == EINTR)
+			continue;
+		fprintf(stderr, "child: %d couldn't lower the semaphore 2",
+			self_pid);
+		exit(1);
+	}
+
+	for (j = 0; j < num_writes; ++j) {
+		buf = bufs[j % nbufs];
+
+		*(int *)&buf[0] = self_pid;
+		*(int *)&buf[NBPW] = j;
+		if (size >= (int)BENCH_HDR_SIZE) {
+			now = mono_ns();
+			memcpy(&buf[BENCH_TS_OFF], &now, sizeof(now));
+		}
+
+		for (off = 0; off < size; off += nb) {
+			if (bench[0] == 'v') {
+				iov.iov_base = buf + off;
+				iov.iov_len = size - off;
+				nb = vmsplice(write_fd, &iov, 1, 0);
+			} else {
+				nb = write(write_fd, buf + off, size - off);
+			}
+
+			if (nb <= 0) {
+				if (nb == -1 && errno == EINTR) {
+					nb = 0;
+					continue;
+				}
+				fprintf(stderr, "pass %d: %s failed: %s", j,
+					bench[0] == 'v' ? "vmsplice" : "write",
+					strerror(errno));
+				exit(1);
+			}
+		}
+
+		if (chld_wait)
+			usleep(lrand48() % chld_wait);
+	}
+
+	sem_op = (struct sembuf) {
+		  .sem_num = 1, .sem_op = -1, .sem_flg = 0};
+	if (semop(sem_id, &sem_op, 1) == -1)
+		fprintf(stderr, "Couldn't lower the semaphore 1");
+
+	exit(0);
+}
+
+/* consume exactly len bytes from fd */
+static void bench_drain(int fd, int null_fd, ssize_t len)
+{
+	ssize_t nb;
+
+	while (len > 0) {
+		nb = splice(fd, NULL, null_fd, NULL, len, SPLICE_F_MOVE);
+		if (nb <= 0) {
+			if (nb == -1 && errno == EINTR)
+				continue;
+			tst_brkm(TBROK | TERRNO, cleanup, "splice() failed");
+		}
+		len -= nb;
+	}
+}
+
+static void do_bench_parent(void)
+{
+	int null_fd, tee_fds[2], lat_ok;
+	long long bytes = 0, expected, then;
+	ssize_t nb, off = 0;
+	double secs;
+	struct sembuf sem_op;
+	static struct tst_hist lat;
+
+	if (!unpipe) {
+		read_fd = SAFE_OPEN(cleanup, pname, O_RDONLY);
+		if (pipe_size &&
+		    fcntl(read_fd, F_SETPIPE_SZ, pipe_size) == -1) {
+			tst_brkm(TBROK | TERRNO, cleanup,
+				 "fcntl(F_SETPIPE_SZ, %d) failed", pipe_size);
+		}
+	} else {
+		SAFE_CLOSE(cleanup, write_fd);
+	}
+
+	null_fd = SAFE_OPEN(cleanup, "/dev/null", O_WRONLY);
+
+	if (bench[1] == 't') {
+		SAFE_PIPE(cleanup, tee_fds);
+		if (pipe_size &&
+		    fcntl(tee_fds[1], F_SETPIPE_SZ, pipe_size) == -1) {
+			tst_brkm(TBROK | TERRNO, cleanup,
+				 "fcntl(F_SETPIPE_SZ, %d) failed", pipe_size);
+		}
+	}
+
+	/*
+	 * Only read() sees the data and buffers are delimited only when they
+	 * are not interleaved, i.e. with one writer or atomic writes.
+	 */
+	lat_ok = bench[1] == 'r' && size >= (int)BENCH_HDR_SIZE &&
+		 (num_writers == 1 || (bench[0] == 'w' && size <= PIPE_BUF));
+
+	tst_hist_init(&lat);
+
+	sem_op = (struct sembuf) {
+		  .sem_num = 1, .sem_op = num_writers, .sem_flg = 0};
+	if (semop(sem_id, &sem_op, 1) == -1) {
+		tst_brkm(TBROK | TERRNO, cleanup,
+			 "Couldn't raise the semaphore 1");
+	}
+
+	sem_op = (struct sembuf) {
+		  .sem_num = 0, .sem_op = -num_writers, .sem_flg = 0};
+	while (semop(sem_id, &sem_op, 1) == -1) {
+		if (errno == EINTR)
+			continue;
+		tst_brkm(TBROK | TERRNO, cleanup,
+			 "Couldn't wait on semaphore 0");
+	}
+
+	tst_timer_start(CLOCK_MONOTONIC);
+
+	sem_op = (struct sembuf) {
+		  .sem_num = 2, .sem_op = num_writers, .sem_flg = 0};
+	if (semop(sem_id, &sem_op, 1) == -1) {
+		tst_brkm(TBROK | TERRNO, cleanup,
+			 "Couldn't raise the semaphore 2");
+	}
+
+	for (;;) {
+		switch (bench[1]) {
+		case 'r':
+			nb = read(read_fd, readbuf + off, size - off);
+			break;
+		case 's':
+			nb = splice(read_fd, NULL, null_fd, NULL, size,
+				    SPLICE_F_MOVE);
+			break;
+		default:
+			nb = tee(read_fd, tee_fds[1], size, 0);
+			if (nb > 0) {
+				bench_drain(read_fd, null_fd, nb);
+				bench_drain(tee_fds[0], null_fd, nb);
+			}
+			break;
+		}
+
+		if (nb == -1) {
+			if (errno == EINTR)
+				continue;
+			tst_brkm(TBROK | TERRNO, cleanup, "%s failed",
+				 bench_name());
+		}
+
+		/* all writers have closed the pipe */
+		if (nb == 0)
+			break;
+
+		++count;
+		bytes += nb;
+
+		if (bench[1] == 'r' && (off += nb) == size) {
+			off = 0;
+			if (lat_ok) {
+				memcpy(&then, &readbuf[BENCH_TS_OFF],
+				       sizeof(then));
+				tst_hist_add(&lat, mono_ns() - then);
+			}
+		}
+	}
+
+	tst_timer_stop();
+
+	secs = tst_timer_elapsed_us() / 1000000.0;
+	if (secs <= 0)
+		secs = 0.000001;
+
+	tst_resm(TINFO, "%s, %d writer(s), pipe size %d: %lld bytes in "
+		 "%.3fs, %.1f MB/s, %.0f reads/s", bench_name(), num_writers,
+		 fcntl(read_fd, F_GETPIPE_SZ), bytes, secs,
+		 bytes / secs / (1024 * 1024), count / secs);
+
+	if (lat_ok)
+		tst_hist_report("write to read latency", &lat);
+
+	expected = (long long)size * num_writes * num_writers;
+	if (bytes != expected) {
+		tst_resm(TFAIL, "read %lld bytes, expected %lld", bytes,
+			 expected);
+		++error;
+	}
+
+	if (bench[1] == 't') {
+		SAFE_CLOSE(cleanup, tee_fds[0]);
+		SAFE_CLOSE(cleanup, tee_fds[1]);
+	}
+	SAFE_CLOSE(cleanup, null_fd);
+	SAFE_CLOSE(cleanup, read_fd);
+}
+
 static void usage(void)
 {
 	fprintf(stderr, "Usage: %s [-bEv][-c #writers][-D pname][-h]"
 		"[-e exit_num][-f fmt][-l][-i #writes][-n #writes][-p num_rpt]"
-		"\n\t[-s size][-W max_wait][-w max_wait][-u]\n", TCID);
+		"\n\t[-s size][-W max_wait][-w max_wait][-u][-B wr][-P size]"
+		"\n", TCID);
 	fflush(stderr);
 }
 
@@ -730,6 +1080,11 @@ static void help(void)
 	usage();
 
 	printf(" -b    - blocking reads and writes. default non-block\n\
+  -B wr        - benchmark mode, w is the write method: w (write) or\n\
+                 v (vmsplice), r is the read method: r (read), s (splice\n\
+                 to /dev/null) or t (tee to second pipe). Implies -b,\n\
+                 data is not verified. Reports MB/s and, for read with\n\
+                 delimited buffers, write to read latency percentiles.\n\
   -c #writers  - number of writers (childern)\n\
   -D pname     - name of fifo (def tpipe<pid>)\n\
   -h           - print this help message\n\
@@ -744,6 +1099,7 @@ static void help(void)
   -l           - loop forever (implied by -n 0).\n\
   -n #writes   - same as -i (for compatability).\n\
   -p num_rpt   - number of reads before a report\n\
+  -P size      - set pipe size with F_SETPIPE_SZ\n\
   -q           - quiet mode, no PASS results are printed\n\
   -s size      - size of read and write (def 327)\n\
                  if size >= 4096, i/o will be in 4096 chuncks\n\
@@ -851,6 +1207,8 @@ static void prt_examples(void)
 	printf("%s -c 5 -i 0 -s 4090 -b\n", TCID);
 	printf("%s -c 5 -i 0 -s 4090 -b -u \n", TCID);
 	printf("%s -c 5 -i 0 -s 4090 -b -W 3 -w 3 \n", TCID);
+	printf("%s -c 4 -i 100000 -s 65536 -u -B vs -P 1048576\n", TCID);
+	printf("%s -c 1 -i 10000 -s 64 -u -B wr -w 0.001\n", TCID);
 }
 
 static void sig_child(int sig)
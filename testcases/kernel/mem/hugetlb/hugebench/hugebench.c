@@ -0,0 +1,500 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program;  if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+/*
+ * hugebench - measures how fast concurrent workers reserve and fault huge
+ * pages.
+ *
+ * Every worker maps its own hugetlbfs file (mmap) or SHM_HUGETLB segment
+ * (shm) and touches each huge page of it once. All workers start together
+ * when the parent releases them and the parent samples the per node free
+ * huge pages while the workers hold their memory. The number of workers
+ * is doubled from 1 up to -n and for each backend and worker count the
+ * faults per second, the reservation (open + mmap or shmget + shmat)
+ * latency, the per fault latency percentiles and the node distribution
+ * of the huge pages are reported.
+ *
+ * Workers are processes, or threads of one process with -T.
+ *
+ * Usage: hugebench [-t mmap,shm] [-n workers] [-N pages] [-T]
+ *                  [-H /hugetlbfs] [-s nr_hugepages]
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "safe_macros.h"
+#include "tst_hist.h"
+#include "lapi/futex.h"
+#include "hugetlb.h"
+#include "mem.h"
+
+char *TCID = "hugebench";
+int TST_TOTAL = 1;
+
+#define BACKEND_MMAP	0
+#define BACKEND_SHM	1
+#define MAX_NODES	64
+
+struct result {
+	long long start_ns;
+	long long end_ns;
+	long long reserve_ns;
+	struct tst_hist fault;
+	int err;
+	const char *what;
+};
+
+struct shared {
+	/* workers waiting in worker_sync() and its generation */
+	futex_t arrived;
+	futex_t phase;
+	struct result res[];
+};
+
+static const char *const backend_names[] = {"mmap", "shm"};
+
+static char *t_opt, *n_opt, *N_opt, *H_opt, *s_opt;
+static int t_flag, n_flag, N_flag, T_flag, H_flag, s_flag;
+
+static option_t options[] = {
+	{"t:", &t_flag, &t_opt},
+	{"n:", &n_flag, &n_opt},
+	{"N:", &N_flag, &N_opt},
+	{"T", &T_flag, NULL},
+	{"H:", &H_flag, &H_opt},
+	{"s:", &s_flag, &s_opt},
+	{NULL, NULL, NULL}
+};
+
+static int max_workers;
+static int nr_pages = 8;
+static long hpage_size;
+static char *hugetlbfs;
+static int mounted;
+static struct shared *shared;
+static size_t shared_size;
+
+static int backend;
+static int failed;
+
+static void help(void);
+
+static long long mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void worker_error(struct result *r, const char *what)
+{
+	r->err = errno;
+	r->what = what;
+}
+
+static char *reserve(struct result *r, int id, size_t size)
+{
+	char path[PATH_MAX];
+	char *addr;
+	int fd, shmid;
+
+	if (backend == BACKEND_MMAP) {
+		snprintf(path, sizeof(path), "%s/hugebench.%d.%d", hugetlbfs,
+			 getpid(), id);
+		fd = open(path, O_RDWR | O_CREAT, 0600);
+		if (fd == -1) {
+			worker_error(r, "open");
+			return NULL;
+		}
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    fd, 0);
+		if (addr == MAP_FAILED) {
+			worker_error(r, "mmap");
+			addr = NULL;
+		}
+		close(fd);
+		unlink(path);
+		return addr;
+	}
+
+	shmid = shmget(IPC_PRIVATE, size, SHM_HUGETLB | IPC_CREAT | SHM_RW);
+	if (shmid == -1) {
+		worker_error(r, "shmget");
+		return NULL;
+	}
+	addr = shmat(shmid, NULL, 0);
+	if (addr == (void *)-1) {
+		worker_error(r, "shmat");
+		addr = NULL;
+	}
+	/* the segment goes away with the last detach */
+	rm_shm(shmid);
+	return addr;
+}
+
+/* waits until the parent releases all the workers in run_sync() */
+static void worker_sync(void)
+{
+	uint32_t phase = shared->phase;
+
+	__sync_add_and_fetch(&shared->arrived, 1);
+	syscall(SYS_futex, &shared->arrived, FUTEX_WAKE, 1, NULL);
+
+	while (shared->phase == phase)
+		syscall(SYS_futex, &shared->phase, FUTEX_WAIT, phase, NULL);
+}
+
+static void worker(int id)
+{
+	struct result *r = &shared->res[id];
+	size_t size = nr_pages * hpage_size;
+	long long start;
+	char *addr;
+	int i;
+
+	worker_sync();
+
+	r->start_ns = start = mono_ns();
+	addr = reserve(r, id, size);
+	r->reserve_ns = mono_ns() - start;
+
+	for (i = 0; addr && i < nr_pages; i++) {
+		start = mono_ns();
+		addr[i * hpage_size] = 1;
+		tst_hist_add(&r->fault, mono_ns() - start);
+	}
+	r->end_ns = mono_ns();
+
+	/* hold the memory until the parent has seen the node counters */
+	worker_sync();
+	worker_sync();
+
+	if (!addr)
+		return;
+
+	if (backend == BACKEND_MMAP)
+		munmap(addr, size);
+	else
+		shmdt(addr);
+}
+
+static void *worker_thread(void *arg)
+{
+	worker((long)arg);
+	return NULL;
+}
+
+static void report_nodes(const char *name, long *before, long *after,
+			 int nodes)
+{
+	char buf[BUFSIZ];
+	int i, len = 0;
+
+	for (i = 0; i < nodes; i++) {
+		len += snprintf(buf + len, sizeof(buf) - len, " node%d=%ld",
+				i, before[i] - after[i]);
+	}
+
+	tst_resm(TINFO, "%s: huge pages per node:%s", name, buf);
+}
+
+/*
+ * Waits for all the workers to reach worker_sync() and releases them.
+ * Unlike a barrier this notices a worker process that died on the way,
+ * e.g. of SIGBUS when it ran out of huge pages, and kills the others.
+ */
+static void run_sync(int workers, pid_t *pids)
+{
+	struct timespec timeout = {0, 100000000};
+	uint32_t arrived;
+	int i, j, status;
+
+	while ((arrived = shared->arrived) < (uint32_t)workers) {
+		for (i = 0; pids && i < workers; i++) {
+			status = 0;
+			if (!waitpid(pids[i], &status, WNOHANG))
+				continue;
+
+			for (j = 0; j < workers; j++) {
+				if (j == i)
+					continue;
+				kill(pids[j], SIGKILL);
+				waitpid(pids[j], NULL, 0);
+			}
+			tst_brkm(TBROK, cleanup, "worker %d died with status %d",
+				 i, status);
+		}
+		syscall(SYS_futex, &shared->arrived, FUTEX_WAIT, arrived,
+			&timeout);
+	}
+
+	shared->arrived = 0;
+	__sync_add_and_fetch(&shared->phase, 1);
+	syscall(SYS_futex, &shared->phase, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static void run(int workers)
+{
+	pthread_t *threads = NULL;
+	pid_t *pids = NULL;
+	struct tst_hist reserve_lat, fault_lat;
+	long before[MAX_NODES], after[MAX_NODES];
+	long long start = 0, end = 0;
+	double secs;
+	long faults = 0;
+	char name[64], hist_name[80];
+	int i, ret, status, nodes;
+
+	memset(shared, 0, shared_size);
+	for (i = 0; i < workers; i++)
+		tst_hist_init(&shared->res[i].fault);
+
+	nodes = get_node_free_hugepages(cleanup, hpage_size / KB, before,
+					MAX_NODES);
+
+	if (T_flag) {
+		threads = SAFE_MALLOC(cleanup, workers * sizeof(*threads));
+		for (i = 0; i < workers; i++) {
+			ret = pthread_create(&threads[i], NULL, worker_thread,
+					     (void *)(long)i);
+			if (ret) {
+				tst_brkm(TBROK, cleanup, "pthread_create(): %s",
+					 tst_strerrno(ret));
+			}
+		}
+	} else {
+		pids = SAFE_MALLOC(cleanup, workers * sizeof(*pids));
+		for (i = 0; i < workers; i++) {
+			pids[i] = tst_fork();
+			if (pids[i] == -1)
+				tst_brkm(TBROK | TERRNO, cleanup, "fork");
+			if (!pids[i]) {
+				/* a dying worker leaves the cleanup to us */
+				tst_sig(FORK, DEF_HANDLER, NULL);
+				worker(i);
+				exit(0);
+			}
+		}
+	}
+
+	run_sync(workers, pids);
+	run_sync(workers, pids);
+
+	get_node_free_hugepages(cleanup, hpage_size / KB, after, nodes);
+	run_sync(workers, pids);
+
+	for (i = 0; i < workers; i++) {
+		if (T_flag) {
+			pthread_join(threads[i], NULL);
+			continue;
+		}
+		SAFE_WAITPID(cleanup, pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			tst_resm(TFAIL, "worker %d exited with status %d", i,
+				 status);
+			failed = 1;
+		}
+	}
+
+	free(threads);
+	free(pids);
+
+	tst_hist_init(&reserve_lat);
+	tst_hist_init(&fault_lat);
+
+	for (i = 0; i < workers; i++) {
+		struct result *r = &shared->res[i];
+
+		if (r->what) {
+			errno = r->err;
+			tst_resm(TFAIL | TERRNO, "worker %d: %s() failed",
+				 i, r->what);
+			failed = 1;
+			continue;
+		}
+		if (!start || r->start_ns < start)
+			start = r->start_ns;
+		if (r->end_ns > end)
+			end = r->end_ns;
+		tst_hist_add(&reserve_lat, r->reserve_ns);
+		tst_hist_merge(&fault_lat, &r->fault);
+		faults += r->fault.count;
+	}
+
+	snprintf(name, sizeof(name), "%s, %d %s", backend_names[backend],
+		 workers, T_flag ? "threads" : "processes");
+
+	/* from the first reservation to the last fault of any worker */
+	secs = (end - start) / 1000000000.0;
+	if (secs <= 0)
+		secs = 0.000000001;
+
+	tst_resm(TINFO, "%s: %ld faults in %.2fms, %.0f faults/s, %.0f MB/s",
+		 name, faults, secs * 1000, faults / secs,
+		 (double)faults * hpage_size / MB / secs);
+
+	snprintf(hist_name, sizeof(hist_name), "%s reserve", name);
+	tst_hist_report(hist_name, &reserve_lat);
+	snprintf(hist_name, sizeof(hist_name), "%s fault", name);
+	tst_hist_report(hist_name, &fault_lat);
+
+	if (nodes)
+		report_nodes(name, before, after, nodes);
+}
+
+static int selected(const char *name)
+{
+	const char *s;
+	size_t len = strlen(name);
+
+	if (!t_opt)
+		return 1;
+
+	for (s = t_opt; (s = strstr(s, name)); s += len) {
+		if ((s == t_opt || s[-1] == ',') &&
+		    (s[len] == ',' || s[len] == '\0'))
+			return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int workers, lc;
+
+	tst_parse_opts(argc, argv, options, help);
+
+	setup();
+
+	for (lc = 0; TEST_LOOPING(lc); lc++) {
+		tst_count = 0;
+		failed = 0;
+
+		for (backend = BACKEND_MMAP; backend <= BACKEND_SHM; backend++) {
+			if (!selected(backend_names[backend]))
+				continue;
+
+			for (workers = 1; workers < max_workers; workers *= 2)
+				run(workers);
+			run(max_workers);
+		}
+
+		if (!failed)
+			tst_resm(TPASS, "hugetlb fault benchmark completed");
+	}
+
+	cleanup();
+	tst_exit();
+}
+
+void setup(void)
+{
+	long hugepages, free_pages;
+
+	orig_hugepages = -1;
+
+	tst_require_root();
+	check_hugepage();
+
+	max_workers = tst_ncpus();
+	if (n_flag)
+		max_workers = SAFE_STRTOL(NULL, n_opt, 1, 4096);
+	if (N_flag)
+		nr_pages = SAFE_STRTOL(NULL, N_opt, 1, INT_MAX);
+
+	tst_sig(FORK, DEF_HANDLER, cleanup);
+
+	tst_tmpdir();
+
+	hpage_size = read_meminfo("Hugepagesize:") * KB;
+
+	if (H_flag) {
+		hugetlbfs = H_opt;
+	} else {
+		hugetlbfs = tst_get_tmpdir();
+		if (mount("none", hugetlbfs, "hugetlbfs", 0, NULL) < 0) {
+			tst_brkm(TBROK | TERRNO, cleanup,
+				 "mount failed on %s", hugetlbfs);
+		}
+		mounted = 1;
+	}
+
+	orig_hugepages = get_sys_tune("nr_hugepages");
+	free_pages = read_meminfo("HugePages_Free:");
+	hugepages = orig_hugepages - free_pages +
+		    (long)max_workers * nr_pages;
+	if (s_flag)
+		hugepages = SAFE_STRTOL(cleanup, s_opt, 0, LONG_MAX);
+	set_sys_tune("nr_hugepages", hugepages, 0);
+
+	free_pages = read_meminfo("HugePages_Free:");
+	if (free_pages < (long)max_workers * nr_pages) {
+		tst_brkm(TCONF, cleanup, "%ld free huge pages, %ld needed",
+			 free_pages, (long)max_workers * nr_pages);
+	}
+
+	shared_size = sizeof(*shared) + max_workers * sizeof(struct result);
+	shared = SAFE_MMAP(cleanup, NULL, shared_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	tst_resm(TINFO, "%d workers max, %d huge pages of %ldkB each",
+		 max_workers, nr_pages, hpage_size / KB);
+
+	TEST_PAUSE;
+}
+
+void cleanup(void)
+{
+	if (orig_hugepages != -1)
+		set_sys_tune("nr_hugepages", orig_hugepages, 0);
+
+	if (mounted)
+		umount(hugetlbfs);
+
+	tst_rmdir();
+}
+
+static void help(void)
+{
+	printf("  -t list  Comma separated backends: mmap, shm (default all)\n");
+	printf("  -n x     Maximal number of workers (default ncpus)\n");
+	printf("  -N x     Huge pages per worker (default 8)\n");
+	printf("  -T       Run the workers as threads\n");
+	printf("  -H /..   Location of hugetlbfs, i.e. -H /var/hugetlbfs\n");
+	printf("  -s x     Set the number of huge pages\n");
+}
@@ -30,6 +30,7 @@
  *	getipckey()
  *	getuserid()
  *	rm_shm()
+ *	get_node_free_hugepages()
  */
 
 #include <sys/types.h>
@@ -37,7 +38,9 @@
 #include <sys/shm.h>
 #include <sys/timeb.h>
 #include <pwd.h>
+#include <stdio.h>
 #include "hugetlb.h"
+#include "safe_file_ops.h"
 
 void check_hugepage(void)
 {
@@ -115,3 +118,26 @@ void rm_shm(int shm_id)
 		tst_resm(TINFO, "id = %d", shm_id);
 	}
 }
+
+/*
+ * get_node_free_hugepages() - reads free_hugepages of hpage_kb sized pages
+ *			       for node0 .. node(max_nodes - 1) and returns
+ *			       the number of nodes found, 0 without NUMA.
+ */
+int get_node_free_hugepages(void (*cleanup_fn) (void), long hpage_kb,
+			    long *nr_free, int max_nodes)
+{
+	char path[BUFSIZ];
+	int node;
+
+	for (node = 0; node < max_nodes; node++) {
+		snprintf(path, sizeof(path), PATH_NODE_HUGEPAGES
+			 "node%d/hugepages/hugepages-%ldkB/free_hugepages",
+			 node, hpage_kb);
+		if (access(path, F_OK))
+			break;
+		SAFE_FILE_SCANF(cleanup_fn, path, "%ld", &nr_free[node]);
+	}
+
+	return node;
+}
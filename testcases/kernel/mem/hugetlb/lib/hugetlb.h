@@ -44,6 +44,7 @@
  */
 #define MODE_MASK	0x01FF
 #define PATH_HUGEPAGES	"/sys/kernel/mm/hugepages/"
+#define PATH_NODE_HUGEPAGES	"/sys/devices/system/node/"
 
 key_t shmkey;			/* an IPC key generated by ftok() */
 
@@ -52,6 +53,8 @@ void check_hugepage(void);
 int getipckey(void (*cleanup_fn) (void));
 int getuserid(void (*cleanup_fn) (void), char *user);
 void rm_shm(int shm_id);
+int get_node_free_hugepages(void (*cleanup_fn) (void), long hpage_kb,
+			    long *nr_free, int max_nodes);
 
 char *nr_opt;
 int sflag;
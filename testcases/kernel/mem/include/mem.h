@@ -36,26 +36,40 @@ static inline void clean_node(unsigned long *array)
 #define NORMAL			2
 #define MLOCK			3
 #define KSM			4
+#define THP			5
 
 long overcommit;
 void oom(int testcase, int lite, int retcode, int allow_sigkill);
 void testoom(int mempolicy, int lite, int retcode, int allow_sigkill);
+int opt_oom_threads, opt_oom_chunk, opt_oom_rate, opt_oom_thp;
+char *opt_oom_threads_str, *opt_oom_chunk_str, *opt_oom_rate_str;
+extern option_t oom_options[];
+void check_oom_options(void);
+void oom_usage(void);
 
 /* KSM */
 
 #define PATH_KSM		"/sys/kernel/mm/ksm/"
+#define KSM_POLL_MIN_US		1000
+#define KSM_POLL_MAX_US		500000
+#define KSM_STABLE_POLLS	3
+#define KSM_STABLE_SCANS	10
+#define KSM_WAIT_TIMEOUT	600
 
 void test_ksm_merge_across_nodes(unsigned long nr_pages);
+void ksm_tune(long pages_to_scan, long sleep_millisecs);
+void ksm_restore(void);
 
 /* THP */
 
 #define PATH_THP		"/sys/kernel/mm/transparent_hugepage/"
 #define PATH_KHPD		PATH_THP "khugepaged/"
 
-int opt_nr_children, opt_nr_thps;
+int opt_nr_children, opt_nr_thps, opt_thp_bench;
 char *opt_nr_children_str, *opt_nr_thps_str;
 void test_transparent_hugepage(int nr_children, int nr_thps,
 			       int hg_aligned, int mempolicy);
+void bench_transparent_hugepage(int nr_thps);
 void check_thp_options(int *nr_children, int *nr_thps);
 void thp_usage(void);
 
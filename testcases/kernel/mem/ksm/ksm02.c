@@ -125,6 +125,8 @@ void cleanup(void)
 		FILE_PRINTF(PATH_KSM "merge_across_nodes",
 				 "%d", merge_across_nodes);
 
+	ksm_restore();
+
 	umount_mem(CPATH, CPATH_NEW);
 }
 
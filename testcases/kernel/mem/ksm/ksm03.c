@@ -124,5 +124,7 @@ void cleanup(void)
 		FILE_PRINTF(PATH_KSM "merge_across_nodes",
 				 "%d", merge_across_nodes);
 
+	ksm_restore();
+
 	umount_mem(MEMCG_PATH, MEMCG_PATH_NEW);
 }
@@ -55,7 +55,6 @@ int TST_TOTAL = 1;
 	&& HAVE_MPOL_CONSTANTS
 
 static int run;
-static int sleep_millisecs;
 static int merge_across_nodes;
 static int n_flag;
 static unsigned long nr_pages;
@@ -102,8 +101,6 @@ void setup(void)
 	SAFE_FILE_SCANF(NULL, PATH_KSM "run", "%d", &run);
 	SAFE_FILE_SCANF(NULL, PATH_KSM "merge_across_nodes",
 			"%d", &merge_across_nodes);
-	SAFE_FILE_SCANF(NULL, PATH_KSM "sleep_millisecs",
-			"%d", &sleep_millisecs);
 
 	tst_sig(FORK, DEF_HANDLER, cleanup);
 	TEST_PAUSE;
@@ -113,8 +110,7 @@ void cleanup(void)
 {
 	FILE_PRINTF(PATH_KSM "merge_across_nodes",
 			 "%d", merge_across_nodes);
-	FILE_PRINTF(PATH_KSM "sleep_millisecs",
-			 "%d", sleep_millisecs);
+	ksm_restore();
 	FILE_PRINTF(PATH_KSM "run", "%d", run);
 }
 
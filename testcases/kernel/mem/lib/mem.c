@@ -16,21 +16,96 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "test.h"
 #include "safe_macros.h"
 #include "safe_file_ops.h"
+#include "tst_timer.h"
+#include "tst_hist.h"
 #include "mem.h"
 #include "numa_helper.h"
 
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return tst_timespec_to_us(ts);
+}
+
 /* OOM */
 
-static int alloc_mem(long int length, int testcase)
+/*
+ * Pressure engine configuration, see oom_usage(). With -t the allocating
+ * threads are spread over the allowed NUMA nodes and each thread binds its
+ * memory to its node, otherwise the child runs ncpus - 1 unbound threads.
+ */
+static int oom_threads_per_node;
+static long oom_chunk = LENGTH;
+static long oom_rate;		/* bytes per second per thread, 0 unlimited */
+static int oom_thp;
+
+/* first touch latency is sampled on every OOM_LAT_SAMPLE-th page */
+#define OOM_LAT_SAMPLE	16
+
+struct oom_thread {
+	int testcase;
+	int node;		/* -1 when not bound */
+	long long bytes;	/* touched so far */
+	struct tst_hist lat;	/* sampled first touch latency in ns */
+};
+
+/*
+ * Shared with the parent, so the statistics outlive the child killed by
+ * the OOM killer.
+ */
+struct oom_stats {
+	int nr_threads;
+	struct oom_thread th[];
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int bind_mem(char *s, long length, int node)
+{
+#if HAVE_NUMA_H && HAVE_LINUX_MEMPOLICY_H && HAVE_NUMAIF_H \
+	&& HAVE_MPOL_CONSTANTS
+	unsigned long nmask[MAXNODES / BITS_PER_LONG] = { 0 };
+
+	if (node < 0)
+		return 0;
+
+	set_node(nmask, node);
+	if (mbind(s, length, MPOL_BIND, nmask, MAXNODES, 0) == -1)
+		return errno;
+#endif
+	return 0;
+}
+
+/* sleeps when bytes touched since start are ahead of the allocation rate */
+static void throttle(long long start, long bytes)
+{
+	long long due = start + (double)bytes / oom_rate * 1000000000;
+	long long now = now_ns();
+
+	if (due > now)
+		usleep((due - now) / 1000);
+}
+
+static int alloc_mem(long int length, struct oom_thread *t)
 {
 	char *s;
 	long i, pagesz = getpagesize();
-	int loop = 10;
+	long long start, t0;
+	int loop = 10, ret;
 
 	tst_resm(TINFO, "thread (%lx), allocating %ld bytes.",
 		(unsigned long) pthread_self(), length);
@@ -40,7 +115,11 @@ static int alloc_mem(long int length, int testcase)
 	if (s == MAP_FAILED)
 		return errno;
 
-	if (testcase == MLOCK) {
+	ret = bind_mem(s, length, t->node);
+	if (ret)
+		return ret;
+
+	if (t->testcase == MLOCK) {
 		while (mlock(s, length) == -1 && loop > 0) {
 			if (EAGAIN != errno)
 				return errno;
@@ -50,44 +129,62 @@ static int alloc_mem(long int length, int testcase)
 	}
 
 #ifdef HAVE_MADV_MERGEABLE
-	if (testcase == KSM && madvise(s, length, MADV_MERGEABLE) == -1)
+	if (t->testcase == KSM && madvise(s, length, MADV_MERGEABLE) == -1)
 		return errno;
 #endif
-	for (i = 0; i < length; i += pagesz)
-		s[i] = '\a';
+#ifdef MADV_HUGEPAGE
+	if (t->testcase == THP && madvise(s, length, MADV_HUGEPAGE) == -1)
+		return errno;
+#endif
+	t0 = now_ns();
+	for (i = 0; i < length; i += pagesz) {
+		/* time only some of the faults to keep the overhead low */
+		if (i / pagesz % OOM_LAT_SAMPLE) {
+			s[i] = '\a';
+		} else {
+			start = now_ns();
+			s[i] = '\a';
+			tst_hist_add(&t->lat, now_ns() - start);
+		}
+		t->bytes += pagesz;
+
+		if (oom_rate && !(i & (MB - 1)))
+			throttle(t0, i + pagesz);
+	}
 
 	return 0;
 }
 
 static void *child_alloc_thread(void *args)
 {
+	struct oom_thread *t = args;
 	int ret = 0;
 
 	/* keep allocating until there's an error */
 	while (!ret)
-		ret = alloc_mem(LENGTH, (long)args);
+		ret = alloc_mem(oom_chunk, t);
 	exit(ret);
 }
 
-static void child_alloc(int testcase, int lite, int threads)
+static void child_alloc(struct oom_stats *stats, int lite)
 {
 	int i;
 	pthread_t *th;
 
 	if (lite) {
-		int ret = alloc_mem(TESTMEM + MB, testcase);
+		int ret = alloc_mem(TESTMEM + MB, &stats->th[0]);
 		exit(ret);
 	}
 
-	th = malloc(sizeof(pthread_t) * threads);
+	th = malloc(sizeof(pthread_t) * stats->nr_threads);
 	if (!th) {
 		tst_resm(TINFO | TERRNO, "malloc");
 		goto out;
 	}
 
-	for (i = 0; i < threads; i++) {
+	for (i = 0; i < stats->nr_threads; i++) {
 		TEST(pthread_create(&th[i], NULL, child_alloc_thread,
-			(void *)((long)testcase)));
+			&stats->th[i]));
 		if (TEST_RETURN) {
 			tst_resm(TINFO | TRERRNO, "pthread_create");
 			/*
@@ -106,11 +203,125 @@ out:
 	exit(1);
 }
 
+static struct oom_stats *alloc_oom_stats(int testcase, size_t *size)
+{
+	struct oom_stats *stats;
+	int i, nr_threads, num_nodes = 0, *nodes = NULL;
+
+	if (oom_threads_per_node) {
+		if (get_allowed_nodes_arr(NH_MEMS, &num_nodes, &nodes) != 0)
+			tst_brkm(TBROK | TERRNO, cleanup,
+				 "get_allowed_nodes_arr");
+	}
+
+	if (num_nodes)
+		nr_threads = num_nodes * oom_threads_per_node;
+	else if (oom_threads_per_node)
+		nr_threads = oom_threads_per_node;
+	else
+		nr_threads = MAX(1, tst_ncpus() - 1);
+
+	*size = sizeof(*stats) + nr_threads * sizeof(struct oom_thread);
+	stats = SAFE_MMAP(cleanup, NULL, *size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	stats->nr_threads = nr_threads;
+	for (i = 0; i < nr_threads; i++) {
+		stats->th[i].testcase = testcase;
+		stats->th[i].node = num_nodes ?
+			nodes[i / oom_threads_per_node] : -1;
+		tst_hist_init(&stats->th[i].lat);
+	}
+
+	free(nodes);
+	return stats;
+}
+
+struct vmstat_reclaim {
+	long pgscan;
+	long pgsteal;
+	long allocstall;
+	long oom_kill;
+};
+
+/* sums the per zone/per reclaimer counters of older and newer kernels */
+static void read_vmstat_reclaim(struct vmstat_reclaim *v)
+{
+	FILE *fp;
+	char key[BUFSIZ];
+	long val;
+
+	memset(v, 0, sizeof(*v));
+
+	fp = fopen("/proc/vmstat", "r");
+	if (fp == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "fopen /proc/vmstat");
+
+	while (fscanf(fp, "%s %ld", key, &val) == 2) {
+		if (!strncmp(key, "pgscan_kswapd", 13) ||
+		    !strncmp(key, "pgscan_direct", 13))
+			v->pgscan += val;
+		else if (!strncmp(key, "pgsteal_kswapd", 14) ||
+			 !strncmp(key, "pgsteal_direct", 14))
+			v->pgsteal += val;
+		else if (!strncmp(key, "allocstall", 10))
+			v->allocstall += val;
+		else if (!strcmp(key, "oom_kill"))
+			v->oom_kill = val;
+	}
+
+	fclose(fp);
+}
+
+static void report_oom_stats(struct oom_stats *stats,
+			     struct vmstat_reclaim *before,
+			     struct vmstat_reclaim *after, long long elapsed_ns)
+{
+	struct tst_hist *lat;
+	double secs = elapsed_ns / 1000000000.0;
+	long long bytes = 0, node_bytes;
+	long pagesz = getpagesize();
+	int i, j;
+
+	lat = SAFE_MALLOC(cleanup, sizeof(*lat));
+	tst_hist_init(lat);
+
+	for (i = 0; i < stats->nr_threads; i++) {
+		bytes += stats->th[i].bytes;
+		tst_hist_merge(lat, &stats->th[i].lat);
+	}
+
+	tst_resm(TINFO, "time to OOM %.2fs, %d threads touched %lldMB "
+		 "(%.0f MB/s)", secs, stats->nr_threads, bytes / MB,
+		 bytes / MB / secs);
+
+	/* bound threads come in groups of oom_threads_per_node per node */
+	for (i = 0; stats->th[0].node >= 0 && i < stats->nr_threads;
+	     i += oom_threads_per_node) {
+		node_bytes = 0;
+		for (j = i; j < i + oom_threads_per_node; j++)
+			node_bytes += stats->th[j].bytes;
+		tst_resm(TINFO, "node %d: %lldMB", stats->th[i].node,
+			 node_bytes / MB);
+	}
+
+	tst_resm(TINFO, "reclaim: %ld pages scanned, %ld reclaimed "
+		 "(%.1f MB/s), %ld allocation stalls, %ld OOM kills",
+		 after->pgscan - before->pgscan,
+		 after->pgsteal - before->pgsteal,
+		 (double)(after->pgsteal - before->pgsteal) * pagesz / MB /
+		 secs, after->allocstall - before->allocstall,
+		 after->oom_kill - before->oom_kill);
+
+	tst_hist_report("first touch latency", lat);
+	free(lat);
+}
+
 /*
  * oom - allocates memory according to specified testcase and checks
  *       desired outcome (e.g. child killed, operation failed with ENOMEM)
  * @testcase: selects how child allocates memory
- *            valid choices are: OVERCOMMIT, NORMAL, MLOCK and KSM
+ *            valid choices are: OVERCOMMIT, NORMAL, MLOCK, KSM and THP
  * @lite: if non-zero, child makes only single TESTMEM+MB allocation
  *        if zero, child keeps allocating memory until it gets killed
  *        or some operation fails
@@ -123,15 +334,22 @@ out:
  */
 void oom(int testcase, int lite, int retcode, int allow_sigkill)
 {
+	struct oom_stats *stats;
+	struct vmstat_reclaim before, after;
+	long long start;
+	size_t size;
 	pid_t pid;
-	int status, threads;
+	int status;
+
+	stats = alloc_oom_stats(testcase, &size);
+	read_vmstat_reclaim(&before);
+	start = now_ns();
 
 	switch (pid = fork()) {
 	case -1:
 		tst_brkm(TBROK | TERRNO, cleanup, "fork");
 	case 0:
-		threads = MAX(1, tst_ncpus() - 1);
-		child_alloc(testcase, lite, threads);
+		child_alloc(stats, lite);
 	default:
 		break;
 	}
@@ -140,6 +358,10 @@ void oom(int testcase, int lite, int retcode, int allow_sigkill)
 	if (waitpid(-1, &status, 0) == -1)
 		tst_brkm(TBROK | TERRNO, cleanup, "waitpid");
 
+	read_vmstat_reclaim(&after);
+	report_oom_stats(stats, &before, &after, now_ns() - start);
+	SAFE_MUNMAP(cleanup, stats, size);
+
 	if (WIFSIGNALED(status)) {
 		if (allow_sigkill && WTERMSIG(status) == SIGKILL) {
 			tst_resm(TPASS, "victim signalled: (%d) %s",
@@ -221,6 +443,50 @@ void testoom(int mempolicy, int lite, int retcode, int allow_sigkill)
 		tst_resm(TINFO, "start OOM testing for KSM pages.");
 		oom(KSM, lite, retcode, allow_sigkill);
 	}
+
+	if (!oom_thp)
+		return;
+
+	if (access(PATH_THP, F_OK) == -1) {
+		tst_resm(TINFO, "THP is not enabled, "
+			 "skip OOM test for THP pages");
+	} else {
+		tst_resm(TINFO, "start OOM testing for THP pages.");
+		oom(THP, lite, retcode, allow_sigkill);
+	}
+}
+
+option_t oom_options[] = {
+	{"t:", &opt_oom_threads, &opt_oom_threads_str},
+	{"c:", &opt_oom_chunk, &opt_oom_chunk_str},
+	{"r:", &opt_oom_rate, &opt_oom_rate_str},
+	{"H", &opt_oom_thp, NULL},
+	{NULL, NULL, NULL}
+};
+
+void check_oom_options(void)
+{
+	if (opt_oom_threads) {
+		oom_threads_per_node = SAFE_STRTOL(NULL, opt_oom_threads_str,
+						   1, 4096);
+	}
+	if (opt_oom_chunk) {
+		oom_chunk = SAFE_STRTOL(NULL, opt_oom_chunk_str, 1,
+					LONG_MAX / MB) * MB;
+	}
+	if (opt_oom_rate) {
+		oom_rate = SAFE_STRTOL(NULL, opt_oom_rate_str, 0,
+				       LONG_MAX / MB) * MB;
+	}
+	oom_thp = opt_oom_thp;
+}
+
+void oom_usage(void)
+{
+	printf("  -t      Allocating threads per NUMA node\n");
+	printf("  -c      Size of one allocation in MB\n");
+	printf("  -r      Allocation rate per thread in MB/s\n");
+	printf("  -H      Also test THP backed memory\n");
 }
 
 /* KSM */
@@ -238,44 +504,145 @@ static void check(char *path, long int value)
 		tst_resm(TFAIL, "%s is not %ld.", path, value);
 }
 
+struct ksm_counters {
+	long pages_shared;
+	long pages_sharing;
+	long pages_volatile;
+	long pages_unshared;
+	long full_scans;
+	long pages_scanned;	/* -1 on kernels without the counter */
+};
+
+static void read_ksm_counters(struct ksm_counters *c)
+{
+	SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_shared",
+			"%ld", &c->pages_shared);
+	SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_sharing",
+			"%ld", &c->pages_sharing);
+	SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_volatile",
+			"%ld", &c->pages_volatile);
+	SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_unshared",
+			"%ld", &c->pages_unshared);
+	SAFE_FILE_SCANF(cleanup, PATH_KSM "full_scans",
+			"%ld", &c->full_scans);
+
+	c->pages_scanned = -1;
+	if (access(PATH_KSM "pages_scanned", F_OK) == 0)
+		SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_scanned",
+				"%ld", &c->pages_scanned);
+}
+
+static int ksm_counters_changed(struct ksm_counters *a,
+				struct ksm_counters *b)
+{
+	return a->pages_shared != b->pages_shared ||
+	       a->pages_sharing != b->pages_sharing ||
+	       a->pages_volatile != b->pages_volatile ||
+	       a->pages_unshared != b->pages_unshared;
+}
+
+static long ksm_poll_interval(long us)
+{
+	if (us < KSM_POLL_MIN_US)
+		return KSM_POLL_MIN_US;
+	if (us > KSM_POLL_MAX_US)
+		return KSM_POLL_MAX_US;
+	return us;
+}
+
+static void report_ksmd(struct ksm_counters *start, struct ksm_counters *end,
+			long long elapsed_us)
+{
+	double secs = elapsed_us / 1000000.0;
+	long scans = end->full_scans - start->full_scans;
+	long merged = end->pages_sharing - start->pages_sharing;
+
+	tst_resm(TINFO, "ksm daemon takes %.2fs to scan all mergeable pages",
+		 secs);
+
+	if (!scans)
+		return;
+
+	tst_resm(TINFO, "ksmd: %ld full scans, %.1fms per scan, "
+		 "pages_sharing %+ld (%.0f pages/s)", scans,
+		 elapsed_us / 1000.0 / scans, merged, merged / secs);
+
+	if (start->pages_scanned != -1) {
+		tst_resm(TINFO, "ksmd: scan rate %.0f pages/s",
+			 (end->pages_scanned - start->pages_scanned) / secs);
+	}
+}
+
+/*
+ * Waits until ksmd has nothing more to do with the current memory layout.
+ *
+ * While ksmd runs the counters are compared at full scan boundaries and ksmd
+ * is done once they did not change for KSM_STABLE_SCANS full scans. A page
+ * needs a scan to checksum it and one more to merge it, and with smart_scan
+ * pages which did not merge are skipped for up to eight scans, so a single
+ * quiet scan proves nothing. The poll interval follows the measured scan
+ * time, so fast scans are noticed in milliseconds.
+ *
+ * When ksmd is stopped or unmerging (run != 1) full_scans does not move, the
+ * counters only have to settle then.
+ */
 static void wait_ksmd_done(void)
 {
-	long pages_shared, pages_sharing, pages_volatile, pages_unshared;
-	long old_pages_shared = 0, old_pages_sharing = 0;
-	long old_pages_volatile = 0, old_pages_unshared = 0;
-	int changing = 1, count = 0;
+	struct ksm_counters start, old, cur;
+	long run, interval = KSM_POLL_MIN_US, scan_us = 0;
+	long long t0, t_scan, now;
+	int stable = 0;
 
-	while (changing) {
-		sleep(10);
-		count++;
+	SAFE_FILE_SCANF(cleanup, PATH_KSM "run", "%ld", &run);
 
-		SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_shared",
-				"%ld", &pages_shared);
+	read_ksm_counters(&start);
+	old = start;
+	t0 = t_scan = now_us();
 
-		SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_sharing",
-				"%ld", &pages_sharing);
+	for (;;) {
+		usleep(interval);
+		read_ksm_counters(&cur);
+		now = now_us();
 
-		SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_volatile",
-				"%ld", &pages_volatile);
+		if (now - t0 > KSM_WAIT_TIMEOUT * 1000000LL) {
+			tst_brkm(TBROK, cleanup, "ksm daemon did not settle "
+				 "in %ds", KSM_WAIT_TIMEOUT);
+		}
 
-		SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_unshared",
-				"%ld", &pages_unshared);
+		if (run != 1) {
+			if (ksm_counters_changed(&cur, &old))
+				stable = 0;
+			else if (++stable >= KSM_STABLE_POLLS)
+				break;
+			interval = ksm_poll_interval(interval * 2);
+			old = cur;
+			continue;
+		}
 
-		if (pages_shared != old_pages_shared ||
-		    pages_sharing != old_pages_sharing ||
-		    pages_volatile != old_pages_volatile ||
-		    pages_unshared != old_pages_unshared) {
-			old_pages_shared = pages_shared;
-			old_pages_sharing = pages_sharing;
-			old_pages_volatile = pages_volatile;
-			old_pages_unshared = pages_unshared;
-		} else {
-			changing = 0;
+		if (cur.full_scans == old.full_scans) {
+			if (scan_us)
+				interval = ksm_poll_interval(scan_us / 4);
+			else
+				interval = ksm_poll_interval(interval * 2);
+			continue;
 		}
+
+		scan_us = (now - t_scan) / (cur.full_scans - old.full_scans);
+		t_scan = now;
+		interval = ksm_poll_interval(scan_us / 4);
+
+		if (ksm_counters_changed(&cur, &old))
+			stable = 0;
+		else
+			stable += cur.full_scans - old.full_scans;
+
+		if (stable >= KSM_STABLE_SCANS)
+			break;
+
+		old = cur;
 	}
 
-	tst_resm(TINFO, "ksm daemon takes %ds to scan all mergeable pages",
-		 count * 10);
+	report_ksmd(&start, &cur, now - t0);
 }
 
 static void group_check(int run, int pages_shared, int pages_sharing,
@@ -295,6 +662,39 @@ static void group_check(int run, int pages_shared, int pages_sharing,
 	check("pages_to_scan", pages_to_scan);
 }
 
+static struct ksm_tunables {
+	pid_t pid;		/* the process which saved the values */
+	long pages_to_scan;
+	long sleep_millisecs;
+} ksm_saved;
+
+void ksm_tune(long pages_to_scan, long sleep_millisecs)
+{
+	if (!ksm_saved.pid) {
+		SAFE_FILE_SCANF(cleanup, PATH_KSM "pages_to_scan",
+				"%ld", &ksm_saved.pages_to_scan);
+		SAFE_FILE_SCANF(cleanup, PATH_KSM "sleep_millisecs",
+				"%ld", &ksm_saved.sleep_millisecs);
+		ksm_saved.pid = getpid();
+	}
+
+	SAFE_FILE_PRINTF(cleanup, PATH_KSM "pages_to_scan", "%ld",
+			 pages_to_scan);
+	SAFE_FILE_PRINTF(cleanup, PATH_KSM "sleep_millisecs", "%ld",
+			 sleep_millisecs);
+}
+
+void ksm_restore(void)
+{
+	if (ksm_saved.pid != getpid())
+		return;
+
+	FILE_PRINTF(PATH_KSM "pages_to_scan", "%ld", ksm_saved.pages_to_scan);
+	FILE_PRINTF(PATH_KSM "sleep_millisecs", "%ld",
+		    ksm_saved.sleep_millisecs);
+	ksm_saved.pid = 0;
+}
+
 static void verify(char **memory, char value, int proc,
 		    int start, int end, int start2, int end2)
 {
@@ -498,26 +898,27 @@ void create_same_memory(int size, int num, int unit)
 
 	tst_resm(TINFO, "KSM merging...");
 	SAFE_FILE_PRINTF(cleanup, PATH_KSM "run", "1");
-	SAFE_FILE_PRINTF(cleanup, PATH_KSM "pages_to_scan", "%ld",
-			 size * pages *num);
-	SAFE_FILE_PRINTF(cleanup, PATH_KSM "sleep_millisecs", "0");
+	ksm_tune(size * pages * num, 0);
 
+	/*
+	 * The children are stopped again before every check so that ksmd
+	 * is only waited for once they have written all their memory.
+	 */
 	resume_ksm_children(child, num);
+	stop_ksm_children(child, num);
 	group_check(1, 2, size * num * pages - 2, 0, 0, 0, size * pages * num);
 
-	stop_ksm_children(child, num);
 	resume_ksm_children(child, num);
+	stop_ksm_children(child, num);
 	group_check(1, 3, size * num * pages - 3, 0, 0, 0, size * pages * num);
 
-	stop_ksm_children(child, num);
 	resume_ksm_children(child, num);
+	stop_ksm_children(child, num);
 	group_check(1, 1, size * num * pages - 1, 0, 0, 0, size * pages * num);
 
-	stop_ksm_children(child, num);
 	resume_ksm_children(child, num);
-	group_check(1, 1, size * num * pages - 2, 0, 1, 0, size * pages * num);
-
 	stop_ksm_children(child, num);
+	group_check(1, 1, size * num * pages - 2, 0, 1, 0, size * pages * num);
 
 	tst_resm(TINFO, "KSM unmerging...");
 	SAFE_FILE_PRINTF(cleanup, PATH_KSM "run", "2");
@@ -529,7 +930,7 @@ void create_same_memory(int size, int num, int unit)
 	SAFE_FILE_PRINTF(cleanup, PATH_KSM "run", "0");
 	group_check(0, 0, 0, 0, 0, 0, size * pages * num);
 
-	while (waitpid(-1, &status, WUNTRACED | WCONTINUED) > 0)
+	while (waitpid(-1, &status, 0) > 0)
 		if (WEXITSTATUS(status) != 0)
 			tst_resm(TFAIL, "child exit status is %d",
 				 WEXITSTATUS(status));
@@ -587,9 +988,7 @@ void test_ksm_merge_across_nodes(unsigned long nr_pages)
 		memset(memory[i], 10, length);
 	}
 
-	SAFE_FILE_PRINTF(cleanup, PATH_KSM "sleep_millisecs", "0");
-	SAFE_FILE_PRINTF(cleanup, PATH_KSM "pages_to_scan", "%ld",
-			 nr_pages * num_nodes);
+	ksm_tune(nr_pages * num_nodes, 0);
 	/*
 	 * merge_across_nodes setting can be changed only when there
 	 * are no ksm shared pages in system, so set run 2 to unmerge
@@ -695,6 +1094,9 @@ static void khugepaged_scan_done(void)
 	long old_pages_collapsed = 0, old_max_ptes_none = 0,
 		old_pages_to_scan = 0;
 	long pages_collapsed = 0, max_ptes_none = 0, pages_to_scan = 0;
+	long start_collapsed;
+	long long t0, t_change;
+	double secs;
 
 	/*
 	 * as 'khugepaged' run 100% during testing, so 5s is an
@@ -703,6 +1105,10 @@ static void khugepaged_scan_done(void)
 	 */
 	interval = 5;
 
+	SAFE_FILE_SCANF(cleanup, PATH_KHPD "pages_collapsed",
+		       "%ld", &start_collapsed);
+	t0 = t_change = now_us();
+
 	while (changing) {
 		sleep(interval);
 		count++;
@@ -720,6 +1126,7 @@ static void khugepaged_scan_done(void)
 			old_pages_collapsed = pages_collapsed;
 			old_max_ptes_none = max_ptes_none;
 			old_pages_to_scan = pages_to_scan;
+			t_change = now_us();
 		} else {
 			changing = 0;
 		}
@@ -727,6 +1134,16 @@ static void khugepaged_scan_done(void)
 
 	tst_resm(TINFO, "khugepaged daemon takes %ds to scan all thp pages",
 		 count * interval);
+
+	/* the collapsing ended somewhere in the last interval with changes */
+	secs = (t_change - t0) / 1000000.0;
+	if (pages_collapsed != start_collapsed && secs > 0) {
+		tst_resm(TINFO, "khugepaged collapsed %ld pages in %.0fs or "
+			 "less (>= %.1f pages/s) with pages_to_scan %ld",
+			 pages_collapsed - start_collapsed, secs,
+			 (pages_collapsed - start_collapsed) / secs,
+			 pages_to_scan);
+	}
 }
 
 static void verify_thp_size(int *children, int nr_children, int nr_thps)
@@ -826,6 +1243,242 @@ void test_transparent_hugepage(int nr_children, int nr_thps,
 	}
 }
 
+#ifdef MADV_HUGEPAGE
+
+#define THP_BENCH_PASSES	4
+#define THP_BENCH_TIMEOUT	60
+
+/* keeps the compiler from dropping the read loops */
+static volatile long thp_sink;
+
+struct thp_area {
+	char *base;
+	size_t len;
+	char *addr;
+	size_t size;
+};
+
+static void thp_area_map(struct thp_area *a, size_t size,
+			 unsigned long hpage_size, int advice)
+{
+	unsigned long addr;
+
+	a->len = size + hpage_size;
+	a->base = mmap(NULL, a->len, PROT_READ|PROT_WRITE,
+		       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (a->base == MAP_FAILED)
+		tst_brkm(TBROK|TERRNO, cleanup, "mmap");
+
+	addr = ((unsigned long)a->base + hpage_size - 1) & ~(hpage_size - 1);
+	a->addr = (char *)addr;
+	a->size = size;
+
+	if (madvise(a->addr, size, advice) == -1)
+		tst_brkm(TBROK|TERRNO, cleanup, "madvise");
+}
+
+static void thp_area_unmap(struct thp_area *a)
+{
+	if (munmap(a->base, a->len) == -1)
+		tst_brkm(TBROK|TERRNO, cleanup, "munmap");
+}
+
+/* AnonHugePages in kB of the mapping containing addr */
+static long thp_area_huge_kb(struct thp_area *a)
+{
+	FILE *fp;
+	char line[BUFSIZ];
+	unsigned long start, end, addr = (unsigned long)a->addr;
+	long val = 0;
+	int found = 0;
+
+	fp = fopen("/proc/self/smaps", "r");
+	if (fp == NULL)
+		tst_brkm(TBROK|TERRNO, cleanup, "fopen /proc/self/smaps");
+
+	while (fgets(line, BUFSIZ, fp) != NULL) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			found = start <= addr && addr < end;
+			continue;
+		}
+		if (found && sscanf(line, "AnonHugePages: %ld", &val) == 1)
+			break;
+	}
+
+	fclose(fp);
+	return val;
+}
+
+/* first touch of every page, returns the time in us */
+static long long thp_area_touch(struct thp_area *a)
+{
+	long long start = now_us();
+	size_t off, pagesize = getpagesize();
+
+	for (off = 0; off < a->size; off += pagesize)
+		a->addr[off] = 1;
+
+	return now_us() - start;
+}
+
+static double thp_area_write_mbs(struct thp_area *a)
+{
+	long long start = now_us();
+	int i;
+
+	for (i = 0; i < THP_BENCH_PASSES; i++)
+		memset(a->addr, i, a->size);
+
+	return (double)a->size * THP_BENCH_PASSES / MB /
+	       ((now_us() - start) / 1000000.0);
+}
+
+static double thp_area_read_mbs(struct thp_area *a, long *sum)
+{
+	long long start = now_us();
+	long *p, *end = (long *)(a->addr + a->size);
+	int i;
+
+	for (i = 0; i < THP_BENCH_PASSES; i++) {
+		for (p = (long *)a->addr; p < end; p++)
+			*sum += *p;
+	}
+
+	return (double)a->size * THP_BENCH_PASSES / MB /
+	       ((now_us() - start) / 1000000.0);
+}
+
+/* dependent loads at random cache lines, dominated by TLB misses */
+static double thp_area_random_ns(struct thp_area *a, long *sum)
+{
+	unsigned long idx = 1, lines = a->size / 64, n = lines;
+	long long start = now_us();
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		idx = (idx * 6364136223846793005UL + 1442695040888963407UL +
+		       (unsigned long)*sum) % lines;
+		*sum += a->addr[idx * 64];
+	}
+
+	return (now_us() - start) * 1000.0 / n;
+}
+
+static void thp_bench_backing(const char *name, size_t size,
+			      unsigned long hpage_size, int advice)
+{
+	struct thp_area a;
+	long long touch_us;
+	long sum = 0, faults;
+	double wr, rd, rnd;
+
+	thp_area_map(&a, size, hpage_size, advice);
+
+	touch_us = thp_area_touch(&a);
+	faults = advice == MADV_HUGEPAGE ? size / hpage_size
+					 : size / getpagesize();
+
+	wr = thp_area_write_mbs(&a);
+	rd = thp_area_read_mbs(&a, &sum);
+	rnd = thp_area_random_ns(&a, &sum);
+
+	tst_resm(TINFO, "%s: AnonHugePages %ldkB of %zukB", name,
+		 thp_area_huge_kb(&a), size / KB);
+	tst_resm(TINFO, "%s: first touch %.3fms, %.2fus per %s fault, "
+		 "%.0f MB/s", name, touch_us / 1000.0,
+		 (double)touch_us / faults,
+		 advice == MADV_HUGEPAGE ? "2M" : "4K",
+		 (double)size / MB / (touch_us / 1000000.0));
+	tst_resm(TINFO, "%s: write %.0f MB/s, read %.0f MB/s, random "
+		 "access %.1fns", name, wr, rd, rnd);
+	thp_sink = sum;
+
+	thp_area_unmap(&a);
+}
+
+/*
+ * khugepaged scan/alloc sleep are expected to be 0 already, the test
+ * saves them in setup() and restores them in cleanup()
+ */
+static void thp_bench_collapse(size_t size, unsigned long hpage_size)
+{
+	struct thp_area a;
+	long pages_to_scan;
+	long collapsed0, collapsed, scans0, scans, huge_kb = 0;
+	long long t0, now;
+	double secs;
+
+	SAFE_FILE_SCANF(cleanup, PATH_KHPD "pages_to_scan",
+			"%ld", &pages_to_scan);
+
+	/* populate with 4K pages, then let khugepaged collapse them */
+	thp_area_map(&a, size, hpage_size, MADV_NOHUGEPAGE);
+	memset(a.addr, 1, size);
+
+	SAFE_FILE_SCANF(cleanup, PATH_KHPD "pages_collapsed",
+			"%ld", &collapsed0);
+	SAFE_FILE_SCANF(cleanup, PATH_KHPD "full_scans", "%ld", &scans0);
+
+	t0 = now = now_us();
+	if (madvise(a.addr, size, MADV_HUGEPAGE) == -1)
+		tst_brkm(TBROK|TERRNO, cleanup, "madvise");
+	do {
+		usleep(10000);
+		now = now_us();
+		huge_kb = thp_area_huge_kb(&a);
+		SAFE_FILE_SCANF(cleanup, PATH_KHPD "full_scans",
+				"%ld", &scans);
+		/* two full scans without finishing means it never will */
+	} while ((size_t)huge_kb * KB < size && scans - scans0 < 2 &&
+		 now - t0 < THP_BENCH_TIMEOUT * 1000000LL);
+
+	SAFE_FILE_SCANF(cleanup, PATH_KHPD "pages_collapsed",
+			"%ld", &collapsed);
+
+	secs = (now - t0) / 1000000.0;
+	tst_resm(TINFO, "collapse: %ld hugepages in %.2fs, %.1f hugepages/s "
+		 "(%.0f MB/s) with pages_to_scan %ld, AnonHugePages %ldkB "
+		 "of %zukB", collapsed - collapsed0, secs,
+		 (collapsed - collapsed0) / secs,
+		 (double)(collapsed - collapsed0) * hpage_size / MB / secs,
+		 pages_to_scan, huge_kb, size / KB);
+
+	thp_area_unmap(&a);
+}
+
+void bench_transparent_hugepage(int nr_thps)
+{
+	char enabled[BUFSIZ];
+	unsigned long hugepagesize;
+	size_t size;
+
+	SAFE_FILE_SCANF(cleanup, PATH_THP "enabled", "%[^\n]", enabled);
+	if (strstr(enabled, "[never]")) {
+		tst_resm(TCONF, "THP is disabled, skip THP measurement");
+		return;
+	}
+
+	hugepagesize = read_meminfo("Hugepagesize:") * KB;
+	size = (size_t)nr_thps * hugepagesize;
+
+	tst_resm(TINFO, "Measuring THP vs 4K backing of %zuMB...", size / MB);
+	thp_bench_backing("4K", size, hugepagesize, MADV_NOHUGEPAGE);
+	thp_bench_backing("THP", size, hugepagesize, MADV_HUGEPAGE);
+
+	tst_resm(TINFO, "Measuring khugepaged collapse of %zuMB...",
+		 size / MB);
+	thp_bench_collapse(size, hugepagesize);
+}
+
+#else
+
+void bench_transparent_hugepage(int nr_thps)
+{
+	tst_resm(TCONF, "MADV_HUGEPAGE is not defined, skip THP measurement");
+}
+
+#endif
+
 void check_thp_options(int *nr_children, int *nr_thps)
 {
 	if (opt_nr_children)
@@ -839,6 +1492,7 @@ void thp_usage(void)
 {
 	printf("  -n      Number of processes\n");
 	printf("  -N      Number of transparent hugepages\n");
+	printf("  -b      Measure faults, bandwidth and collapse speed\n");
 }
 
 /* cpuset/memcg */
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program;  if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+/*
+ * mmapbench - measures page fault latency while other threads of the same
+ * process change its address space.
+ *
+ * Fault threads own a private anonymous region each, touch every page of
+ * it and drop the pages again with MADV_DONTNEED, so that every touch is a
+ * fresh fault. Mapper threads meanwhile loop over mmap(), mprotect() and
+ * munmap() of a small region, which need the address space lock for
+ * writing and thus contend with the faults that hold it for reading; this
+ * is the race mmap1 - mmap3 and mmapstress stress for correctness.
+ *
+ * The number of fault threads is doubled from 1 up to -f and for each of
+ * them the number of mapper threads is doubled from 0 up to -m. Every step
+ * runs for -d seconds and reports the fault rate, the fault latency
+ * percentiles, the mapper call rate and the per call latency of the mapper
+ * operations.
+ *
+ * Usage: mmapbench [-f fault threads] [-m mapper threads] [-s MB]
+ *                  [-d seconds]
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "safe_macros.h"
+#include "tst_hist.h"
+
+char *TCID = "mmapbench";
+int TST_TOTAL = 1;
+
+/* pages mapped, protected and unmapped by one mapper iteration */
+#define MAPPER_PAGES	16
+
+struct thread_stats {
+	struct tst_hist lat;
+	unsigned long ops;
+	int err;
+	const char *what;
+};
+
+static char *f_opt, *m_opt, *s_opt, *d_opt;
+static int f_flag, m_flag, s_flag, d_flag;
+
+static option_t options[] = {
+	{"f:", &f_flag, &f_opt},
+	{"m:", &m_flag, &m_opt},
+	{"s:", &s_flag, &s_opt},
+	{"d:", &d_flag, &d_opt},
+	{NULL, NULL, NULL}
+};
+
+static int max_faulters;
+static int max_mappers = 2;
+static size_t region_size = 64 * 1024 * 1024;
+static int duration = 1;
+static long page_size;
+
+static pthread_barrier_t barrier;
+static volatile int stop;
+static int failed;
+
+static void setup(void);
+static void cleanup(void);
+static void help(void);
+
+static long long mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void thread_error(struct thread_stats *st, const char *what)
+{
+	st->err = errno;
+	st->what = what;
+}
+
+static void *faulter(void *arg)
+{
+	struct thread_stats *st = arg;
+	long long start;
+	size_t off;
+	char *addr;
+
+	addr = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		thread_error(st, "mmap");
+
+	pthread_barrier_wait(&barrier);
+
+	if (st->what)
+		return NULL;
+
+	while (!stop) {
+		for (off = 0; off < region_size && !stop; off += page_size) {
+			start = mono_ns();
+			addr[off] = 1;
+			tst_hist_add(&st->lat, mono_ns() - start);
+			st->ops++;
+		}
+
+		if (madvise(addr, region_size, MADV_DONTNEED)) {
+			thread_error(st, "madvise");
+			break;
+		}
+	}
+
+	munmap(addr, region_size);
+	return NULL;
+}
+
+/*
+ * One sample is the whole mmap() + mprotect() + munmap() sequence, ops
+ * counts each of the four calls.
+ */
+static void *mapper(void *arg)
+{
+	struct thread_stats *st = arg;
+	size_t size = MAPPER_PAGES * page_size;
+	long long start;
+	char *addr;
+
+	pthread_barrier_wait(&barrier);
+
+	while (!stop) {
+		start = mono_ns();
+
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED) {
+			thread_error(st, "mmap");
+			break;
+		}
+
+		/* split the vma in the middle and merge it back */
+		if (mprotect(addr, size / 2, PROT_READ) ||
+		    mprotect(addr, size / 2, PROT_READ | PROT_WRITE)) {
+			thread_error(st, "mprotect");
+			munmap(addr, size);
+			break;
+		}
+
+		if (munmap(addr, size)) {
+			thread_error(st, "munmap");
+			break;
+		}
+
+		tst_hist_add(&st->lat, mono_ns() - start);
+		st->ops += 4;
+	}
+
+	return NULL;
+}
+
+static void check_errors(const char *name, struct thread_stats *st, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (!st[i].what)
+			continue;
+
+		errno = st[i].err;
+		tst_resm(TFAIL | TERRNO, "%s thread %d: %s() failed",
+			 name, i, st[i].what);
+		failed = 1;
+	}
+}
+
+static void run(int faulters, int mappers)
+{
+	int nr = faulters + mappers;
+	struct thread_stats *st;
+	struct tst_hist fault_lat, map_lat;
+	unsigned long faults = 0, map_ops = 0;
+	pthread_t *threads;
+	long long start, end;
+	double secs;
+	char name[64], hist_name[96];
+	int i, ret;
+
+	st = SAFE_MALLOC(cleanup, nr * sizeof(*st));
+	threads = SAFE_MALLOC(cleanup, nr * sizeof(*threads));
+	memset(st, 0, nr * sizeof(*st));
+
+	ret = pthread_barrier_init(&barrier, NULL, nr + 1);
+	if (ret) {
+		tst_brkm(TBROK, cleanup, "pthread_barrier_init(): %s",
+			 tst_strerrno(ret));
+	}
+
+	stop = 0;
+
+	for (i = 0; i < nr; i++) {
+		tst_hist_init(&st[i].lat);
+		ret = pthread_create(&threads[i], NULL,
+				     i < faulters ? faulter : mapper, &st[i]);
+		if (ret) {
+			tst_brkm(TBROK, cleanup, "pthread_create(): %s",
+				 tst_strerrno(ret));
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	start = mono_ns();
+	sleep(duration);
+	stop = 1;
+
+	for (i = 0; i < nr; i++)
+		pthread_join(threads[i], NULL);
+	end = mono_ns();
+
+	pthread_barrier_destroy(&barrier);
+
+	check_errors("fault", st, faulters);
+	check_errors("mapper", st + faulters, mappers);
+
+	tst_hist_init(&fault_lat);
+	tst_hist_init(&map_lat);
+
+	for (i = 0; i < faulters; i++) {
+		tst_hist_merge(&fault_lat, &st[i].lat);
+		faults += st[i].ops;
+	}
+
+	for (i = faulters; i < nr; i++) {
+		tst_hist_merge(&map_lat, &st[i].lat);
+		map_ops += st[i].ops;
+	}
+
+	secs = (end - start) / 1000000000.0;
+
+	snprintf(name, sizeof(name), "%d fault, %d mapper threads",
+		 faulters, mappers);
+
+	tst_resm(TINFO, "%s: %.0f faults/s, %.0f mmap/mprotect/munmap calls/s",
+		 name, faults / secs, map_ops / secs);
+
+	snprintf(hist_name, sizeof(hist_name), "%s fault", name);
+	tst_hist_report(hist_name, &fault_lat);
+
+	if (mappers) {
+		snprintf(hist_name, sizeof(hist_name),
+			 "%s mmap+mprotect+munmap", name);
+		tst_hist_report(hist_name, &map_lat);
+	}
+
+	free(threads);
+	free(st);
+}
+
+static void run_mappers(int faulters)
+{
+	int mappers;
+
+	run(faulters, 0);
+
+	if (!max_mappers)
+		return;
+
+	for (mappers = 1; mappers < max_mappers; mappers *= 2)
+		run(faulters, mappers);
+	run(faulters, max_mappers);
+}
+
+int main(int argc, char *argv[])
+{
+	int faulters, lc;
+
+	tst_parse_opts(argc, argv, options, help);
+
+	setup();
+
+	for (lc = 0; TEST_LOOPING(lc); lc++) {
+		tst_count = 0;
+		failed = 0;
+
+		for (faulters = 1; faulters < max_faulters; faulters *= 2)
+			run_mappers(faulters);
+		run_mappers(max_faulters);
+
+		if (!failed)
+			tst_resm(TPASS, "mmap fault benchmark completed");
+	}
+
+	cleanup();
+	tst_exit();
+}
+
+static void setup(void)
+{
+	long mb = 64;
+
+	max_faulters = tst_ncpus();
+	if (f_flag)
+		max_faulters = SAFE_STRTOL(NULL, f_opt, 1, 4096);
+	if (m_flag)
+		max_mappers = SAFE_STRTOL(NULL, m_opt, 0, 4096);
+	if (s_flag)
+		mb = SAFE_STRTOL(NULL, s_opt, 1, LONG_MAX / 1024 / 1024);
+	if (d_flag)
+		duration = SAFE_STRTOL(NULL, d_opt, 1, INT_MAX);
+
+	region_size = mb * 1024 * 1024;
+	page_size = getpagesize();
+
+	tst_sig(NOFORK, DEF_HANDLER, cleanup);
+
+	tst_resm(TINFO, "up to %d fault threads with %ldMB each, up to %d "
+		 "mapper threads, %ds per step", max_faulters, mb,
+		 max_mappers, duration);
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+}
+
+static void help(void)
+{
+	printf("  -f x     Maximal number of fault threads (default ncpus)\n");
+	printf("  -m x     Maximal number of mmap/mprotect/munmap threads "
+	       "(default 2)\n");
+	printf("  -s x     Region touched by each fault thread in MB "
+	       "(default 64)\n");
+	printf("  -d x     Seconds to run each step (default 1)\n");
+}
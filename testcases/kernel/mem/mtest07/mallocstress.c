@@ -55,12 +55,24 @@
 /*		                - Removed mallocs that could fail             */
 /*		                - Note that pthread_create fails with EINTR   */
 /*                                                                            */
+/*		Time every malloc()/free() by size class, sample RSS and     */
+/*		address space growth, allow running the workload under other  */
+/*		allocators through LD_PRELOAD.                                */
+/*                                                                            */
 /* File:	mallocstress.c						      */
 /*									      */
 /* Description:	This program stresses the VMM and C library                   */
 /*              by spawning N threads which                                   */
 /*              malloc blocks of increasing size until malloc returns NULL.   */
+/*                                                                            */
+/*		Each malloc() and free() is timed and accounted into a        */
+/*		histogram for its size class, the allocated but not yet freed */
+/*		bytes are compared against RSS and virtual size growth to     */
+/*		estimate allocator overhead. With -L the same workload is     */
+/*		rerun once per listed allocator library, so the numbers can   */
+/*		be compared side by side.                                     */
 /******************************************************************************/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
@@ -72,9 +84,28 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/sem.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <dlfcn.h>
+
+#include "test.h"
+#include "tst_hist.h"
 
 #define MAXL    100		/* default number of loops to do malloc and free      */
 #define MAXT     60		/* default number of threads to create.               */
+#define SAMPLE_MS 100		/* default RSS sampling interval in miliseconds       */
+
+/*
+ * Size classes grow by a factor of 8, class N holds blocks of
+ * [8^N, 8^(N+1)) bytes, the last class everything above.
+ */
+#define NR_SIZE_CLASSES 10
+
+/* set in the environment of the per allocator children started by -L */
+#define CHILD_ENV "MALLOCSTRESS_ALLOCATOR"
 
 #ifdef DEBUG
 #define dprt(args)	printf args
@@ -88,9 +119,40 @@
                                usage(prog); \
                                    } while (0)
 
+char *TCID = "mallocstress";
+int TST_TOTAL = 1;
+
 int num_loop = MAXL;		/* number of loops to perform                     */
 int semid;
 
+struct thread_stats {
+	struct tst_hist malloc_lat[NR_SIZE_CLASSES];
+	struct tst_hist free_lat[NR_SIZE_CLASSES];
+	unsigned long nr_failed;	/* malloc() returned NULL                 */
+	volatile size_t live;		/* bytes allocated and not yet freed      */
+};
+
+/*
+ * Mapped with mmap() rather than malloc() so that the bookkeeping does
+ * not show up in the heap of the allocator under test.
+ */
+static struct thread_stats *stats;
+static int num_thrd = MAXT;	/* number of threads to create                */
+
+static int verbose;
+static int sample_ms = SAMPLE_MS;
+static volatile int sampling;
+static volatile int sampling_done;
+
+struct mem_sample {
+	unsigned long rss;	/* RSS growth since start in bytes            */
+	unsigned long vsz;	/* virtual size growth since start in bytes   */
+	unsigned long live;	/* sum of stats[].live                        */
+};
+
+static struct mem_sample base_sample, peak_sample;
+static unsigned long peak_rss;
+
 /* Define SPEW_SIGNALS to tickle thread_create bug (it fails if interrupted). */
 #define SPEW_SIGNALS
 
@@ -119,6 +181,58 @@ static void my_yield()
 #endif
 }
 
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int size_class(size_t size)
+{
+	int bits = 0;
+
+	while (size >>= 1)
+		bits++;
+
+	if (bits / 3 >= NR_SIZE_CLASSES)
+		return NR_SIZE_CLASSES - 1;
+
+	return bits / 3;
+}
+
+static const char *fmt_size(char *buf, size_t len, unsigned long long size)
+{
+	const char *units = "BKMGTPE";
+
+	while (size >= 1024 && !(size % 1024) && units[1]) {
+		size /= 1024;
+		units++;
+	}
+
+	snprintf(buf, len, "%llu%c", size, *units);
+
+	return buf;
+}
+
+static const char *size_class_name(char *buf, size_t len, int cls)
+{
+	char lo[24], hi[24];
+
+	if (cls == NR_SIZE_CLASSES - 1) {
+		snprintf(buf, len, "%s+", fmt_size(lo, sizeof(lo), 1ULL << (3 * cls)));
+		return buf;
+	}
+
+	snprintf(buf, len, "%s-%s",
+		 cls ? fmt_size(lo, sizeof(lo), 1ULL << (3 * cls)) : "0B",
+		 fmt_size(hi, sizeof(hi), 1ULL << (3 * (cls + 1))));
+
+	return buf;
+}
+
 /******************************************************************************/
 /*								 	      */
 /* Function:	usage							      */
@@ -133,10 +247,15 @@ static void my_yield()
 static void usage(char *progname)
 {				/* name of this program                       */
 	fprintf(stderr,
-		"Usage: %s -d NUMDIR -f NUMFILES -h -t NUMTHRD\n"
+		"Usage: %s -h -l NUMLOOP -t NUMTHRD -a ARENAS -L LIBS -m MSEC -v\n"
 		"\t -h Help!\n"
-		"\t -l Number of loops:               Default: 1000\n"
-		"\t -t Number of threads to generate: Default: 30\n", progname);
+		"\t -l Number of loops:               Default: 100\n"
+		"\t -t Number of threads to generate: Default: 60\n"
+		"\t -a Limit glibc malloc arenas (M_ARENA_MAX)\n"
+		"\t -L Comma separated allocator libraries to preload, the\n"
+		"\t    workload runs once per library, 'glibc' means none\n"
+		"\t -m RSS sampling interval in ms:   Default: 100\n"
+		"\t -v Print per thread histograms and RSS samples\n", progname);
 	exit(-1);
 }
 
@@ -150,13 +269,15 @@ static void usage(char *progname)
 /*									      */
 /* Input:	int repeat - number of times the alloc/free is repeated.      */
 /*		int scheme  - 0 to 3; selects how fast memory size grows      */
+/*		struct thread_stats *st - latencies are accounted here       */
 /*								              */
 /* Return:	1 on failure						      */
 /*		0 on success						      */
 /******************************************************************************/
 int allocate_free(int repeat,	/* number of times to repeat allocate/free    */
-		  int scheme)
-{				/* how fast to increase block size            */
+		  int scheme,	/* how fast to increase block size            */
+		  struct thread_stats *st)
+{				/* where to account the latencies             */
 	int loop;
 	const int MAXPTRS = 50;	/* only 42 or so get used on 32 bit machine */
 
@@ -167,6 +288,8 @@ int allocate_free(int repeat,	/* number of times to repeat allocate/free    */
 		size_t oldsize = 5;	/* remember size for fibannoci series     */
 		size_t size = sizeof(long);	/* size of next block in ptrs[]           */
 		long *ptrs[MAXPTRS];	/* the pointers allocated in this loop    */
+		size_t sizes[MAXPTRS];	/* and their sizes                        */
+		unsigned long long start;
 		int num_alloc;	/* number of elements in ptrs[] so far    */
 		int i;
 
@@ -185,12 +308,18 @@ int allocate_free(int repeat,	/* number of times to repeat allocate/free    */
 			      getpid(), loop, repeat, num_alloc, size));
 
 			/* Malloc the next block */
+			start = now_ns();
 			ptrs[num_alloc] = malloc(size);
 			if (ptrs[num_alloc] == NULL) {
 				/* terminate loop if malloc couldn't give us the memory we asked for */
+				st->nr_failed++;
 				break;
 			}
+			tst_hist_add(&st->malloc_lat[size_class(size)],
+				     now_ns() - start);
 			ptrs[num_alloc][0] = num_alloc;
+			sizes[num_alloc] = size;
+			st->live += size;
 
 			/* Increase size according to one of four schedules. */
 			switch (scheme) {
@@ -227,7 +356,11 @@ int allocate_free(int repeat,	/* number of times to repeat allocate/free    */
 					getpid());
 				return 1;
 			}
+			start = now_ns();
 			free(ptrs[i]);
+			tst_hist_add(&st->free_lat[size_class(sizes[i])],
+				     now_ns() - start);
+			st->live -= sizes[i];
 			my_yield();
 		}
 
@@ -264,7 +397,8 @@ void *alloc_mem(void *threadnum)
 	}
 
 	/* thread N will use growth scheme N mod 4 */
-	int err = allocate_free(num_loop, ((uintptr_t) threadnum) % 4);
+	int err = allocate_free(num_loop, ((uintptr_t) threadnum) % 4,
+				&stats[(uintptr_t) threadnum]);
 	fprintf(stdout,
 		"Thread [%d]: allocate_free() returned %d, %s.  Thread exiting.\n",
 		(int)(uintptr_t) threadnum, err,
@@ -272,6 +406,240 @@ void *alloc_mem(void *threadnum)
 	return (void *)(uintptr_t) (err ? -1 : 0);
 }
 
+/******************************************************************************/
+/* Function:	read_sample						      */
+/*									      */
+/* Description:	Reads RSS and virtual size from /proc/self/statm and sums the */
+/*		bytes the threads hold allocated.                             */
+/******************************************************************************/
+static int read_sample(struct mem_sample *s)
+{
+	unsigned long size, resident;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	FILE *f;
+	int i;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return -1;
+
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	s->vsz = size * pagesize;
+	s->rss = resident * pagesize;
+	s->live = 0;
+
+	for (i = 0; i < num_thrd; i++)
+		s->live += stats[i].live;
+
+	return 0;
+}
+
+static void sample_delta(struct mem_sample *s)
+{
+	s->vsz = s->vsz > base_sample.vsz ? s->vsz - base_sample.vsz : 0;
+	s->rss = s->rss > base_sample.rss ? s->rss - base_sample.rss : 0;
+}
+
+/*
+ * Percentage of the address space growth that is not backed by live
+ * allocations, i.e. allocator metadata, rounding and fragmentation. Blocks
+ * are only written in the first word, so RSS mostly tracks the heap pages
+ * the allocator touched and did not return and is reported as it is.
+ */
+static long overhead_pct(unsigned long grown, unsigned long live)
+{
+	/* statm and the live counters are not read atomically */
+	if (!grown || live > grown)
+		return 0;
+
+	return ((long)grown - (long)live) * 100 / (long)grown;
+}
+
+/******************************************************************************/
+/* Function:	sampler							      */
+/*									      */
+/* Description:	Samples memory usage every sample_ms miliseconds while the    */
+/*		workload runs and tracks the peak RSS.                        */
+/******************************************************************************/
+static void *sampler(void *arg)
+{
+	unsigned long long start = 0;
+	struct mem_sample s;
+
+	(void)arg;
+
+	while (!sampling_done) {
+		if (!sampling || read_sample(&s)) {
+			usleep(1000);
+			continue;
+		}
+
+		if (!start)
+			start = now_ns();
+
+		sample_delta(&s);
+
+		if (s.vsz > peak_sample.vsz)
+			peak_sample = s;
+
+		if (s.rss > peak_rss)
+			peak_rss = s.rss;
+
+		if (verbose) {
+			tst_resm(TINFO, "t=%.1fs rss=+%luKB vsz=+%luKB "
+				 "live=%luKB overhead=%ld%%",
+				 (now_ns() - start) / 1000000000.0,
+				 s.rss / 1024, s.vsz / 1024, s.live / 1024,
+				 overhead_pct(s.vsz, s.live));
+		}
+
+		usleep(sample_ms * 1000);
+	}
+
+	return NULL;
+}
+
+/******************************************************************************/
+/* Function:	report_stats						      */
+/*									      */
+/* Description:	Prints malloc() and free() latency per size class, optionally */
+/*		per thread, and the memory usage summary.                     */
+/******************************************************************************/
+static void report_stats(unsigned long long elapsed)
+{
+	struct tst_hist h;
+	struct mem_sample end;
+	unsigned long nr_failed = 0;
+	char name[96], cls_name[64];
+	int i, cls;
+
+	for (cls = 0; cls < NR_SIZE_CLASSES; cls++) {
+		size_class_name(cls_name, sizeof(cls_name), cls);
+
+		tst_hist_init(&h);
+		for (i = 0; i < num_thrd; i++)
+			tst_hist_merge(&h, &stats[i].malloc_lat[cls]);
+		if (h.count) {
+			snprintf(name, sizeof(name), "malloc %s", cls_name);
+			tst_hist_report(name, &h);
+		}
+
+		tst_hist_init(&h);
+		for (i = 0; i < num_thrd; i++)
+			tst_hist_merge(&h, &stats[i].free_lat[cls]);
+		if (h.count) {
+			snprintf(name, sizeof(name), "free %s", cls_name);
+			tst_hist_report(name, &h);
+		}
+	}
+
+	for (i = 0; i < num_thrd; i++) {
+		nr_failed += stats[i].nr_failed;
+
+		if (!verbose)
+			continue;
+
+		tst_hist_init(&h);
+		for (cls = 0; cls < NR_SIZE_CLASSES; cls++)
+			tst_hist_merge(&h, &stats[i].malloc_lat[cls]);
+		snprintf(name, sizeof(name), "thread %i malloc", i);
+		tst_hist_report(name, &h);
+
+		tst_hist_init(&h);
+		for (cls = 0; cls < NR_SIZE_CLASSES; cls++)
+			tst_hist_merge(&h, &stats[i].free_lat[cls]);
+		snprintf(name, sizeof(name), "thread %i free", i);
+		tst_hist_report(name, &h);
+	}
+
+	tst_resm(TINFO, "%i threads finished in %.2fs, %lu failed mallocs",
+		 num_thrd, elapsed / 1000000000.0, nr_failed);
+
+	tst_resm(TINFO, "peak rss=+%luKB vsz=+%luKB live=%luKB overhead=%ld%%",
+		 peak_rss / 1024, peak_sample.vsz / 1024,
+		 peak_sample.live / 1024,
+		 overhead_pct(peak_sample.vsz, peak_sample.live));
+
+	if (!read_sample(&end)) {
+		sample_delta(&end);
+		tst_resm(TINFO, "retained after free rss=+%luKB vsz=+%luKB",
+			 end.rss / 1024, end.vsz / 1024);
+	}
+}
+
+/******************************************************************************/
+/* Function:	allocator_name						      */
+/*									      */
+/* Description:	Returns the path of the object malloc() resolves to.          */
+/******************************************************************************/
+static const char *allocator_name(void)
+{
+	Dl_info info;
+	void *sym;
+
+	sym = dlsym(RTLD_DEFAULT, "malloc");
+	if (sym && dladdr(sym, &info) && info.dli_fname)
+		return info.dli_fname;
+
+	return "unknown";
+}
+
+/******************************************************************************/
+/* Function:	run_allocators						      */
+/*									      */
+/* Description:	Reruns this program once for each library in the comma       */
+/*		separated list with LD_PRELOAD pointing to it, one after      */
+/*		another so that the runs do not compete for memory.           */
+/*									      */
+/* Return:	-1 if any of the runs failed, 0 otherwise                     */
+/******************************************************************************/
+static int run_allocators(char *libs, char **argv)
+{
+	char *lib, *saveptr = NULL;
+	int status, ret = 0;
+	pid_t pid;
+
+	for (lib = strtok_r(libs, ",", &saveptr); lib;
+	     lib = strtok_r(NULL, ",", &saveptr)) {
+		fflush(stdout);
+
+		pid = fork();
+		if (pid < 0) {
+			perror("main(): fork()");
+			return -1;
+		}
+
+		if (!pid) {
+			setenv(CHILD_ENV, lib, 1);
+			if (strcmp(lib, "glibc"))
+				setenv("LD_PRELOAD", lib, 1);
+			else
+				unsetenv("LD_PRELOAD");
+			execv("/proc/self/exe", argv);
+			perror("main(): execv()");
+			exit(-1);
+		}
+
+		if (waitpid(pid, &status, 0) < 0) {
+			perror("main(): waitpid()");
+			return -1;
+		}
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "main(): run with %s failed, status %x\n",
+				lib, status);
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
 /******************************************************************************/
 /*								 	      */
 /* Function:	main							      */
@@ -292,14 +660,17 @@ int main(int argc,		/* number of input parameters                 */
 	 char **argv)
 {				/* pointer to the command line arguments.     */
 	int c;			/* command line options                       */
-	int num_thrd = MAXT;	/* number of threads to create                */
 	int thrd_ndx;		/* index into the array of thread ids         */
 	pthread_t *thrdid;	/* the threads                                */
 	extern int optopt;	/* options to the program                     */
 	struct sembuf sop[1];
+	pthread_t sampler_thrd;
+	unsigned long long start;
+	char *libs = NULL;
+	int arenas = 0;
 	int ret = 0;
 
-	while ((c = getopt(argc, argv, "hl:t:")) != -1) {
+	while ((c = getopt(argc, argv, "hl:t:a:L:m:v")) != -1) {
 		switch (c) {
 		case 'h':
 			usage(argv[0]);
@@ -322,14 +693,51 @@ int main(int argc,		/* number of input parameters                 */
 				num_thrd = MAXT;
 			}
 			break;
+		case 'a':
+			if ((arenas = atoi(optarg)) < 1)
+				OPT_MISSING(argv[0], optopt);
+			break;
+		case 'L':
+			libs = optarg;
+			break;
+		case 'm':
+			if ((sample_ms = atoi(optarg)) < 1)
+				OPT_MISSING(argv[0], optopt);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
 		default:
 			usage(argv[0]);
 			break;
 		}
 	}
 
+	if (libs && !getenv(CHILD_ENV))
+		exit(run_allocators(libs, argv));
+
+	if (arenas) {
+#ifdef M_ARENA_MAX
+		if (!mallopt(M_ARENA_MAX, arenas))
+			fprintf(stderr, "main(): mallopt(M_ARENA_MAX) failed\n");
+#else
+		fprintf(stdout, "WARNING: M_ARENA_MAX not supported\n");
+#endif
+	}
+
+	tst_resm(TINFO, "allocator %s (malloc from %s)",
+		 getenv(CHILD_ENV) ? getenv(CHILD_ENV) : "default",
+		 allocator_name());
+
 	dprt(("number of times to loop in the thread = %d\n", num_loop));
 
+	stats = mmap(NULL, sizeof(*stats) * num_thrd, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {
+		perror("main(): mmap() stats");
+		return 1;
+	}
+
 	thrdid = malloc(sizeof(pthread_t) * num_thrd);
 	if (thrdid == NULL) {
 		perror("main(): allocating space for thrdid[] malloc()");
@@ -350,6 +758,12 @@ int main(int argc,		/* number of input parameters                 */
 		goto out;
 	}
 
+	if (pthread_create(&sampler_thrd, NULL, sampler, NULL)) {
+		perror("main(): pthread_create() sampler");
+		ret = -1;
+		goto out;
+	}
+
 	for (thrd_ndx = 0; thrd_ndx < num_thrd; thrd_ndx++) {
 		if (pthread_create(&thrdid[thrd_ndx], NULL, alloc_mem,
 				   (void *)(uintptr_t) thrd_ndx)) {
@@ -367,6 +781,12 @@ int main(int argc,		/* number of input parameters                 */
 	}
 	my_yield();
 
+	/* thread stacks are mapped now, start counting from here */
+	if (read_sample(&base_sample))
+		perror("main(): reading /proc/self/statm");
+	sampling = 1;
+	start = now_ns();
+
 	sop[0].sem_op = -1;
 	if (semop(semid, sop, 1) == -1) {
 		perror("semop");
@@ -393,8 +813,18 @@ int main(int argc,		/* number of input parameters                 */
 		}
 		my_yield();
 	}
+
+	/* stop the sampler before reading what it collected */
+	sampling_done = 1;
+	if (pthread_join(sampler_thrd, NULL) != 0) {
+		perror("main(): pthread_join() sampler");
+		ret = -1;
+		goto out;
+	}
+	report_stats(now_ns() - start);
 	printf("main(): test passed.\n");
 out:
+	sampling_done = 1;
 	if (semctl(semid, 0, IPC_RMID) == -1) {
 		perror("semctl\n");
 		ret = -1;
@@ -45,7 +45,8 @@ int main(int argc, char *argv[])
 {
 	int lc;
 
-	tst_parse_opts(argc, argv, NULL, NULL);
+	tst_parse_opts(argc, argv, oom_options, oom_usage);
+	check_oom_options();
 
 #if __WORDSIZE == 32
 	tst_brkm(TCONF, NULL, "test is not designed for 32-bit system.");
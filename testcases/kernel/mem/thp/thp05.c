@@ -59,12 +59,14 @@ int TST_TOTAL = 1;
 option_t thp_options[] = {
 	{"n:", &opt_nr_children, &opt_nr_children_str},
 	{"N:", &opt_nr_thps, &opt_nr_thps_str},
+	{"b", &opt_thp_bench, NULL},
 	{NULL, NULL, NULL}
 };
 
 static int pre_thp_scan_sleep_millisecs;
 static int pre_thp_alloc_sleep_millisecs;
 static char pre_thp_enabled[BUFSIZ];
+static int numa;
 
 int main(int argc, char *argv[])
 {
@@ -84,6 +86,9 @@ int main(int argc, char *argv[])
 	for (lc = 0; TEST_LOOPING(lc); lc++) {
 		tst_count = 0;
 
+		if (!numa)
+			goto bench;
+
 		tst_resm(TINFO, "THP on MPOL_BIND mempolicy...");
 		test_transparent_hugepage(nr_children, nr_thps, 1, MPOL_BIND);
 
@@ -94,6 +99,10 @@ int main(int argc, char *argv[])
 		tst_resm(TINFO, "THP on MPOL_PREFERRED mempolicy...");
 		test_transparent_hugepage(nr_children, nr_thps, 1,
 					  MPOL_PREFERRED);
+
+bench:
+		if (opt_thp_bench)
+			bench_transparent_hugepage(nr_thps);
 	}
 
 	cleanup();
@@ -107,8 +116,12 @@ void setup(void)
 	if (access(PATH_THP, F_OK) == -1)
 		tst_brkm(TCONF, NULL, "THP not enabled in kernel?");
 
-	if (!is_numa(NULL))
+	/* the measurement with -b does not depend on NUMA */
+	numa = is_numa(NULL);
+	if (!numa && !opt_thp_bench)
 		tst_brkm(TCONF, NULL, "The case need a NUMA system.");
+	if (!numa)
+		tst_resm(TINFO, "Not a NUMA system, only measuring THP");
 
 	SAFE_FILE_SCANF(NULL, PATH_KHPD "scan_sleep_millisecs",
 			"%d", &pre_thp_scan_sleep_millisecs);
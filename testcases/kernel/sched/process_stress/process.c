@@ -45,7 +45,12 @@
 #include <sys/shm.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <stdint.h>
 #include "lapi/semun.h"
+#include "linux_syscall_numbers.h"
 
 /* indexes into environment variable array */
 #define ADBG 0
@@ -138,6 +143,8 @@ int sem_count;			/* counter semaphore */
 int sem_lock;			/* locks access to counter semaphore */
 int shmid;			/* global shared memory id varible */
 int procgrp;			/* process group id */
+int cflag;			/* clone3/pidfd tree instead of SysV IPC */
+int eflag;			/* leaves exec themselves in clone3 mode */
 
 timer_t timer;			/* timer structure */
 
@@ -184,6 +191,8 @@ void severe(char *fmt, ...);
 Pinfo *shmgetseg(void);
 int spawn(int val);
 unsigned long sumit(int B, int D);
+int tree_bench(char *argv0);
+void tree_exec_leaf(char *argv[]);
 
 /*
  *  Prints out the data structures in shared memory.
@@ -906,7 +915,7 @@ void parse_args(int argc, char *argv[])
 	/* DVAL:        0  1     2      3   4  5  6  7  8  9  10 11 */
 	int limits[] = { -1, -1, MAXBVAL, 17, 8, 5, 4, 3, 2, 2, 2, 2 };
 
-	while ((opt = getopt(argc, argv, "b:d:ft:D?")) != EOF) {
+	while ((opt = getopt(argc, argv, "b:cd:eft:D?")) != EOF) {
 		switch (opt) {
 		case 'b':
 			if (bflag)
@@ -943,6 +952,12 @@ void parse_args(int argc, char *argv[])
 		case 'f':
 			fflag = 1;
 			break;
+		case 'c':
+			cflag = 1;
+			break;
+		case 'e':
+			eflag = 1;
+			break;
 		case 'D':
 			AUSDEBUG = 1;
 			break;
@@ -985,15 +1000,24 @@ follows:\n\t\tdepth\tbreadth\ttotal\n", sumit(BVAL, DVAL));
 		exit(1);
 	}
 
+	if (eflag && !cflag) {
+		errflag++;
+		fprintf(stderr, "-e can be used only together with -c\n");
+	}
+
 	if (errflag) {
 		fprintf(stderr,
-			"usage: %s [-b number] [-d number] [-t number] \n",
+			"usage: %s [-b number] [-d number] [-t number] [-c [-e]]\n",
 			argv[0]);
 		fprintf(stderr, "where:\n");
 		fprintf(stderr,
 			"\t-b number\tnumber of children each parent will spawn ( > 1)\n");
 		fprintf(stderr, "\t-d number\tdepth of process tree ( > 1)\n");
 		fprintf(stderr, "\t-t\t\tset timeout value\n");
+		fprintf(stderr,
+			"\t-c\t\tbuild the tree with clone3/pidfd and futexes,\n"
+			"\t\t\treport fork/exit rates per level\n");
+		fprintf(stderr, "\t-e\t\tleaves exec themselves, report exec rate\n");
 		fprintf(stderr, " SEVERE : Command line parameter error.\n");
 		exit(1);
 	}
@@ -1220,11 +1244,390 @@ void doit(void)
 	}
 }
 
+/*
+ * clone3/pidfd mode (-c)
+ *
+ * The SysV semaphores and message queues used above serialize the whole
+ * tree and limit it to SEMMSL processes.  In this mode each node creates
+ * its children with clone3(CLONE_PIDFD), every node bumps a futex counter
+ * in shared memory once its subtree exists, the initial process releases
+ * the leaves through a second futex and each parent reaps its children
+ * through their pidfds.  Creation and exit (and with -e exec) rates are
+ * reported per tree level.
+ */
+
+#define TREE_MAXLEVELS 32
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+/* kernel struct clone_args, CLONE_ARGS_SIZE_VER0 */
+struct tree_clone_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+};
+
+struct tree_level {
+	long long fork_first;	/* earliest clone of a node at this level */
+	long long fork_last;	/* latest node of this level running */
+	long long exec_first;	/* earliest execve() of a leaf */
+	long long exec_last;	/* latest leaf back in main() */
+	long long exit_last;	/* latest node of this level reaped */
+	volatile int created;
+	volatile int execed;
+	volatile int exited;
+	volatile int failed;
+};
+
+struct tree_ctl {
+	volatile int ready;	/* nodes whose subtree has been created */
+	volatile int expected;	/* nodes expected, lowered on clone failure */
+	volatile int release;	/* set once by the initial process */
+	long long release_ns;
+	struct tree_level lvl[TREE_MAXLEVELS];
+};
+
+static struct tree_ctl *tctl;
+static int tree_fd = -1;
+/* per-node child table, BVAL entries; each process works on its own copy */
+static pid_t *tree_pids;
+static int *tree_pidfds;
+
+static long long tree_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void tree_min(long long *p, long long val)
+{
+	long long old;
+
+	while ((old = *p) == 0 || val < old) {
+		if (__sync_bool_compare_and_swap(p, old, val))
+			break;
+	}
+}
+
+static void tree_max(long long *p, long long val)
+{
+	long long old;
+
+	while (val > (old = *p)) {
+		if (__sync_bool_compare_and_swap(p, old, val))
+			break;
+	}
+}
+
+static void tree_wake(volatile int *addr)
+{
+	syscall(__NR_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void tree_wait(volatile int *addr, int val, long long timeout_ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = timeout_ns / 1000000000LL;
+	ts.tv_nsec = timeout_ns % 1000000000LL;
+	syscall(__NR_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void tree_ready(void)
+{
+	if (__sync_add_and_fetch(&tctl->ready, 1) >= tctl->expected)
+		tree_wake(&tctl->ready);
+}
+
+/*
+ * Returns pid of the child (0 in the child), stores pidfd or -1 if the
+ * kernel does not support clone3() or pidfd_open().
+ */
+static pid_t tree_clone(int *pidfd)
+{
+	static int no_clone3;
+	struct tree_clone_args args;
+	pid_t pid;
+
+	*pidfd = -1;
+
+	if (!no_clone3) {
+		memset(&args, 0, sizeof(args));
+		args.flags = CLONE_PIDFD;
+		args.pidfd = (uintptr_t)pidfd;
+		args.exit_signal = SIGCHLD;
+
+		pid = syscall(__NR_clone3, &args, sizeof(args));
+		if (pid != -1 || errno != ENOSYS)
+			return pid;
+
+		no_clone3 = 1;
+	}
+
+	pid = fork();
+	if (pid > 0)
+		*pidfd = syscall(__NR_pidfd_open, pid, 0);
+
+	return pid;
+}
+
+static int tree_reap(pid_t pid, int pidfd)
+{
+	siginfo_t info;
+	int status;
+
+	if (pidfd != -1) {
+		while (waitid(P_PIDFD, pidfd, &info, WEXITED) == -1) {
+			if (errno != EINTR)
+				return -1;
+		}
+		close(pidfd);
+		return info.si_code == CLD_EXITED ? info.si_status : 1;
+	}
+
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static void tree_leaf(void)
+{
+	while (!tctl->release)
+		tree_wait(&tctl->release, 0, 1000000000LL);
+
+	exit(0);
+}
+
+static int tree_node(int level, char *argv0)
+{
+	struct tree_level *lv = &tctl->lvl[level];
+	pid_t *pids = tree_pids;
+	int *pidfds = tree_pidfds;
+	int i, n = 0, rc = 0;
+	char fdstr[16], lvlstr[16], tsstr[32];
+	long long now;
+
+	tree_max(&lv->fork_last, tree_ns());
+	__sync_add_and_fetch(&lv->created, 1);
+
+	if (level == DVAL) {
+		tree_ready();
+		if (eflag) {
+			now = tree_ns();
+			tree_min(&lv->exec_first, now);
+			sprintf(fdstr, "%d", tree_fd);
+			sprintf(lvlstr, "%d", level);
+			sprintf(tsstr, "%lld", now);
+			execl("/proc/self/exe", argv0, "-X", fdstr, lvlstr,
+			      tsstr, (char *)NULL);
+			perror("execl");
+			exit(1);
+		}
+		tree_leaf();
+	}
+
+	for (i = 0; i < BVAL; i++) {
+		tree_min(&tctl->lvl[level + 1].fork_first, tree_ns());
+		pids[n] = tree_clone(&pidfds[n]);
+		if (pids[n] == 0) {
+			/* pidfds from clone3() are not close-on-exec */
+			for (i = 0; i < n; i++) {
+				if (pidfds[i] != -1)
+					close(pidfds[i]);
+			}
+			exit(tree_node(level + 1, argv0));
+		}
+		if (pids[n] == -1) {
+			/* the subtree will never report ready */
+			__sync_add_and_fetch(&tctl->lvl[level + 1].failed, 1);
+			__sync_sub_and_fetch(&tctl->expected,
+					     sumit(BVAL, DVAL - level - 1));
+			tree_wake(&tctl->ready);
+			rc = 1;
+			continue;
+		}
+		n++;
+	}
+
+	tree_ready();
+
+	for (i = 0; i < n; i++) {
+		if (tree_reap(pids[i], pidfds[i]))
+			rc = 1;
+		tree_max(&tctl->lvl[level + 1].exit_last, tree_ns());
+		__sync_add_and_fetch(&tctl->lvl[level + 1].exited, 1);
+	}
+
+	return rc;
+}
+
+/*
+ * Entry point of a leaf that re-executed itself:
+ * argv[] = { argv0, "-X", shared memory fd, level, time before execve() }
+ */
+void tree_exec_leaf(char *argv[])
+{
+	struct tree_level *lv;
+	int level;
+
+	tree_fd = atoi(argv[2]);
+	level = atoi(argv[3]);
+
+	tctl = mmap(NULL, sizeof(*tctl), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    tree_fd, 0);
+	if (tctl == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	lv = &tctl->lvl[level];
+	tree_max(&lv->exec_last, tree_ns());
+	__sync_add_and_fetch(&lv->execed, 1);
+
+	tree_leaf();
+}
+
+static double tree_rate(int count, long long first, long long last)
+{
+	if (count <= 0 || last <= first)
+		return 0;
+
+	return count / ((last - first) / 1000000000.0);
+}
+
+int tree_bench(char *argv0)
+{
+	char fname[] = "/tmp/process_stress.XXXXXX";
+	struct tree_level *lv;
+	long long start, deadline;
+	pid_t pid;
+	int pidfd, rc, ready, i, failed = 0;
+
+	if (DVAL >= TREE_MAXLEVELS) {
+		fprintf(stderr, " SEVERE : depth must be less than %d\n",
+			TREE_MAXLEVELS);
+		exit(1);
+	}
+
+	nodesum = sumit(BVAL, DVAL);
+	printf("clone3 tree: breadth %d depth %d, %d processes\n", BVAL, DVAL,
+	       nodesum);
+	fflush(stdout);
+
+	/* a file, not anonymous memory, so that re-executed leaves can map it */
+	tree_fd = mkstemp(fname);
+	if (tree_fd == -1) {
+		perror("mkstemp");
+		exit(1);
+	}
+	unlink(fname);
+
+	if (ftruncate(tree_fd, sizeof(*tctl))) {
+		perror("ftruncate");
+		exit(1);
+	}
+
+	tctl = mmap(NULL, sizeof(*tctl), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    tree_fd, 0);
+	if (tctl == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	tctl->expected = nodesum;
+
+	tree_pids = malloc(BVAL * sizeof(*tree_pids));
+	tree_pidfds = malloc(BVAL * sizeof(*tree_pidfds));
+	if (!tree_pids || !tree_pidfds) {
+		perror("malloc");
+		exit(1);
+	}
+
+	start = tree_ns();
+	/* as with setitimer() above, zero means no timeout */
+	deadline = TVAL ? start + TVAL * 60 * 1000000000LL : 0;
+
+	tctl->lvl[0].fork_first = start;
+	pid = tree_clone(&pidfd);
+	if (pid == 0) {
+		setpgid(0, 0);
+		exit(tree_node(0, argv0));
+	}
+	if (pid == -1) {
+		perror("clone3");
+		exit(1);
+	}
+	setpgid(pid, pid);
+
+	while ((ready = tctl->ready) < tctl->expected) {
+		if (deadline && tree_ns() > deadline) {
+			fprintf(stderr, " SEVERE : timed out, %d of %d "
+				"processes ready\n", ready, tctl->expected);
+			killpg(pid, SIGKILL);
+			tree_reap(pid, pidfd);
+			exit(1);
+		}
+		tree_wait(&tctl->ready, ready, 100000000LL);
+	}
+
+	tctl->release_ns = tree_ns();
+	tctl->release = 1;
+	tree_wake(&tctl->release);
+
+	rc = tree_reap(pid, pidfd);
+	tctl->lvl[0].exit_last = tree_ns();
+	tctl->lvl[0].exited = 1;
+
+	printf("created %d processes in %.3fs, exited in %.3fs\n",
+	       tctl->ready, (tctl->release_ns - start) / 1000000000.0,
+	       (tctl->lvl[0].exit_last - tctl->release_ns) / 1000000000.0);
+	printf("level    nodes    failed       fork/s       exec/s       exit/s\n");
+
+	for (i = 0; i <= DVAL; i++) {
+		lv = &tctl->lvl[i];
+		failed += lv->failed;
+		printf("%5d %8d %9d %12.0f %12.0f %12.0f\n", i, lv->created,
+		       lv->failed,
+		       tree_rate(lv->created, lv->fork_first, lv->fork_last),
+		       tree_rate(lv->execed, lv->exec_first, lv->exec_last),
+		       tree_rate(lv->exited, tctl->release_ns, lv->exit_last));
+	}
+
+	if (rc || failed) {
+		fprintf(stderr, " SEVERE : %d clone3 failures, tree exit %d\n",
+			failed, rc);
+		exit(1);
+	}
+
+	printf("Test exiting with SUCCESS\n");
+	return 0;
+}
+
 /* main */
 int main(int argc, char *argv[])
 {
 	extern Pinfo *shmaddr;	/* start address of shared memory */
 
+	/* re-executed leaf of the clone3 tree */
+	if (argc == 5 && !strcmp(argv[1], "-X"))
+		tree_exec_leaf(argv);
+
 	prtln();
 	getenv_val();		/* Get and initialize all environment variables */
 	prtln();
@@ -1244,6 +1647,10 @@ int main(int argc, char *argv[])
 
 	parse_args(argc, argv);	/* Get all command line arguments */
 	dprt("value of BVAL = %d, value of DVAL = %d\n", BVAL, DVAL);
+
+	if (cflag)
+		return tree_bench(argv[0]);
+
 	nodesum = sumit(BVAL, DVAL);
 #ifdef _LINUX
 	if (nodesum > 250) {
@@ -22,6 +22,9 @@
 /*
  *  FILE        : pth_str01.c
  *  DESCRIPTION : create a tree of threads
+ *                With -S the tree is instead rebuilt for every depth from 1
+ *                to -d and pthread_create()/start/join latencies and the
+ *                thread creation rate are reported for each step.
  *  HISTORY:
  *    04/09/2001 Paul Larson (plars@us.ibm.com)
  *      -Ported
@@ -35,8 +38,11 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <limits.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include "test.h"
+#include "tst_hist.h"
 #include "pth_str01.h"
 
 int depth = 3;
@@ -44,6 +50,12 @@ int breadth = 4;
 int timeout = 30;		/* minutes */
 int cdepth;			/* current depth */
 int debug = 0;
+int sweep = 0;			/* -S latency sweep mode */
+int loops = 1;			/* trees built per sweep step */
+int use_pool = 0;		/* -m preallocated stack pool */
+size_t stack_size = 0;		/* bytes, 0 = library default */
+size_t guard_size = 0;		/* bytes */
+int guard_set = 0;
 
 c_info *child_info;		/* pointer to info array */
 int node_count;			/* number of nodes created so far */
@@ -78,8 +90,9 @@ static void parse_args(int argc, char *argv[])
 {
 	int opt, errflag = 0;
 	int bflag = 0, dflag = 0, tflag = 0;
+	long kb;
 
-	while ((opt = getopt(argc, argv, "b:d:t:Dh?")) != EOF) {
+	while ((opt = getopt(argc, argv, "b:d:t:g:mn:s:SDh?")) != EOF) {
 		switch (opt) {
 		case 'b':
 			if (bflag)
@@ -111,6 +124,30 @@ static void parse_args(int argc, char *argv[])
 					errflag++;
 			}
 			break;
+		case 'g':
+			kb = atol(optarg);
+			if (kb < 0)
+				errflag++;
+			guard_size = (size_t)kb * 1024;
+			guard_set = 1;
+			break;
+		case 'm':
+			use_pool = 1;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0)
+				errflag++;
+			break;
+		case 's':
+			kb = atol(optarg);
+			if (kb <= 0 || (size_t)kb * 1024 < PTHREAD_STACK_MIN)
+				errflag++;
+			stack_size = (size_t)kb * 1024;
+			break;
+		case 'S':
+			sweep = 1;
+			break;
 		case 'D':
 			debug = 1;
 			break;
@@ -121,9 +158,13 @@ static void parse_args(int argc, char *argv[])
 		}
 	}
 
+	if (use_pool && !sweep)
+		errflag++;
+
 	if (errflag) {
 		fprintf(stderr,
-			"usage: %s [-b <num>] [-d <num>] [-t <num>] [-D]",
+			"usage: %s [-b <num>] [-d <num>] [-t <num>] [-D]"
+			" [-S [-n <num>] [-m]] [-s <kb>] [-g <kb>]",
 			argv[0]);
 		fprintf(stderr, " where:\n");
 		fprintf(stderr, "\t-b <num>\tbreadth of child nodes\n");
@@ -131,6 +172,12 @@ static void parse_args(int argc, char *argv[])
 		fprintf(stderr,
 			"\t-t <num>\ttimeout for child communication (in minutes)\n");
 		fprintf(stderr, "\t-D\t\tdebug mode on\n");
+		fprintf(stderr, "\t-S\t\tsweep depth 1..d and report "
+			"create/start/join latencies\n");
+		fprintf(stderr, "\t-n <num>\ttrees built per sweep step\n");
+		fprintf(stderr, "\t-m\t\tuse a preallocated mmap stack pool\n");
+		fprintf(stderr, "\t-s <kb>\t\tthread stack size\n");
+		fprintf(stderr, "\t-g <kb>\t\tstack guard size\n");
 		testexit(1);
 	}
 
@@ -539,6 +586,280 @@ int doit(c_info * parent)
 
 }
 
+/*
+ * Sweep mode
+ *
+ * The tree is laid out as an implicit breadth-ary heap: the children of
+ * node i are nodes i * breadth + 1 .. i * breadth + breadth.  Every
+ * interior node creates its children, joins them and records, per child,
+ * the pthread_create() call time, the time from the create call until
+ * the child runs and the time from the child's exit until the join
+ * returns.  Each interior thread keeps private histograms that are merged
+ * into the step totals once it is done, so the timed sections never
+ * contend on the totals.
+ */
+struct bench_node {
+	pthread_t tid;
+	void *stack;
+	int level;
+	int depth;
+	unsigned long long create_ns;
+	unsigned long long start_ns;
+	unsigned long long exit_ns;
+};
+
+struct bench_hists {
+	struct tst_hist create;
+	struct tst_hist start;
+	struct tst_hist join;
+};
+
+static struct bench_node *bnodes;
+static struct bench_hists bench_total;
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Stacks for -m are carved out of a single mapping up front, each slot
+ * with its own PROT_NONE guard below the stack, and recycled through a
+ * free list so that thread creation never has to mmap() a new stack.
+ */
+static char *pool_base;
+static size_t pool_slot;
+static int *pool_free;
+static int pool_nfree;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int pool_init(int n)
+{
+	size_t page = getpagesize();
+	size_t guard = guard_set ? guard_size : page;
+	int i;
+
+	if (!stack_size)
+		stack_size = 256 * 1024;
+
+	guard = (guard + page - 1) & ~(page - 1);
+	stack_size = (stack_size + page - 1) & ~(page - 1);
+	pool_slot = guard + stack_size;
+
+	pool_base = mmap(NULL, pool_slot * n, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			 -1, 0);
+	if (pool_base == MAP_FAILED) {
+		tst_resm(TINFO, "mmap stack pool: %s", strerror(errno));
+		return -1;
+	}
+
+	pool_free = malloc(n * sizeof(int));
+	if (pool_free == NULL) {
+		perror("malloc pool_free");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (guard && mprotect(pool_base + i * pool_slot, guard,
+				      PROT_NONE)) {
+			tst_resm(TINFO, "mprotect stack guard: %s",
+				 strerror(errno));
+			return -1;
+		}
+		pool_free[i] = n - 1 - i;
+	}
+	pool_nfree = n;
+
+	tst_resm(TINFO, "Stack pool: %d stacks of %zu kB + %zu kB guard",
+		 n, stack_size / 1024, guard / 1024);
+
+	return 0;
+}
+
+static void *pool_get(void)
+{
+	void *stack = NULL;
+
+	pthread_mutex_lock(&pool_mutex);
+	if (pool_nfree > 0)
+		stack = pool_base + pool_free[--pool_nfree] * pool_slot +
+			(pool_slot - stack_size);
+	pthread_mutex_unlock(&pool_mutex);
+
+	return stack;
+}
+
+static void pool_put(void *stack)
+{
+	pthread_mutex_lock(&pool_mutex);
+	pool_free[pool_nfree++] = ((char *)stack - pool_base) / pool_slot;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+static int bench_attr(pthread_attr_t *a, struct bench_node *node)
+{
+	int rc;
+
+	if ((rc = pthread_attr_init(a)))
+		return rc;
+
+	if (use_pool) {
+		node->stack = pool_get();
+		if (node->stack == NULL)
+			return EAGAIN;
+		return pthread_attr_setstack(a, node->stack, stack_size);
+	}
+
+	if (stack_size && (rc = pthread_attr_setstacksize(a, stack_size)))
+		return rc;
+
+	if (guard_set && (rc = pthread_attr_setguardsize(a, guard_size)))
+		return rc;
+
+	return 0;
+}
+
+static void *bench_doit(void *arg)
+{
+	struct bench_node *node = arg, *child;
+	struct bench_hists *h;
+	pthread_attr_t a;
+	unsigned long long t;
+	int rc, i, first;
+
+	node->start_ns = bench_ns();
+
+	if (node->level == node->depth)
+		goto done;
+
+	h = malloc(sizeof(*h));
+	if (h == NULL) {
+		perror("malloc bench_hists");
+		testexit(10);
+	}
+	tst_hist_init(&h->create);
+	tst_hist_init(&h->start);
+	tst_hist_init(&h->join);
+
+	first = (node - bnodes) * breadth + 1;
+
+	for (i = 0; i < breadth; i++) {
+		child = &bnodes[first + i];
+		child->level = node->level + 1;
+		child->depth = node->depth;
+
+		if ((rc = bench_attr(&a, child))) {
+			tst_resm(TINFO, "thread attributes: %s", strerror(rc));
+			testexit(17);
+		}
+
+		child->create_ns = bench_ns();
+		rc = pthread_create(&child->tid, &a, bench_doit, child);
+		t = bench_ns();
+		pthread_attr_destroy(&a);
+
+		if (rc) {
+			tst_resm(TINFO, "pthread_create (bench_doit): %s",
+				 strerror(rc));
+			testexit(3);
+		}
+		tst_hist_add(&h->create, t - child->create_ns);
+	}
+
+	for (i = 0; i < breadth; i++) {
+		child = &bnodes[first + i];
+
+		if ((rc = pthread_join(child->tid, NULL))) {
+			tst_resm(TINFO, "pthread_join (bench_doit): %s",
+				 strerror(rc));
+			testexit(4);
+		}
+		t = bench_ns();
+
+		tst_hist_add(&h->start, child->start_ns - child->create_ns);
+		tst_hist_add(&h->join, t - child->exit_ns);
+
+		if (use_pool)
+			pool_put(child->stack);
+	}
+
+	pthread_mutex_lock(&bench_mutex);
+	tst_hist_merge(&bench_total.create, &h->create);
+	tst_hist_merge(&bench_total.start, &h->start);
+	tst_hist_merge(&bench_total.join, &h->join);
+	pthread_mutex_unlock(&bench_mutex);
+
+	free(h);
+done:
+	node->exit_ns = bench_ns();
+	return NULL;
+}
+
+/*
+ * sweep_tree
+ *
+ * Build trees of depth 1 to depth, loops times each, and report the
+ * thread creation rate and latency distributions for every depth.
+ */
+static int sweep_tree(void)
+{
+	struct bench_node *root;
+	unsigned long long t0, elapsed;
+	int d, l, threads, rc, total = num_nodes(breadth, depth);
+
+	bnodes = calloc(total, sizeof(*bnodes));
+	if (bnodes == NULL) {
+		perror("malloc bnodes");
+		return 10;
+	}
+
+	if (use_pool && pool_init(total))
+		return 10;
+
+	tst_resm(TINFO, "Sweeping breadth %d, depth 1-%d, %d tree(s) per step",
+		 breadth, depth, loops);
+
+	root = &bnodes[0];
+
+	for (d = 1; d <= depth; d++) {
+		tst_hist_init(&bench_total.create);
+		tst_hist_init(&bench_total.start);
+		tst_hist_init(&bench_total.join);
+		threads = num_nodes(breadth, d) - 1;
+		elapsed = 0;
+
+		for (l = 0; l < loops; l++) {
+			root->level = 0;
+			root->depth = d;
+
+			t0 = bench_ns();
+			bench_doit(root);
+			elapsed += bench_ns() - t0;
+		}
+
+		tst_resm(TINFO, "depth %d: %d threads x %d in %.3f ms, "
+			 "%.0f threads/s", d, threads, loops, elapsed / 1e6,
+			 elapsed ? (double)threads * loops * 1e9 / elapsed : 0);
+		tst_hist_report("  pthread_create", &bench_total.create);
+		tst_hist_report("  create->run   ", &bench_total.start);
+		tst_hist_report("  exit->join    ", &bench_total.join);
+	}
+
+	rc = 0;
+	if (use_pool && pool_nfree != total) {
+		tst_resm(TINFO, "Stack pool leaked %d stacks",
+			 total - pool_nfree);
+		rc = 1;
+	}
+
+	return rc;
+}
+
 /*
  * main
  */
@@ -549,6 +870,9 @@ int main(int argc, char *argv[])
 
 	parse_args(argc, argv);
 
+	if (sweep)
+		testexit(sweep_tree());
+
 	/*
 	 * Initialize node mutex.
 	 */
@@ -660,6 +984,18 @@ int main(int argc, char *argv[])
 		testexit(18);
 	}
 
+	if (stack_size && (rc = pthread_attr_setstacksize(&attr, stack_size))) {
+		tst_resm(TINFO, "pthread_attr_setstacksize: %s\n",
+			 strerror(rc));
+		testexit(18);
+	}
+
+	if (guard_set && (rc = pthread_attr_setguardsize(&attr, guard_size))) {
+		tst_resm(TINFO, "pthread_attr_setguardsize: %s\n",
+			 strerror(rc));
+		testexit(18);
+	}
+
 	tst_resm(TINFO, "Creating root thread via pthread_create.");
 
 	if ((rc = pthread_create(&root_thread, &attr, (void *)doit, NULL))) {
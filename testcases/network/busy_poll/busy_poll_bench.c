@@ -0,0 +1,610 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * busy_poll_bench - TCP ping-pong latency with and without busy polling,
+ * without a remote host.
+ *
+ * A server thread echoes fixed size messages back to the main thread over
+ * loopback or, with -V, over a veth pair between two private network
+ * namespaces with GRO enabled, so that veth receives through NAPI and the
+ * sockets get a NAPI id to busy poll on.
+ *
+ * Every value from -b is run in two modes on both ends of the connection:
+ *
+ *   sockopt - blocking recv() with SO_BUSY_POLL set to the value
+ *   epoll   - nonblocking recv() and epoll_wait() with the busy poll time
+ *             of the epoll instance (EPIOCSPARAMS) set to the value, or the
+ *             net.core.busy_poll sysctl on kernels without EPIOCSPARAMS
+ *
+ * Value 0 is the baseline without busy polling. Each step reports the
+ * round trip rate, the RTT percentiles and the CPU time consumed by the
+ * client and the server thread per packet.
+ *
+ * Usage: busy_poll_bench [-V] [-m sockopt|epoll|both] [-b usecs,...]
+ *                        [-n round trips] [-s msg size]
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "safe_macros.h"
+#include "safe_net.h"
+#include "tst_hist.h"
+
+char *TCID = "busy_poll_bench";
+int TST_TOTAL = 1;
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL		46
+#endif
+
+#ifndef SO_INCOMING_NAPI_ID
+#define SO_INCOMING_NAPI_ID	56
+#endif
+
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+#define EPIOCSPARAMS		_IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+#define VETH_CLIENT		"bpv0"
+#define VETH_SERVER		"bpv1"
+#define VETH_CLIENT_IP		"10.23.1.1"
+#define VETH_SERVER_IP		"10.23.1.2"
+
+#define WARMUP_ROUNDS		100
+#define BUSY_POLL_BUDGET	8
+#define MAX_VALUES		32
+
+enum {
+	MODE_SOCKOPT = 1,
+	MODE_EPOLL = 2,
+};
+
+enum {
+	MSG_PING,
+	MSG_CONFIG,
+	MSG_STATS,
+	MSG_QUIT,
+};
+
+/* at the start of every message, the rest is padding */
+struct msg_hdr {
+	uint32_t type;
+	uint32_t mode;
+	uint64_t val;
+};
+
+struct end {
+	int fd;
+	int epfd;
+	char *buf;
+};
+
+static char *m_opt, *b_opt, *n_opt, *s_opt;
+static int V_flag, m_flag, b_flag, n_flag, s_flag;
+
+static option_t options[] = {
+	{"V", &V_flag, NULL},
+	{"m:", &m_flag, &m_opt},
+	{"b:", &b_flag, &b_opt},
+	{"n:", &n_flag, &n_opt},
+	{"s:", &s_flag, &s_opt},
+	{NULL, NULL, NULL}
+};
+
+static int modes = MODE_SOCKOPT | MODE_EPOLL;
+static int values[MAX_VALUES] = {0, 25, 50, 100};
+static int nr_values = 4;
+static int rounds = 10000;
+static int msg_size = 64;
+
+static const char busy_poll_sysctl[] = "/proc/sys/net/core/busy_poll";
+static int busy_poll_orig = -1;
+static int epoll_params_supported = 1;
+
+static pthread_barrier_t ready;
+static struct sockaddr_in server_addr;
+static pthread_t server_thread;
+
+static void setup(void);
+static void cleanup(void);
+static void help(void);
+
+static long long now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* veth only receives through NAPI with GRO or XDP enabled */
+static void gro_on(const char *ifname)
+{
+	struct ethtool_value ev = {.cmd = ETHTOOL_SGRO, .data = 1};
+	struct ifreq ifr;
+	int fd;
+
+	fd = SAFE_SOCKET(cleanup, AF_INET, SOCK_DGRAM, 0);
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ifr.ifr_data = (void *)&ev;
+
+	if (ioctl(fd, SIOCETHTOOL, &ifr))
+		tst_resm(TINFO | TERRNO, "failed to enable GRO on %s", ifname);
+
+	SAFE_CLOSE(cleanup, fd);
+}
+
+/*
+ * Runs in the server thread, which moves itself into a new netns and
+ * creates the veth pair with the client end in the netns of the main
+ * thread.
+ */
+static void veth_server_setup(void)
+{
+	char pid[32];
+	const char *const lo_up[] = {"ip", "link", "set", "lo", "up", NULL};
+	const char *const veth_add[] = {"ip", "link", "add", VETH_SERVER,
+		"type", "veth", "peer", "name", VETH_CLIENT, NULL};
+	const char *const veth_move[] = {"ip", "link", "set", VETH_CLIENT,
+		"netns", pid, NULL};
+	const char *const addr_add[] = {"ip", "addr", "add",
+		VETH_SERVER_IP "/24", "dev", VETH_SERVER, NULL};
+	const char *const link_up[] = {"ip", "link", "set", VETH_SERVER, "up",
+		NULL};
+
+	if (unshare(CLONE_NEWNET))
+		tst_brkm(TBROK | TERRNO, cleanup, "unshare(CLONE_NEWNET)");
+
+	snprintf(pid, sizeof(pid), "%d", getpid());
+
+	tst_run_cmd(cleanup, lo_up, NULL, NULL, 0);
+	tst_run_cmd(cleanup, veth_add, NULL, NULL, 0);
+	tst_run_cmd(cleanup, veth_move, NULL, NULL, 0);
+	gro_on(VETH_SERVER);
+	tst_run_cmd(cleanup, addr_add, NULL, NULL, 0);
+	tst_run_cmd(cleanup, link_up, NULL, NULL, 0);
+}
+
+static void veth_client_setup(void)
+{
+	const char *const addr_add[] = {"ip", "addr", "add",
+		VETH_CLIENT_IP "/24", "dev", VETH_CLIENT, NULL};
+	const char *const link_up[] = {"ip", "link", "set", VETH_CLIENT, "up",
+		NULL};
+
+	gro_on(VETH_CLIENT);
+	tst_run_cmd(cleanup, addr_add, NULL, NULL, 0);
+	tst_run_cmd(cleanup, link_up, NULL, NULL, 0);
+}
+
+static void end_init(struct end *e, int fd)
+{
+	struct epoll_event ev = {.events = EPOLLIN};
+	const int one = 1;
+
+	e->fd = fd;
+	e->buf = SAFE_MALLOC(cleanup, msg_size);
+	memset(e->buf, 'a', msg_size);
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+		tst_brkm(TBROK | TERRNO, cleanup, "setsockopt(TCP_NODELAY)");
+
+	e->epfd = epoll_create1(0);
+	if (e->epfd == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "epoll_create1()");
+
+	if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, fd, &ev))
+		tst_brkm(TBROK | TERRNO, cleanup, "epoll_ctl()");
+}
+
+static void end_fini(struct end *e)
+{
+	SAFE_CLOSE(cleanup, e->epfd);
+	SAFE_CLOSE(cleanup, e->fd);
+	free(e->buf);
+}
+
+static void set_busy_poll(struct end *e, int mode, int usecs)
+{
+	struct epoll_params params;
+	int val = mode == MODE_SOCKOPT ? usecs : 0;
+
+	if (setsockopt(e->fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)))
+		tst_brkm(TBROK | TERRNO, cleanup, "setsockopt(SO_BUSY_POLL)");
+
+	if (mode != MODE_EPOLL || !epoll_params_supported)
+		return;
+
+	memset(&params, 0, sizeof(params));
+	params.busy_poll_usecs = usecs;
+	params.busy_poll_budget = BUSY_POLL_BUDGET;
+
+	if (ioctl(e->epfd, EPIOCSPARAMS, &params))
+		tst_brkm(TBROK | TERRNO, cleanup, "ioctl(EPIOCSPARAMS)");
+}
+
+/* decided once in setup(), the threads only read it afterwards */
+static void probe_epoll_params(void)
+{
+	struct epoll_params params;
+	int epfd;
+
+	epfd = epoll_create1(0);
+	if (epfd == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "epoll_create1()");
+
+	memset(&params, 0, sizeof(params));
+	if (!ioctl(epfd, EPIOCSPARAMS, &params)) {
+		SAFE_CLOSE(NULL, epfd);
+		return;
+	}
+
+	if (errno != ENOTTY && errno != EINVAL)
+		tst_brkm(TBROK | TERRNO, NULL, "ioctl(EPIOCSPARAMS)");
+
+	SAFE_CLOSE(NULL, epfd);
+	tst_resm(TINFO, "EPIOCSPARAMS not supported, using %s",
+		 busy_poll_sysctl);
+	epoll_params_supported = 0;
+}
+
+static void send_msg(struct end *e)
+{
+	if (send(e->fd, e->buf, msg_size, MSG_NOSIGNAL) != msg_size)
+		tst_brkm(TBROK | TERRNO, cleanup, "send()");
+}
+
+static void recv_msg(struct end *e, int mode)
+{
+	struct epoll_event ev;
+	int flags = mode == MODE_EPOLL ? MSG_DONTWAIT : 0;
+	int off = 0, ret;
+
+	while (off < msg_size) {
+		ret = recv(e->fd, e->buf + off, msg_size - off, flags);
+		if (ret > 0) {
+			off += ret;
+			continue;
+		}
+
+		if (ret == -1 && errno == EAGAIN && mode == MODE_EPOLL) {
+			if (epoll_wait(e->epfd, &ev, 1, -1) == -1 &&
+			    errno != EINTR)
+				tst_brkm(TBROK | TERRNO, cleanup,
+					 "epoll_wait()");
+			continue;
+		}
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+
+		if (!ret)
+			errno = ECONNRESET;
+		tst_brkm(TBROK | TERRNO, cleanup, "recv()");
+	}
+}
+
+static void *server_fn(void *arg)
+{
+	struct msg_hdr *hdr;
+	struct end e;
+	long long cpu_start = 0, cpu;
+	int lfd, fd, mode = MODE_SOCKOPT;
+	socklen_t len = sizeof(server_addr);
+
+	(void)arg;
+
+	if (V_flag)
+		veth_server_setup();
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	inet_pton(AF_INET, V_flag ? VETH_SERVER_IP : "127.0.0.1",
+		  &server_addr.sin_addr);
+
+	lfd = SAFE_SOCKET(cleanup, AF_INET, SOCK_STREAM, 0);
+	SAFE_BIND(cleanup, lfd, (struct sockaddr *)&server_addr,
+		  sizeof(server_addr));
+	SAFE_LISTEN(cleanup, lfd, 1);
+	SAFE_GETSOCKNAME(cleanup, lfd, (struct sockaddr *)&server_addr, &len);
+
+	pthread_barrier_wait(&ready);
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "accept()");
+	SAFE_CLOSE(cleanup, lfd);
+
+	end_init(&e, fd);
+	hdr = (struct msg_hdr *)e.buf;
+
+	for (;;) {
+		recv_msg(&e, mode);
+
+		switch (hdr->type) {
+		case MSG_CONFIG:
+			mode = hdr->mode;
+			set_busy_poll(&e, mode, hdr->val);
+			cpu_start = now_ns(CLOCK_THREAD_CPUTIME_ID);
+		break;
+		case MSG_STATS:
+			cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+			hdr->val = cpu - cpu_start;
+			cpu_start = cpu;
+		break;
+		case MSG_QUIT:
+			end_fini(&e);
+			return NULL;
+		}
+
+		send_msg(&e);
+	}
+}
+
+static uint64_t request(struct end *e, int mode, uint32_t type,
+			uint32_t arg, uint64_t val)
+{
+	struct msg_hdr *hdr = (struct msg_hdr *)e->buf;
+
+	hdr->type = type;
+	hdr->mode = arg;
+	hdr->val = val;
+	send_msg(e);
+	recv_msg(e, mode);
+
+	return hdr->val;
+}
+
+static const char *mode_name(int mode)
+{
+	return mode == MODE_SOCKOPT ? "SO_BUSY_POLL" : "epoll busy poll";
+}
+
+static void run_step(struct end *e, int mode, int usecs)
+{
+	struct tst_hist lat;
+	long long start, end, cpu_start, cpu, t;
+	double client_cpu, server_cpu, pkts;
+	char name[64];
+	int i;
+
+	if (mode == MODE_EPOLL && !epoll_params_supported)
+		SAFE_FILE_PRINTF(cleanup, busy_poll_sysctl, "%d", usecs);
+
+	/* the server applies the new mode after it replied in the old one */
+	request(e, mode, MSG_CONFIG, mode, usecs);
+	set_busy_poll(e, mode, usecs);
+
+	for (i = 0; i < WARMUP_ROUNDS; i++)
+		request(e, mode, MSG_PING, 0, 0);
+
+	tst_hist_init(&lat);
+	request(e, mode, MSG_STATS, 0, 0);
+	cpu_start = now_ns(CLOCK_THREAD_CPUTIME_ID);
+	start = now_ns(CLOCK_MONOTONIC);
+
+	for (i = 0; i < rounds; i++) {
+		t = now_ns(CLOCK_MONOTONIC);
+		request(e, mode, MSG_PING, 0, 0);
+		tst_hist_add(&lat, now_ns(CLOCK_MONOTONIC) - t);
+	}
+
+	end = now_ns(CLOCK_MONOTONIC);
+	cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+	server_cpu = request(e, mode, MSG_STATS, 0, 0);
+	client_cpu = cpu - cpu_start;
+
+	pkts = 2.0 * rounds;
+
+	snprintf(name, sizeof(name), "%s %dus", mode_name(mode), usecs);
+	tst_resm(TINFO, "%s: %.0f round trips/s, CPU per packet: client "
+		 "%.2fus server %.2fus", name,
+		 rounds * 1000000000.0 / (end - start),
+		 client_cpu / pkts / 1000, server_cpu / pkts / 1000);
+	tst_hist_report(name, &lat);
+}
+
+static void check_napi_id(struct end *e)
+{
+	unsigned int napi_id = 0;
+	socklen_t len = sizeof(napi_id);
+
+	if (getsockopt(e->fd, SOL_SOCKET, SO_INCOMING_NAPI_ID, &napi_id,
+		       &len) || !napi_id) {
+		tst_resm(TINFO, "the socket has no NAPI id, busy polling has "
+			 "nothing to poll and only spins%s",
+			 V_flag ? "" : ", try -V");
+		return;
+	}
+
+	tst_resm(TINFO, "socket NAPI id %u", napi_id);
+}
+
+static void run(void)
+{
+	struct end e;
+	int fd, mode, i, ret;
+
+	ret = pthread_barrier_init(&ready, NULL, 2);
+	if (ret) {
+		tst_brkm(TBROK, cleanup, "pthread_barrier_init(): %s",
+			 tst_strerrno(ret));
+	}
+
+	ret = pthread_create(&server_thread, NULL, server_fn, NULL);
+	if (ret) {
+		tst_brkm(TBROK, cleanup, "pthread_create(): %s",
+			 tst_strerrno(ret));
+	}
+
+	pthread_barrier_wait(&ready);
+	pthread_barrier_destroy(&ready);
+
+	if (V_flag)
+		veth_client_setup();
+
+	fd = SAFE_SOCKET(cleanup, AF_INET, SOCK_STREAM, 0);
+	SAFE_CONNECT(cleanup, fd, (struct sockaddr *)&server_addr,
+		     sizeof(server_addr));
+	end_init(&e, fd);
+
+	for (mode = MODE_SOCKOPT; mode <= MODE_EPOLL; mode <<= 1) {
+		if (!(modes & mode))
+			continue;
+
+		for (i = 0; i < nr_values; i++) {
+			run_step(&e, mode, values[i]);
+			if (mode == MODE_SOCKOPT && !i)
+				check_napi_id(&e);
+		}
+	}
+
+	((struct msg_hdr *)e.buf)->type = MSG_QUIT;
+	send_msg(&e);
+
+	pthread_join(server_thread, NULL);
+	end_fini(&e);
+
+	tst_resm(TPASS, "busy poll benchmark completed");
+}
+
+int main(int argc, char *argv[])
+{
+	tst_parse_opts(argc, argv, options, help);
+
+	setup();
+
+	run();
+
+	cleanup();
+	tst_exit();
+}
+
+static void parse_values(void)
+{
+	char *str = strdup(b_opt), *tok, *save;
+
+	nr_values = 0;
+
+	for (tok = strtok_r(str, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (nr_values == MAX_VALUES)
+			tst_brkm(TBROK, NULL, "-b takes at most %d values",
+				 MAX_VALUES);
+		values[nr_values++] = SAFE_STRTOL(NULL, tok, 0, INT_MAX);
+	}
+
+	free(str);
+
+	if (!nr_values)
+		tst_brkm(TBROK, NULL, "-b needs at least one value");
+}
+
+static void setup(void)
+{
+	const char *const lo_up[] = {"ip", "link", "set", "lo", "up", NULL};
+
+	if (m_flag) {
+		if (!strcmp(m_opt, "sockopt"))
+			modes = MODE_SOCKOPT;
+		else if (!strcmp(m_opt, "epoll"))
+			modes = MODE_EPOLL;
+		else if (strcmp(m_opt, "both"))
+			tst_brkm(TBROK, NULL, "invalid -m '%s'", m_opt);
+	}
+
+	if (b_flag)
+		parse_values();
+	if (n_flag)
+		rounds = SAFE_STRTOL(NULL, n_opt, 1, INT_MAX);
+	if (s_flag)
+		msg_size = SAFE_STRTOL(NULL, s_opt, sizeof(struct msg_hdr),
+				       INT_MAX);
+
+	tst_require_root();
+
+	if (tst_kvercmp(3, 11, 0) < 0)
+		tst_brkm(TCONF, NULL, "test requires kernel 3.11 or newer");
+
+	if (access(busy_poll_sysctl, F_OK))
+		tst_brkm(TCONF, NULL, "busy poll not configured, "
+			 "CONFIG_NET_RX_BUSY_POLL");
+
+	if (modes & MODE_EPOLL)
+		probe_epoll_params();
+
+	SAFE_FILE_SCANF(NULL, busy_poll_sysctl, "%d", &busy_poll_orig);
+
+	tst_sig(NOFORK, DEF_HANDLER, cleanup);
+
+	/* keeps the veth pair and the addresses off the host */
+	if (V_flag) {
+		if (unshare(CLONE_NEWNET))
+			tst_brkm(TCONF | TERRNO, NULL, "unshare(CLONE_NEWNET)");
+		tst_run_cmd(NULL, lo_up, NULL, NULL, 0);
+	}
+
+	tst_resm(TINFO, "%s, %d byte messages, %d round trips per step",
+		 V_flag ? "veth between two netns" : "loopback", msg_size,
+		 rounds);
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+	if (busy_poll_orig != -1 && !epoll_params_supported)
+		FILE_PRINTF(busy_poll_sysctl, "%d", busy_poll_orig);
+}
+
+static void help(void)
+{
+	printf("  -V       Run over a veth pair between two private netns\n");
+	printf("  -m x     Mode: sockopt, epoll or both (default)\n");
+	printf("  -b x,..  Busy poll values in us (default 0,25,50,100)\n");
+	printf("  -n x     Round trips per step (default 10000)\n");
+	printf("  -s x     Message size (default 64)\n");
+}
@@ -31,8 +31,10 @@
  *
  * History:
  *	Oct 19 2005 - Created (Mitsuru Chinen)
+ *	Oct 19 2026 - Added epoll server mode
  *---------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
 #include "ns-traffic.h"
 
 /*
@@ -44,8 +46,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -77,8 +83,67 @@ struct server_info {
 	size_t lost_connection;	/* number of lost connection */
 	size_t small_sending;	/* if non-zero, in the small sending mode */
 	size_t window_scaling;	/* if non-zero, in the window scaling mode */
+	size_t event_loops;	/* if non-zero, number of epoll threads */
+	int reuse_port;		/* if non-zero, set SO_REUSEPORT */
 };
 
+/*
+ * Number of send() calls a connection may do before the other ready
+ * connections of the same event loop get their turn
+ */
+#define SEND_BUDGET	16
+
+/* Maximum number of events returned by one epoll_wait() */
+#define MAX_EVENTS	256
+
+/*
+ * Structure: connection
+ *
+ * Description:
+ *  This structure stores the state and the counters of a connection
+ *  handled by an event loop
+ */
+struct connection {
+	int sd;			/* socket descriptor */
+	int ready;		/* if non-zero, linked in the ready list */
+	struct timespec start;	/* time when the connection was accepted */
+	unsigned long long bytes;	/* number of the sent bytes */
+	struct connection *prev;	/* ready list */
+	struct connection *next;
+	struct connection *all_prev;	/* list of all the connections */
+	struct connection *all_next;
+};
+
+/*
+ * Structure: event_loop
+ *
+ * Description:
+ *  This structure stores the information of an epoll thread. Every thread
+ *  has its own SO_REUSEPORT listen socket, so the kernel spreads the new
+ *  connections over the threads.
+ */
+struct event_loop {
+	pthread_t thread;	/* thread id */
+	int id;			/* index of this event loop */
+	int listen_sd;		/* socket descriptor for listening */
+	int epoll_fd;		/* epoll instance */
+	struct server_info *info_p;	/* pointer to a server infomation */
+	struct connection ready;	/* head of the ready list */
+	struct connection all;	/* head of the list of all the connections */
+	size_t current_connection;	/* number of the current connection */
+	size_t max_connection;	/* maximum connection number */
+	size_t total_connection;	/* number of accepted connection */
+	size_t lost_connection;	/* number of lost connection */
+	unsigned long long bytes;	/* bytes sent by closed connection */
+	double min_rate;	/* minimum throughput of a connection [B/s] */
+	double max_rate;	/* maximum throughput of a connection [B/s] */
+	double sum_rate;	/* sum of throughput of connections [B/s] */
+	int ret;		/* return value of the thread */
+};
+
+char *sendbuf;			/* data sent by the event loops */
+int sendbuf_size;		/* size of the send buffer */
+
 /*
  * Function: usage()
  *
@@ -108,6 +173,8 @@ void usage(char *program_name, int exit_value)
 		"\t-c\twork in the concurrent server mode\n"
 		"\t-s\twork in the small sending mode\n"
 		"\t-w\twork in the window scaling mode\n"
+		"\t-e num\twork in the epoll mode with num threads\n"
+		"\t\t  0 : one thread per CPU\n"
 		"\t-o\tfilename where the server infomation is outputted\n"
 		"\t-d\twork in the debug mode\n"
 		"\t-h\tdisplay this usage\n"
@@ -247,6 +314,19 @@ void create_listen_socket(struct server_info *info_p)
 		       SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)))
 		fatal_error("setsockopt()");
 
+	/* Let the event loops listen on the same port */
+	if (info_p->reuse_port) {
+#ifdef SO_REUSEPORT
+		on = 1;
+		if (setsockopt(info_p->listen_sd,
+			       SOL_SOCKET, SO_REUSEPORT, &on, sizeof(int)))
+			fatal_error("setsockopt()");
+#else
+		fprintf(stderr, "SO_REUSEPORT is not supported\n");
+		exit(EXIT_FAILURE);
+#endif
+	}
+
 	/* Disable the Nagle algorithm, when small sending mode */
 	if (info_p->small_sending) {
 		on = 1;
@@ -268,7 +348,8 @@ void create_listen_socket(struct server_info *info_p)
 	freeaddrinfo(res);
 
 	/* Start to listen for connections */
-	if (listen(info_p->listen_sd, 5) < 0)
+	if (listen(info_p->listen_sd,
+		   info_p->event_loops ? SOMAXCONN : 5) < 0)
 		fatal_error("listen()");
 }
 
@@ -522,6 +603,444 @@ int handle_client(struct server_info *info_p)
 	return ret;
 }
 
+/*
+ * Function: ready_add()
+ *
+ * Descripton:
+ *  Link a connection to the tail of the ready list of an event loop
+ *
+ * Argument:
+ *  loop_p:	pointer to an event loop
+ *  conn_p:	pointer to a connection
+ *
+ * Return value:
+ *  None
+ */
+void ready_add(struct event_loop *loop_p, struct connection *conn_p)
+{
+	if (conn_p->ready)
+		return;
+
+	conn_p->ready = 1;
+	conn_p->next = &loop_p->ready;
+	conn_p->prev = loop_p->ready.prev;
+	loop_p->ready.prev->next = conn_p;
+	loop_p->ready.prev = conn_p;
+}
+
+/*
+ * Function: ready_del()
+ *
+ * Descripton:
+ *  Unlink a connection from the ready list
+ *
+ * Argument:
+ *  conn_p:	pointer to a connection
+ *
+ * Return value:
+ *  None
+ */
+void ready_del(struct connection *conn_p)
+{
+	if (!conn_p->ready)
+		return;
+
+	conn_p->ready = 0;
+	conn_p->prev->next = conn_p->next;
+	conn_p->next->prev = conn_p->prev;
+}
+
+/*
+ * Function: close_connection()
+ *
+ * Descripton:
+ *  Close a connection and add its throughput to the counters of the
+ *  event loop
+ *
+ * Argument:
+ *  loop_p:	pointer to an event loop
+ *  conn_p:	pointer to a connection
+ *  lost:	if non-zero, the connection failed
+ *
+ * Return value:
+ *  None
+ */
+void close_connection(struct event_loop *loop_p, struct connection *conn_p,
+		      int lost)
+{
+	struct timespec now;	/* time when the connection is closed */
+	double elapsed;		/* lifetime of the connection [sec] */
+	double rate;		/* throughput of the connection [B/s] */
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - conn_p->start.tv_sec) +
+	    (now.tv_nsec - conn_p->start.tv_nsec) / 1000000000.0;
+	rate = elapsed > 0 ? conn_p->bytes / elapsed : 0;
+
+	/* the first closed connection sets the minimum */
+	if (loop_p->total_connection == loop_p->current_connection ||
+	    rate < loop_p->min_rate)
+		loop_p->min_rate = rate;
+	if (rate > loop_p->max_rate)
+		loop_p->max_rate = rate;
+	loop_p->sum_rate += rate;
+	loop_p->bytes += conn_p->bytes;
+
+	if (lost)
+		++loop_p->lost_connection;
+
+	if (debug)
+		fprintf(stderr,
+			"loop %d: sd=%d closed. %llu bytes in %.3f sec\n",
+			loop_p->id, conn_p->sd, conn_p->bytes, elapsed);
+
+	ready_del(conn_p);
+	conn_p->all_prev->all_next = conn_p->all_next;
+	conn_p->all_next->all_prev = conn_p->all_prev;
+	--loop_p->current_connection;
+
+	/* close() removes the descriptor from the epoll set as well */
+	if (close(conn_p->sd))
+		fatal_error("close()");
+	free(conn_p);
+}
+
+/*
+ * Function: accept_connections()
+ *
+ * Descripton:
+ *  Accept all the pending connections of an event loop. Since the listen
+ *  socket is edge-triggered, accept until the queue is empty.
+ *
+ * Argument:
+ *  loop_p:	pointer to an event loop
+ *
+ * Return value:
+ *  None
+ */
+void accept_connections(struct event_loop *loop_p)
+{
+	struct connection *conn_p;	/* pointer to the new connection */
+	struct epoll_event event;	/* event to watch */
+	int data_sd;		/* socket descriptor for send/recv data */
+
+	for (;;) {
+		data_sd = accept4(loop_p->listen_sd, NULL, NULL, SOCK_NONBLOCK);
+		if (data_sd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept4()");
+			return;
+		}
+
+		conn_p = calloc(1, sizeof(struct connection));
+		if (conn_p == NULL) {
+			fprintf(stderr, "calloc() is failed.\n");
+			if (close(data_sd))
+				fatal_error("close()");
+			continue;
+		}
+		conn_p->sd = data_sd;
+		clock_gettime(CLOCK_MONOTONIC, &conn_p->start);
+		conn_p->all_next = &loop_p->all;
+		conn_p->all_prev = loop_p->all.all_prev;
+		loop_p->all.all_prev->all_next = conn_p;
+		loop_p->all.all_prev = conn_p;
+
+		event.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = conn_p;
+		if (epoll_ctl(loop_p->epoll_fd, EPOLL_CTL_ADD, data_sd, &event))
+			fatal_error("epoll_ctl()");
+
+		++loop_p->total_connection;
+		++loop_p->current_connection;
+		if (loop_p->max_connection < loop_p->current_connection)
+			loop_p->max_connection = loop_p->current_connection;
+
+		if (debug)
+			fprintf(stderr, "loop %d: accepted. data_sd=%d\n",
+				loop_p->id, data_sd);
+	}
+}
+
+/*
+ * Function: send_connection()
+ *
+ * Descripton:
+ *  Send on a writable connection until the socket buffer is full or the
+ *  connection has used up its budget. In the later case the connection
+ *  stays in the ready list.
+ *
+ * Argument:
+ *  loop_p:	pointer to an event loop
+ *  conn_p:	pointer to a connection
+ *
+ * Return value:
+ *  None
+ */
+void send_connection(struct event_loop *loop_p, struct connection *conn_p)
+{
+	ssize_t sntbyte_size;	/* size of the sent byte */
+	int budget;		/* remaining number of send() */
+
+	for (budget = SEND_BUDGET; budget; budget--) {
+		sntbyte_size = send(conn_p->sd, sendbuf, sendbuf_size,
+				    MSG_NOSIGNAL);
+		if (sntbyte_size >= 0) {
+			conn_p->bytes += sntbyte_size;
+			continue;
+		}
+
+		switch (errno) {
+		case EINTR:
+			continue;
+		case EAGAIN:
+			ready_del(conn_p);
+			return;
+		case EPIPE:
+		case ECONNRESET:
+			if (debug)
+				fprintf(stderr,
+					"The client closed the connection.\n");
+			close_connection(loop_p, conn_p, 0);
+			return;
+		default:
+			perror("send()");
+			close_connection(loop_p, conn_p, 1);
+			return;
+		}
+	}
+
+	ready_add(loop_p, conn_p);
+}
+
+/*
+ * Function: event_loop()
+ *
+ * Descripton:
+ *  Main loop of an epoll thread. Accept the connections of its own listen
+ *  socket and send tcp segments to all of them till SIGHUP is caught.
+ *
+ * Argument:
+ *  arg:	pointer to an event loop
+ *
+ * Return value:
+ *  NULL
+ */
+void *event_loop(void *arg)
+{
+	struct event_loop *loop_p = arg;
+	struct epoll_event events[MAX_EVENTS];	/* the returned events */
+	struct epoll_event event;	/* event to watch */
+	struct connection *conn_p, *next_p;
+	int nfds;		/* number of the returned events */
+	int idx;
+
+	loop_p->ready.next = loop_p->ready.prev = &loop_p->ready;
+	loop_p->all.all_next = loop_p->all.all_prev = &loop_p->all;
+
+	loop_p->epoll_fd = epoll_create1(0);
+	if (loop_p->epoll_fd < 0)
+		fatal_error("epoll_create1()");
+
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = NULL;
+	if (epoll_ctl(loop_p->epoll_fd, EPOLL_CTL_ADD, loop_p->listen_sd,
+		      &event))
+		fatal_error("epoll_ctl()");
+
+	while (!catch_sighup) {
+		/* Poll without waiting while some connection is ready */
+		nfds = epoll_wait(loop_p->epoll_fd, events, MAX_EVENTS,
+				  loop_p->ready.next != &loop_p->ready ?
+				  0 : 500);
+		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait()");
+			loop_p->ret = EXIT_FAILURE;
+			break;
+		}
+
+		for (idx = 0; idx < nfds; idx++) {
+			conn_p = events[idx].data.ptr;
+			if (conn_p == NULL) {
+				accept_connections(loop_p);
+				continue;
+			}
+			if (events[idx].events &
+			    (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+				close_connection(loop_p, conn_p, 0);
+				continue;
+			}
+			if (events[idx].events & EPOLLOUT)
+				ready_add(loop_p, conn_p);
+		}
+
+		/* Give each ready connection one turn */
+		for (conn_p = loop_p->ready.next; conn_p != &loop_p->ready;
+		     conn_p = next_p) {
+			next_p = conn_p->next;
+			send_connection(loop_p, conn_p);
+		}
+	}
+
+	if (close(loop_p->listen_sd))
+		fatal_error("close()");
+
+	/* close the remaining connections */
+	while (loop_p->all.all_next != &loop_p->all)
+		close_connection(loop_p, loop_p->all.all_next, 0);
+
+	if (close(loop_p->epoll_fd))
+		fatal_error("close()");
+
+	return NULL;
+}
+
+/*
+ * Function: run_event_loops()
+ *
+ * Descripton:
+ *  Create one SO_REUSEPORT listen socket per event loop, start the event
+ *  loops pinned round-robin on the CPUs, wait for SIGHUP and output the
+ *  per loop and total connection counters and throughput.
+ *
+ * Argument:
+ *  info_p:	pointer to a server infomation
+ *  info_fp:	FILE pointer where the server information is outputted
+ *
+ * Return value:
+ *  0:	    success
+ *  other:  fail
+ */
+int run_event_loops(struct server_info *info_p, FILE * info_fp)
+{
+	struct event_loop *loops;	/* the event loops */
+	struct rlimit rlim;	/* limit of the file descriptor number */
+	cpu_set_t cpus, cpu;	/* CPUs this program may run on */
+	sigset_t sigset;	/* SIGHUP */
+	sigset_t oldset;	/* signal mask to wait for SIGHUP with */
+	socklen_t sock_optlen;	/* size of the result parameter */
+	size_t total = 0, max = 0, lost = 0;
+	unsigned long long bytes = 0;
+	double sum_rate = 0;
+	int ret = EXIT_SUCCESS;
+	int cpu_idx = -1;
+	size_t idx;
+
+	/* Tens of thousands of connections need as many descriptors */
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+	    rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &rlim))
+			perror("setrlimit()");
+	}
+
+	loops = calloc(info_p->event_loops, sizeof(struct event_loop));
+	if (loops == NULL) {
+		fprintf(stderr, "calloc() is failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	info_p->reuse_port = 1;
+	for (idx = 0; idx < info_p->event_loops; idx++) {
+		create_listen_socket(info_p);
+		if (fcntl(info_p->listen_sd, F_SETFL, O_NONBLOCK))
+			fatal_error("fcntl()");
+		loops[idx].id = idx;
+		loops[idx].listen_sd = info_p->listen_sd;
+		loops[idx].info_p = info_p;
+	}
+
+	/* Size of the data sent at once, the same as the forking server */
+	if (info_p->small_sending) {
+		sendbuf_size = 1;
+	} else {
+		sock_optlen = sizeof(sendbuf_size);
+		if (getsockopt(loops[0].listen_sd, SOL_SOCKET, SO_SNDBUF,
+			       &sendbuf_size, &sock_optlen) < 0)
+			fatal_error("getsockopt()");
+	}
+	sendbuf = calloc(1, sendbuf_size);
+	if (sendbuf == NULL) {
+		fprintf(stderr, "calloc() is failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Output any server information to the information file */
+	fprintf(info_fp, "PID: %u\n", getpid());
+	fflush(info_fp);
+
+	/* Only the main thread handles SIGHUP */
+	handler.sa_handler = set_signal_flag;
+	if (sigaction(SIGHUP, &handler, NULL) < 0)
+		fatal_error("sigaction()");
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+	sigdelset(&oldset, SIGHUP);
+
+	if (sched_getaffinity(0, sizeof(cpus), &cpus))
+		fatal_error("sched_getaffinity()");
+
+	for (idx = 0; idx < info_p->event_loops; idx++) {
+		if (pthread_create(&loops[idx].thread, NULL, event_loop,
+				   &loops[idx])) {
+			fprintf(stderr, "pthread_create() is failed.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		/* Pin the loop to the next CPU in the affinity mask */
+		do {
+			cpu_idx = (cpu_idx + 1) % CPU_SETSIZE;
+		} while (!CPU_ISSET(cpu_idx, &cpus));
+		CPU_ZERO(&cpu);
+		CPU_SET(cpu_idx, &cpu);
+		pthread_setaffinity_np(loops[idx].thread, sizeof(cpu), &cpu);
+	}
+
+	/* SIGHUP stays blocked between the check and the wait */
+	while (!catch_sighup)
+		sigsuspend(&oldset);
+
+	for (idx = 0; idx < info_p->event_loops; idx++) {
+		struct event_loop *loop_p = &loops[idx];
+
+		pthread_join(loop_p->thread, NULL);
+		if (loop_p->ret != EXIT_SUCCESS)
+			ret = loop_p->ret;
+
+		fprintf(info_fp,
+			"loop %d: connections: %zu, max concurrent: %zu, "
+			"lost: %zu, sent: %llu bytes, per connection "
+			"throughput min/avg/max: %.0f/%.0f/%.0f B/s\n",
+			loop_p->id, loop_p->total_connection,
+			loop_p->max_connection, loop_p->lost_connection,
+			loop_p->bytes, loop_p->min_rate,
+			loop_p->total_connection ?
+			loop_p->sum_rate / loop_p->total_connection : 0,
+			loop_p->max_rate);
+
+		total += loop_p->total_connection;
+		max += loop_p->max_connection;
+		lost += loop_p->lost_connection;
+		bytes += loop_p->bytes;
+		sum_rate += loop_p->sum_rate;
+	}
+
+	fprintf(info_fp,
+		"total: connections: %zu, max concurrent: %zu, lost: %zu, "
+		"sent: %llu bytes, average per connection throughput: "
+		"%.0f B/s\n", total, max, lost, bytes,
+		total ? sum_rate / total : 0);
+
+	free(sendbuf);
+	free(loops);
+	return ret;
+}
+
 /*
  *
  *  Function: main()
@@ -544,7 +1063,7 @@ int main(int argc, char *argv[])
 	server.portnum = NULL;
 
 	/* Retrieve the options */
-	while ((optc = getopt(argc, argv, "f:p:bcswo:dh")) != EOF) {
+	while ((optc = getopt(argc, argv, "f:p:bcswe:o:dh")) != EOF) {
 		switch (optc) {
 		case 'f':
 			if (strncmp(optarg, "4", 1) == 0)
@@ -588,6 +1107,21 @@ int main(int argc, char *argv[])
 			server.window_scaling = 1;
 			break;
 
+		case 'e':
+			{
+				long int num;
+				num = strtol(optarg, NULL, 0);
+				if (num < 0) {
+					fprintf(stderr,
+						"The number of threads should be positive\n");
+					usage(program_name, EXIT_FAILURE);
+				}
+				if (num == 0)
+					num = sysconf(_SC_NPROCESSORS_ONLN);
+				server.event_loops = num;
+			}
+			break;
+
 		case 'o':
 			if ((info_fp = fopen(optarg, "w")) == NULL) {
 				fprintf(stderr, "Cannot open %s\n", optarg);
@@ -634,6 +1168,15 @@ int main(int argc, char *argv[])
 	if (sigaction(SIGHUP, &handler, NULL) < 0)
 		fatal_error("sigaction()");
 
+	/* In the epoll mode, the event loops create their own sockets */
+	if (server.event_loops) {
+		ret = run_event_loops(&server, info_fp);
+		if (info_fp != stdout)
+			if (fclose(info_fp))
+				fatal_error("fclose()");
+		exit(ret);
+	}
+
 	/* Create a listen socket */
 	create_listen_socket(&server);
 
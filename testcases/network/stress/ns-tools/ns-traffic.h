@@ -91,6 +91,21 @@ EXTERN int debug;		/* If nonzero, output debug information. */
 #define PROC_IFINET6_FILE_LINELENGTH	64
 #define PROC_IFINET6_LINKLOCAL		0x20
 
+#define UDP_BATCH_MAX		1024	/* max datagrams per sendmmsg/recvmmsg */
+#define UDP_GSO_MAXSEGS		64	/* max segments per UDP_SEGMENT send */
+#define UDP_GSO_MAXSIZE		65507	/* max UDP payload of a GSO send */
+#define UDP_SEQ_MAGIC		0x4C545053	/* "LTPS" */
+
+#ifndef SOL_UDP
+#  define SOL_UDP		17
+#endif
+#ifndef UDP_SEGMENT
+#  define UDP_SEGMENT		103
+#endif
+#ifndef UDP_GRO
+#  define UDP_GRO		104
+#endif
+
 
 /*
  * Structure definition
@@ -200,6 +215,17 @@ struct my_mldv2_query {
 };
 
 
+/*
+ * Header at the beginning of the UDP payload when ns-udpsender numbers
+ * the datagrams, all members in network byte order
+ */
+struct udp_seq_header {
+    uint32_t magic;
+    uint32_t seq_hi;
+    uint32_t seq_lo;
+};
+
+
 /*
  * Macros
  */
@@ -30,11 +30,13 @@
  *
  * History:
  *	Mar 17 2006 - Created (Mitsuru Chinen)
+ *	Oct 19 2026 - Added sendmmsg(), UDP_SEGMENT and sequence numbers
  *---------------------------------------------------------------------------*/
 
 /*
  * Header Files
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,6 +48,8 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 
 #include "ns-traffic.h"
 
@@ -61,9 +65,14 @@ struct udp_info {
 	char *dst_name;
 	char *dst_port;
 	struct addrinfo addr_info;
+	struct sockaddr_storage dst_addr;
+	socklen_t dst_addrlen;
 	unsigned char *msg;
 	size_t msgsize;
 	double timeout;
+	size_t batch;		/* datagrams per sendmmsg(), 0: sendto() */
+	size_t segments;	/* segments per UDP_SEGMENT send, 0: no GSO */
+	int sequence;		/* if non-zero, number the datagrams */
 };
 
 /*
@@ -102,6 +111,9 @@ void usage(char *program_name, int exit_value)
 		"\t-s size\tdata size of UDP payload\n"
 		"\t-t value\ttimeout [sec]\n"
 		"\t-o\t\tsend only one UDP datagram\n"
+		"\t-B num\tsend num datagrams per sendmmsg()\n"
+		"\t-G num\tsend num segments of size bytes per UDP_SEGMENT send\n"
+		"\t-n\t\tnumber the datagrams for ns-udpserver -r\n"
 		"\t-b\t\twork in the background\n"
 		"\t-d\t\tdisplay debug informations\n"
 		"\t-h\t\tdisplay this usage\n"
@@ -168,7 +180,7 @@ void parse_options(int argc, char *argv[], struct udp_info *udp_p, int *bg_p)
 	int is_specified_daddr = 0;
 	int is_specified_port = 0;
 
-	while ((optc = getopt(argc, argv, "f:D:p:s:t:obdhmI:")) != EOF) {
+	while ((optc = getopt(argc, argv, "f:D:p:s:t:oB:G:nbdhmI:")) != EOF) {
 		switch (optc) {
 		case 'f':
 			if (optarg[0] == '4')
@@ -221,6 +233,32 @@ void parse_options(int argc, char *argv[], struct udp_info *udp_p, int *bg_p)
 			udp_p->timeout = -1.0;
 			break;
 
+		case 'B':
+			opt_ul = strtoul(optarg, NULL, 0);
+			if (opt_ul < 1 || UDP_BATCH_MAX < opt_ul) {
+				fprintf(stderr,
+					"The range of batch is from 1 to %u\n",
+					UDP_BATCH_MAX);
+				usage(program_name, EXIT_FAILURE);
+			}
+			udp_p->batch = opt_ul;
+			break;
+
+		case 'G':
+			opt_ul = strtoul(optarg, NULL, 0);
+			if (opt_ul < 1 || UDP_GSO_MAXSEGS < opt_ul) {
+				fprintf(stderr,
+					"The range of segments is from 1 to %u\n",
+					UDP_GSO_MAXSEGS);
+				usage(program_name, EXIT_FAILURE);
+			}
+			udp_p->segments = opt_ul;
+			break;
+
+		case 'n':
+			udp_p->sequence = 1;
+			break;
+
 		case 'b':
 			*bg_p = 1;
 			break;
@@ -271,6 +309,21 @@ void parse_options(int argc, char *argv[], struct udp_info *udp_p, int *bg_p)
 			usage(program_name, EXIT_FAILURE);
 		}
 	}
+
+	if (udp_p->segments &&
+	    udp_p->segments * udp_p->msgsize > UDP_GSO_MAXSIZE) {
+		fprintf(stderr,
+			"segments * size should be %u bytes or less\n",
+			UDP_GSO_MAXSIZE);
+		usage(program_name, EXIT_FAILURE);
+	}
+
+	if (udp_p->sequence &&
+	    udp_p->msgsize < sizeof(struct udp_seq_header)) {
+		fprintf(stderr, "size should be %zu bytes or more with -n\n",
+			sizeof(struct udp_seq_header));
+		usage(program_name, EXIT_FAILURE);
+	}
 }
 
 /*
@@ -358,11 +411,140 @@ void create_udp_datagram(struct udp_info *udp_p)
 	}
 	fill_payload(udp_p->msg, udp_p->msgsize);
 
-	/* Store addrinfo */
+	/* Store addrinfo, ai_addr is freed with res, so keep a copy of it */
 	memcpy(&(udp_p->addr_info), res, sizeof(struct addrinfo));
+	memcpy(&(udp_p->dst_addr), res->ai_addr, res->ai_addrlen);
+	udp_p->dst_addrlen = res->ai_addrlen;
+	udp_p->addr_info.ai_addr = (struct sockaddr *)&(udp_p->dst_addr);
 	freeaddrinfo(res);
 }
 
+/*
+ * Function: send_udp_batch()
+ *
+ * Description:
+ *  This function sends udp datagrams with sendmmsg(), batch messages
+ *  per call. With UDP_SEGMENT every message carries segments datagrams
+ *  that the kernel splits as late as possible. When the datagrams are
+ *  numbered, each one starts with struct udp_seq_header. Statistics are
+ *  output to stderr, so that they don't mix with the output of the
+ *  scripts.
+ *
+ * Argument:
+ *  udp_p: pointer to the udp data structure
+ *
+ * Return value:
+ *  None
+ */
+void send_udp_batch(struct udp_info *udp_p)
+{
+	size_t nmsg = udp_p->batch ? udp_p->batch : 1;
+	size_t segs = udp_p->segments ? udp_p->segments : 1;
+	size_t bufsize = udp_p->msgsize * segs;	/* payload per message */
+	size_t cmsg_space = CMSG_SPACE(sizeof(uint16_t));
+	struct mmsghdr *msgs;	/* messages for sendmmsg() */
+	struct iovec *iovs;	/* one iovec per message */
+	unsigned char *bufs;	/* payload of all the messages */
+	char *cbufs;		/* UDP_SEGMENT control messages */
+	struct cmsghdr *cmsg;
+	struct udp_seq_header *hdr;
+	struct timespec start, end;
+	unsigned long long seq = 0;	/* next sequence number */
+	unsigned long long sent = 0;	/* number of sent datagrams */
+	unsigned long long calls = 0;	/* number of sendmmsg() calls */
+	double elapsed;
+	size_t idx, seg, done;
+	int retval;
+	time_t start_time;
+
+	msgs = calloc(nmsg, sizeof(struct mmsghdr));
+	iovs = calloc(nmsg, sizeof(struct iovec));
+	bufs = malloc(nmsg * bufsize);
+	cbufs = calloc(nmsg, cmsg_space);
+	if (msgs == NULL || iovs == NULL || bufs == NULL || cbufs == NULL)
+		fatal_error("malloc()");
+
+	for (idx = 0; idx < nmsg; idx++) {
+		for (seg = 0; seg < segs; seg++)
+			fill_payload(bufs + idx * bufsize +
+				     seg * udp_p->msgsize, udp_p->msgsize);
+
+		iovs[idx].iov_base = bufs + idx * bufsize;
+		iovs[idx].iov_len = bufsize;
+		msgs[idx].msg_hdr.msg_iov = &iovs[idx];
+		msgs[idx].msg_hdr.msg_iovlen = 1;
+		msgs[idx].msg_hdr.msg_name = &(udp_p->dst_addr);
+		msgs[idx].msg_hdr.msg_namelen = udp_p->dst_addrlen;
+
+		if (!udp_p->segments)
+			continue;
+
+		msgs[idx].msg_hdr.msg_control = cbufs + idx * cmsg_space;
+		msgs[idx].msg_hdr.msg_controllen = cmsg_space;
+		cmsg = CMSG_FIRSTHDR(&msgs[idx].msg_hdr);
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		*(uint16_t *) CMSG_DATA(cmsg) = udp_p->msgsize;
+	}
+
+	start_time = time(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (;;) {
+		if (udp_p->sequence) {
+			for (idx = 0; idx < nmsg * segs; idx++, seq++) {
+				hdr = (struct udp_seq_header *)
+				    (bufs + idx * udp_p->msgsize);
+				hdr->magic = htonl(UDP_SEQ_MAGIC);
+				hdr->seq_hi = htonl(seq >> 32);
+				hdr->seq_lo = htonl(seq & 0xFFFFFFFF);
+			}
+		}
+
+		/* Resend the rest, not to leave a hole in the numbers */
+		for (done = 0; done < nmsg; done += retval) {
+			retval = sendmmsg(udp_p->sd, msgs + done, nmsg - done,
+					  0);
+			if (retval < 0)
+				break;
+			calls++;
+			sent += retval * segs;
+		}
+		if (retval < 0) {
+			if (catch_sighup)
+				break;
+			else
+				fatal_error("sendmmsg()");
+		}
+
+		/* Check timeout:
+		   If timeout value is negative only send one batch */
+		if (udp_p->timeout)
+			if (udp_p->timeout < difftime(time(NULL), start_time))
+				break;
+
+		if (catch_sighup)	/* catch SIGHUP */
+			break;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) +
+	    (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+	if (elapsed <= 0)
+		elapsed = 0.000000001;
+
+	fprintf(stderr, "sent %llu datagrams of %zu bytes in %llu calls, "
+		"%.3f sec, %.0f datagrams/sec, %.1f Mbit/sec\n",
+		sent, udp_p->msgsize, calls, elapsed, sent / elapsed,
+		sent * udp_p->msgsize * 8 / elapsed / 1000000);
+
+	free(cbufs);
+	free(bufs);
+	free(iovs);
+	free(msgs);
+}
+
 /*
  * Function: send_udp_datagram()
  *
@@ -388,6 +570,13 @@ void send_udp_datagram(struct udp_info *udp_p)
 	if (sigaction(SIGHUP, &handler, NULL) < 0)
 		fatal_error("sigaction()");
 
+	/* Batched, segmented or numbered datagrams */
+	if (udp_p->batch || udp_p->segments || udp_p->sequence) {
+		send_udp_batch(udp_p);
+		close(udp_p->sd);
+		return;
+	}
+
 	/*
 	 * loop for sending packets
 	 */
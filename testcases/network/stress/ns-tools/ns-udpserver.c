@@ -31,8 +31,10 @@
  *
  * History:
  *	Oct 19 2005 - Created (Mitsuru Chinen)
+ *	Oct 19 2026 - Added sink mode with recvmmsg() and UDP_GRO
  *---------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
 #include "ns-traffic.h"
 
 /*
@@ -52,6 +54,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 
 /*
  * Gloval variables
@@ -87,6 +90,10 @@ void usage(char *program_name, int exit_value)
 		"\t\tthe port number specified by -p option would be the first port number\n"
 		"\t-b\twork in the background\n"
 		"\t-o\tfilename where the server infomation is outputted\n"
+		"\t-r\twork in the sink mode, receive without responding\n"
+		"\t\tand output the statistics to the -o file at exit\n"
+		"\t-B num\treceive num messages per recvmmsg() in the sink mode\n"
+		"\t-G\tenable UDP_GRO in the sink mode\n"
 		"\t-d\twork in the debug mode\n"
 		"\t-h\tdisplay this usage\n"
 		"" "*) Server works till it receives SIGHUP\n", program_name);
@@ -182,6 +189,236 @@ void respond_to_client(sock_fd)
 	free(msgbuf);
 }
 
+/* Number of sequence numbers below the newest one tracked for duplicates */
+#define SEQ_WINDOW	65536
+
+/*
+ * Structure: recv_stats
+ *
+ * Description:
+ *  This structure stores the statistics of the sink mode
+ */
+struct recv_stats {
+	unsigned long long datagrams;	/* number of received datagrams */
+	unsigned long long bytes;	/* number of received bytes */
+	unsigned long long calls;	/* number of recvmmsg() calls */
+	unsigned long long messages;	/* number of received messages */
+	unsigned long long numbered;	/* datagrams with udp_seq_header */
+	unsigned long long lost;	/* gaps in the sequence numbers */
+	unsigned long long reordered;	/* datagrams older than the newest */
+	unsigned long long duplicates;	/* sequence numbers seen before */
+	unsigned long long first_seq;	/* first received sequence number */
+	unsigned long long max_seq;	/* newest sequence number */
+	int seen_seq;		/* if non-zero, max_seq is valid */
+	unsigned char window[SEQ_WINDOW / 8];	/* seen bits below max_seq */
+	struct timespec first;	/* time of the first datagram */
+	struct timespec last;	/* time of the last datagram */
+};
+
+/*
+ * Function: account_datagram()
+ *
+ * Description:
+ *  Count a datagram. If it is numbered, a datagram newer than expected
+ *  counts the skipped numbers as lost, an older one was counted lost
+ *  before and is moved to the reordered counter. A number seen before
+ *  is counted as a duplicate. Numbers older than SEQ_WINDOW can not be
+ *  told apart from duplicates, they are counted as reordered but are
+ *  left in the lost counter, so it never drops below the real loss.
+ *
+ * Argument:
+ *  stats_p:	pointer to the statistics
+ *  data:	pointer to the payload
+ *  len:	length of the payload
+ *
+ * Return value:
+ *  None
+ */
+void account_datagram(struct recv_stats *stats_p, unsigned char *data,
+		      size_t len)
+{
+	struct udp_seq_header hdr;
+	unsigned long long seq, bit;
+
+	++stats_p->datagrams;
+	stats_p->bytes += len;
+
+	if (len < sizeof(hdr))
+		return;
+
+	memcpy(&hdr, data, sizeof(hdr));
+	if (ntohl(hdr.magic) != UDP_SEQ_MAGIC)
+		return;
+
+	++stats_p->numbered;
+	seq = ((unsigned long long)ntohl(hdr.seq_hi) << 32) |
+	    ntohl(hdr.seq_lo);
+
+	if (!stats_p->seen_seq) {
+		stats_p->seen_seq = 1;
+		stats_p->first_seq = seq;
+		stats_p->max_seq = seq;
+	} else if (seq > stats_p->max_seq) {
+		stats_p->lost += seq - stats_p->max_seq - 1;
+		/* forget the numbers the window slides over */
+		if (seq - stats_p->max_seq >= SEQ_WINDOW) {
+			memset(stats_p->window, 0, sizeof(stats_p->window));
+		} else {
+			for (bit = stats_p->max_seq + 1; bit < seq; bit++)
+				stats_p->window[bit % SEQ_WINDOW / 8] &=
+				    ~(1 << bit % 8);
+		}
+		stats_p->max_seq = seq;
+	} else if (stats_p->max_seq - seq >= SEQ_WINDOW) {
+		++stats_p->reordered;
+		return;
+	} else if (stats_p->window[seq % SEQ_WINDOW / 8] & (1 << seq % 8)) {
+		++stats_p->duplicates;
+		return;
+	} else {
+		++stats_p->reordered;
+		/* numbers before the first one were never counted lost */
+		if (seq > stats_p->first_seq)
+			--stats_p->lost;
+	}
+
+	stats_p->window[seq % SEQ_WINDOW / 8] |= 1 << seq % 8;
+}
+
+/*
+ * Function: receive_datagrams()
+ *
+ * Description:
+ *  Receive all the queued datagrams with recvmmsg(), batch messages per
+ *  call. With UDP_GRO a message may carry several datagrams of the size
+ *  passed in the control message.
+ *
+ * Argument:
+ *  sock_fd:	socket file descriptor
+ *  batch:	number of messages per recvmmsg()
+ *  stats_p:	pointer to the statistics
+ *
+ * Return value:
+ *  None
+ */
+void receive_datagrams(int sock_fd, size_t batch, struct recv_stats *stats_p)
+{
+	static struct mmsghdr *msgs;	/* messages for recvmmsg() */
+	static struct iovec *iovs;	/* one iovec per message */
+	static unsigned char *bufs;	/* payload of all the messages */
+	static char *cbufs;	/* UDP_GRO control messages */
+	size_t bufsize = 65536;	/* the maximum UDP message */
+	size_t cmsg_space = CMSG_SPACE(sizeof(int));
+	struct cmsghdr *cmsg;
+	size_t idx, off, len, seglen;
+	int retval, gso_size;
+
+	if (msgs == NULL) {
+		msgs = calloc(batch, sizeof(struct mmsghdr));
+		iovs = calloc(batch, sizeof(struct iovec));
+		bufs = malloc(batch * bufsize);
+		cbufs = calloc(batch, cmsg_space);
+		if (msgs == NULL || iovs == NULL || bufs == NULL ||
+		    cbufs == NULL)
+			fatal_error("malloc()");
+	}
+
+	for (;;) {
+		for (idx = 0; idx < batch; idx++) {
+			iovs[idx].iov_base = bufs + idx * bufsize;
+			iovs[idx].iov_len = bufsize;
+			memset(&msgs[idx].msg_hdr, 0, sizeof(struct msghdr));
+			msgs[idx].msg_hdr.msg_iov = &iovs[idx];
+			msgs[idx].msg_hdr.msg_iovlen = 1;
+			msgs[idx].msg_hdr.msg_control = cbufs + idx * cmsg_space;
+			msgs[idx].msg_hdr.msg_controllen = cmsg_space;
+		}
+
+		retval = recvmmsg(sock_fd, msgs, batch, MSG_DONTWAIT, NULL);
+		if (retval < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == EINTR)
+				return;
+			fatal_error("recvmmsg()");
+		}
+
+		if (stats_p->calls++ == 0)
+			clock_gettime(CLOCK_MONOTONIC, &stats_p->first);
+		clock_gettime(CLOCK_MONOTONIC, &stats_p->last);
+		stats_p->messages += retval;
+
+		for (idx = 0; idx < (size_t)retval; idx++) {
+			len = msgs[idx].msg_len;
+			seglen = len;
+
+			for (cmsg = CMSG_FIRSTHDR(&msgs[idx].msg_hdr);
+			     cmsg != NULL;
+			     cmsg = CMSG_NXTHDR(&msgs[idx].msg_hdr, cmsg)) {
+				if (cmsg->cmsg_level == SOL_UDP &&
+				    cmsg->cmsg_type == UDP_GRO) {
+					memcpy(&gso_size, CMSG_DATA(cmsg),
+					       sizeof(gso_size));
+					seglen = gso_size;
+				}
+			}
+			if (seglen == 0)
+				seglen = len;
+
+			/* A zero length datagram is still a datagram */
+			off = 0;
+			do {
+				account_datagram(stats_p,
+						 bufs + idx * bufsize + off,
+						 len - off < seglen ?
+						 len - off : seglen);
+				off += seglen;
+			} while (off < len);
+		}
+	}
+}
+
+/*
+ * Function: output_stats()
+ *
+ * Description:
+ *  Output the statistics of the sink mode
+ *
+ * Argument:
+ *  info_fp:	FILE pointer where the statistics are outputted
+ *  stats_p:	pointer to the statistics
+ *
+ * Return value:
+ *  None
+ */
+void output_stats(FILE * info_fp, struct recv_stats *stats_p)
+{
+	double elapsed;		/* from the first to the last datagram */
+
+	elapsed = (stats_p->last.tv_sec - stats_p->first.tv_sec) +
+	    (stats_p->last.tv_nsec - stats_p->first.tv_nsec) / 1000000000.0;
+	if (elapsed <= 0)
+		elapsed = 0.000000001;
+
+	fprintf(info_fp,
+		"received %llu datagrams (%llu bytes) in %llu messages, "
+		"%llu calls, %.3f sec, %.0f datagrams/sec, %.1f Mbit/sec\n",
+		stats_p->datagrams, stats_p->bytes, stats_p->messages,
+		stats_p->calls, elapsed, stats_p->datagrams / elapsed,
+		stats_p->bytes * 8 / elapsed / 1000000);
+
+	if (stats_p->numbered) {
+		fprintf(info_fp,
+			"numbered %llu, lost %llu (%.3f%%), reordered %llu, "
+			"duplicates %llu\n",
+			stats_p->numbered, stats_p->lost,
+			100.0 * stats_p->lost /
+			(stats_p->numbered - stats_p->duplicates +
+			 stats_p->lost),
+			stats_p->reordered, stats_p->duplicates);
+	}
+	fflush(info_fp);
+}
+
 /*
  *
  *  Function: main()
@@ -202,12 +439,17 @@ int main(int argc, char *argv[])
 	int err;		/* return value of getaddrinfo */
 	struct addrinfo hints;	/* hints for getaddrinfo() */
 	struct addrinfo *res;	/* pointer to addrinfo */
+	int sink = 0;		/* if non-zero, work in the sink mode */
+	size_t batch = 0;	/* messages per recvmmsg() */
+	int gro = 0;		/* if non-zero, enable UDP_GRO */
+	struct recv_stats stats;	/* statistics of the sink mode */
 
 	debug = 0;
+	memset(&stats, '\0', sizeof(stats));
 	family = PF_UNSPEC;
 
 	/* Retrieve the options */
-	while ((optc = getopt(argc, argv, "f:p:bo:dh")) != EOF) {
+	while ((optc = getopt(argc, argv, "f:p:bo:rB:Gdh")) != EOF) {
 		switch (optc) {
 		case 'f':
 			if (strncmp(optarg, "4", 1) == 0)
@@ -246,6 +488,24 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'r':
+			sink = 1;
+			break;
+
+		case 'B':
+			batch = strtoul(optarg, NULL, 0);
+			if (batch < 1 || UDP_BATCH_MAX < batch) {
+				fprintf(stderr,
+					"The range of batch is from 1 to %u\n",
+					UDP_BATCH_MAX);
+				usage(program_name, EXIT_FAILURE);
+			}
+			break;
+
+		case 'G':
+			gro = 1;
+			break;
+
 		case 'd':
 			debug = 1;
 			break;
@@ -265,6 +525,13 @@ int main(int argc, char *argv[])
 		usage(program_name, EXIT_FAILURE);
 	}
 
+	if ((batch || gro) && !sink) {
+		fprintf(stderr, "-B and -G are options of the sink mode.\n");
+		usage(program_name, EXIT_FAILURE);
+	}
+	if (!batch)
+		batch = 1;
+
 	/* At first, SIGHUP is ignored. */
 	handler.sa_handler = SIG_IGN;
 	if (sigfillset(&handler.sa_mask) < 0)
@@ -312,6 +579,13 @@ int main(int argc, char *argv[])
 	if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)))
 		fatal_error("setsockopt()");
 
+	/* Let the kernel coalesce the datagrams of a flow */
+	if (gro) {
+		on = 1;
+		if (setsockopt(sock_fd, SOL_UDP, UDP_GRO, &on, sizeof(int)))
+			fatal_error("setsockopt()");
+	}
+
 	/* Bind to the local address */
 	if (bind(sock_fd, res->ai_addr, res->ai_addrlen) < 0)
 		fatal_error("bind()");
@@ -326,7 +600,7 @@ int main(int argc, char *argv[])
 	/* Output any server information to the information file */
 	fprintf(info_fp, "PID: %u\n", getpid());
 	fflush(info_fp);
-	if (info_fp != stdout)
+	if (info_fp != stdout && !sink)
 		if (fclose(info_fp))
 			fatal_error("fclose()");
 
@@ -362,7 +636,11 @@ int main(int argc, char *argv[])
 		} else if (select_ret == 0) {
 			continue;
 		} else {
-			if (FD_ISSET(sock_fd, &active_fds))
+			if (!FD_ISSET(sock_fd, &active_fds))
+				continue;
+			if (sink)
+				receive_datagrams(sock_fd, batch, &stats);
+			else
 				respond_to_client(sock_fd);
 		}
 	}
@@ -371,5 +649,12 @@ int main(int argc, char *argv[])
 	if (close(sock_fd))
 		fatal_error("close()");
 
+	if (sink) {
+		output_stats(info_fp, &stats);
+		if (info_fp != stdout)
+			if (fclose(info_fp))
+				fatal_error("fclose()");
+	}
+
 	exit(EXIT_SUCCESS);
 }
@@ -19,14 +19,19 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <poll.h>
 #include <time.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -34,6 +39,7 @@
 #include "test.h"
 #include "lapi/posix_clocks.h"
 #include "safe_macros.h"
+#include "tst_hist.h"
 
 char *TCID = "tcp_fastopen";
 
@@ -72,6 +78,7 @@ static int tw_reuse_changed;
 static int tfo_cfg_value;
 static int tfo_bit_num;
 static int tfo_cfg_changed;
+static int tfo_cfg_orig = -1;
 static int tfo_queue_size	= 100;
 static int max_queue_len	= 100;
 static const int client_byte	= 0x43;
@@ -105,8 +112,10 @@ static char *rpath		= "./tfo_result";
 
 static int force_run;
 static int verbose;
+static int bench_mode;
 
 static char *narg, *Narg, *qarg, *rarg, *Rarg, *aarg, *Targ, *barg;
+static char *warg, *carg, *targ;
 
 static const option_t options[] = {
 	/* server params */
@@ -130,6 +139,12 @@ static const option_t options[] = {
 	{"o", &fastopen_api, NULL},
 	{"O", &tfo_support, NULL},
 	{"v", &verbose, NULL},
+
+	/* benchmark */
+	{"B", &bench_mode, NULL},
+	{"w:", NULL, &warg},
+	{"c:", NULL, &carg},
+	{"t:", NULL, &targ},
 	{NULL, NULL, NULL}
 };
 
@@ -159,6 +174,13 @@ static void help(void)
 	printf("\n          Server:\n");
 	printf("  -R x    x - num of requests, after which conn. closed\n");
 	printf("  -q x    x - server's limit on the queue of TFO requests\n");
+
+	printf("\n          Benchmark:\n");
+	printf("  -B      Run server and client in this process, compare\n"
+	       "          TFO off and on over loopback\n");
+	printf("  -w x    x - num of server/client workers, default is ncpus\n");
+	printf("  -c x    x - connections in flight per client worker\n");
+	printf("  -t x    x - seconds to run with TFO off and on, default 5\n");
 }
 
 /* common structure for TCP server and TCP client */
@@ -193,6 +215,11 @@ static void do_cleanup(void)
 		SAFE_FILE_PRINTF(NULL, tfo_cfg, "%d", tfo_cfg_value);
 	}
 
+	if (tfo_cfg_orig != -1) {
+		tst_resm(TINFO, "set '%s' back to '%d'", tfo_cfg, tfo_cfg_orig);
+		SAFE_FILE_PRINTF(NULL, tfo_cfg, "%d", tfo_cfg_orig);
+	}
+
 	if (tw_reuse_changed) {
 		SAFE_FILE_PRINTF(NULL, tcp_tw_reuse, "0");
 		tst_resm(TINFO, "unset '%s' back to '0'", tcp_tw_reuse);
@@ -699,46 +726,564 @@ static void check_opt_l(const char *name, char *arg, long *val, long lim)
 	}
 }
 
-static void setup(int argc, char *argv[])
+/*
+ * Benchmark mode (-B): an event driven server and client run in this
+ * process over loopback, first with TFO off and then on. Every CPU gets
+ * one server worker with its own SO_REUSEPORT listen socket and one
+ * client worker keeping bench_inflight connections in flight. Each
+ * connection carries one request, the time from socket() to the first
+ * byte of the reply is recorded.
+ */
+enum {
+	CONN_CONNECTING = 0,
+	CONN_SENT,
+};
+
+struct bench_conn {
+	int fd;
+	int state;
+	int offset;
+	long long start;
+	struct bench_worker *worker;
+	/* server connections are linked to their worker until freed */
+	struct bench_conn *prev, *next;
+};
+
+struct bench_worker {
+	pthread_t id;
+	int cpu;
+	int epfd;
+	int lfd;
+	struct bench_conn *conns;
+	struct bench_conn *live;
+	unsigned long requests;
+	unsigned long errors;
+	struct tst_hist lat;
+};
+
+struct bench_result {
+	unsigned long requests;
+	unsigned long errors;
+	unsigned long long tfo_active;
+	unsigned long long tfo_passive;
+	double secs;
+	struct tst_hist lat;
+};
+
+static int bench_workers;
+static int bench_inflight = 16;
+static int bench_time = 5;
+static int bench_tfo;
+static volatile int bench_stop, bench_server_stop;
+static struct bench_worker *bench_servers, *bench_clients;
+static struct bench_result bench_res[2];
+
+static long long bench_ns(void)
 {
-	tst_parse_opts(argc, argv, options, help);
+	struct timespec ts;
 
-	/* if client_num is not set, use num of processors */
-	clients_num = sysconf(_SC_NPROCESSORS_ONLN);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-	check_opt("a", aarg, &clients_num, 1);
-	check_opt("r", rarg, &client_max_requests, 1);
-	check_opt("R", Rarg, &server_max_requests, 1);
-	check_opt("n", narg, &client_msg_size, 1);
-	check_opt("N", Narg, &server_msg_size, 1);
-	check_opt("q", qarg, &tfo_queue_size, 1);
-	check_opt_l("T", Targ, &wait_timeout, 0L);
-	check_opt("b", barg, &busy_poll, 0);
+static void bench_pin(pthread_t id, int cpu)
+{
+	cpu_set_t set;
+	int err;
 
-	if (!force_run)
-		tst_require_root();
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	err = pthread_setaffinity_np(id, sizeof(set), &set);
+	if (err) {
+		tst_brkm(TBROK, cleanup, "pthread_setaffinity_np(%d): %s",
+			 cpu, tst_strerrno(err));
+	}
+}
 
-	if (!force_run && tst_kvercmp(3, 7, 0) < 0) {
-		tst_brkm(TCONF, NULL,
-			"Test must be run with kernel 3.7 or newer");
+static unsigned long long read_tcpext(const char *name)
+{
+	char names[4096], values[4096];
+	char *n, *v, *nsave, *vsave;
+	unsigned long long ret = 0;
+	FILE *f;
+
+	f = fopen("/proc/net/netstat", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(names, sizeof(names), f) &&
+	       fgets(values, sizeof(values), f)) {
+		if (strncmp(names, "TcpExt:", 7))
+			continue;
+
+		n = strtok_r(names, " \n", &nsave);
+		v = strtok_r(values, " \n", &vsave);
+		while (n && v) {
+			if (!strcmp(n, name)) {
+				ret = strtoull(v, NULL, 10);
+				break;
+			}
+			n = strtok_r(NULL, " \n", &nsave);
+			v = strtok_r(NULL, " \n", &vsave);
+		}
+		break;
 	}
 
-	if (!force_run && busy_poll >= 0 && tst_kvercmp(3, 11, 0) < 0) {
-		tst_brkm(TCONF, NULL,
-			"Test must be run with kernel 3.11 or newer");
+	fclose(f);
+	return ret;
+}
+
+static int bench_listen(void)
+{
+	const int flag = 1;
+	struct addrinfo hints, *res;
+	int fd;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(NULL, tcp_port, &hints, &res) != 0)
+		tst_brkm(TBROK | TERRNO, cleanup, "getaddrinfo failed");
+
+	fd = SAFE_SOCKET(cleanup, AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)))
+		tst_brkm(TBROK | TERRNO, cleanup, "setsockopt(SO_REUSEPORT)");
+
+	if (bench_tfo && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+				    &tfo_queue_size, sizeof(tfo_queue_size)))
+		tst_brkm(TBROK | TERRNO, cleanup, "Can't set TFO sock. options");
+
+	SAFE_BIND(cleanup, fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	SAFE_LISTEN(cleanup, fd, SOMAXCONN);
+
+	return fd;
+}
+
+static void bench_epoll_add(int epfd, int fd, uint32_t events, void *ptr)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = ptr;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+		tst_brkm(TBROK | TERRNO, cleanup, "epoll_ctl failed");
+}
+
+static void bench_conn_free(struct bench_conn *c)
+{
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		c->worker->live = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+
+	close(c->fd);
+	free(c);
+}
+
+/*
+ * The listener is level triggered, so when accept4() fails for lack of
+ * resources the rest of the backlog is picked up by the next epoll_wait().
+ */
+static void bench_server_accept(struct bench_worker *w)
+{
+	struct bench_conn *c;
+	int fd;
+
+	for (;;) {
+		fd = accept4(w->lfd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd == -1) {
+			if (errno == EAGAIN)
+				return;
+			if (errno == ECONNABORTED || errno == EINTR)
+				continue;
+			w->errors++;
+			return;
+		}
+
+		c = SAFE_MALLOC(cleanup, sizeof(*c));
+		c->fd = fd;
+		c->offset = 0;
+		c->worker = w;
+		c->prev = NULL;
+		c->next = w->live;
+		if (w->live)
+			w->live->prev = c;
+		w->live = c;
+		bench_epoll_add(w->epfd, fd, EPOLLIN | EPOLLET, c);
 	}
+}
 
-	/* check tcp fast open knob */
-	if (!force_run && access(tfo_cfg, F_OK) == -1)
-		tst_brkm(TCONF, NULL, "Failed to find '%s'", tfo_cfg);
+/*
+ * Read the request, reply and close. The request ends with end_byte, so
+ * only the last byte read so far has to be checked.
+ */
+static void bench_server_read(struct bench_conn *c)
+{
+	char buf[max_msg_len];
+	int len;
+
+	for (;;) {
+		len = recv(c->fd, buf, sizeof(buf), 0);
+		if (len > 0) {
+			c->offset += len;
+			if (buf[len - 1] != end_byte &&
+			    c->offset < client_msg_size)
+				continue;
+			if (send(c->fd, server_msg, server_msg_size,
+				 MSG_NOSIGNAL) != server_msg_size)
+				c->worker->errors++;
+			else
+				c->worker->requests++;
+			break;
+		}
+		if (len == -1 && errno == EAGAIN)
+			return;
+		break;
+	}
 
-	if (!force_run) {
-		SAFE_FILE_SCANF(NULL, tfo_cfg, "%d", &tfo_cfg_value);
-		tst_resm(TINFO, "'%s' is %d", tfo_cfg, tfo_cfg_value);
+	bench_conn_free(c);
+}
+
+static void *bench_server_fn(void *arg)
+{
+	struct bench_worker *w = arg;
+	struct epoll_event ev[64];
+	int i, n;
+
+	/* keep going until the connections closed by the clients are freed */
+	for (;;) {
+		n = epoll_wait(w->epfd, ev, ARRAY_SIZE(ev), 100);
+		if (n <= 0 && bench_server_stop)
+			break;
+
+		for (i = 0; i < n; i++) {
+			if (!ev[i].data.ptr)
+				bench_server_accept(w);
+			else
+				bench_server_read(ev[i].data.ptr);
+		}
 	}
 
-	tst_sig(FORK, DEF_HANDLER, cleanup);
+	/* requests that did not complete before the phase ended */
+	while (w->live)
+		bench_conn_free(w->live);
+
+	return NULL;
+}
+
+static void bench_client_start(struct bench_worker *w, struct bench_conn *c)
+{
+	int ret;
+
+	c->start = bench_ns();
+	c->offset = 0;
+	c->fd = socket(remote_addrinfo->ai_family,
+		       SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (c->fd == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "socket failed");
+
+	if (bench_tfo) {
+		/* the data goes in the SYN once the client has a cookie */
+		ret = sendto(c->fd, client_msg, client_msg_size,
+			     MSG_FASTOPEN | MSG_NOSIGNAL,
+			     remote_addrinfo->ai_addr,
+			     remote_addrinfo->ai_addrlen);
+		c->state = (ret == client_msg_size) ? CONN_SENT :
+			   CONN_CONNECTING;
+	} else {
+		ret = connect(c->fd, remote_addrinfo->ai_addr,
+			      remote_addrinfo->ai_addrlen);
+		c->state = CONN_CONNECTING;
+	}
+
+	if (ret == -1 && errno != EINPROGRESS) {
+		w->errors++;
+		close(c->fd);
+		c->fd = -1;
+		return;
+	}
+
+	bench_epoll_add(w->epfd, c->fd, EPOLLIN | EPOLLOUT | EPOLLET, c);
+}
+
+static void bench_client_event(struct bench_worker *w, struct bench_conn *c,
+			       uint32_t events)
+{
+	char buf[max_msg_len];
+	int len;
+
+	if (events & EPOLLERR)
+		goto fail;
+
+	if (c->state == CONN_CONNECTING && (events & EPOLLOUT)) {
+		if (send(c->fd, client_msg, client_msg_size,
+			 MSG_NOSIGNAL) != client_msg_size)
+			goto fail;
+		c->state = CONN_SENT;
+	}
+
+	if (c->state != CONN_SENT || !(events & (EPOLLIN | EPOLLHUP)))
+		return;
+
+	for (;;) {
+		len = recv(c->fd, buf, sizeof(buf), 0);
+		if (len > 0) {
+			if (!c->offset)
+				tst_hist_add(&w->lat, bench_ns() - c->start);
+			c->offset += len;
+			continue;
+		}
+		if (len == -1 && errno == EAGAIN)
+			return;
+		break;
+	}
 
+	/* the server closes the connection after the reply */
+	if (c->offset != server_msg_size)
+		goto fail;
+
+	w->requests++;
+	close(c->fd);
+	c->fd = -1;
+	if (!bench_stop)
+		bench_client_start(w, c);
+	return;
+
+fail:
+	w->errors++;
+	close(c->fd);
+	c->fd = -1;
+	if (!bench_stop)
+		bench_client_start(w, c);
+}
+
+static void *bench_client_fn(void *arg)
+{
+	struct bench_worker *w = arg;
+	struct epoll_event ev[64];
+	int i, n;
+
+	for (i = 0; i < bench_inflight; i++)
+		bench_client_start(w, &w->conns[i]);
+
+	while (!bench_stop) {
+		n = epoll_wait(w->epfd, ev, ARRAY_SIZE(ev), 100);
+		for (i = 0; i < n; i++)
+			bench_client_event(w, ev[i].data.ptr, ev[i].events);
+	}
+
+	for (i = 0; i < bench_inflight; i++) {
+		if (w->conns[i].fd != -1)
+			close(w->conns[i].fd);
+	}
+
+	return NULL;
+}
+
+static void bench_start(struct bench_worker *w, void *(*fn)(void *))
+{
+	w->epfd = epoll_create1(0);
+	if (w->epfd == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "epoll_create1 failed");
+
+	if (w->lfd != -1)
+		bench_epoll_add(w->epfd, w->lfd, EPOLLIN, NULL);
+
+	w->live = NULL;
+	tst_hist_init(&w->lat);
+	w->requests = w->errors = 0;
+
+	if (pthread_create(&w->id, NULL, fn, w))
+		tst_brkm(TBROK | TERRNO, cleanup, "pthread_create failed");
+
+	bench_pin(w->id, w->cpu);
+}
+
+static void bench_phase(struct bench_result *r)
+{
+	unsigned long long active, passive;
+	long long start;
+	int i, j;
+
+	bench_stop = bench_server_stop = 0;
+
+	for (i = 0; i < bench_workers; i++) {
+		bench_servers[i].lfd = bench_listen();
+		bench_start(&bench_servers[i], bench_server_fn);
+	}
+
+	active = read_tcpext("TCPFastOpenActive");
+	passive = read_tcpext("TCPFastOpenPassive");
+	start = bench_ns();
+
+	for (i = 0; i < bench_workers; i++) {
+		for (j = 0; j < bench_inflight; j++)
+			bench_clients[i].conns[j].fd = -1;
+		bench_clients[i].lfd = -1;
+		bench_start(&bench_clients[i], bench_client_fn);
+	}
+
+	sleep(bench_time);
+	bench_stop = 1;
+
+	tst_hist_init(&r->lat);
+	r->requests = r->errors = 0;
+
+	for (i = 0; i < bench_workers; i++) {
+		pthread_join(bench_clients[i].id, NULL);
+		tst_hist_merge(&r->lat, &bench_clients[i].lat);
+		r->requests += bench_clients[i].requests;
+		r->errors += bench_clients[i].errors;
+		SAFE_CLOSE(cleanup, bench_clients[i].epfd);
+	}
+
+	r->secs = (bench_ns() - start) / 1000000000.0;
+	r->tfo_active = read_tcpext("TCPFastOpenActive") - active;
+	r->tfo_passive = read_tcpext("TCPFastOpenPassive") - passive;
+
+	bench_server_stop = 1;
+	for (i = 0; i < bench_workers; i++) {
+		pthread_join(bench_servers[i].id, NULL);
+		r->errors += bench_servers[i].errors;
+		SAFE_CLOSE(cleanup, bench_servers[i].lfd);
+		SAFE_CLOSE(cleanup, bench_servers[i].epfd);
+	}
+}
+
+static void bench_report(const char *name, struct bench_result *r)
+{
+	char hist_name[64];
+
+	tst_resm(TINFO, "%s: %lu requests, %lu errors, %.0f conn/s, "
+		 "TFO active %llu, passive %llu", name, r->requests,
+		 r->errors, r->requests / r->secs, r->tfo_active,
+		 r->tfo_passive);
+
+	snprintf(hist_name, sizeof(hist_name), "%s connect+first byte", name);
+	tst_hist_report(hist_name, &r->lat);
+}
+
+static double bench_gain(double off, double on)
+{
+	return off ? (on - off) * 100 / off : 0;
+}
+
+static void bench_init(void)
+{
+	struct addrinfo hints;
+	cpu_set_t set;
+	int cpus[CPU_SETSIZE];	/* CPUs in the affinity mask */
+	int ncpus = 0;
+	int i, err;
+
+	/* online CPUs need not be numbered 0..n-1 nor be all allowed */
+	if (sched_getaffinity(0, sizeof(set), &set))
+		tst_brkm(TBROK | TERRNO, cleanup, "sched_getaffinity failed");
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &set))
+			cpus[ncpus++] = i;
+	}
+
+	bench_workers = ncpus;
+	check_opt("w", warg, &bench_workers, 1);
+	check_opt("c", carg, &bench_inflight, 1);
+	check_opt("t", targ, &bench_time, 1);
+
+	client_msg = SAFE_MALLOC(cleanup, client_msg_size);
+	memset(client_msg, client_byte, client_msg_size);
+	make_client_request();
+	server_msg = make_server_reply(server_msg_size);
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	err = getaddrinfo(server_addr, tcp_port, &hints, &remote_addrinfo);
+	if (err) {
+		tst_brkm(TBROK, cleanup, "getaddrinfo of '%s' failed, %s",
+			server_addr, gai_strerror(err));
+	}
+
+	bench_servers = SAFE_MALLOC(cleanup,
+				    bench_workers * sizeof(*bench_servers));
+	bench_clients = SAFE_MALLOC(cleanup,
+				    bench_workers * sizeof(*bench_clients));
+	for (i = 0; i < bench_workers; i++) {
+		bench_servers[i].cpu = bench_clients[i].cpu = cpus[i % ncpus];
+		bench_clients[i].conns = SAFE_MALLOC(cleanup,
+			bench_inflight * sizeof(struct bench_conn));
+	}
+
+	tst_resm(TINFO, "benchmark: %d server and client workers, "
+		 "%d connections in flight per worker, %ds per run",
+		 bench_workers, bench_inflight, bench_time);
+}
+
+static void bench_run(void)
+{
+	struct bench_result *off = &bench_res[TFO_DISABLED];
+	struct bench_result *on = &bench_res[TFO_ENABLED];
+
+	bench_tfo = 0;
+	bench_phase(off);
+	bench_tfo = 1;
+	bench_phase(on);
+
+	bench_report("TFO off", off);
+	bench_report("TFO on", on);
+
+	tst_resm(TINFO, "TFO on vs off: conn/s %+.1f%%, p50 %+.1f%%, "
+		 "p99 %+.1f%%",
+		 bench_gain(off->requests / off->secs,
+			    on->requests / on->secs),
+		 bench_gain(tst_hist_percentile(&off->lat, 50),
+			    tst_hist_percentile(&on->lat, 50)),
+		 bench_gain(tst_hist_percentile(&off->lat, 99),
+			    tst_hist_percentile(&on->lat, 99)));
+
+	if (!on->tfo_passive)
+		tst_resm(TFAIL, "no connection was established with TFO");
+	else if (off->errors || on->errors)
+		tst_resm(TFAIL, "%lu requests failed",
+			 off->errors + on->errors);
+	else
+		tst_resm(TPASS, "TFO benchmark completed");
+}
+
+static void bench_cleanup(void)
+{
+	int i;
+
+	if (bench_clients) {
+		for (i = 0; i < bench_workers; i++)
+			free(bench_clients[i].conns);
+	}
+	free(bench_clients);
+	free(bench_servers);
+
+	if (remote_addrinfo)
+		freeaddrinfo(remote_addrinfo);
+}
+
+static void bench_setup(void)
+{
+	tcp.init	= bench_init;
+	tcp.run		= bench_run;
+	tcp.cleanup	= bench_cleanup;
+
+	/* both ends are in this process, TFO is toggled per socket */
+	if ((tfo_cfg_value & 3) != 3) {
+		tst_resm(TINFO, "set '%s' to '%d'", tfo_cfg, tfo_cfg_value | 3);
+		SAFE_FILE_PRINTF(cleanup, tfo_cfg, "%d", tfo_cfg_value | 3);
+		tfo_cfg_orig = tfo_cfg_value;
+	}
+}
+
+static void mode_setup(void)
+{
 	tst_resm(TINFO, "TCP %s is using %s TCP API.",
 		(tcp_mode == TCP_SERVER) ? "server" : "client",
 		(fastopen_api == TFO_ENABLED) ? "Fastopen" : "old");
@@ -775,6 +1320,52 @@ static void setup(int argc, char *argv[])
 		SAFE_FILE_PRINTF(cleanup, tfo_cfg, "%d", value);
 		tfo_cfg_changed = 1;
 	}
+}
+
+static void setup(int argc, char *argv[])
+{
+	tst_parse_opts(argc, argv, options, help);
+
+	/* if client_num is not set, use num of processors */
+	clients_num = sysconf(_SC_NPROCESSORS_ONLN);
+
+	check_opt("a", aarg, &clients_num, 1);
+	check_opt("r", rarg, &client_max_requests, 1);
+	check_opt("R", Rarg, &server_max_requests, 1);
+	check_opt("n", narg, &client_msg_size, 1);
+	check_opt("N", Narg, &server_msg_size, 1);
+	check_opt("q", qarg, &tfo_queue_size, 1);
+	check_opt_l("T", Targ, &wait_timeout, 0L);
+	check_opt("b", barg, &busy_poll, 0);
+
+	if (!force_run)
+		tst_require_root();
+
+	if (!force_run && tst_kvercmp(3, 7, 0) < 0) {
+		tst_brkm(TCONF, NULL,
+			"Test must be run with kernel 3.7 or newer");
+	}
+
+	if (!force_run && busy_poll >= 0 && tst_kvercmp(3, 11, 0) < 0) {
+		tst_brkm(TCONF, NULL,
+			"Test must be run with kernel 3.11 or newer");
+	}
+
+	/* check tcp fast open knob */
+	if (!force_run && access(tfo_cfg, F_OK) == -1)
+		tst_brkm(TCONF, NULL, "Failed to find '%s'", tfo_cfg);
+
+	if (!force_run) {
+		SAFE_FILE_SCANF(NULL, tfo_cfg, "%d", &tfo_cfg_value);
+		tst_resm(TINFO, "'%s' is %d", tfo_cfg, tfo_cfg_value);
+	}
+
+	tst_sig(FORK, DEF_HANDLER, cleanup);
+
+	if (bench_mode)
+		bench_setup();
+	else
+		mode_setup();
 
 	int reuse_value = 0;
 	SAFE_FILE_SCANF(cleanup, tcp_tw_reuse, "%d", &reuse_value);
@@ -784,8 +1375,10 @@ static void setup(int argc, char *argv[])
 		tst_resm(TINFO, "set '%s' to '1'", tcp_tw_reuse);
 	}
 
-	tst_resm(TINFO, "TFO support %s",
-		(tfo_support) ? "enabled" : "disabled");
+	if (!bench_mode) {
+		tst_resm(TINFO, "TFO support %s",
+			(tfo_support) ? "enabled" : "disabled");
+	}
 
 	tcp.init();
 }
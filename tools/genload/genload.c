@@ -17,17 +17,23 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <linux/aio_abi.h>
 
 /* By default, print all messages of severity info and above.  */
 static int global_debug = 2;
@@ -50,6 +56,30 @@ static char *global_progname = PACKAGE;
 /* By default, do not hang after allocating memory.  */
 static int global_vmhang = 0;
 
+/* By default, threaded hogcpu workers spin for 100% of each period.  */
+static int global_cpuload = 100;
+
+/* By default, the duty cycle period of a threaded hogcpu worker is 100ms.  */
+static long global_period = 100000;
+
+/* By default, do not pin threaded workers to CPUs.  */
+static int global_pin = 0;
+
+/* By default, threaded hoghdd workers use buffered synchronous writes.  */
+static int global_hdd_direct = 0;
+
+/* Number of in-flight writes per threaded hoghdd worker, 0 for sync.  */
+static int global_hdd_qd = 0;
+
+/* By default, do not limit the bandwidth of threaded hoghdd workers.  */
+static long long global_hdd_rate = 0;
+
+/* By default, threaded hoghdd workers write 1MB blocks.  */
+static long long global_hdd_block = 1024 * 1024;
+
+/* By default, do not print a periodic stats line.  */
+static int global_stats = 0;
+
 /* Implemention of runtime-selectable severity message printing.  */
 #define dbg if (global_debug >= 3) \
             fprintf (stdout, "%s: debug: (%d) ", global_progname, __LINE__), \
@@ -84,6 +114,8 @@ int hogcpu(long long forks);
 int hogio(long long forks);
 int hogvm(long long forks, long long chunks, long long bytes);
 int hoghdd(long long forks, int clean, long long files, long long bytes);
+int hogthreads(long long cpus, long long ios, long long hdds, int clean,
+	       long long files, long long bytes);
 
 int main(int argc, char **argv)
 {
@@ -106,6 +138,7 @@ int main(int argc, char **argv)
 	int do_hdd_clean = 0;
 	long long do_hdd_files = 1;
 	long long do_hdd_bytes = 1024 * 1024 * 1024;
+	int do_threads = 0;
 
 	/* Record our start time.  */
 	if ((starttime = time(NULL)) == -1) {
@@ -190,6 +223,54 @@ int main(int argc, char **argv)
 		} else if (strcmp(arg, "--hdd-bytes") == 0) {
 			assert_arg("--hdd-bytes");
 			do_hdd_bytes = atoll_b(arg);
+		} else if (strcmp(arg, "--threads") == 0) {
+			do_threads = 1;
+		} else if (strcmp(arg, "--cpu-load") == 0) {
+			do_threads = 1;
+			assert_arg("--cpu-load");
+			global_cpuload = atoi(arg);
+			if (global_cpuload < 1 || global_cpuload > 100) {
+				err(stderr, "invalid cpu load: %s\n", arg);
+				exit(1);
+			}
+		} else if (strcmp(arg, "--cpu-period") == 0) {
+			do_threads = 1;
+			assert_arg("--cpu-period");
+			global_period = atol(arg);
+			if (global_period < 1000) {
+				err(stderr, "invalid cpu period: %s\n", arg);
+				exit(1);
+			}
+		} else if (strcmp(arg, "--cpu-pin") == 0) {
+			do_threads = 1;
+			global_pin = 1;
+		} else if (strcmp(arg, "--hdd-direct") == 0) {
+			do_threads = 1;
+			global_hdd_direct = 1;
+		} else if (strcmp(arg, "--hdd-async") == 0) {
+			do_threads = 1;
+			assert_arg("--hdd-async");
+			global_hdd_qd = atoi(arg);
+			if (global_hdd_qd < 1) {
+				err(stderr, "invalid queue depth: %s\n", arg);
+				exit(1);
+			}
+		} else if (strcmp(arg, "--hdd-rate") == 0) {
+			do_threads = 1;
+			assert_arg("--hdd-rate");
+			global_hdd_rate = atoll_b(arg);
+		} else if (strcmp(arg, "--hdd-block") == 0) {
+			do_threads = 1;
+			assert_arg("--hdd-block");
+			global_hdd_block = atoll_b(arg);
+			if (global_hdd_block < 512 || global_hdd_block % 512) {
+				err(stderr, "invalid block size: %s\n", arg);
+				exit(1);
+			}
+		} else if (strcmp(arg, "--stats") == 0) {
+			do_threads = 1;
+			assert_arg("--stats");
+			global_stats = atoi(arg);
 		} else {
 			err(stderr, "unrecognized option: %s\n", arg);
 			exit(1);
@@ -197,7 +278,7 @@ int main(int argc, char **argv)
 	}
 
 	/* Hog CPU option.  */
-	if (do_cpu) {
+	if (do_cpu && !do_threads) {
 		out(stdout, "dispatching %lli hogcpu forks\n", do_cpu_forks);
 
 		switch (pid = fork()) {
@@ -215,7 +296,7 @@ int main(int argc, char **argv)
 	}
 
 	/* Hog I/O option.  */
-	if (do_io) {
+	if (do_io && !do_threads) {
 		out(stdout, "dispatching %lli hogio forks\n", do_io_forks);
 
 		switch (pid = fork()) {
@@ -253,7 +334,7 @@ int main(int argc, char **argv)
 	}
 
 	/* Hog HDD option.  */
-	if (do_hdd) {
+	if (do_hdd && !do_threads) {
 		out(stdout, "dispatching %lli hoghdd forks, each %lli files of "
 		    "%lli bytes\n", do_hdd_forks, do_hdd_files, do_hdd_bytes);
 
@@ -273,9 +354,22 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/* We have no work to do, so bail out.  */
-	if (children == 0)
+	/* Threaded hogs run in this process alongside the dispatchers.  */
+	if (do_threads && (do_cpu || do_io || do_hdd)) {
+		out(stdout, "starting threaded workers: %lli hogcpu, %lli hogio, "
+		    "%lli hoghdd\n", do_cpu ? do_cpu_forks : 0,
+		    do_io ? do_io_forks : 0, do_hdd ? do_hdd_forks : 0);
+
+		if (!do_dryrun)
+			retval += hogthreads(do_cpu ? do_cpu_forks : -1,
+					     do_io ? do_io_forks : -1,
+					     do_hdd ? do_hdd_forks : -1,
+					     do_hdd_clean, do_hdd_files,
+					     do_hdd_bytes);
+	} else if (children == 0) {
+		/* We have no work to do, so bail out.  */
 		usage(0);
+	}
 
 	/* Wait for our children to exit.  */
 	while (children) {
@@ -352,9 +446,22 @@ int usage(int status)
 	    "     --hdd-noclean     do not unlink file to which random data written\n"
 	    "     --hdd-files f     write to f files (default is 1)\n"
 	    "     --hdd-bytes b     write b bytes (default is 1GB)\n\n"
+	    "     --threads         run -c, -i, -d as threads of this process\n"
+	    "     --cpu-load p      spin for p%% of each period (default is 100)\n"
+	    "     --cpu-period n    duty cycle period of n us (default is 100ms)\n"
+	    "     --cpu-pin         pin worker k to the k-th online CPU\n"
+	    "     --hdd-direct      write with O_DIRECT\n"
+	    "     --hdd-async q     keep q writes in flight with Linux AIO\n"
+	    "     --hdd-rate b      limit each hdd worker to b bytes per second\n"
+	    "     --hdd-block b     write blocks of b bytes (default is 1MB)\n"
+	    "     --stats n         print a stats line every n seconds\n\n"
 	    "Infinity is denoted with 0.  For -m, -d: n=0 means infinite redo,\n"
 	    "n<0 means redo abs(n) times. Valid suffixes are m,h,d,y for time;\n"
-	    "k,m,g for size.\n\n";
+	    "k,m,g for size.\n\n"
+	    "All of --cpu-*, --hdd-direct/async/rate/block and --stats imply\n"
+	    "--threads.  With --threads, n=0 for -c, -i, -d starts one worker\n"
+	    "per online CPU and the hogs stop cleanly at the timeout or on\n"
+	    "SIGINT/SIGTERM, printing a summary of the achieved load.\n\n";
 
 	fprintf(stdout, mesg, global_progname, global_progname);
 
@@ -891,3 +998,512 @@ int hoghdd(long long forks, int clean, long long files, long long bytes)
 
 	return retval;
 }
+
+/* Threaded workers.  Unlike the forked hogs above, these live in a single
+ * process so that their progress can be sampled for the stats line and so
+ * that their load can be controlled precisely.
+ */
+enum { HOG_CPU, HOG_IO, HOG_HDD };
+
+struct hog_worker {
+	pthread_t thread;
+	int type;
+	int cpu;
+	int clean;
+	long long files;
+	long long bytes;
+	/* Progress counters, sampled by the stats loop.  */
+	volatile long long busy_ns;
+	volatile long long ops;
+	volatile long long written;
+	int retval;
+};
+
+static volatile sig_atomic_t hog_stop;
+
+static void hog_sighandler(int sig)
+{
+	(void)sig;
+	hog_stop = 1;
+}
+
+static long long ts_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static long long clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts_ns(&ts);
+}
+
+static void ns_ts(long long ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000LL;
+	ts->tv_nsec = ns % 1000000000LL;
+}
+
+static void sleep_until(long long deadline)
+{
+	struct timespec ts;
+
+	ns_ts(deadline, &ts);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR && !hog_stop) ;
+}
+
+static int nth_online_cpu(int n)
+{
+	cpu_set_t set;
+	int i, count;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return -1;
+
+	count = CPU_COUNT(&set);
+	if (count == 0)
+		return -1;
+
+	n %= count;
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &set) && n-- == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static void pin_worker(struct hog_worker *w)
+{
+	cpu_set_t set;
+
+	if (!global_pin || w->cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+		wrn(stderr, "failed to pin worker to cpu %i\n", w->cpu);
+	} else {
+		dbg(stdout, "worker pinned to cpu %i\n", w->cpu);
+	}
+}
+
+/* Keeps the compiler from dropping the sqrt() calls.  */
+static volatile double hogcpu_sink;
+
+/* Spin on sqrt() for global_cpuload percent of every period.  The busy part
+ * is measured in thread CPU time, so time lost to preemption is not counted
+ * as load; any shortfall (or overshoot) is carried over into the next period
+ * so that the long term duty cycle converges on the requested value.
+ */
+static void *hogcpu_thread(void *arg)
+{
+	struct hog_worker *w = arg;
+	long long period = global_period * 1000LL;
+	long long target = period * global_cpuload / 100;
+	long long next, debt = 0, busy, start, used;
+	unsigned int seed = w->cpu + 1;
+	int k;
+
+	pin_worker(w);
+
+	next = clock_ns(CLOCK_MONOTONIC);
+
+	while (!hog_stop) {
+		next += period;
+
+		busy = target + debt;
+		if (busy < 0)
+			busy = 0;
+		if (busy > period)
+			busy = period;
+
+		start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+		do {
+			for (k = 0; k < 64; k++)
+				hogcpu_sink = sqrt(rand_r(&seed));
+			used = clock_ns(CLOCK_THREAD_CPUTIME_ID) - start;
+		} while (used < busy && clock_ns(CLOCK_MONOTONIC) < next);
+
+		debt = busy - used;
+		if (debt > period || debt < -period)
+			debt = 0;
+
+		__sync_fetch_and_add(&w->busy_ns, used);
+		__sync_fetch_and_add(&w->ops, 1);
+
+		if (global_cpuload < 100)
+			sleep_until(next);
+
+		/* Do not try to catch up after having been stopped.  */
+		if (clock_ns(CLOCK_MONOTONIC) > next + period)
+			next = clock_ns(CLOCK_MONOTONIC);
+	}
+
+	return NULL;
+}
+
+static void *hogio_thread(void *arg)
+{
+	struct hog_worker *w = arg;
+
+	pin_worker(w);
+
+	while (!hog_stop) {
+		sync();
+		__sync_fetch_and_add(&w->ops, 1);
+	}
+
+	return NULL;
+}
+
+static long io_setup(unsigned nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static long io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static long io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static long io_getevents(aio_context_t ctx, long min_nr, long nr,
+			 struct io_event *events, struct timespec *timeout)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+/* Sleep as long as needed to keep the worker at global_hdd_rate.  */
+static void hoghdd_throttle(long long start, long long written)
+{
+	if (global_hdd_rate <= 0)
+		return;
+
+	sleep_until(start + written * 1000000000LL / global_hdd_rate);
+}
+
+/* Write @bytes (infinite if 0) to @fd, keeping global_hdd_qd writes in
+ * flight.  Returns the number of bytes written or -1 on error.
+ */
+static long long hoghdd_aio(struct hog_worker *w, int fd, char *buff,
+			    long long bytes, long long start)
+{
+	long long block = global_hdd_block;
+	long long offset = 0, done = 0;
+	int qd = global_hdd_qd, inflight = 0, i, k, n;
+	aio_context_t ctx = 0;
+	struct iocb *cbs, *cbp;
+	struct io_event *events;
+
+	cbs = calloc(qd, sizeof(*cbs));
+	events = calloc(qd, sizeof(*events));
+	if (!cbs || !events || io_setup(qd, &ctx)) {
+		err(stderr, "failed to set up aio: %s\n", strerror(errno));
+		free(cbs);
+		free(events);
+		return -1;
+	}
+
+	for (i = 0; i < qd; i++) {
+		cbs[i].aio_fildes = fd;
+		cbs[i].aio_lio_opcode = IOCB_CMD_PWRITE;
+		cbs[i].aio_buf = (unsigned long)buff;
+		cbs[i].aio_nbytes = block;
+	}
+
+	i = 0;
+	while (!hog_stop || inflight) {
+		while (!hog_stop && inflight < qd &&
+		       (bytes == 0 || offset < bytes)) {
+			hoghdd_throttle(start, w->written);
+			cbp = &cbs[i];
+			cbp->aio_offset = offset;
+			if (io_submit(ctx, 1, &cbp) != 1) {
+				err(stderr, "io_submit failed: %s\n",
+				    strerror(errno));
+				hog_stop = 1;
+				break;
+			}
+			offset += block;
+			inflight++;
+			i = (i + 1) % qd;
+		}
+
+		if (!inflight)
+			break;
+
+		n = io_getevents(ctx, 1, inflight, events, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(stderr, "io_getevents failed: %s\n",
+			    strerror(errno));
+			break;
+		}
+
+		for (k = 0; k < n; k++) {
+			if ((long long)events[k].res != block) {
+				err(stderr, "aio write failed: %lli\n",
+				    (long long)events[k].res);
+				hog_stop = 1;
+				w->retval = 1;
+			} else {
+				done += block;
+				__sync_fetch_and_add(&w->written, block);
+				__sync_fetch_and_add(&w->ops, 1);
+			}
+		}
+		inflight -= n;
+	}
+
+	io_destroy(ctx);
+	free(cbs);
+	free(events);
+
+	return w->retval ? -1 : done;
+}
+
+static void *hoghdd_thread(void *arg)
+{
+	struct hog_worker *w = arg;
+	long long block = global_hdd_block;
+	long long i, j, start, bytes = w->bytes;
+	unsigned int seed = w->cpu + 1;
+	char *buff;
+	int fd;
+
+	pin_worker(w);
+
+	/* O_DIRECT needs aligned buffers and whole blocks.  */
+	if (posix_memalign((void **)&buff, 4096, block)) {
+		err(stderr, "failed to allocate hdd buffer\n");
+		w->retval = 1;
+		return NULL;
+	}
+	if (global_hdd_direct && bytes % block)
+		bytes += block - bytes % block;
+
+	for (i = 0; i < block - 1; i++)
+		buff[i] = 32 + rand_r(&seed) % 95;
+	buff[i] = '\n';
+
+	start = clock_ns(CLOCK_MONOTONIC);
+
+	while (!hog_stop) {
+		for (i = 0; i < w->files && !hog_stop; i++) {
+			char name[] = "./stress.XXXXXX";
+
+			fd = mkostemp(name, global_hdd_direct ? O_DIRECT : 0);
+			if (fd < 0) {
+				err(stderr, "mkostemp failed: %s\n",
+				    strerror(errno));
+				w->retval = 1;
+				goto exit_worker;
+			}
+
+			if (w->clean == 0 && unlink(name)) {
+				err(stderr, "unlink failed\n");
+				w->retval = 1;
+				close(fd);
+				goto exit_worker;
+			}
+
+			dbg(stdout, "writing to %s\n", name);
+			if (global_hdd_qd) {
+				j = hoghdd_aio(w, fd, buff, bytes, start);
+			} else {
+				for (j = 0; !hog_stop && (bytes == 0 || j < bytes);
+				     j += block) {
+					long long len = block;
+
+					if (bytes && bytes - j < len)
+						len = bytes - j;
+
+					hoghdd_throttle(start, w->written);
+					if (pwrite(fd, buff, len, j) != len) {
+						err(stderr, "write failed: %s\n",
+						    strerror(errno));
+						w->retval = 1;
+						break;
+					}
+					__sync_fetch_and_add(&w->written, len);
+					__sync_fetch_and_add(&w->ops, 1);
+				}
+			}
+
+			dbg(stdout, "closing %s after writing %lli bytes\n",
+			    name, j);
+			close(fd);
+
+			if (w->clean == 1 && unlink(name)) {
+				err(stderr, "unlink failed\n");
+				w->retval = 1;
+			}
+
+			if (w->retval)
+				goto exit_worker;
+		}
+	}
+
+exit_worker:
+	free(buff);
+	return NULL;
+}
+
+static void hog_sum(struct hog_worker *w, int n, int type, long long *busy,
+		    long long *ops, long long *written, int *count)
+{
+	int i;
+
+	*busy = *ops = *written = 0;
+	*count = 0;
+
+	for (i = 0; i < n; i++) {
+		if (w[i].type != type)
+			continue;
+		*busy += w[i].busy_ns;
+		*ops += w[i].ops;
+		*written += w[i].written;
+		(*count)++;
+	}
+}
+
+/* Print a single line describing the load generated during the last @ns.  */
+static void hog_report(const char *what, struct hog_worker *w, int n,
+		       long long *last, long long ns)
+{
+	long long busy, io_ops, hdd, unused1, unused2;
+	int cpus, ios, hdds;
+	double secs = ns / 1e9;
+
+	hog_sum(w, n, HOG_CPU, &busy, &unused1, &unused2, &cpus);
+	hog_sum(w, n, HOG_IO, &unused1, &io_ops, &unused2, &ios);
+	hog_sum(w, n, HOG_HDD, &unused1, &unused2, &hdd, &hdds);
+
+	out(stdout, "%s %.1fs: cpu %.1f%% x%i, io %.0f syncs/s x%i, "
+	    "hdd %.1f MB/s x%i\n", what, secs,
+	    cpus ? (busy - last[0]) * 100.0 / ns / cpus : 0.0, cpus,
+	    (io_ops - last[1]) / secs, ios,
+	    (hdd - last[2]) / secs / (1024 * 1024), hdds);
+
+	last[0] = busy;
+	last[1] = io_ops;
+	last[2] = hdd;
+}
+
+int hogthreads(long long cpus, long long ios, long long hdds, int clean,
+	       long long files, long long bytes)
+{
+	struct hog_worker *w;
+	struct sigaction sa;
+	long long i, n, start, now, last_ns, stats_ns, deadline = 0;
+	long long last[3] = { 0, 0, 0 };
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	int retval = 0;
+	void *(*fn)(void *);
+
+	/* A negative count means that hog was not requested.  */
+	cpus = cpus == 0 ? online : (cpus < 0 ? 0 : cpus);
+	ios = ios == 0 ? online : (ios < 0 ? 0 : ios);
+	hdds = hdds == 0 ? online : (hdds < 0 ? 0 : hdds);
+
+	n = cpus + ios + hdds;
+	w = calloc(n, sizeof(*w));
+	if (!w) {
+		err(stderr, "failed to allocate workers\n");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = hog_sighandler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i = 0; i < n; i++) {
+		if (i < cpus)
+			w[i].type = HOG_CPU;
+		else if (i < cpus + ios)
+			w[i].type = HOG_IO;
+		else
+			w[i].type = HOG_HDD;
+		w[i].cpu = nth_online_cpu(i);
+		w[i].clean = clean;
+		w[i].files = files;
+		w[i].bytes = bytes;
+	}
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	if (global_timeout)
+		deadline = start + global_timeout * 1000000000LL;
+
+	for (i = 0; i < n; i++) {
+		switch (w[i].type) {
+		case HOG_CPU:
+			fn = hogcpu_thread;
+			break;
+		case HOG_IO:
+			fn = hogio_thread;
+			break;
+		default:
+			fn = hoghdd_thread;
+		}
+
+		if (pthread_create(&w[i].thread, NULL, fn, &w[i])) {
+			err(stderr, "failed to create worker thread\n");
+			hog_stop = 1;
+			n = i;
+			retval = 1;
+			break;
+		}
+		dbg(stdout, "--> worker thread %lli started\n", i);
+	}
+
+	last_ns = start;
+	stats_ns = global_stats * 1000000000LL;
+
+	while (!hog_stop) {
+		long long wake;
+
+		now = clock_ns(CLOCK_MONOTONIC);
+		if (deadline && now >= deadline)
+			break;
+
+		if (stats_ns) {
+			if (now - last_ns >= stats_ns) {
+				hog_report("stats", w, n, last, now - last_ns);
+				last_ns = now;
+			}
+			wake = last_ns + stats_ns;
+		} else {
+			wake = now + 3600 * 1000000000LL;
+		}
+		if (deadline && deadline < wake)
+			wake = deadline;
+
+		sleep_until(wake);
+	}
+
+	hog_stop = 1;
+
+	for (i = 0; i < n; i++) {
+		pthread_join(w[i].thread, NULL);
+		retval += w[i].retval;
+		dbg(stdout, "<-- worker thread %lli exited\n", i);
+	}
+
+	last[0] = last[1] = last[2] = 0;
+	hog_report("total", w, n, last, clock_ns(CLOCK_MONOTONIC) - start);
+
+	free(w);
+
+	return retval;
+}
@@ -0,0 +1,970 @@
+/*
+ * Copyright (C) 2026 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+/*
+ * NPstream -- self-contained multi-stream variant of NPtcp.
+ *
+ * Both ends of every stream live in this process, so no remote host and no
+ * separately started receiver are needed. The streams run over loopback or,
+ * with -V, over a veth pair connecting two private network namespaces that
+ * disappear together with the process.
+ *
+ * Every stream is a TCP connection served by a client and a server thread,
+ * both pinned to entry (stream number % number of CPUs) of the CPUs this
+ * process may run on. The message size is doubled from -l up to -u and for
+ * each size all streams run concurrently for -d milliseconds in:
+ *
+ *   rr     - ping-pong, the client sends a message and waits for the server
+ *            to echo it back, every round trip is a latency sample
+ *   stream - the client sends messages back to back, the throughput is
+ *            measured at the server from the start until the last byte
+ *
+ * Sends can use MSG_ZEROCOPY (-z) and one of the variants (-s): nodelay sets
+ * TCP_NODELAY, cork wraps every message in TCP_CORK, nagle leaves Nagle's
+ * algorithm on.
+ *
+ * One CSV line per size and mode is written to stdout or to the -o file.
+ * Throughput is in Mbps as in NPtcp output (2^20 bits per second), RTT in
+ * microseconds; the rtt columns are empty for the stream mode.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/veth.h>
+#include <net/if.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY		60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY		0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY	5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+#define DEFPORT		5003
+#define RECV_MIN	65536
+
+#define VETH_CLIENT	"npv0"
+#define VETH_SERVER	"npv1"
+#define VETH_CLIENT_IP	"10.23.0.1"
+#define VETH_SERVER_IP	"10.23.0.2"
+
+enum { MODE_RR = 1, MODE_STREAM = 2 };
+enum { VARIANT_NODELAY, VARIANT_CORK, VARIANT_NAGLE };
+
+static const char *const variant_names[] = { "nodelay", "cork", "nagle" };
+
+/*
+ * Log-linear histogram, each power of two is split into 8 buckets, the
+ * same layout as tst_hist in the LTP library which NetPIPE does not link.
+ */
+#define HIST_SUB_BITS	3
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(64 << HIST_SUB_BITS)
+
+struct hist {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long long buckets[HIST_BUCKETS];
+};
+
+/* Per end of a connection */
+struct end {
+	int fd;
+	char *buf;
+	unsigned long long zc_sent;	/* MSG_ZEROCOPY sends */
+	unsigned long long zc_done;	/* completions reaped */
+	unsigned long long zc_copied;	/* completions that fell back to copy */
+};
+
+struct stream {
+	int id;
+	int cpu;
+	struct end client, server;
+	pthread_t client_thread, server_thread;
+
+	unsigned long long msgs;
+	unsigned long long tx_bytes;
+	volatile unsigned long long rx_bytes;
+	volatile int client_done;
+	double end_time;
+	struct hist rtt;
+};
+
+static int nr_streams;
+static int min_size = 1;
+static int max_size = 1024 * 1024;
+static int duration_ms = 500;
+static int modes = MODE_RR | MODE_STREAM;
+static int variant = VARIANT_NODELAY;
+static int zerocopy;
+static int use_veth;
+static int sockbuf;
+static int printopt;
+static unsigned short port = DEFPORT;
+
+static int ns_client = -1, ns_server = -1;
+static struct stream *streams;
+static pthread_barrier_t barrier;
+static volatile int stop;
+static int phase_mode, phase_size;
+static int cpus[CPU_SETSIZE];	/* CPUs in the affinity mask */
+static int ncpus;
+
+static void PrintUsage(void)
+{
+	printf("\n NPSTREAM USAGE \n\n");
+	printf("b: specify send and receive buffer sizes e.g. <-b 32768>\n");
+	printf("d: milliseconds to run each size and mode, default 500\n");
+	printf("l: lower bound message size, default 1\n");
+	printf("m: mode: rr, stream or both (default)\n");
+	printf("n: number of concurrent streams, default number of CPUs\n");
+	printf("o: specify output filename <-o fn>, default stdout\n");
+	printf("P: print summary on stderr\n");
+	printf("p: specify port e.g. <-p 5150>\n");
+	printf("s: send variant: nodelay (default), cork or nagle\n");
+	printf("u: upper bound message size, default 1048576\n");
+	printf("V: run over a veth pair between two private netns\n");
+	printf("z: send with MSG_ZEROCOPY\n");
+	printf("\n");
+	exit(-12);
+}
+
+static void fatal(const char *msg)
+{
+	fprintf(stderr, "NPstream: %s: %s\n", msg, strerror(errno));
+	exit(1);
+}
+
+static double When(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned int hist_idx(unsigned long long val)
+{
+	unsigned int msb;
+
+	if (val < HIST_SUB)
+		return val;
+
+	msb = 63 - __builtin_clzll(val);
+
+	return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+	       ((val >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static unsigned long long hist_val(unsigned int idx)
+{
+	unsigned int msb, shift;
+
+	if (idx < HIST_SUB)
+		return idx;
+
+	msb = (idx >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	shift = msb - HIST_SUB_BITS;
+
+	return ((1ULL << msb) |
+		((unsigned long long)(idx & (HIST_SUB - 1)) << shift)) +
+	       ((1ULL << shift) >> 1);
+}
+
+static void hist_add(struct hist *h, unsigned long long val)
+{
+	if (val > h->max)
+		h->max = val;
+	h->count++;
+	h->sum += val;
+	h->buckets[hist_idx(val)]++;
+}
+
+static void hist_merge(struct hist *dst, const struct hist *src)
+{
+	unsigned int i;
+
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+static double hist_pct_us(const struct hist *h, double pct)
+{
+	unsigned long long rank, seen = 0, val;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	rank = h->count * pct / 100;
+	if (rank >= h->count)
+		return h->max / 1000.0;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank)
+			break;
+	}
+
+	val = hist_val(i);
+	if (val > h->max)
+		val = h->max;
+
+	return val / 1000.0;
+}
+
+/*
+ * Netlink helpers for the veth setup, every request is acked and the ack
+ * is checked for an error.
+ */
+struct nl_req {
+	struct nlmsghdr nh;
+	char buf[1024];
+};
+
+static struct rtattr *nl_attr(struct nlmsghdr *nh, int type,
+			      const void *data, int len)
+{
+	struct rtattr *rta = (void *)nh + NLMSG_ALIGN(nh->nlmsg_len);
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if (len)
+		memcpy(RTA_DATA(rta), data, len);
+	nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+	return rta;
+}
+
+static void nl_nest_end(struct nlmsghdr *nh, struct rtattr *nest)
+{
+	nest->rta_len = (void *)nh + nh->nlmsg_len - (void *)nest;
+}
+
+static void nl_talk(int fd, struct nlmsghdr *nh, const char *what)
+{
+	char buf[4096];
+	struct nlmsgerr *err;
+	int len;
+
+	nh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+
+	if (send(fd, nh, nh->nlmsg_len, 0) != (ssize_t)nh->nlmsg_len)
+		fatal(what);
+
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < (int)NLMSG_LENGTH(sizeof(*err)))
+		fatal(what);
+
+	nh = (struct nlmsghdr *)buf;
+	if (nh->nlmsg_type != NLMSG_ERROR)
+		return;
+
+	err = NLMSG_DATA(nh);
+	if (err->error) {
+		errno = -err->error;
+		fatal(what);
+	}
+}
+
+static int nl_open(void)
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+	if (fd < 0)
+		fatal("socket(NETLINK_ROUTE)");
+
+	return fd;
+}
+
+static void nl_init(struct nl_req *req, int type, int flags, int len)
+{
+	memset(req, 0, sizeof(*req));
+	req->nh.nlmsg_len = NLMSG_LENGTH(len);
+	req->nh.nlmsg_type = type;
+	req->nh.nlmsg_flags = flags;
+}
+
+static void link_up(int nl, const char *name)
+{
+	struct nl_req req;
+	struct ifinfomsg *ifi;
+
+	nl_init(&req, RTM_NEWLINK, 0, sizeof(*ifi));
+	ifi = NLMSG_DATA(&req.nh);
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = if_nametoindex(name);
+	ifi->ifi_flags = IFF_UP;
+	ifi->ifi_change = IFF_UP;
+
+	if (!ifi->ifi_index)
+		fatal(name);
+
+	nl_talk(nl, &req.nh, "RTM_NEWLINK up");
+}
+
+static void addr_add(int nl, const char *name, const char *ip)
+{
+	struct nl_req req;
+	struct ifaddrmsg *ifa;
+	struct in_addr addr;
+
+	nl_init(&req, RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, sizeof(*ifa));
+	ifa = NLMSG_DATA(&req.nh);
+	ifa->ifa_family = AF_INET;
+	ifa->ifa_prefixlen = 24;
+	ifa->ifa_index = if_nametoindex(name);
+
+	if (!ifa->ifa_index)
+		fatal(name);
+
+	inet_pton(AF_INET, ip, &addr);
+	nl_attr(&req.nh, IFA_LOCAL, &addr, sizeof(addr));
+	nl_attr(&req.nh, IFA_ADDRESS, &addr, sizeof(addr));
+
+	nl_talk(nl, &req.nh, "RTM_NEWADDR");
+}
+
+/* creates VETH_CLIENT in the current netns with its peer in peer_ns */
+static void veth_add(int nl, int peer_ns)
+{
+	struct nl_req req;
+	struct ifinfomsg *ifi, peer;
+	struct rtattr *linkinfo, *data, *info_peer;
+
+	nl_init(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, sizeof(*ifi));
+	ifi = NLMSG_DATA(&req.nh);
+	ifi->ifi_family = AF_UNSPEC;
+
+	nl_attr(&req.nh, IFLA_IFNAME, VETH_CLIENT, sizeof(VETH_CLIENT));
+	linkinfo = nl_attr(&req.nh, IFLA_LINKINFO, NULL, 0);
+	nl_attr(&req.nh, IFLA_INFO_KIND, "veth", 4);
+	data = nl_attr(&req.nh, IFLA_INFO_DATA, NULL, 0);
+
+	memset(&peer, 0, sizeof(peer));
+	peer.ifi_family = AF_UNSPEC;
+	info_peer = nl_attr(&req.nh, VETH_INFO_PEER, &peer, sizeof(peer));
+	nl_attr(&req.nh, IFLA_IFNAME, VETH_SERVER, sizeof(VETH_SERVER));
+	nl_attr(&req.nh, IFLA_NET_NS_FD, &peer_ns, sizeof(peer_ns));
+
+	nl_nest_end(&req.nh, info_peer);
+	nl_nest_end(&req.nh, data);
+	nl_nest_end(&req.nh, linkinfo);
+
+	nl_talk(nl, &req.nh, "RTM_NEWLINK veth");
+}
+
+static int netns_new(void)
+{
+	int fd;
+
+	if (unshare(CLONE_NEWNET))
+		fatal("unshare(CLONE_NEWNET)");
+
+	fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		fatal("open(/proc/thread-self/ns/net)");
+
+	return fd;
+}
+
+static void netns_enter(int fd)
+{
+	if (setns(fd, CLONE_NEWNET))
+		fatal("setns");
+}
+
+/*
+ * The client ends live in one private netns, the server ends in another
+ * one, connected with a veth pair. The process stays in the client netns.
+ */
+static void veth_setup(void)
+{
+	int nl;
+
+	ns_client = netns_new();
+	ns_server = netns_new();
+
+	nl = nl_open();
+	link_up(nl, "lo");
+	close(nl);
+
+	netns_enter(ns_client);
+	nl = nl_open();
+	link_up(nl, "lo");
+	veth_add(nl, ns_server);
+	addr_add(nl, VETH_CLIENT, VETH_CLIENT_IP);
+	link_up(nl, VETH_CLIENT);
+	close(nl);
+
+	netns_enter(ns_server);
+	nl = nl_open();
+	addr_add(nl, VETH_SERVER, VETH_SERVER_IP);
+	link_up(nl, VETH_SERVER);
+	close(nl);
+
+	netns_enter(ns_client);
+}
+
+static void set_sockopts(int fd)
+{
+	int one = 1;
+
+	if (variant == VARIANT_NODELAY &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+		fatal("setsockopt(TCP_NODELAY)");
+
+	if (zerocopy &&
+	    setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+		fatal("setsockopt(SO_ZEROCOPY)");
+
+	if (sockbuf > 0 &&
+	    (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sockbuf, sizeof(sockbuf)) ||
+	     setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sockbuf, sizeof(sockbuf))))
+		fatal("setsockopt(SO_SNDBUF/SO_RCVBUF)");
+}
+
+static void connect_streams(void)
+{
+	struct sockaddr_in addr;
+	int lfd, one = 1, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+
+	if (use_veth)
+		netns_enter(ns_server);
+
+	lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0)
+		fatal("socket");
+
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	inet_pton(AF_INET, use_veth ? VETH_SERVER_IP : "127.0.0.1",
+		  &addr.sin_addr);
+
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)))
+		fatal("bind");
+	if (listen(lfd, 16))
+		fatal("listen");
+
+	if (use_veth)
+		netns_enter(ns_client);
+
+	for (i = 0; i < nr_streams; i++) {
+		struct stream *s = &streams[i];
+
+		s->client.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (s->client.fd < 0)
+			fatal("socket");
+
+		set_sockopts(s->client.fd);
+
+		if (connect(s->client.fd, (struct sockaddr *)&addr,
+			    sizeof(addr)))
+			fatal("connect");
+
+		s->server.fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+		if (s->server.fd < 0)
+			fatal("accept");
+
+		set_sockopts(s->server.fd);
+	}
+
+	close(lfd);
+}
+
+/* reaps MSG_ZEROCOPY completions, waits for at least one if block is set */
+static void zc_reap(struct end *e, int block)
+{
+	char control[128];
+	struct sock_extended_err *serr;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct pollfd pfd;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(e->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno != EAGAIN)
+				fatal("recvmsg(MSG_ERRQUEUE)");
+			if (!block)
+				return;
+
+			/* POLLERR is reported even if not asked for */
+			pfd.fd = e->fd;
+			pfd.events = 0;
+			poll(&pfd, 1, 100);
+			continue;
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			unsigned int n;
+
+			serr = (void *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			n = serr->ee_data - serr->ee_info + 1;
+			e->zc_done += n;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				e->zc_copied += n;
+		}
+
+		block = 0;
+	}
+}
+
+static void send_msg(struct end *e, int len)
+{
+	int flags = MSG_NOSIGNAL, on = 1, off = 0;
+	char *p = e->buf;
+	ssize_t ret;
+
+	if (zerocopy)
+		flags |= MSG_ZEROCOPY;
+
+	if (variant == VARIANT_CORK)
+		setsockopt(e->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+
+	while (len > 0) {
+		ret = send(e->fd, p, len, flags);
+		if (ret < 0) {
+			/* out of optmem for pending zerocopy notifications */
+			if (errno == ENOBUFS && zerocopy) {
+				zc_reap(e, 1);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			fatal("send");
+		}
+
+		if (zerocopy)
+			e->zc_sent++;
+		p += ret;
+		len -= ret;
+	}
+
+	if (variant == VARIANT_CORK)
+		setsockopt(e->fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+
+	if (zerocopy)
+		zc_reap(e, 0);
+}
+
+static void recv_msg(struct end *e, int len)
+{
+	ssize_t ret;
+	char *p = e->buf;
+
+	while (len > 0) {
+		ret = recv(e->fd, p, len, 0);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (!ret)
+				errno = ECONNRESET;
+			fatal("recv");
+		}
+		p += ret;
+		len -= ret;
+	}
+}
+
+static void *client_fn(void *arg)
+{
+	struct stream *s = arg;
+	double t0;
+
+	pthread_barrier_wait(&barrier);
+
+	while (!stop) {
+		t0 = When();
+		send_msg(&s->client, phase_size);
+		if (phase_mode == MODE_RR) {
+			recv_msg(&s->client, phase_size);
+			hist_add(&s->rtt, (When() - t0) * 1e9);
+		}
+		s->msgs++;
+		s->tx_bytes += phase_size;
+	}
+
+	if (phase_mode == MODE_RR)
+		s->end_time = When();
+
+	while (s->client.zc_done < s->client.zc_sent)
+		zc_reap(&s->client, 1);
+
+	__sync_synchronize();
+	s->client_done = 1;
+
+	return NULL;
+}
+
+/* echoes rr messages or sinks the stream until all the client sent is in */
+static void *server_fn(void *arg)
+{
+	struct stream *s = arg;
+	struct pollfd pfd = { .fd = s->server.fd, .events = POLLIN };
+	int buflen = phase_size > RECV_MIN ? phase_size : RECV_MIN;
+	ssize_t ret;
+
+	pthread_barrier_wait(&barrier);
+
+	for (;;) {
+		if (!poll(&pfd, 1, 10)) {
+			if (s->client_done && s->rx_bytes == s->tx_bytes)
+				break;
+			continue;
+		}
+
+		/* only zerocopy completions of the rr replies are pending */
+		if (!(pfd.revents & POLLIN)) {
+			zc_reap(&s->server, 0);
+			continue;
+		}
+
+		if (phase_mode == MODE_RR) {
+			recv_msg(&s->server, phase_size);
+			send_msg(&s->server, phase_size);
+			s->rx_bytes += phase_size;
+			continue;
+		}
+
+		ret = recv(s->server.fd, s->server.buf, buflen, MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (ret <= 0)
+			fatal("recv");
+
+		s->rx_bytes += ret;
+		s->end_time = When();
+	}
+
+	while (s->server.zc_done < s->server.zc_sent)
+		zc_reap(&s->server, 1);
+
+	return NULL;
+}
+
+static void start_thread(pthread_t *id, void *(*fn)(void *), struct stream *s)
+{
+	pthread_attr_t attr;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(s->cpu, &set);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+
+	errno = pthread_create(id, &attr, fn, s);
+	if (errno)
+		fatal("pthread_create");
+
+	pthread_attr_destroy(&attr);
+}
+
+static void run_phase(FILE *out, int mode, int size)
+{
+	unsigned long long msgs = 0, bytes = 0, zc_sent = 0, zc_copied = 0;
+	struct hist *rtt;
+	double start, end = 0, secs, mbps;
+	int i;
+
+	rtt = calloc(1, sizeof(*rtt));
+	if (!rtt)
+		fatal("calloc");
+
+	phase_mode = mode;
+	phase_size = size;
+	stop = 0;
+
+	errno = pthread_barrier_init(&barrier, NULL, 2 * nr_streams + 1);
+	if (errno)
+		fatal("pthread_barrier_init");
+
+	for (i = 0; i < nr_streams; i++) {
+		struct stream *s = &streams[i];
+
+		s->msgs = s->tx_bytes = s->rx_bytes = 0;
+		s->client.zc_sent = s->client.zc_done = 0;
+		s->client.zc_copied = 0;
+		s->server.zc_sent = s->server.zc_done = 0;
+		s->server.zc_copied = 0;
+		s->client_done = 0;
+		s->end_time = 0;
+		memset(&s->rtt, 0, sizeof(s->rtt));
+
+		start_thread(&s->client_thread, client_fn, s);
+		start_thread(&s->server_thread, server_fn, s);
+	}
+
+	pthread_barrier_wait(&barrier);
+	start = When();
+	usleep(duration_ms * 1000);
+	stop = 1;
+
+	for (i = 0; i < nr_streams; i++) {
+		struct stream *s = &streams[i];
+
+		pthread_join(s->client_thread, NULL);
+		pthread_join(s->server_thread, NULL);
+
+		msgs += s->msgs;
+		bytes += s->tx_bytes;
+		zc_sent += s->client.zc_sent + s->server.zc_sent;
+		zc_copied += s->client.zc_copied + s->server.zc_copied;
+		hist_merge(rtt, &s->rtt);
+
+		if (s->end_time > end)
+			end = s->end_time;
+	}
+
+	pthread_barrier_destroy(&barrier);
+
+	/* rr ends with the last reply, stream with the last byte received */
+	if (end < start)
+		end = When();
+
+	secs = end - start;
+	mbps = bytes * 8 / (secs * 1024 * 1024);
+
+	fprintf(out, "%s,%s,%d,%s,%d,%d,%llu,%llu,%.6f,%.3f,",
+		mode == MODE_RR ? "rr" : "stream", variant_names[variant],
+		zerocopy, use_veth ? "veth" : "lo", nr_streams, size, msgs,
+		bytes, secs, mbps);
+
+	if (mode == MODE_RR) {
+		fprintf(out, "%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,",
+			rtt->count ? rtt->sum / 1000.0 / rtt->count : 0,
+			hist_pct_us(rtt, 50), hist_pct_us(rtt, 90),
+			hist_pct_us(rtt, 99), hist_pct_us(rtt, 99.9),
+			rtt->max / 1000.0);
+	} else {
+		fprintf(out, ",,,,,,");
+	}
+
+	fprintf(out, "%llu,%llu\n", zc_sent, zc_copied);
+	fflush(out);
+
+	if (printopt) {
+		fprintf(stderr, "%-6s %9d bytes %10llu msgs --> %10.2f Mbps",
+			mode == MODE_RR ? "rr" : "stream", size, msgs, mbps);
+		if (mode == MODE_RR)
+			fprintf(stderr, " rtt p50 %.1fus p99 %.1fus",
+				hist_pct_us(rtt, 50), hist_pct_us(rtt, 99));
+		if (zerocopy)
+			fprintf(stderr, " zc copied %llu/%llu",
+				zc_copied, zc_sent);
+		fprintf(stderr, "\n");
+	}
+
+	free(rtt);
+}
+
+static char *alloc_buf(int size)
+{
+	void *buf;
+
+	/* page aligned so that MSG_ZEROCOPY can pin whole pages */
+	errno = posix_memalign(&buf, getpagesize(), size);
+	if (errno)
+		fatal("posix_memalign");
+
+	memset(buf, 'a', size);
+	return buf;
+}
+
+/* Online CPUs need not be numbered 0..n-1 nor be all allowed */
+static void get_cpus(void)
+{
+	cpu_set_t set;
+	int i;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		fatal("sched_getaffinity");
+
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &set))
+			cpus[ncpus++] = i;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *out = stdout;
+	int c, i, size, buflen;
+
+	get_cpus();
+	nr_streams = ncpus;
+
+	while ((c = getopt(argc, argv, "b:d:l:m:n:o:Pp:s:u:Vz")) != -1) {
+		switch (c) {
+		case 'b':
+			sockbuf = atoi(optarg);
+			break;
+		case 'd':
+			duration_ms = atoi(optarg);
+			break;
+		case 'l':
+			min_size = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "rr"))
+				modes = MODE_RR;
+			else if (!strcmp(optarg, "stream"))
+				modes = MODE_STREAM;
+			else if (!strcmp(optarg, "both"))
+				modes = MODE_RR | MODE_STREAM;
+			else
+				PrintUsage();
+			break;
+		case 'n':
+			nr_streams = atoi(optarg);
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out)
+				fatal(optarg);
+			break;
+		case 'P':
+			printopt = 1;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 's':
+			for (i = 0; i < 3; i++) {
+				if (!strcmp(optarg, variant_names[i]))
+					break;
+			}
+			if (i == 3)
+				PrintUsage();
+			variant = i;
+			break;
+		case 'u':
+			max_size = atoi(optarg);
+			break;
+		case 'V':
+			use_veth = 1;
+			break;
+		case 'z':
+			zerocopy = 1;
+			break;
+		default:
+			PrintUsage();
+		}
+	}
+
+	if (min_size < 1 || max_size < min_size) {
+		fprintf(stderr, "NPstream: need 1 <= -l <= -u\n");
+		exit(2);
+	}
+
+	if (nr_streams < 1 || duration_ms < 1) {
+		fprintf(stderr, "NPstream: -n and -d must be positive\n");
+		exit(2);
+	}
+
+	if (use_veth)
+		veth_setup();
+
+	streams = calloc(nr_streams, sizeof(*streams));
+	if (!streams)
+		fatal("calloc");
+
+	buflen = max_size > RECV_MIN ? max_size : RECV_MIN;
+
+	for (i = 0; i < nr_streams; i++) {
+		streams[i].id = i;
+		streams[i].cpu = cpus[i % ncpus];
+		streams[i].client.buf = alloc_buf(buflen);
+		streams[i].server.buf = alloc_buf(buflen);
+	}
+
+	connect_streams();
+
+	fprintf(out, "mode,variant,zerocopy,link,streams,msg_size,msgs,bytes,"
+		"secs,mbps,rtt_avg_us,rtt_p50_us,rtt_p90_us,rtt_p99_us,"
+		"rtt_p999_us,rtt_max_us,zc_sends,zc_copied\n");
+
+	for (size = min_size;;) {
+		if (modes & MODE_RR)
+			run_phase(out, MODE_RR, size);
+		if (modes & MODE_STREAM)
+			run_phase(out, MODE_STREAM, size);
+
+		if (size == max_size)
+			break;
+		size = size > max_size / 2 ? max_size : size * 2;
+	}
+
+	for (i = 0; i < nr_streams; i++) {
+		close(streams[i].client.fd);
+		close(streams[i].server.fd);
+		free(streams[i].client.buf);
+		free(streams[i].server.buf);
+	}
+	free(streams);
+
+	if (out != stdout)
+		fclose(out);
+
+	return 0;
+}